@@ -0,0 +1,141 @@
+/* Measures the setup cost of a transfer in lr_download_packages().
+ *
+ * A local (file://) mirror with a single tiny package is created and
+ * the package is downloaded N times into distinct destination files,
+ * one transfer at a time. The handle is configured with a number of
+ * options and HTTP headers, like a handle of a real repository, so
+ * that preparing the curl easy handle of a transfer is not free.
+ * The transfers themselves are nearly free, the time per target is
+ * the cost of setting up and finishing a transfer.
+ *
+ * Usage: ./benchmark_transfer_setup [N ...]   (default: 1000 10000)
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <librepo/librepo.h>
+
+#define PACKAGE_NAME    "package.rpm"
+#define HEADERS         32
+
+static gboolean
+run(const char *mirrordir, const char *destdir, long n, double *elapsed)
+{
+    gboolean ret;
+    LrHandle *h;
+    GSList *packages = NULL;
+    GError *tmp_err = NULL;
+    gchar *url = g_strconcat("file://", mirrordir, NULL);
+    char *urls[] = {url, NULL};
+    char *headers[HEADERS + 1];
+
+    for (int i = 0; i < HEADERS; i++)
+        headers[i] = g_strdup_printf("X-Benchmark-Header-%d: %d", i, i);
+    headers[HEADERS] = NULL;
+
+    h = lr_handle_init();
+    lr_handle_setopt(h, NULL, LRO_URLS, urls);
+    lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO);
+    lr_handle_setopt(h, NULL, LRO_MAXPARALLELDOWNLOADS, 1L);
+    lr_handle_setopt(h, NULL, LRO_USERAGENT, "librepo-benchmark/1.0");
+    lr_handle_setopt(h, NULL, LRO_HTTPHEADER, headers);
+    lr_handle_setopt(h, NULL, LRO_USERPWD, "user:password");
+    lr_handle_setopt(h, NULL, LRO_CONNECTTIMEOUT, 10L);
+
+    for (long i = 0; i < n; i++) {
+        gchar *dest = g_strdup_printf("%s/%ld.rpm", destdir, i);
+        LrPackageTarget *target;
+        target = lr_packagetarget_new(h, PACKAGE_NAME, dest,
+                                      LR_CHECKSUM_UNKNOWN, NULL, 0, NULL,
+                                      FALSE, NULL, NULL, &tmp_err);
+        g_free(dest);
+        if (!target) {
+            fprintf(stderr, "Error: %s\n", tmp_err->message);
+            g_error_free(tmp_err);
+            g_slist_free_full(packages,
+                              (GDestroyNotify) lr_packagetarget_free);
+            lr_handle_free(h);
+            g_free(url);
+            return FALSE;
+        }
+        packages = g_slist_prepend(packages, target);
+    }
+
+    GTimer *timer = g_timer_new();
+    ret = lr_download_packages(packages, LR_PACKAGEDOWNLOAD_FAILFAST,
+                               &tmp_err);
+    *elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    if (!ret) {
+        fprintf(stderr, "Error: %d: %s\n", tmp_err->code, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    // Remove downloaded files
+    for (GSList *elem = packages; elem; elem = g_slist_next(elem)) {
+        LrPackageTarget *target = elem->data;
+        g_unlink(target->local_path);
+    }
+
+    g_slist_free_full(packages, (GDestroyNotify) lr_packagetarget_free);
+    lr_handle_free(h);
+    for (int i = 0; i < HEADERS; i++)
+        g_free(headers[i]);
+    g_free(url);
+    return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rc = EXIT_SUCCESS;
+    long default_counts[] = {1000, 10000};
+    long *counts = default_counts;
+    int counts_len = G_N_ELEMENTS(default_counts);
+
+    if (argc > 1) {
+        counts = g_new0(long, argc - 1);
+        counts_len = argc - 1;
+        for (int i = 1; i < argc; i++)
+            counts[i-1] = strtol(argv[i], NULL, 10);
+    }
+
+    // Prepare a local mirror with one tiny package
+
+    gchar *mirrordir = g_dir_make_tmp("librepo-bench-mirror-XXXXXX", NULL);
+    gchar *destdir = g_dir_make_tmp("librepo-bench-dest-XXXXXX", NULL);
+    gchar *package = g_build_filename(mirrordir, PACKAGE_NAME, NULL);
+    if (!mirrordir || !destdir
+        || !g_file_set_contents(package, "x", 1, NULL))
+    {
+        fprintf(stderr, "Cannot prepare temporary directories\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%10s %12s %18s\n", "transfers", "total [s]", "per transfer [us]");
+    for (int i = 0; i < counts_len; i++) {
+        double elapsed;
+        if (counts[i] <= 0)
+            continue;
+        if (!run(mirrordir, destdir, counts[i], &elapsed)) {
+            rc = EXIT_FAILURE;
+            break;
+        }
+        printf("%10ld %12.3f %18.2f\n", counts[i], elapsed,
+               elapsed * G_USEC_PER_SEC / counts[i]);
+    }
+
+    g_unlink(package);
+    g_rmdir(mirrordir);
+    g_rmdir(destdir);
+    g_free(package);
+    g_free(mirrordir);
+    g_free(destdir);
+    if (counts != default_counts)
+        g_free(counts);
+
+    return rc;
+}
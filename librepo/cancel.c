@@ -0,0 +1,127 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#define LR_HAVE_EVENTFD 1
+#endif
+
+#include "cancel.h"
+#include "rcodes.h"
+#include "util.h"
+
+struct _LrCancelToken {
+    volatile gint cancelled; /*!<
+        Non-zero if the token was cancelled */
+    int read_fd; /*!<
+        Readable when the token is cancelled */
+    int write_fd; /*!<
+        Written by lr_cancel_token_cancel() (the same eventfd as read_fd
+        or the write end of a pipe) */
+};
+
+LrCancelToken *
+lr_cancel_token_new(GError **err)
+{
+    LrCancelToken *token;
+
+    assert(!err || *err == NULL);
+
+    token = lr_malloc0(sizeof(*token));
+
+#ifdef LR_HAVE_EVENTFD
+    token->read_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (token->read_fd == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "eventfd() failed: %s", strerror(errno));
+        lr_free(token);
+        return NULL;
+    }
+    token->write_fd = token->read_fd;
+#else
+    int fds[2];
+    if (pipe(fds) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "pipe() failed: %s", strerror(errno));
+        lr_free(token);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    token->read_fd = fds[0];
+    token->write_fd = fds[1];
+#endif
+
+    return token;
+}
+
+void
+lr_cancel_token_cancel(LrCancelToken *token)
+{
+    assert(token);
+
+    // Only the first call wakes up the waiting, the fd stays readable
+    if (!g_atomic_int_compare_and_exchange(&token->cancelled, 0, 1))
+        return;
+
+#ifdef LR_HAVE_EVENTFD
+    guint64 value = 1;
+#else
+    char value = 1;
+#endif
+    // Nothing is logged here to keep the function async-signal-safe.
+    // The write cannot fail anyway, the token is written only once.
+    if (write(token->write_fd, &value, sizeof(value)) == -1)
+        return;
+}
+
+gboolean
+lr_cancel_token_is_cancelled(LrCancelToken *token)
+{
+    assert(token);
+    return g_atomic_int_get(&token->cancelled) ? TRUE : FALSE;
+}
+
+int
+lr_cancel_token_get_fd(LrCancelToken *token)
+{
+    assert(token);
+    return token->read_fd;
+}
+
+void
+lr_cancel_token_free(LrCancelToken *token)
+{
+    if (!token)
+        return;
+
+    close(token->read_fd);
+    if (token->write_fd != token->read_fd)
+        close(token->write_fd);
+    lr_free(token);
+}
@@ -0,0 +1,86 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_CANCEL_H__
+#define __LR_CANCEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** \defgroup   cancel  Cancellation of running operations
+ *  \addtogroup cancel
+ *  @{
+ */
+
+/** Cancel token. A token is set to a handle by LRO_CANCELTOKEN and
+ * ::lr_cancel_token_cancel then stops all running (and all later)
+ * downloads of the handle. The download loop waits for the token
+ * together with the sockets of transfers, so the downloading is
+ * stopped right away and the running function returns with
+ * LRE_CANCELLED. If targets of several handles are downloaded at once,
+ * only the targets of the handles of the cancelled token are stopped.
+ */
+typedef struct _LrCancelToken LrCancelToken;
+
+/** Create a new cancel token.
+ * @param err       GError **
+ * @return          New cancel token or NULL if err is set.
+ */
+LrCancelToken *
+lr_cancel_token_new(GError **err);
+
+/** Cancel the token. The function can be called from any thread
+ * (or from a signal handler) and it doesn't block. A cancelled token
+ * stays cancelled.
+ * @param token     Cancel token.
+ */
+void
+lr_cancel_token_cancel(LrCancelToken *token);
+
+/** Check if the token is cancelled.
+ * @param token     Cancel token.
+ * @return          TRUE if ::lr_cancel_token_cancel was called.
+ */
+gboolean
+lr_cancel_token_is_cancelled(LrCancelToken *token);
+
+/** Get a file descriptor which becomes readable when the token is
+ * cancelled. It can be added to a poll set of an external event loop.
+ * Don't read from it nor close it.
+ * @param token     Cancel token.
+ * @return          File descriptor.
+ */
+int
+lr_cancel_token_get_fd(LrCancelToken *token);
+
+/** Free the cancel token. The token must not be used by any running
+ * operation (and it must be unset from handles that will be used
+ * again).
+ * @param token     Cancel token.
+ */
+void
+lr_cancel_token_free(LrCancelToken *token);
+
+/** @} */
+
+G_END_DECLS
+
+#endif
@@ -18,6 +18,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _XOPEN_SOURCE 700 // Because of pread(), posix_fadvise() and st_mtim
+
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <assert.h>
@@ -25,6 +27,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <attr/xattr.h>
 #include <openssl/evp.h>
@@ -35,8 +38,15 @@
 #include "util.h"
 
 #define BUFFER_SIZE             2048
+#define READ_BUFFER_SIZE        (256 * 1024)
 #define MAX_CHECKSUM_NAME_LEN   7
 
+#define CHECKSUM_CACHE_XATTR_PREFIX "user.Librepo.checksum."
+
+/** Maximal number of threads of lr_checksum_check_files(). Checksumming
+ * is CPU bound, but more concurrent reads only make the storage seek. */
+#define CHECK_FILES_MAX_THREADS     16
+
 LrChecksumType
 lr_checksum_type(const char *type)
 {
@@ -100,6 +110,31 @@ lr_checksum_type_to_str(LrChecksumType type)
     return NULL;
 }
 
+static const EVP_MD *
+lr_checksum_evp_md(LrChecksumType type)
+{
+    switch (type) {
+        case LR_CHECKSUM_MD5:       return EVP_md5();
+        case LR_CHECKSUM_SHA1:      return EVP_sha1();
+        case LR_CHECKSUM_SHA224:    return EVP_sha224();
+        case LR_CHECKSUM_SHA256:    return EVP_sha256();
+        case LR_CHECKSUM_SHA384:    return EVP_sha384();
+        case LR_CHECKSUM_SHA512:    return EVP_sha512();
+        case LR_CHECKSUM_UNKNOWN:
+        default:
+            return NULL;
+    }
+}
+
+static char *
+lr_checksum_to_hex(const unsigned char *raw_checksum, unsigned int len)
+{
+    char *checksum = lr_malloc0(sizeof(char) * (len * 2 + 1));
+    for (size_t x = 0; x < len; x++)
+        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+    return checksum;
+}
+
 char *
 lr_checksum_fd(LrChecksumType type, int fd, GError **err)
 {
@@ -107,27 +142,19 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
     ssize_t readed;
     char buf[BUFFER_SIZE];
     unsigned char raw_checksum[EVP_MAX_MD_SIZE];
-    char *checksum;
     EVP_MD_CTX *ctx;
     const EVP_MD *ctx_type;
 
     assert(fd > -1);
     assert(!err || *err == NULL);
 
-    switch (type) {
-        case LR_CHECKSUM_MD5:       ctx_type = EVP_md5();    break;
-        case LR_CHECKSUM_SHA1:      ctx_type = EVP_sha1();   break;
-        case LR_CHECKSUM_SHA224:    ctx_type = EVP_sha224(); break;
-        case LR_CHECKSUM_SHA256:    ctx_type = EVP_sha256(); break;
-        case LR_CHECKSUM_SHA384:    ctx_type = EVP_sha384(); break;
-        case LR_CHECKSUM_SHA512:    ctx_type = EVP_sha512(); break;
-        case LR_CHECKSUM_UNKNOWN:
-        default:
-            g_debug("%s: Unknown checksum type", __func__);
-            assert(0);
-            g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
-                        "Unknown checksum type: %d", type);
-            return NULL;
+    ctx_type = lr_checksum_evp_md(type);
+    if (!ctx_type) {
+        g_debug("%s: Unknown checksum type", __func__);
+        assert(0);
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Unknown checksum type: %d", type);
+        return NULL;
     }
 
     ctx = EVP_MD_CTX_create();
@@ -173,11 +200,329 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
 
     EVP_MD_CTX_destroy(ctx);
 
-    checksum = lr_malloc0(sizeof(char) * (len * 2 + 1));
-    for (size_t x = 0; x < len; x++)
-        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+    return lr_checksum_to_hex(raw_checksum, len);
+}
 
-    return checksum;
+struct _LrChecksumCtx {
+    LrChecksumType type; /*!<
+        Checksum type */
+    EVP_MD_CTX *ctx; /*!<
+        OpenSSL digest context */
+};
+
+LrChecksumCtx *
+lr_checksumctx_new(LrChecksumType type, GError **err)
+{
+    const EVP_MD *ctx_type;
+    LrChecksumCtx *ctx;
+
+    assert(!err || *err == NULL);
+
+    ctx_type = lr_checksum_evp_md(type);
+    if (!ctx_type) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Unknown checksum type: %d", type);
+        return NULL;
+    }
+
+    ctx = lr_malloc0(sizeof(*ctx));
+    ctx->type = type;
+    ctx->ctx = EVP_MD_CTX_create();
+    if (!ctx->ctx) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_MD_CTX_create() failed");
+        lr_free(ctx);
+        return NULL;
+    }
+
+    if (!EVP_DigestInit_ex(ctx->ctx, ctx_type, NULL)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_DigestInit_ex() failed");
+        lr_checksumctx_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+LrChecksumType
+lr_checksumctx_type(LrChecksumCtx *ctx)
+{
+    assert(ctx);
+    return ctx->type;
+}
+
+gboolean
+lr_checksumctx_update(LrChecksumCtx *ctx,
+                      const void *buf,
+                      size_t len,
+                      GError **err)
+{
+    assert(ctx);
+    assert(!err || *err == NULL);
+
+    if (!len)
+        return TRUE;
+
+    if (!EVP_DigestUpdate(ctx->ctx, buf, len)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_DigestUpdate() failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_checksumctx_list_update_fd(GSList *ctxs,
+                              int fd,
+                              gint64 len,
+                              GError **err)
+{
+    _cleanup_free_ char *buf = NULL;
+    gint64 offset = 0;
+
+    assert(fd > -1);
+    assert(!err || *err == NULL);
+
+    // The file is read sequentially in large blocks. It is not mapped
+    // into the memory, because a concurrent truncation of a mapped file
+    // (e.g. by another process rewriting a cache) would kill the process
+    // by SIGBUS instead of producing a checksum mismatch.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    buf = g_malloc(READ_BUFFER_SIZE);
+
+    while (len < 0 || offset < len) {
+        size_t to_read = READ_BUFFER_SIZE;
+        ssize_t readed;
+
+        if (len >= 0 && len - offset < READ_BUFFER_SIZE)
+            to_read = (size_t) (len - offset);
+
+        readed = pread(fd, buf, to_read, (off_t) offset);
+        if (readed == -1) {
+            if (errno == EINTR)
+                continue;
+            g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                        "pread(%d) failed: %s", fd, strerror(errno));
+            return FALSE;
+        }
+
+        if (readed == 0) {
+            if (len < 0)
+                break;  // EOF
+            g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                        "Unexpected end of file (fd: %d) at offset %"
+                        G_GINT64_FORMAT, fd, offset);
+            return FALSE;
+        }
+
+        for (GSList *elem = ctxs; elem; elem = g_slist_next(elem))
+            if (!lr_checksumctx_update(elem->data, buf, readed, err))
+                return FALSE;
+
+        offset += readed;
+    }
+
+    return TRUE;
+}
+
+char *
+lr_checksumctx_final(LrChecksumCtx *ctx, GError **err)
+{
+    unsigned int len;
+    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
+
+    assert(ctx);
+    assert(!err || *err == NULL);
+
+    if (!EVP_DigestFinal_ex(ctx->ctx, raw_checksum, &len)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_DigestFinal_ex() failed");
+        return NULL;
+    }
+
+    return lr_checksum_to_hex(raw_checksum, len);
+}
+
+void
+lr_checksumctx_free(LrChecksumCtx *ctx)
+{
+    if (!ctx)
+        return;
+    if (ctx->ctx)
+        EVP_MD_CTX_destroy(ctx->ctx);
+    lr_free(ctx);
+}
+
+/** Stamp of the file content. Every cached checksum is stored together
+ * with the stamp of the file it was calculated for ("<stamp> <checksum>")
+ * and it is valid only if the stamp matches the current stamp.
+ */
+static gchar *
+lr_checksum_cache_stamp(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return NULL;
+
+    return g_strdup_printf("%llu.%09ld:%llu",
+                           (unsigned long long) st.st_mtim.tv_sec,
+                           (long) st.st_mtim.tv_nsec,
+                           (unsigned long long) st.st_size);
+}
+
+/** Get checksum of the specified type cached in xattr or NULL.
+ */
+static gchar *
+lr_checksum_cache_get(int fd, LrChecksumType type)
+{
+    ssize_t attr_ret;
+    char buf[256];
+    _cleanup_free_ gchar *stamp = NULL;
+    _cleanup_free_ gchar *key = NULL;
+
+    gsize stamp_len;
+
+    stamp = lr_checksum_cache_stamp(fd);
+    if (!stamp)
+        return NULL;
+    stamp_len = strlen(stamp);
+
+    key = g_strconcat(CHECKSUM_CACHE_XATTR_PREFIX,
+                      lr_checksum_type_to_str(type), NULL);
+    attr_ret = fgetxattr(fd, key, &buf, sizeof(buf)-1);
+    if (attr_ret == -1)
+        return NULL;
+    buf[attr_ret] = '\0';
+
+    if (strncmp(buf, stamp, stamp_len) || buf[stamp_len] != ' ')
+        return NULL;  // Cached checksum is outdated
+
+    g_debug("%s: Using checksum cached in xattr: [%s] %s",
+            __func__, key, buf + stamp_len + 1);
+    return g_strdup(buf + stamp_len + 1);
+}
+
+/** Store checksum of the specified type to the xattr cache.
+ */
+static void
+lr_checksum_cache_set(int fd, LrChecksumType type, const char *checksum)
+{
+    _cleanup_free_ gchar *stamp = NULL;
+    _cleanup_free_ gchar *key = NULL;
+    _cleanup_free_ gchar *value = NULL;
+
+    stamp = lr_checksum_cache_stamp(fd);
+    if (!stamp)
+        return;
+
+    key = g_strconcat(CHECKSUM_CACHE_XATTR_PREFIX,
+                      lr_checksum_type_to_str(type), NULL);
+    value = g_strconcat(stamp, " ", checksum, NULL);
+    fsetxattr(fd, key, value, strlen(value)+1, 0);
+}
+
+void
+lr_checksum_cache_store(int fd, LrChecksumType type, const char *checksum)
+{
+    struct stat st;
+    _cleanup_free_ gchar *key = NULL;
+
+    assert(fd >= 0);
+    assert(checksum);
+
+    lr_checksum_cache_set(fd, type, checksum);
+
+    // Type agnostic cache used also by other tools
+    if (fstat(fd, &st) != 0)
+        return;
+
+    key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
+                          (unsigned long long) st.st_mtime);
+    fsetxattr(fd, key, checksum, strlen(checksum)+1, 0);
+}
+
+gboolean
+lr_checksum_fd_multi(int fd,
+                     const LrChecksumType *types,
+                     gsize count,
+                     gboolean caching,
+                     gchar **checksums,
+                     GError **err)
+{
+    gboolean ret = TRUE;
+    GSList *ctxs = NULL;
+    LrChecksumCtx **type_ctx = NULL;  // Context for each of the types
+
+    assert(fd >= 0);
+    assert(types || count == 0);
+    assert(checksums || count == 0);
+    assert(!err || *err == NULL);
+
+    type_ctx = lr_malloc0(sizeof(*type_ctx) * (count + 1));
+
+    for (gsize x = 0; x < count; x++) {
+        checksums[x] = NULL;
+
+        if (caching)
+            checksums[x] = lr_checksum_cache_get(fd, types[x]);
+        if (checksums[x])
+            continue;
+
+        // Checksum of the same type could be already requested
+        for (GSList *elem = ctxs; elem; elem = g_slist_next(elem))
+            if (lr_checksumctx_type(elem->data) == types[x])
+                type_ctx[x] = elem->data;
+        if (type_ctx[x])
+            continue;
+
+        type_ctx[x] = lr_checksumctx_new(types[x], err);
+        if (!type_ctx[x]) {
+            ret = FALSE;
+            goto cleanup;
+        }
+        ctxs = g_slist_append(ctxs, type_ctx[x]);
+    }
+
+    if (!ctxs)
+        goto cleanup;  // Everything was cached
+
+    // Read the file only once for all the checksums
+    if (!lr_checksumctx_list_update_fd(ctxs, fd, -1, err)) {
+        ret = FALSE;
+        goto cleanup;
+    }
+
+    for (GSList *elem = ctxs; elem; elem = g_slist_next(elem)) {
+        LrChecksumCtx *ctx = elem->data;
+        gchar *checksum = lr_checksumctx_final(ctx, err);
+        if (!checksum) {
+            ret = FALSE;
+            goto cleanup;
+        }
+
+        for (gsize x = 0; x < count; x++)
+            if (type_ctx[x] == ctx)
+                checksums[x] = g_strdup(checksum);
+
+        if (caching)
+            lr_checksum_cache_set(fd, lr_checksumctx_type(ctx), checksum);
+
+        lr_free(checksum);
+    }
+
+cleanup:
+    if (!ret) {
+        for (gsize x = 0; x < count; x++) {
+            lr_free(checksums[x]);
+            checksums[x] = NULL;
+        }
+    }
+    g_slist_free_full(ctxs, (GDestroyNotify) lr_checksumctx_free);
+    lr_free(type_ctx);
+    return ret;
 }
 
 
@@ -217,7 +562,18 @@ lr_checksum_fd_compare(LrChecksumType type,
     }
 
     if (caching) {
-        // Load cached checksum if enabled and used
+        // Load cached checksum of the type if enabled and used
+        _cleanup_free_ gchar *cached = lr_checksum_cache_get(fd, type);
+        if (cached) {
+            *matches = strcmp(expected, cached) ? FALSE : TRUE;
+            if (calculated)
+                *calculated = g_strdup(cached);
+            return TRUE;
+        }
+    }
+
+    if (caching) {
+        // Load type agnostic cached checksum
         struct stat st;
         if (fstat(fd, &st) == 0) {
             ssize_t attr_ret;
@@ -245,13 +601,7 @@ lr_checksum_fd_compare(LrChecksumType type,
 
     if (caching && *matches) {
         // Store checksum as extended file attribute if caching is enabled
-        struct stat st;
-        if (fstat(fd, &st) == 0) {
-            _cleanup_free_ gchar *key = NULL;
-            key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                                  (unsigned long long) st.st_mtime);
-            fsetxattr(fd, key, checksum, strlen(checksum)+1, 0);
-        }
+        lr_checksum_cache_store(fd, type, checksum);
     }
 
     if (calculated)
@@ -259,3 +609,131 @@ lr_checksum_fd_compare(LrChecksumType type,
 
     return TRUE;
 }
+
+
+/** Shared state of lr_checksum_check_files() */
+typedef struct {
+    GAsyncQueue *done;  /*!< Finished checks (LrChecksumCheck *) */
+    gint stop;          /*!< Set if the remaining checks are skipped */
+} ChecksumCheckPool;
+
+
+static void
+checksum_check_file(LrChecksumCheck *check)
+{
+    GError *tmp_err = NULL;
+    int fd;
+
+    check->checked = TRUE;
+    check->matches = FALSE;
+
+    fd = open(check->path, O_RDONLY);
+    if (fd < 0) {
+        g_debug("%s: Cannot open %s: %s",
+                __func__, check->path, strerror(errno));
+        check->rcode = LRE_IO;
+        g_set_error(&check->err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", check->path, strerror(errno));
+        return;
+    }
+
+    check->rcode = LRE_OK;
+    if (!lr_checksum_fd_compare(check->type,
+                                fd,
+                                check->expected,
+                                check->caching,
+                                &check->matches,
+                                NULL,
+                                &tmp_err))
+    {
+        g_debug("%s: Cannot check checksum of %s: %s",
+                __func__, check->path, tmp_err->message);
+        check->rcode = tmp_err->code;
+        check->err = tmp_err;
+    }
+
+    close(fd);
+}
+
+
+static void
+checksum_check_worker(gpointer data, gpointer user_data)
+{
+    LrChecksumCheck *check = data;
+    ChecksumCheckPool *pool = user_data;
+
+    if (!g_atomic_int_get(&pool->stop))
+        checksum_check_file(check);
+
+    g_async_queue_push(pool->done, check);
+}
+
+
+gboolean
+lr_checksum_check_files(LrChecksumCheck *checks,
+                        gsize count,
+                        LrChecksumCheckCb cb,
+                        void *cbdata,
+                        GError **err)
+{
+    ChecksumCheckPool pool;
+    GThreadPool *threads;
+    guint nthreads;
+
+    assert(!err || *err == NULL);
+
+    for (gsize x = 0; x < count; x++) {
+        checks[x].checked = FALSE;
+        checks[x].rcode = LRE_OK;
+        checks[x].err = NULL;
+        checks[x].matches = FALSE;
+    }
+
+    nthreads = MIN(g_get_num_processors(), CHECK_FILES_MAX_THREADS);
+    nthreads = MIN(nthreads, count);
+
+    if (nthreads <= 1) {
+        // Not worth the threads
+        for (gsize x = 0; x < count; x++) {
+            checksum_check_file(&checks[x]);
+            if (cb && !cb(&checks[x], cbdata))
+                break;
+        }
+        return TRUE;
+    }
+
+    g_debug("%s: Checking %"G_GSIZE_FORMAT" files by %u threads",
+            __func__, count, nthreads);
+
+    pool.done = g_async_queue_new();
+    pool.stop = 0;
+
+    threads = g_thread_pool_new(checksum_check_worker, &pool,
+                                nthreads, TRUE, err);
+    if (!threads) {
+        g_async_queue_unref(pool.done);
+        return FALSE;
+    }
+
+    for (gsize x = 0; x < count; x++)
+        g_thread_pool_push(threads, &checks[x], NULL);
+
+    // Deliver results to the callback from this thread
+    for (gsize x = 0; x < count; x++) {
+        LrChecksumCheck *check = g_async_queue_pop(pool.done);
+
+        if (!check->checked || !cb)
+            continue;
+
+        if (!cb(check, cbdata)) {
+            // Skip queued checks, only the running ones are finished
+            g_atomic_int_set(&pool.stop, 1);
+            break;
+        }
+    }
+
+    g_thread_pool_free(threads, g_atomic_int_get(&pool.stop), TRUE);
+    g_async_queue_unref(pool.done);
+
+    return TRUE;
+}
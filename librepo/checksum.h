@@ -107,6 +107,156 @@ lr_checksum_fd_compare(LrChecksumType type,
                        gchar **calculated,
                        GError **err);
 
+/** Calculate checksums of several types for data pointed by file
+ * descriptor. The file is read only once regardless of number of
+ * requested checksum types.
+ * @param fd        File descriptor. Its offset is not changed.
+ * @param types     Array of checksum types
+ * @param count     Number of items in types
+ * @param caching   Use checksums cached as extended file attributes and
+ *                  cache all calculated checksums.
+ * @param checksums Array of at least count pointers. Malloced checksum
+ *                  string of types[x] is stored to checksums[x].
+ *                  The strings must be freed by caller.
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_checksum_fd_multi(int fd,
+                     const LrChecksumType *types,
+                     gsize count,
+                     gboolean caching,
+                     gchar **checksums,
+                     GError **err);
+
+/** Store the checksum as a cached checksum value (extended file attribute)
+ * of the file. The cached value is used by ::lr_checksum_fd_compare and
+ * ::lr_checksum_fd_multi if caching is enabled. Errors are silently ignored.
+ * @param fd        File descriptor
+ * @param type      Checksum type
+ * @param checksum  Checksum value (hex string) of the whole file
+ */
+void
+lr_checksum_cache_store(int fd, LrChecksumType type, const char *checksum);
+
+/** Incremental checksum context.
+ */
+typedef struct _LrChecksumCtx LrChecksumCtx;
+
+/** Create a new incremental checksum context.
+ * @param type      Checksum type
+ * @param err       GError **
+ * @return          New context or NULL on error.
+ */
+LrChecksumCtx *
+lr_checksumctx_new(LrChecksumType type, GError **err);
+
+/** Get checksum type of the context.
+ * @param ctx       Checksum context
+ * @return          Checksum type
+ */
+LrChecksumType
+lr_checksumctx_type(LrChecksumCtx *ctx);
+
+/** Add data to the checksum.
+ * @param ctx       Checksum context
+ * @param buf       Data
+ * @param len       Length of the data
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_checksumctx_update(LrChecksumCtx *ctx,
+                      const void *buf,
+                      size_t len,
+                      GError **err);
+
+/** Read the file from its begin and add the data to all the passed
+ * checksum contexts. The file is read only once regardless of number
+ * of the contexts. Offset of the file descriptor is not changed.
+ * @param ctxs      GSList of ::LrChecksumCtx
+ * @param fd        File descriptor
+ * @param len       Number of bytes to read or -1 to read whole file
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_checksumctx_list_update_fd(GSList *ctxs,
+                              int fd,
+                              gint64 len,
+                              GError **err);
+
+/** Finish the checksum calculation. The context cannot be updated
+ * after this call.
+ * @param ctx       Checksum context
+ * @param err       GError **
+ * @return          Malloced checksum string or NULL on error.
+ */
+char *
+lr_checksumctx_final(LrChecksumCtx *ctx, GError **err);
+
+/** Free the checksum context.
+ * @param ctx       Checksum context or NULL
+ */
+void
+lr_checksumctx_free(LrChecksumCtx *ctx);
+
+/** A file checked by ::lr_checksum_check_files */
+typedef struct {
+    const char *path; /*!<
+        Path to the file */
+    LrChecksumType type; /*!<
+        Checksum type */
+    const char *expected; /*!<
+        Expected checksum value */
+    gboolean caching; /*!<
+        Cache/Use cached checksum value as extended file attr. */
+    void *cbdata; /*!<
+        User data of the file (not used by librepo) */
+
+    // Results
+
+    gboolean checked; /*!<
+        FALSE if the file was not checked because the check
+        was stopped by the callback */
+    int rcode; /*!<
+        LRE_OK if the checksum was calculated, LRE_IO if the file
+        cannot be opened, otherwise the code of the checksum error */
+    GError *err; /*!<
+        Error of the check if rcode is not LRE_OK, otherwise NULL.
+        It must be freed by the caller. */
+    gboolean matches; /*!<
+        TRUE if the rcode is LRE_OK and the checksum matches */
+} LrChecksumCheck;
+
+/** Callback called for every checked file.
+ * @param check     Checked file
+ * @param cbdata    User data
+ * @return          FALSE to stop checking of the remaining files
+ */
+typedef gboolean (*LrChecksumCheckCb)(LrChecksumCheck *check, void *cbdata);
+
+/** Check checksums of several files in parallel. The files are checked
+ * by a pool of threads, its size is given by the number of CPUs (and
+ * limited to not overload the storage with concurrent reads).
+ * The callback is always called from the calling thread, in the order
+ * in which the checks finish. If it returns FALSE, files which are not
+ * being checked yet are skipped and checks which are running are finished
+ * without calling the callback.
+ * @param checks    Array of files to check
+ * @param count     Number of items in checks
+ * @param cb        Callback called for every checked file or NULL
+ * @param cbdata    User data for the callback
+ * @param err       GError **
+ * @return          FALSE if the threads cannot be started (err is set)
+ */
+gboolean
+lr_checksum_check_files(LrChecksumCheck *checks,
+                        gsize count,
+                        LrChecksumCheckCb cb,
+                        void *cbdata,
+                        GError **err);
+
 /** @} */
 
 G_END_DECLS
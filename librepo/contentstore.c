@@ -0,0 +1,351 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE     // for utimensat() and struct stat.st_atim
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "contentstore.h"
+#include "checksum.h"
+#include "cleanup.h"
+#include "util.h"
+
+#define LR_CONTENTSTORE_TMPDIR          "tmp"
+#define LR_CONTENTSTORE_TMP_MAXAGE      (24 * 60 * 60)  // seconds
+
+/** An entry (file) of the store found by the eviction */
+typedef struct {
+    gchar *path; /*!<
+        Path to the file */
+    gint64 size; /*!<
+        Size of the file */
+    struct timespec atime; /*!<
+        Last access of the file */
+} LrContentStoreEntry;
+
+/** Return the path of the file with the checksum in the store or NULL
+ * if the checksum cannot be used as a filename.
+ */
+static gchar *
+lr_contentstore_path(const char *store, LrChecksumType type, const char *checksum)
+{
+    gchar prefix[3];
+
+    if (!store || !checksum || type == LR_CHECKSUM_UNKNOWN)
+        return NULL;
+
+    // The checksum comes from the (untrusted) metadata, it must
+    // not be able to point outside of the store
+    if (strlen(checksum) < 3)
+        return NULL;
+    for (const char *c = checksum; *c; c++)
+        if (!g_ascii_isxdigit(*c))
+            return NULL;
+
+    prefix[0] = checksum[0];
+    prefix[1] = checksum[1];
+    prefix[2] = '\0';
+
+    return g_build_filename(store, lr_checksum_type_to_str(type),
+                            prefix, checksum, NULL);
+}
+
+/** Set the access time of the file to now. The access time is used
+ * as the time of the last use of the file by the eviction.
+ */
+static gboolean
+lr_contentstore_touch(int fd, const char *path)
+{
+    struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_OMIT}};
+
+    if (fd >= 0)
+        return futimens(fd, times) == 0;
+    return utimensat(AT_FDCWD, path, times, 0) == 0;
+}
+
+gchar *
+lr_contentstore_lookup(const char *store,
+                       LrChecksumType type,
+                       const char *checksum)
+{
+    _cleanup_file_close_ int src = -1;
+    gchar *path;
+    gboolean matches = FALSE;
+    GError *tmp_err = NULL;
+
+    path = lr_contentstore_path(store, type, checksum);
+    if (!path)
+        return NULL;
+
+    src = open(path, O_RDONLY);
+    if (src == -1) {
+        if (errno != ENOENT)
+            g_debug("%s: Cannot open %s: %s",
+                    __func__, path, strerror(errno));
+        g_free(path);
+        return NULL;
+    }
+
+    // The file was verified when it was published, the checksum is
+    // cached, so this is cheap unless the file was changed since then
+    if (!lr_checksum_fd_cmp(type, src, checksum, TRUE, &matches, &tmp_err)) {
+        g_debug("%s: Cannot check %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+        g_free(path);
+        return NULL;
+    }
+
+    if (!matches) {
+        g_debug("%s: %s is damaged - removing it", __func__, path);
+        unlink(path);
+        g_free(path);
+        return NULL;
+    }
+
+    lr_contentstore_touch(src, path);
+    return path;
+}
+
+void
+lr_contentstore_publish(const char *store,
+                        LrChecksumType type,
+                        const char *checksum,
+                        int fd,
+                        const char *fn)
+{
+    _cleanup_free_ gchar *path = NULL;
+    _cleanup_free_ gchar *dir = NULL;
+    _cleanup_free_ gchar *tmpdir = NULL;
+    _cleanup_free_ gchar *tmp = NULL;
+    _cleanup_file_close_ int src_fn = -1;
+    _cleanup_file_close_ int dst = -1;
+    int src = fd;
+
+    assert((fd >= 0 && !fn) || (fd < 0 && fn));
+
+    path = lr_contentstore_path(store, type, checksum);
+    if (!path)
+        return;
+
+    if (lr_contentstore_touch(-1, path)) {
+        g_debug("%s: %s is already in the store", __func__, checksum);
+        return;
+    }
+
+    if (fn) {
+        src = src_fn = open(fn, O_RDONLY);
+        if (src == -1) {
+            g_debug("%s: Cannot open %s: %s", __func__, fn, strerror(errno));
+            return;
+        }
+    }
+
+    // The file is prepared under a temporary name, other processes
+    // see it under its final name only when it is complete
+    dir = g_path_get_dirname(path);
+    tmpdir = g_build_filename(store, LR_CONTENTSTORE_TMPDIR, NULL);
+    if (g_mkdir_with_parents(dir, 0755) == -1
+        || g_mkdir_with_parents(tmpdir, 0755) == -1)
+    {
+        g_debug("%s: Cannot create directories in %s: %s",
+                __func__, store, strerror(errno));
+        return;
+    }
+
+    // The entry is always a private file of the store, a file of the
+    // caller is never linked into it as the caller could modify it later
+    tmp = g_build_filename(tmpdir, "publish-XXXXXX", NULL);
+    dst = mkstemp(tmp);
+    if (dst == -1) {
+        g_debug("%s: Cannot create a temporary file in %s: %s",
+                __func__, tmpdir, strerror(errno));
+        return;
+    }
+
+    // lr_copy_content() makes a reflink where the filesystem supports it
+    if (lr_copy_content(src, dst) != 0) {
+        g_debug("%s: Cannot copy the file into %s: %s",
+                __func__, tmp, strerror(errno));
+        unlink(tmp);
+        return;
+    }
+
+    // Cache the checksum before the file is made read-only
+    lr_checksum_cache_store(dst, type, checksum);
+    fchmod(dst, 0444);
+
+    if (rename(tmp, path) == -1) {
+        g_debug("%s: Cannot rename %s to %s: %s",
+                __func__, tmp, path, strerror(errno));
+        unlink(tmp);
+        return;
+    }
+
+    g_debug("%s: %s published", __func__, path);
+}
+
+static void
+lr_contentstore_entry_free(LrContentStoreEntry *entry)
+{
+    g_free(entry->path);
+    g_free(entry);
+}
+
+/** Least recently used entries first */
+static gint
+lr_contentstore_entry_cmp(gconstpointer a, gconstpointer b)
+{
+    const LrContentStoreEntry *entry_a = a;
+    const LrContentStoreEntry *entry_b = b;
+
+    if (entry_a->atime.tv_sec != entry_b->atime.tv_sec)
+        return entry_a->atime.tv_sec < entry_b->atime.tv_sec ? -1 : 1;
+    if (entry_a->atime.tv_nsec != entry_b->atime.tv_nsec)
+        return entry_a->atime.tv_nsec < entry_b->atime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/** Collect the files which are depth levels below the dir.
+ */
+static void
+lr_contentstore_scan(const char *dir,
+                     int depth,
+                     GSList **entries,
+                     gint64 *total)
+{
+    GDir *gdir;
+    const gchar *name;
+
+    gdir = g_dir_open(dir, 0, NULL);
+    if (!gdir)
+        return;
+
+    while ((name = g_dir_read_name(gdir))) {
+        gchar *path = g_build_filename(dir, name, NULL);
+        struct stat st;
+
+        if (depth > 0) {
+            lr_contentstore_scan(path, depth - 1, entries, total);
+            g_free(path);
+            continue;
+        }
+
+        if (lstat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+            g_free(path);
+            continue;
+        }
+
+        LrContentStoreEntry *entry = g_new0(LrContentStoreEntry, 1);
+        entry->path = path;
+        entry->size = st.st_size;
+        entry->atime = st.st_atim;
+        *entries = g_slist_prepend(*entries, entry);
+        *total += st.st_size;
+    }
+
+    g_dir_close(gdir);
+}
+
+/** Remove temporary files which were left by crashed publishers.
+ */
+static void
+lr_contentstore_remove_stale(const char *tmpdir)
+{
+    GDir *gdir;
+    const gchar *name;
+    time_t now = time(NULL);
+
+    gdir = g_dir_open(tmpdir, 0, NULL);
+    if (!gdir)
+        return;
+
+    while ((name = g_dir_read_name(gdir))) {
+        _cleanup_free_ gchar *path = g_build_filename(tmpdir, name, NULL);
+        struct stat st;
+
+        if (lstat(path, &st) == 0
+            && now - st.st_mtime > LR_CONTENTSTORE_TMP_MAXAGE)
+        {
+            g_debug("%s: Removing stale %s", __func__, path);
+            unlink(path);
+        }
+    }
+
+    g_dir_close(gdir);
+}
+
+void
+lr_contentstore_evict(const char *store, gint64 maxsize)
+{
+    GDir *gdir;
+    const gchar *name;
+    GSList *entries = NULL;
+    gint64 total = 0;
+
+    if (!store)
+        return;
+
+    gdir = g_dir_open(store, 0, NULL);
+    if (!gdir)
+        return;
+
+    while ((name = g_dir_read_name(gdir))) {
+        _cleanup_free_ gchar *path = g_build_filename(store, name, NULL);
+
+        if (!strcmp(name, LR_CONTENTSTORE_TMPDIR))
+            lr_contentstore_remove_stale(path);
+        else if (maxsize > 0)
+            // <checksum type>/<prefix>/<checksum>
+            lr_contentstore_scan(path, 1, &entries, &total);
+    }
+
+    g_dir_close(gdir);
+
+    if (total > maxsize) {
+        g_debug("%s: Size of %s is %"G_GINT64_FORMAT" (limit %"
+                G_GINT64_FORMAT")", __func__, store, total, maxsize);
+
+        entries = g_slist_sort(entries, lr_contentstore_entry_cmp);
+        for (GSList *elem = entries; elem && total > maxsize;
+             elem = g_slist_next(elem))
+        {
+            LrContentStoreEntry *entry = elem->data;
+
+            // A process which already opened the file can still use it
+            if (unlink(entry->path) == -1) {
+                if (errno != ENOENT)
+                    g_debug("%s: Cannot remove %s: %s",
+                            __func__, entry->path, strerror(errno));
+                continue;
+            }
+            g_debug("%s: Evicted %s", __func__, entry->path);
+            total -= entry->size;
+        }
+    }
+
+    g_slist_free_full(entries, (GDestroyNotify) lr_contentstore_entry_free);
+}
@@ -0,0 +1,85 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_CONTENTSTORE_H__
+#define __LR_CONTENTSTORE_H__
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/* Content store (see LRO_CONTENTSTORE) is a directory with verified
+ * files keyed by their checksums:
+ *
+ *   <store>/<checksum type>/<first two chars of checksum>/<checksum>
+ *
+ * Files are published atomically (written to <store>/tmp and renamed),
+ * so a concurrent reader never sees an incomplete file. Files of the
+ * store are never modified in place. The access time of a file is
+ * updated whenever it is used, the least recently used files are
+ * evicted first.
+ */
+
+/** Look up a file with the checksum in the content store. The checksum
+ * of the found file is verified (a damaged file is removed) and its
+ * access time is updated. Any error is treated as if the file was not
+ * in the store.
+ * @param store         Path to the content store
+ * @param type          Checksum type
+ * @param checksum      Checksum (hex string)
+ * @return              Path of the file in the store (must be freed
+ *                      by g_free()) or NULL if it's not there
+ */
+gchar *
+lr_contentstore_lookup(const char *store,
+                       LrChecksumType type,
+                       const char *checksum);
+
+/** Publish the verified file (fd or fn) with the checksum into
+ * the content store. If the store already contains the file, only its
+ * access time is updated. Errors are only logged.
+ * @param store         Path to the content store
+ * @param type          Checksum type
+ * @param checksum      Checksum (hex string) of the file
+ * @param fd            File descriptor or -1
+ * @param fn            Filename or NULL
+ */
+void
+lr_contentstore_publish(const char *store,
+                        LrChecksumType type,
+                        const char *checksum,
+                        int fd,
+                        const char *fn);
+
+/** Evict the least recently used files from the content store until
+ * its size is at most maxsize bytes. Temporary files left by crashed
+ * publishers are removed as well. Errors are only logged.
+ * @param store         Path to the content store
+ * @param maxsize       Maximal size of the store in bytes,
+ *                      0 means unlimited
+ */
+void
+lr_contentstore_evict(const char *store, gint64 maxsize);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,483 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE 500 // Because of pread()
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <lzma.h>
+#include <bzlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "decompressor.h"
+#include "checksum.h"
+#include "rcodes.h"
+#include "util.h"
+
+#define LR_DECOMPRESSOR_BUFSIZE     131072
+
+struct _LrDecompressor {
+    LrCompressionType type; /*!<
+        Compression of the data */
+    int fd; /*!<
+        Output file descriptor or -1 */
+    GSList *ctxs; /*!<
+        Checksum contexts updated with the output (not owned) */
+    gint64 consumed; /*!<
+        Number of compressed bytes */
+    gint64 produced; /*!<
+        Number of decompressed bytes */
+    gboolean stream_end; /*!<
+        The last stream is complete (a next one could follow, files
+        created by concatenation of compressed files are valid) */
+    union {
+        z_stream gzip;
+        lzma_stream xz;
+        bz_stream bzip2;
+#ifdef WITH_ZSTD
+        ZSTD_DStream *zstd;
+#endif
+    } s; /*!<
+        State of the library used for the compression */
+    unsigned char buf[LR_DECOMPRESSOR_BUFSIZE]; /*!<
+        Output buffer */
+};
+
+/** Suffixes of compressed files */
+static const struct {
+    const char *suffix;
+    LrCompressionType type;
+} lr_compression_suffixes[] = {
+    { ".gz",    LR_COMPRESSION_GZIP },
+    { ".xz",    LR_COMPRESSION_XZ },
+    { ".bz2",   LR_COMPRESSION_BZIP2 },
+    { ".zst",   LR_COMPRESSION_ZSTD },
+    { NULL,     LR_COMPRESSION_NONE },
+};
+
+LrCompressionType
+lr_compression_type(const char *path)
+{
+    if (!path)
+        return LR_COMPRESSION_NONE;
+
+    for (int x = 0; lr_compression_suffixes[x].suffix; x++)
+        if (g_str_has_suffix(path, lr_compression_suffixes[x].suffix))
+            return lr_compression_suffixes[x].type;
+
+    return LR_COMPRESSION_NONE;
+}
+
+gboolean
+lr_compression_supported(LrCompressionType type)
+{
+    switch (type) {
+    case LR_COMPRESSION_GZIP:
+    case LR_COMPRESSION_XZ:
+    case LR_COMPRESSION_BZIP2:
+        return TRUE;
+    case LR_COMPRESSION_ZSTD:
+#ifdef WITH_ZSTD
+        return TRUE;
+#else
+        return FALSE;
+#endif
+    default:
+        return FALSE;
+    }
+}
+
+gchar *
+lr_compression_strip_suffix(const char *path)
+{
+    if (!path)
+        return NULL;
+
+    for (int x = 0; lr_compression_suffixes[x].suffix; x++) {
+        const char *suffix = lr_compression_suffixes[x].suffix;
+        if (g_str_has_suffix(path, suffix)
+            && strlen(path) > strlen(suffix))
+            return g_strndup(path, strlen(path) - strlen(suffix));
+    }
+
+    return NULL;
+}
+
+LrDecompressor *
+lr_decompressor_new(LrCompressionType type,
+                    int fd,
+                    GSList *ctxs,
+                    GError **err)
+{
+    LrDecompressor *dec;
+    gboolean ok = FALSE;
+
+    assert(!err || *err == NULL);
+
+    if (!lr_compression_supported(type)) {
+        g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                    "Unsupported compression: %d", type);
+        return NULL;
+    }
+
+    dec = lr_malloc0(sizeof(*dec));
+    dec->type = type;
+    dec->fd = fd;
+    dec->ctxs = ctxs;
+
+    switch (type) {
+    case LR_COMPRESSION_GZIP:
+        // 32 - Detect gzip or zlib header automatically
+        ok = inflateInit2(&dec->s.gzip, 15 + 32) == Z_OK;
+        break;
+    case LR_COMPRESSION_XZ:
+        dec->s.xz = (lzma_stream) LZMA_STREAM_INIT;
+        ok = lzma_stream_decoder(&dec->s.xz, UINT64_MAX,
+                                 LZMA_CONCATENATED) == LZMA_OK;
+        break;
+    case LR_COMPRESSION_BZIP2:
+        ok = BZ2_bzDecompressInit(&dec->s.bzip2, 0, 0) == BZ_OK;
+        break;
+#ifdef WITH_ZSTD
+    case LR_COMPRESSION_ZSTD:
+        dec->s.zstd = ZSTD_createDStream();
+        ok = dec->s.zstd && !ZSTD_isError(ZSTD_initDStream(dec->s.zstd));
+        break;
+#endif
+    default:
+        break;
+    }
+
+    if (!ok) {
+        g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                    "Cannot initialize decompression");
+        lr_free(dec);
+        return NULL;
+    }
+
+    return dec;
+}
+
+/** Write len bytes of the output buffer to the fd and pass them
+ * to the checksum contexts.
+ */
+static gboolean
+lr_decompressor_output(LrDecompressor *dec, size_t len, GError **err)
+{
+    if (len == 0)
+        return TRUE;
+
+    if (dec->fd != -1) {
+        for (size_t written = 0; written < len;) {
+            ssize_t rc = write(dec->fd, dec->buf + written, len - written);
+            if (rc == -1) {
+                if (errno == EINTR)
+                    continue;
+                g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_IO,
+                            "Cannot write decompressed data: %s",
+                            strerror(errno));
+                return FALSE;
+            }
+            written += rc;
+        }
+    }
+
+    for (GSList *elem = dec->ctxs; elem; elem = g_slist_next(elem))
+        if (!lr_checksumctx_update(elem->data, dec->buf, len, err))
+            return FALSE;
+
+    dec->produced += len;
+    return TRUE;
+}
+
+static gboolean
+lr_decompressor_write_gzip(LrDecompressor *dec,
+                           const void *buf,
+                           size_t len,
+                           GError **err)
+{
+    z_stream *z = &dec->s.gzip;
+
+    z->next_in = (Bytef *) buf;
+    z->avail_in = len;
+
+    do {
+        if (dec->stream_end) {
+            if (z->avail_in == 0)
+                break;
+            // Next member of a concatenated file
+            inflateReset(z);
+            dec->stream_end = FALSE;
+        }
+
+        z->next_out = dec->buf;
+        z->avail_out = sizeof(dec->buf);
+
+        int rc = inflate(z, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            dec->stream_end = TRUE;
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                        "gzip decompression failed: %s",
+                        z->msg ? z->msg : "unknown error");
+            return FALSE;
+        }
+
+        if (!lr_decompressor_output(dec, sizeof(dec->buf) - z->avail_out, err))
+            return FALSE;
+    } while (z->avail_in > 0 || z->avail_out == 0);
+
+    return TRUE;
+}
+
+static gboolean
+lr_decompressor_code_xz(LrDecompressor *dec, lzma_action action, GError **err)
+{
+    lzma_stream *s = &dec->s.xz;
+    lzma_ret rc;
+
+    do {
+        s->next_out = dec->buf;
+        s->avail_out = sizeof(dec->buf);
+
+        rc = lzma_code(s, action);
+        if (rc == LZMA_STREAM_END) {
+            dec->stream_end = TRUE;
+        } else if (rc != LZMA_OK) {
+            g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                        "xz decompression failed (error %d)", rc);
+            return FALSE;
+        }
+
+        if (!lr_decompressor_output(dec, sizeof(dec->buf) - s->avail_out, err))
+            return FALSE;
+    } while (rc != LZMA_STREAM_END && (s->avail_in > 0 || s->avail_out == 0));
+
+    return TRUE;
+}
+
+static gboolean
+lr_decompressor_write_bzip2(LrDecompressor *dec,
+                            const void *buf,
+                            size_t len,
+                            GError **err)
+{
+    bz_stream *b = &dec->s.bzip2;
+
+    b->next_in = (char *) buf;
+    b->avail_in = len;
+
+    do {
+        if (dec->stream_end) {
+            if (b->avail_in == 0)
+                break;
+            // Next stream of a concatenated file
+            char *next_in = b->next_in;
+            unsigned int avail_in = b->avail_in;
+            BZ2_bzDecompressEnd(b);
+            if (BZ2_bzDecompressInit(b, 0, 0) != BZ_OK) {
+                g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                            "Cannot initialize bzip2 decompression");
+                return FALSE;
+            }
+            b->next_in = next_in;
+            b->avail_in = avail_in;
+            dec->stream_end = FALSE;
+        }
+
+        b->next_out = (char *) dec->buf;
+        b->avail_out = sizeof(dec->buf);
+
+        int rc = BZ2_bzDecompress(b);
+        if (rc == BZ_STREAM_END) {
+            dec->stream_end = TRUE;
+        } else if (rc != BZ_OK) {
+            g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                        "bzip2 decompression failed (error %d)", rc);
+            return FALSE;
+        }
+
+        if (!lr_decompressor_output(dec, sizeof(dec->buf) - b->avail_out, err))
+            return FALSE;
+    } while (b->avail_in > 0 || b->avail_out == 0);
+
+    return TRUE;
+}
+
+#ifdef WITH_ZSTD
+static gboolean
+lr_decompressor_write_zstd(LrDecompressor *dec,
+                           const void *buf,
+                           size_t len,
+                           GError **err)
+{
+    ZSTD_inBuffer in = { buf, len, 0 };
+    ZSTD_outBuffer out;
+
+    do {
+        out.dst = dec->buf;
+        out.size = sizeof(dec->buf);
+        out.pos = 0;
+
+        size_t rc = ZSTD_decompressStream(dec->s.zstd, &out, &in);
+        if (ZSTD_isError(rc)) {
+            g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                        "zstd decompression failed: %s",
+                        ZSTD_getErrorName(rc));
+            return FALSE;
+        }
+        // 0 - a frame is complete (a next one could follow)
+        dec->stream_end = rc == 0;
+
+        if (!lr_decompressor_output(dec, out.pos, err))
+            return FALSE;
+    } while (in.pos < in.size || out.pos == out.size);
+
+    return TRUE;
+}
+#endif
+
+gboolean
+lr_decompressor_write(LrDecompressor *dec,
+                      const void *buf,
+                      size_t len,
+                      GError **err)
+{
+    assert(dec);
+    assert(!err || *err == NULL);
+
+    dec->consumed += len;
+
+    switch (dec->type) {
+    case LR_COMPRESSION_GZIP:
+        return lr_decompressor_write_gzip(dec, buf, len, err);
+    case LR_COMPRESSION_XZ:
+        dec->s.xz.next_in = buf;
+        dec->s.xz.avail_in = len;
+        return lr_decompressor_code_xz(dec, LZMA_RUN, err);
+    case LR_COMPRESSION_BZIP2:
+        return lr_decompressor_write_bzip2(dec, buf, len, err);
+#ifdef WITH_ZSTD
+    case LR_COMPRESSION_ZSTD:
+        return lr_decompressor_write_zstd(dec, buf, len, err);
+#endif
+    default:
+        assert(0);
+        return FALSE;
+    }
+}
+
+gboolean
+lr_decompressor_write_fd(LrDecompressor *dec, int fd, GError **err)
+{
+    char buf[LR_DECOMPRESSOR_BUFSIZE];
+    off_t offset = 0;
+    ssize_t readed;
+
+    assert(dec);
+    assert(!err || *err == NULL);
+
+    while ((readed = pread(fd, buf, sizeof(buf), offset)) != 0) {
+        if (readed == -1) {
+            if (errno == EINTR)
+                continue;
+            g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_IO,
+                        "pread(%d) failed: %s", fd, strerror(errno));
+            return FALSE;
+        }
+        if (!lr_decompressor_write(dec, buf, readed, err))
+            return FALSE;
+        offset += readed;
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_decompressor_finish(LrDecompressor *dec, GError **err)
+{
+    assert(dec);
+    assert(!err || *err == NULL);
+
+    if (dec->type == LR_COMPRESSION_XZ) {
+        // Flush the rest of the data, the end of the stream is
+        // recognized only now (the decoder waits for concatenated streams)
+        dec->s.xz.next_in = NULL;
+        dec->s.xz.avail_in = 0;
+        if (!lr_decompressor_code_xz(dec, LZMA_FINISH, err))
+            return FALSE;
+    }
+
+    if (!dec->stream_end) {
+        g_set_error(err, LR_DECOMPRESSOR_ERROR, LRE_DECOMPRESS,
+                    "Unexpected end of compressed data (%"G_GINT64_FORMAT
+                    " bytes read)", dec->consumed);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gint64
+lr_decompressor_consumed(LrDecompressor *dec)
+{
+    assert(dec);
+    return dec->consumed;
+}
+
+gint64
+lr_decompressor_produced(LrDecompressor *dec)
+{
+    assert(dec);
+    return dec->produced;
+}
+
+void
+lr_decompressor_free(LrDecompressor *dec)
+{
+    if (!dec)
+        return;
+
+    switch (dec->type) {
+    case LR_COMPRESSION_GZIP:
+        inflateEnd(&dec->s.gzip);
+        break;
+    case LR_COMPRESSION_XZ:
+        lzma_end(&dec->s.xz);
+        break;
+    case LR_COMPRESSION_BZIP2:
+        BZ2_bzDecompressEnd(&dec->s.bzip2);
+        break;
+#ifdef WITH_ZSTD
+    case LR_COMPRESSION_ZSTD:
+        ZSTD_freeDStream(dec->s.zstd);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    lr_free(dec);
+}
@@ -0,0 +1,140 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_DECOMPRESSOR_H__
+#define __LR_DECOMPRESSOR_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Streaming decompression of metadata files. Compressed data are passed
+ * to the decompressor in chunks as they come (e.g. from lr_writecb()),
+ * the decompressed data are written into a file and passed to checksum
+ * contexts, so the uncompressed file never has to be read again.
+ */
+
+/** Compression of a file */
+typedef enum {
+    LR_COMPRESSION_NONE,    /*!< Not compressed (or unknown compression) */
+    LR_COMPRESSION_GZIP,    /*!< gzip (.gz) */
+    LR_COMPRESSION_XZ,      /*!< xz (.xz) */
+    LR_COMPRESSION_BZIP2,   /*!< bzip2 (.bz2) */
+    LR_COMPRESSION_ZSTD,    /*!< zstd (.zst), only if built with zstd */
+} LrCompressionType;
+
+typedef struct _LrDecompressor LrDecompressor;
+
+/** Detect the compression of a file from the suffix of its path.
+ * @param path          Path (or URL) of the file
+ * @return              Compression type
+ */
+LrCompressionType
+lr_compression_type(const char *path);
+
+/** Check whether the compression could be decompressed by this build
+ * of librepo.
+ * @param type          Compression type
+ * @return              TRUE if supported, FALSE for LR_COMPRESSION_NONE
+ *                      and for compressions librepo wasn't built with
+ */
+gboolean
+lr_compression_supported(LrCompressionType type);
+
+/** Get the path of the uncompressed file (the path without
+ * the compression suffix).
+ * @param path          Path of the compressed file
+ * @return              Newly allocated path or NULL if the path
+ *                      has no known compression suffix
+ */
+gchar *
+lr_compression_strip_suffix(const char *path);
+
+/** Create a new decompressor.
+ * @param type          Compression type
+ * @param fd            File descriptor where the decompressed data are
+ *                      written (at its current offset) or -1
+ * @param ctxs          Checksum contexts (LrChecksumCtx *) updated with
+ *                      the decompressed data or NULL. The list is not
+ *                      copied and must outlive the decompressor.
+ * @param err           GError **
+ * @return              New decompressor or NULL if err is set
+ */
+LrDecompressor *
+lr_decompressor_new(LrCompressionType type,
+                    int fd,
+                    GSList *ctxs,
+                    GError **err);
+
+/** Decompress the next chunk of the compressed data.
+ * @param dec           Decompressor
+ * @param buf           Compressed data
+ * @param len           Length of the data
+ * @param err           GError **
+ * @return              FALSE if the data are not valid or if the
+ *                      decompressed data cannot be written (err is set)
+ */
+gboolean
+lr_decompressor_write(LrDecompressor *dec,
+                      const void *buf,
+                      size_t len,
+                      GError **err);
+
+/** Decompress the whole file (from its beginning).
+ * @param dec           Decompressor
+ * @param fd            File descriptor of the compressed file
+ * @param err           GError **
+ * @return              FALSE if err is set
+ */
+gboolean
+lr_decompressor_write_fd(LrDecompressor *dec, int fd, GError **err);
+
+/** Check that the compressed data ended at the end of a stream
+ * (the file was not truncated).
+ * @param dec           Decompressor
+ * @param err           GError **
+ * @return              FALSE if the data are incomplete (err is set)
+ */
+gboolean
+lr_decompressor_finish(LrDecompressor *dec, GError **err);
+
+/** Get the number of compressed bytes passed to the decompressor.
+ * @param dec           Decompressor
+ * @return              Number of bytes
+ */
+gint64
+lr_decompressor_consumed(LrDecompressor *dec);
+
+/** Get the number of decompressed bytes.
+ * @param dec           Decompressor
+ * @return              Number of bytes
+ */
+gint64
+lr_decompressor_produced(LrDecompressor *dec);
+
+/** Free the decompressor.
+ * @param dec           Decompressor or NULL
+ */
+void
+lr_decompressor_free(LrDecompressor *dec);
+
+G_END_DECLS
+
+#endif
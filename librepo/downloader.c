@@ -18,7 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
-#define _XOPEN_SOURCE   500 // Because of fdopen() and ftruncate()
+#define _XOPEN_SOURCE   600 // Because of fdopen(), ftruncate() and posix_fallocate()
 
 #include <glib.h>
 #include <assert.h>
@@ -29,10 +29,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#define LR_HAVE_EPOLL   1
+#endif
 #include <curl/curl.h>
 #include <attr/xattr.h>
 
 #include "downloader.h"
+#include "downloader_internal.h"
 #include "rcodes.h"
 #include "util.h"
 #include "downloadtarget.h"
@@ -40,14 +46,144 @@
 #include "handle.h"
 #include "handle_internal.h"
 #include "cleanup.h"
+#include "contentstore.h"
+#include "decompressor.h"
 #include "url_substitution.h"
 
+/** Minimal size of a segment of a segmented download */
+#define LR_SEGMENT_MINSIZE  (1024*1024)
+
+/** Weight of a new sample in exponentially weighted moving averages
+ * of mirror statistics */
+#define LR_MIRROR_EWMA_ALPHA            0.3
+
+/** Minimal number of downloaded bytes to take a throughput sample
+ * (transfer times of smaller files are dominated by latency) */
+#define LR_MIRROR_MIN_THROUGHPUT_SAMPLE (16*1024)
+
+/** Error rate is capped to keep expected time of bad mirrors finite */
+#define LR_MIRROR_MAX_ERROR_RATE        0.95
+
+/** Size used to rank mirrors for targets without an expected size */
+#define LR_MIRROR_DEFAULT_SIZE          (256*1024)
+
+/** Length of an interval (in seconds) over which the total throughput
+ * (goodput) is measured by the autotuner of parallel downloads */
+#define LR_AUTOTUNE_INTERVAL            1.0
+
+/** Goodput has to improve at least by this factor to keep raising
+ * the number of parallel downloads */
+#define LR_AUTOTUNE_GROWTH              1.05
+
+/** The number of parallel downloads is lowered by a quarter if goodput
+ * drops below this fraction of goodput of the previous interval */
+#define LR_AUTOTUNE_DROP                0.8
+
+/** Bandwidth limiter: a transfer could save its share of the bandwidth
+ * for at most this many seconds (size of its token bucket) */
+#define LR_BANDWIDTH_BURST              0.1
+
+/** Bandwidth limiter: maximal time (in milliseconds) between two
+ * distributions of the bandwidth (the main loop wakes up at least so
+ * often to resume paused transfers) */
+#define LR_BANDWIDTH_TICK               20
+
+/** Minimal length of an interval (in seconds) over which throughput
+ * of a mirror is measured to adjust its concurrency window */
+#define LR_MIRROR_WINDOW_INTERVAL       0.5
+
+/** Throughput has to improve at least by this factor to keep growing
+ * the concurrency window */
+#define LR_MIRROR_WINDOW_GROWTH         1.05
+
+/** The concurrency window is halved if throughput drops below this
+ * fraction of throughput of the previous interval */
+#define LR_MIRROR_WINDOW_COLLAPSE       0.5
+
 volatile sig_atomic_t lr_interrupt = 0;
 
+/** Number of running interruptible operations */
+static volatile gint lr_interruptible_count = 0;
+
+/** SIGINT handler which was installed before the librepo one */
+static struct sigaction lr_old_sigact;
+
+/** Protects installation of the SIGINT handler */
+G_LOCK_DEFINE_STATIC(lr_sigint);
+
 void
 lr_sigint_handler(G_GNUC_UNUSED int sig)
 {
-    lr_interrupt = 1;
+    lr_interrupt++;
+}
+
+static void
+lr_sigint_action(int sig, siginfo_t *info, void *context)
+{
+    if (g_atomic_int_get(&lr_interruptible_count) > 0) {
+        lr_interrupt++;
+        return;
+    }
+
+    // No interruptible operation is running, behave like the original
+    // handler
+    if (lr_old_sigact.sa_flags & SA_SIGINFO) {
+        lr_old_sigact.sa_sigaction(sig, info, context);
+    } else if (lr_old_sigact.sa_handler == SIG_DFL) {
+        // Terminate the process as if no handler was installed
+        signal(sig, SIG_DFL);
+        raise(sig);
+    } else if (lr_old_sigact.sa_handler != SIG_IGN) {
+        lr_old_sigact.sa_handler(sig);
+    }
+}
+
+gboolean
+lr_interruptible_begin(sig_atomic_t *sigint_count)
+{
+    struct sigaction cur_sigact;
+    gboolean ret = TRUE;
+
+    G_LOCK(lr_sigint);
+
+    if (sigaction(SIGINT, NULL, &cur_sigact) == -1) {
+        ret = FALSE;
+    } else if (!(cur_sigact.sa_flags & SA_SIGINFO)
+               || cur_sigact.sa_sigaction != lr_sigint_action) {
+        // The handler is not installed yet (or it was replaced since)
+        struct sigaction sigact;
+        g_debug("%s: Installing own SIGINT handler", __func__);
+        memset(&sigact, 0, sizeof(sigact));
+        sigemptyset(&sigact.sa_mask);
+        sigaddset(&sigact.sa_mask, SIGINT);
+        sigact.sa_sigaction = lr_sigint_action;
+        // SA_RESTART is kept as the original handler wants it, without
+        // it a SIGINT wakes up the waiting in the download loops
+        sigact.sa_flags = SA_SIGINFO | (cur_sigact.sa_flags & SA_RESTART);
+        lr_old_sigact = cur_sigact;
+        if (sigaction(SIGINT, &sigact, NULL) == -1)
+            ret = FALSE;
+    }
+
+    if (ret)
+        g_atomic_int_inc(&lr_interruptible_count);
+    *sigint_count = lr_interrupt;
+
+    G_UNLOCK(lr_sigint);
+
+    return ret;
+}
+
+void
+lr_interruptible_end(void)
+{
+    g_atomic_int_add(&lr_interruptible_count, -1);
+}
+
+gboolean
+lr_interrupted(sig_atomic_t sigint_count)
+{
+    return lr_interrupt != sigint_count;
 }
 
 typedef enum {
@@ -79,20 +215,88 @@ typedef struct {
     GSList *lrmirrors; /*!<
         List of LrMirrors created from the handle internal mirrorlist
         (could be NULL) */
+    guint lrmirrors_count; /*!<
+        Number of mirrors in the lrmirrors list */
+    GQueue waiting_targets; /*!<
+        Queue of waiting targets (LrTarget *) that are downloaded
+        from the mirrors from lrmirrors */
+    gdouble throughput_sum; /*!<
+        Sum of throughputs of the mirrors that have a throughput estimate */
+    guint throughput_count; /*!<
+        Number of the mirrors that have a throughput estimate */
+    gdouble ttfb_sum; /*!<
+        Sum of times to first byte of the mirrors that have the estimate */
+    guint ttfb_count; /*!<
+        Number of the mirrors that have a time to first byte estimate */
+    gint64 bytes_received; /*!<
+        Number of bytes received by all transfers of targets of the handle */
+    GSList *easy_handles; /*!<
+        Pool of idle curl easy handles (CURL *) of finished transfers of
+        targets of the handle. They are reused by the next transfers. */
 } LrHandleMirrors;
 
+typedef struct {
+    int src; /*!<
+        Local file which is copied */
+    int dst; /*!<
+        File of the target */
+    int wakeup_fd; /*!<
+        Written when the copy is finished (see LrDownload.wakeup_fds) */
+    volatile gint done; /*!<
+        Non-zero if the copy is finished */
+    gboolean copied; /*!<
+        TRUE if the file was copied (valid once the thread is joined) */
+    int errsv; /*!<
+        Errno of the failed copy */
+    GThread *thread; /*!<
+        Thread doing the copy (see local_copy_worker()) */
+} LrLocalCopy;
+
 typedef struct {
     LrInternalMirror *mirror; /*!<
         Mirror */
+    guint index; /*!<
+        Position of the mirror in the lrmirrors list of its
+        LrHandleMirrors (lower than lrmirrors_count). Mirrors without
+        URL are skipped, so it could differ from the position in the
+        internal mirrorlist of the handle. It is used as an index into
+        bitsets of tried mirrors (LrTarget.tried_mirrors). */
     int running_transfers; /*!<
         How many transfers from this mirror are currently in progres. */
     int successful_transfers; /*!<
         How many transfers was finished successfully from the mirror. */
     int failed_transfers; /*!<
         How many transfers failed. */
+    gdouble throughput; /*!<
+        Moving average of throughput in bytes per second
+        (0.0 if not measured yet). */
+    gdouble ttfb; /*!<
+        Moving average of time to first byte in seconds
+        (negative if not measured yet). */
+    gdouble error_rate; /*!<
+        Moving average of failures (0.0 - all transfers were successful,
+        1.0 - all transfers failed). */
+    gdouble window; /*!<
+        Concurrency window - how many transfers could run from the mirror
+        at once. It starts at the upper bound (see mirror_window_limit()),
+        it is halved on errors and throttling and then grows back while
+        throughput of the mirror improves (AIMD). */
+    gint64 bytes_received; /*!<
+        Number of bytes received from the mirror. */
+    gint64 window_bytes; /*!<
+        Value of bytes_received at the start of the current
+        measurement interval of the window. */
+    gint64 window_time; /*!<
+        Monotonic time (in microseconds) of the start of the current
+        measurement interval of the window (0 if not started yet). */
+    gdouble window_throughput; /*!<
+        Throughput (bytes per second) measured in the previous interval
+        (0.0 if not measured yet). */
 } LrMirror;
 
-typedef struct {
+typedef struct _LrTarget LrTarget;
+
+struct _LrTarget {
     LrDownloadState state; /*!<
         State of the download (transfer). */
     LrDownloadTarget *target; /*!<
@@ -117,9 +321,13 @@ typedef struct {
         in curl_handle. */
     char errorbuffer[CURL_ERROR_SIZE]; /*!<
         Error buffer used in curl handle */
-    GSList *tried_mirrors; /*!<
-        List of already tried mirrors (LrMirror *).
-        This mirrors won't be tried again. */
+    guint8 *tried_mirrors; /*!<
+        Bitset of already tried mirrors indexed by LrMirror.index.
+        This mirrors won't be tried again. NULL if no mirror was
+        tried yet. */
+    guint tried_mirrors_count; /*!<
+        Number of finished transfers of the target (Number of tried
+        mirrors or base URLs). */
     gboolean resume; /*!<
         Is resume enabled? Download target may state that resume is True
         but Librepo can decide that resuming won't be done.
@@ -135,6 +343,8 @@ typedef struct {
         and is common for all targets that uses the handle. */
     LrHandle *handle; /*!<
         LrHandle associated with this target */
+    LrHandleMirrors *handle_mirrors; /*!<
+        LrHandleMirrors of the handle associated with this target */
     LrHeaderCbState headercb_state; /*!<
         State of the header callback for current transfer */
     gchar *headercb_interrupt_reason; /*!<
@@ -147,7 +357,96 @@ typedef struct {
         range was downloaded, it is TRUE. Otherwise FALSE. */
     LrCbReturnCode cb_return_code; /*!<
         Last cb return code. */
-} LrTarget;
+    GSList *checksum_ctxs; /*!<
+        Incremental checksum contexts (LrChecksumCtx *), one for each type
+        of checksum in target->checksums. The contexts are updated by
+        lr_writecb() with the data written to the file, so the file
+        doesn't have to be read again when the transfer is finished.
+        NULL if the incremental calculation is not used. */
+    gint64 checksummed_bytes; /*!<
+        Number of bytes of the file (including already existing prefix of
+        a resumed download) that were passed to the checksum_ctxs. */
+    gboolean local_copy; /*!<
+        If TRUE, the local file (file:// URL) is copied by
+        start_local_copy() and the current transfer only checks
+        that the file exists. */
+    gint64 local_copy_size; /*!<
+        Size of the file copied by start_local_copy(). */
+    LrLocalCopy *copy; /*!<
+        Copy of the local file running in a thread. The curl handle of
+        the transfer is added to the multi handle when it is finished
+        (see check_local_copies()). NULL if no copy is running. */
+    gchar *storedpath; /*!<
+        Path of the file of the target in the content store of its
+        handle (see lookup_in_contentstores()). The file is copied from
+        there instead of downloading it from a mirror. NULL if the file
+        is not in the store or the copy failed. */
+    LrDecompressor *decompressor; /*!<
+        Decompressor of the file (see LrDownloadTarget.decompress).
+        It's fed by lr_writecb() during the current transfer or by
+        the file once the transfer is finished. */
+    GSList *checksum_open_ctxs; /*!<
+        Checksum contexts (LrChecksumCtx *), one for each type of checksum
+        in target->checksums_open, updated by the decompressor. */
+    LrTarget *parent; /*!<
+        If the target is a segment of a segmented download, this is
+        the target of the whole file. Segment shares the LrDownloadTarget
+        with its parent and writes its data into the parent's file.
+        NULL for targets that are not segments. */
+    GSList *segments; /*!<
+        Segments (LrTarget *) of the file that is currently being
+        downloaded by the segmented download. NULL otherwise. */
+    gboolean segmentation_disabled; /*!<
+        If TRUE, the target won't be split into segments (e.g. because
+        the segmented download of the target already failed). */
+    gint64 segment_start; /*!<
+        Offset of the first byte of the segment. */
+    gint64 segment_end; /*!<
+        Offset of the last byte of the segment. Could be lowered during
+        the transfer if the rest of the segment is taken by a new one. */
+    gint64 segment_pos; /*!<
+        Offset where the next received byte of the segment will be
+        written. The segment is complete if segment_pos > segment_end. */
+    gint64 segment_transfer_pos; /*!<
+        Value of segment_pos when the current transfer was started. */
+    gint64 transfer_start_time; /*!<
+        Monotonic time when the current transfer was started. */
+    LrTarget *hedge; /*!<
+        Duplicate transfer of this target started from another mirror
+        because the transfer of the target is too slow.
+        NULL if the target is not hedged. */
+    LrTarget *primary; /*!<
+        If the target is a hedge, this is the hedged target. Hedge shares
+        the LrDownloadTarget with the primary target, but it downloads
+        the file into its own temporary file (hedge_fn).
+        NULL for targets that are not hedges. */
+    gchar *hedge_fn; /*!<
+        Temporary file of the hedge. If the hedge finishes first,
+        the file replaces the file of the primary target. */
+    gboolean rate_limited; /*!<
+        If TRUE, the current transfer receives data only while it has
+        tokens from the shared bandwidth limit (LRO_MAXSPEED). */
+    gdouble tokens; /*!<
+        Number of bytes the current transfer is allowed to receive.
+        A chunk of data from curl is accepted if it is positive, so
+        it could go negative - the debt is paid by the next tokens. */
+    gboolean paused; /*!<
+        The current transfer is paused by the write callback because
+        it has no tokens. It is resumed when it gets new tokens. */
+    struct curl_slist *curl_httpheader; /*!<
+        HTTP headers of the current conditional request (headers of
+        the handle followed by If-None-Match and If-Modified-Since).
+        NULL if the request is not conditional. */
+    gchar *etag; /*!<
+        ETag from the response of the current transfer of
+        a conditional target or NULL. */
+    gchar *lastmodified; /*!<
+        Last-Modified from the response of the current transfer of
+        a conditional target or NULL. */
+    LrDownloadTargetChecksum *verified_checksum; /*!<
+        Checksum (from target->checksums) which matched the downloaded
+        file. NULL if the file was not verified by a checksum. */
+};
 
 typedef struct {
 
@@ -174,6 +473,20 @@ typedef struct {
     long adaptivemirrorsorting; /*!<
         See LRO_ADAPTIVEMIRRORSORTING */
 
+    long max_segments; /*!<
+        See LRO_MAXSEGMENTS */
+
+    long hedge_budget; /*!<
+        See LRO_HEDGEBUDGET */
+
+    gboolean multiplex; /*!<
+        See LRO_MULTIPLEX */
+
+    int autotune_limit; /*!<
+        Hard cap of max_parallel_connections that is tuned during
+        the download (See LRO_AUTOTUNEPARALLELDOWNLOADS).
+        0 if the autotuning is disabled. */
+
     // Data
 
     CURLM *multi_handle; /*!<
@@ -185,9 +498,87 @@ typedef struct {
     GSList *targets; /*!<
         List of all targets (list of pointers to LrTarget stuctures) */
 
+    GQueue waiting_targets; /*!<
+        Queue of waiting targets (LrTarget *) that don't use mirrors
+        (they use a base URL or a complete URL). Waiting targets that
+        use mirrors are queued in LrHandleMirrors of their handle. */
+
     GSList *running_transfers; /*!<
         List of running transfers (list of pointer to LrTarget structures) */
 
+    GQueue finished_targets; /*!<
+        Queue of targets (LrDownloadTarget *) that are finished
+        (successfully or not) and which were not returned by
+        lr_download_context_get_finished() yet. */
+
+    gboolean interruptible; /*!<
+        If TRUE, a target has a handle with LRO_INTERRUPTIBLE enabled
+        and the targets of such handles are interrupted by SIGINT. */
+
+    sig_atomic_t sigint_count; /*!<
+        Value of lr_interrupt when the downloading started (or when
+        the targets of interruptible handles were last stopped) */
+
+    GSList *cancel_tokens; /*!<
+        Distinct cancel tokens (LrCancelToken *) of the handles of
+        the targets (LRO_CANCELTOKEN). Cancellation of a token stops
+        the targets of its handles and the token is removed. */
+
+    gint64 total_bytes; /*!<
+        Sum of expected sizes of all targets */
+
+    gint64 hedge_bytes; /*!<
+        Number of bytes received by the hedges whose transfers ended.
+        Running hedges are charged by their expected size on top. */
+
+    gint64 autotune_time; /*!<
+        Monotonic time (in microseconds) of the start of the current
+        measurement interval of the autotuner (0 if not started yet). */
+
+    gint64 autotune_bytes; /*!<
+        Number of bytes received by all transfers at the start of
+        the current measurement interval. */
+
+    gdouble autotune_goodput; /*!<
+        Goodput (bytes per second) measured in the previous interval
+        (0.0 if not measured yet). */
+
+    gboolean autotune_saturated; /*!<
+        TRUE if all slots for parallel downloads were used during
+        the current measurement interval. */
+
+    gboolean autotune_slow_start; /*!<
+        The number of parallel downloads is doubled (instead of increased
+        by one) until goodput stops improving for the first time. */
+
+    gint64 bandwidth_time; /*!<
+        Monotonic time (in microseconds) of the last distribution of
+        the bandwidth among running transfers (0 if not distributed yet). */
+
+    int autotune_prev_limit; /*!<
+        Number of parallel downloads before the last increase or 0 if
+        the last decision of the autotuner wasn't an increase. */
+
+    int epoll_fd; /*!<
+        Epoll set with sockets of running transfers or -1 if the event
+        driven loop is not used (select() loop is used instead). */
+
+    int timer_fd; /*!<
+        Timerfd armed by the curl multi timer callback or -1. */
+
+    int wakeup_fds[2]; /*!<
+        Pipe written by threads copying local files when they finish,
+        so that the waiting for the sockets is woken up. Created with
+        the first copy, -1 until then. */
+
+    guint local_copies; /*!<
+        Number of running transfers whose local file is being copied
+        (their curl handles are not in the multi handle yet). */
+
+    GSList *contentstore_handles; /*!<
+        Handles (LrHandle *) whose content store (LRO_CONTENTSTORE)
+        got new files during the download. */
+
 } LrDownload;
 
 /** Schema of structures as used in downloader module:
@@ -237,7 +628,7 @@ typedef struct {
  *       | LrMirror *mirror          -------/      | LrChecksumType checks..  |
  *       | CURL *curl_handle          |-+          | char *checksum           |
  *       | FILE *f                    |            | int resume               |
- *       | GSList *tried_mirrors      |            | LrProgressCb progresscb  |
+ *       | guint8 *tried_mirrors      |            | LrProgressCb progresscb  |
  *       | gint64 original_offset     |            | void *cbdata             |
  *       | GSlist *lrmirrors         ---\          | GStringChunk *chunk      |
  *       +----------------------------+  |         | int rcode                |
@@ -263,11 +654,13 @@ lr_prepare_lrmirrors(GSList *list, LrTarget *target)
         if (handle_mirrors->handle == handle) {
             // List of LrMirrors for this handle is already created
             target->lrmirrors = handle_mirrors->lrmirrors;
+            target->handle_mirrors = handle_mirrors;
             return list;
         }
     }
 
     GSList *lrmirrors = NULL;
+    guint lrmirrors_count = 0;
 
     if (handle && handle->internal_mirrorlist) {
         g_debug("%s: Preparing internal mirror list for handle id: %p", __func__, handle);
@@ -287,21 +680,97 @@ lr_prepare_lrmirrors(GSList *list, LrTarget *target)
 
             LrMirror *mirror = lr_malloc0(sizeof(*mirror));
             mirror->mirror = imirror;
-            lrmirrors = g_slist_append(lrmirrors, mirror);
+            mirror->index = lrmirrors_count++;
+            mirror->ttfb = -1.0;
+            lrmirrors = g_slist_prepend(lrmirrors, mirror);
         }
+        lrmirrors = g_slist_reverse(lrmirrors);
     }
 
     LrHandleMirrors *handle_mirrors = lr_malloc0(sizeof(*handle_mirrors));
     handle_mirrors->handle = handle;
     handle_mirrors->lrmirrors = lrmirrors;
+    handle_mirrors->lrmirrors_count = lrmirrors_count;
+    g_queue_init(&handle_mirrors->waiting_targets);
 
     target->lrmirrors = lrmirrors;
+    target->handle_mirrors = handle_mirrors;
     list = g_slist_append(list, handle_mirrors);
 
     return list;
 }
 
 
+/** Check if the target is downloaded from mirrors of its handle
+ * (a base URL nor a complete URL is used).
+ */
+static gboolean
+target_uses_mirrors(LrTarget *target)
+{
+    return target->lrmirrors
+           && !target->target->baseurl
+           && !strstr(target->target->path, "://");
+}
+
+
+/** Return queue of waiting targets which the target belongs to.
+ */
+static GQueue *
+waiting_targets_queue(LrDownload *dd, LrTarget *target)
+{
+    if (target_uses_mirrors(target))
+        return &target->handle_mirrors->waiting_targets;
+    return &dd->waiting_targets;
+}
+
+
+/** Set the target as waiting and add it to the queue of waiting targets.
+ * @param head      If TRUE, the target is added to the head of the queue
+ *                  and it will be processed before the others (e.g. if
+ *                  a download of the target is retried).
+ */
+static void
+set_target_waiting(LrDownload *dd, LrTarget *target, gboolean head)
+{
+    GQueue *queue = waiting_targets_queue(dd, target);
+
+    target->state = LR_DS_WAITING;
+    if (head)
+        g_queue_push_head(queue, target);
+    else
+        g_queue_push_tail(queue, target);
+}
+
+
+/** Check if the mirror was already tried by the target.
+ */
+static gboolean
+mirror_was_tried(LrTarget *target, LrMirror *mirror)
+{
+    if (!target->tried_mirrors)
+        return FALSE;
+    return target->tried_mirrors[mirror->index / 8] & (1 << (mirror->index % 8));
+}
+
+
+/** Mark the mirror (could be NULL if mirror was not used)
+ * as tried by the target.
+ */
+static void
+set_mirror_tried(LrTarget *target, LrMirror *mirror)
+{
+    target->tried_mirrors_count++;
+
+    if (!mirror)
+        return;
+
+    if (!target->tried_mirrors)
+        target->tried_mirrors = lr_malloc0(
+                (target->handle_mirrors->lrmirrors_count + 7) / 8);
+    target->tried_mirrors[mirror->index / 8] |= 1 << (mirror->index % 8);
+}
+
+
 /** Progress callback for CURL handles.
  * progress callback set by the user of librepo.
  */
@@ -323,6 +792,20 @@ lr_progresscb(void *ptr,
     if (!target->target->progresscb)
         return ret;
 
+    if (target->local_copy) {
+        // The file is copied by start_local_copy()
+        total_to_download = (double) target->local_copy_size;
+        now_downloaded = total_to_download;
+    } else if (target->parent) {
+        // Segment of a file - report progress of the whole file
+        total_to_download = (double) target->target->expectedsize;
+        now_downloaded = 0.0;
+        for (GSList *elem = target->parent->segments; elem; elem = g_slist_next(elem)) {
+            LrTarget *segment = elem->data;
+            now_downloaded += (double) (segment->segment_pos - segment->segment_start);
+        }
+    }
+
     ret = target->target->progresscb(target->target->cbdata,
                                      total_to_download,
                                      now_downloaded);
@@ -335,11 +818,267 @@ lr_progresscb(void *ptr,
 #define STRLEN(s) (sizeof(s)/sizeof(s[0]) - 1)
 
 
+/** Free incremental checksum contexts of the target.
+ */
+static void
+checksum_ctxs_free(LrTarget *target)
+{
+    g_slist_free_full(target->checksum_ctxs,
+                      (GDestroyNotify) lr_checksumctx_free);
+    target->checksum_ctxs = NULL;
+    target->checksummed_bytes = 0;
+}
+
+
+/** Prepare incremental checksum contexts for the current transfer.
+ * Content of the file that precedes the offset where the download starts
+ * (e.g. already downloaded part of a resumed download) is hashed now,
+ * everything else will be hashed by lr_writecb().
+ * If something goes wrong, contexts are not used and the checksum
+ * is calculated from the file once the transfer is finished.
+ */
+static void
+prepare_checksum_ctxs(LrTarget *target, int fd, gint64 offset)
+{
+    GError *tmp_err = NULL;
+
+    checksum_ctxs_free(target);
+
+    if (offset < 0) {
+        g_debug("%s: Unknown offset, incremental checksum is not used",
+                __func__);
+        return;
+    }
+
+    for (GSList *elem = target->target->checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        gboolean exists = FALSE;
+
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        // Only one context per checksum type is needed
+        for (GSList *el = target->checksum_ctxs; el; el = g_slist_next(el))
+            if (lr_checksumctx_type(el->data) == chksum->type)
+                exists = TRUE;
+        if (exists)
+            continue;
+
+        LrChecksumCtx *ctx = lr_checksumctx_new(chksum->type, &tmp_err);
+        if (!ctx)
+            goto fail;
+        target->checksum_ctxs = g_slist_append(target->checksum_ctxs, ctx);
+    }
+
+    if (!target->checksum_ctxs)
+        return;  // No checksums to calculate
+
+    if (offset > 0) {
+        g_debug("%s: Calculating checksum of the first %"G_GINT64_FORMAT
+                " bytes of %s", __func__, offset, target->target->path);
+        if (!lr_checksumctx_list_update_fd(target->checksum_ctxs, fd,
+                                           offset, &tmp_err))
+            goto fail;
+    }
+
+    target->checksummed_bytes = offset;
+    return;
+
+fail:
+    g_debug("%s: Incremental checksum is not used: %s",
+            __func__, tmp_err->message);
+    g_error_free(tmp_err);
+    checksum_ctxs_free(target);
+}
+
+
+/** Free the decompressor of the target and its checksum contexts.
+ */
+static void
+decompressor_free(LrTarget *target)
+{
+    lr_decompressor_free(target->decompressor);
+    target->decompressor = NULL;
+    g_slist_free_full(target->checksum_open_ctxs,
+                      (GDestroyNotify) lr_checksumctx_free);
+    target->checksum_open_ctxs = NULL;
+}
+
+
+/** Start decompression of the file of the target from its beginning.
+ * The file for the decompressed data is truncated and checksum contexts
+ * for checksums_open are prepared.
+ */
+static gboolean
+decompressor_start(LrTarget *target, GError **err)
+{
+    LrDownloadTarget *dtarget = target->target;
+    int fd = dtarget->decompressfd;
+
+    assert(!err || *err == NULL);
+
+    decompressor_free(target);
+
+    if (fd != -1 && (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot truncate the file for decompressed data: %s",
+                    strerror(errno));
+        return FALSE;
+    }
+
+    for (GSList *elem = dtarget->checksums_open; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        gboolean exists = FALSE;
+
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        // Only one context per checksum type is needed
+        for (GSList *el = target->checksum_open_ctxs; el; el = g_slist_next(el))
+            if (lr_checksumctx_type(el->data) == chksum->type)
+                exists = TRUE;
+        if (exists)
+            continue;
+
+        LrChecksumCtx *ctx = lr_checksumctx_new(chksum->type, err);
+        if (!ctx) {
+            decompressor_free(target);
+            return FALSE;
+        }
+        target->checksum_open_ctxs = g_slist_append(target->checksum_open_ctxs,
+                                                    ctx);
+    }
+
+    target->decompressor = lr_decompressor_new(
+                                    lr_compression_type(dtarget->path),
+                                    fd,
+                                    target->checksum_open_ctxs,
+                                    err);
+    if (!target->decompressor) {
+        decompressor_free(target);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/** Prepare decompression of the file for the current transfer.
+ * The data are decompressed by lr_writecb() as they come, which is
+ * possible only if the whole file is written from its beginning.
+ * Other files (and files whose decompression failed during the transfer)
+ * are decompressed once the transfer is finished.
+ */
+static void
+prepare_decompressor(LrTarget *target, gint64 offset)
+{
+    GError *tmp_err = NULL;
+
+    decompressor_free(target);
+
+    if (!target->target->decompress
+        || offset != 0
+        || target->target->byterangestart > 0
+        || target->target->byterangeend > 0)
+        return;
+
+    if (!decompressor_start(target, &tmp_err)) {
+        g_debug("%s: Decompression during the transfer is not used: %s",
+                __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+}
+
+
+/** Decompress data written to the file.
+ */
+static void
+update_decompressor(LrTarget *target, const char *ptr, size_t len)
+{
+    GError *tmp_err = NULL;
+
+    if (!target->decompressor)
+        return;
+
+    if (!lr_decompressor_write(target->decompressor, ptr, len, &tmp_err)) {
+        // The file will be decompressed once it's complete
+        g_debug("%s: Decompression during the transfer is not used: %s",
+                __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        decompressor_free(target);
+    }
+}
+
+
+/** Update incremental checksums with data written to the file.
+ */
+static void
+update_checksum_ctxs(LrTarget *target, const char *ptr, size_t len)
+{
+    GError *tmp_err = NULL;
+
+    if (!target->checksum_ctxs)
+        return;
+
+    for (GSList *elem = target->checksum_ctxs; elem; elem = g_slist_next(elem)) {
+        if (!lr_checksumctx_update(elem->data, ptr, len, &tmp_err)) {
+            // Checksum will be calculated from the file later
+            g_debug("%s: Incremental checksum is not used: %s",
+                    __func__, tmp_err->message);
+            g_error_free(tmp_err);
+            checksum_ctxs_free(target);
+            return;
+        }
+    }
+
+    target->checksummed_bytes += len;
+}
+
+
+/** Remember validators (ETag and Last-Modified) from a header of
+ * the response to a conditional request. A status line starts headers
+ * of a new response (e.g. after a redirect), so the validators of
+ * the previous one are forgotten.
+ */
+static void
+lr_headercb_validators(LrTarget *target, const char *header, size_t len)
+{
+    gchar **validator = NULL;
+    size_t name_len = 0;
+
+    if (len >= STRLEN("HTTP/")
+        && !g_ascii_strncasecmp(header, "HTTP/", STRLEN("HTTP/"))) {
+        g_free(target->etag);
+        target->etag = NULL;
+        g_free(target->lastmodified);
+        target->lastmodified = NULL;
+        return;
+    }
+
+    if (len > STRLEN("ETag:")
+        && !g_ascii_strncasecmp(header, "ETag:", STRLEN("ETag:"))) {
+        validator = &target->etag;
+        name_len = STRLEN("ETag:");
+    } else if (len > STRLEN("Last-Modified:")
+        && !g_ascii_strncasecmp(header, "Last-Modified:",
+                                STRLEN("Last-Modified:"))) {
+        validator = &target->lastmodified;
+        name_len = STRLEN("Last-Modified:");
+    } else {
+        return;
+    }
+
+    g_free(*validator);
+    *validator = g_strstrip(g_strndup(header + name_len, len - name_len));
+}
+
 /** Header callback for CURL handles.
  * It parses HTTP and FTP headers and try to find length of the content
  * (file size of the target). If the size is different then the expected
  * size, then the transfer is interrupted.
- * This callback is used only if the expected size is specified.
+ * Validators from HTTP headers of conditional targets are remembered.
+ * This callback is used only if the expected size is specified or
+ * the target is conditional.
  */
 static size_t
 lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
@@ -350,7 +1089,12 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
     LrTarget *lrtarget = userdata;
     LrHeaderCbState state = lrtarget->headercb_state;
 
-    if (state == LR_HCS_DONE || state == LR_HCS_INTERRUPTED) {
+    if (lrtarget->target->conditional
+        && lrtarget->protocol == LR_PROTOCOL_HTTP)
+        lr_headercb_validators(lrtarget, ptr, ret);
+
+    if (state == LR_HCS_DONE || state == LR_HCS_INTERRUPTED
+        || lrtarget->target->expectedsize <= 0) {
         // Nothing to do
         return ret;
     }
@@ -448,10 +1192,26 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
     gint64 range_start = target->target->byterangestart;
     gint64 range_end = target->target->byterangeend;
 
+    if (target->rate_limited) {
+        if (target->tokens <= 0) {
+            // Data will be passed again when the transfer is resumed
+            target->paused = TRUE;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        target->tokens -= all;
+    }
+
+    target->handle_mirrors->bytes_received += all;
+    if (target->mirror)
+        target->mirror->bytes_received += all;
+
     if (range_start <= 0 && range_end <= 0) {
         // Write everything curl give to you
         target->writecb_recieved += all;
-        return fwrite(ptr, size, nmemb, target->f);
+        cur_written = fwrite(ptr, size, nmemb, target->f);
+        update_checksum_ctxs(target, ptr, cur_written * size);
+        update_decompressor(target, ptr, cur_written * size);
+        return cur_written;
     }
 
     /* Deal with situation when user wants only specific byte range of the
@@ -523,43 +1283,738 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
         return 0; // There was an error
     }
 
+    update_checksum_ctxs(target, ptr, cur_written);
+
     return cur_written_expected;
 }
 
-/** Select a suitable mirror
+/** Write callback for CURL handles of segments.
+ * Data of the segment are written directly at their offset to the file
+ * of the whole target. If the end of the segment is reached (the end
+ * could be lowered when the rest of the segment was taken by another
+ * segment), the transfer is interrupted.
  */
-static gboolean
-select_suitable_mirror(LrDownload *dd,
-                       LrTarget *target,
-                       LrMirror **selected_mirror,
-                       GError **err)
+static size_t
+lr_segment_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
+    LrTarget *target = (LrTarget *) userdata;
+    size_t all = size * nmemb;  // Total number of bytes from curl
+    size_t len = all;
+    int fd = fileno(target->parent->f);
+
+    if (target->rate_limited) {
+        if (target->tokens <= 0) {
+            // Data will be passed again when the transfer is resumed
+            target->paused = TRUE;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        target->tokens -= all;
+    }
 
-    gboolean at_least_one_suitable_mirror_found = FALSE;
-    //  ^^^ This variable is used to indentify that all possible mirrors
-    // were already tried and the transfer shoud be marked as failed.
+    target->handle_mirrors->bytes_received += all;
+    if (target->mirror)
+        target->mirror->bytes_received += all;
+
+    if (target->protocol == LR_PROTOCOL_HTTP) {
+        long code = 0;
+        curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+        if (code/100 != 2) {
+            // An error page - status code is checked when the transfer
+            // is finished
+            return all;
+        }
+        if (code != 206) {
+            // Server ignored the byte range and sends the whole file
+            target->headercb_state = LR_HCS_INTERRUPTED;
+            g_free(target->headercb_interrupt_reason);
+            target->headercb_interrupt_reason = g_strdup_printf(
+                "Server doesn't support byte ranges (status code: %ld)", code);
+            return 0;
+        }
+    }
 
-    assert(dd);
-    assert(target);
-    assert(selected_mirror);
-    assert(!err || *err == NULL);
+    target->writecb_recieved += all;
 
-    *selected_mirror = NULL;
+    if (target->segment_pos > target->segment_end) {
+        // The segment is complete
+        target->writecb_required_range_written = TRUE;
+        return 0;
+    }
 
-    // Iterate over mirror for the target
-    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
-        LrMirror *c_mirror = elem->data;
-        gchar *mirrorurl = c_mirror->mirror->url; // shortcut
+    if ((gint64) len > target->segment_end - target->segment_pos + 1)
+        len = target->segment_end - target->segment_pos + 1;
 
-        if (g_slist_find(target->tried_mirrors, c_mirror)) {
-            // This mirror was already tried for this target
-            continue;
+    for (size_t written = 0; written < len;) {
+        ssize_t rc = pwrite(fd, ptr + written, len - written,
+                            target->segment_pos);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            g_debug("%s: Error while writting out file: %s",
+                    __func__, strerror(errno));
+            return 0; // There was an error
         }
+        written += rc;
+        target->segment_pos += rc;
+    }
 
-        if (c_mirror->mirror->protocol == LR_PROTOCOL_RSYNC) {
-            // Skip rsync mirrors
-            g_debug("%s: Skipping rsync url: %s", __func__, mirrorurl);
-            continue;
+    if (len < all) {
+        // The rest of the data belongs to another segment
+        target->writecb_required_range_written = TRUE;
+        return 0;
+    }
+
+    return all;
+}
+
+/** Truncate file - Used to remove downloaded garbage (error html pages, etc.)
+ */
+static gboolean
+truncate_transfer_file(LrTarget *target, GError **err)
+{
+    off_t original_offset = 0;  // Truncate whole file by default
+    int rc;
+
+    assert(!err || *err == NULL);
+
+    if (target->original_offset > -1)
+        // If resume is enabled -> truncate file to its original position
+        original_offset = target->original_offset;
+
+    if (target->target->fn)  // Truncate by filename
+        rc = truncate(target->target->fn, original_offset);
+    else  // Truncate by file descriptor number
+        rc = ftruncate(target->target->fd, original_offset);
+
+    if (rc == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "ftruncate() failed: %s", strerror(errno));
+        return FALSE;
+    }
+
+    if (!target->target->fn) {
+        // In case fd is used, seek to the original offset
+        if (lseek(target->target->fd, original_offset, SEEK_SET) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "lseek() failed: %s", strerror(errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/** Copy the local file in a thread, the downloading loop is not blocked
+ * by a long copy. The loop is woken up when the copy is finished.
+ */
+static gpointer
+local_copy_worker(gpointer data)
+{
+    LrLocalCopy *copy = data;
+    char value = 1;
+
+    copy->copied = lr_copy_content(copy->src, copy->dst) == 0;
+    if (!copy->copied)
+        copy->errsv = errno;
+
+    g_atomic_int_set(&copy->done, 1);
+
+    // The pipe is non-blocking, a full pipe wakes up the loop anyway
+    if (write(copy->wakeup_fd, &value, sizeof(value)) == -1)
+        return NULL;
+
+    return NULL;
+}
+
+/** Wait for the copy of the local file of the target and free it.
+ * @return          TRUE if the file was copied.
+ */
+static gboolean
+finish_local_copy(LrDownload *dd, LrTarget *target)
+{
+    LrLocalCopy *copy = target->copy;
+    gboolean copied;
+
+    g_thread_join(copy->thread);
+    close(copy->src);
+    copied = copy->copied;
+    if (!copied)
+        g_debug("%s: Cannot copy the local file of %s: %s",
+                __func__, target->target->path, strerror(copy->errsv));
+
+    lr_free(copy);
+    target->copy = NULL;
+    dd->local_copies--;
+    return copied;
+}
+
+/** Remove the curl easy handle of the target from the multi handle and
+ * return it to the pool of its handle for the next transfer.
+ */
+static void
+release_easy_handle(LrDownload *dd, LrTarget *target)
+{
+    CURL *h = target->curl_handle;
+
+    // The copy writes into the file of the target
+    if (target->copy)
+        finish_local_copy(dd, target);
+
+    curl_multi_remove_handle(dd->multi_handle, h);
+    target->curl_handle = NULL;
+
+    if (target->paused) {
+        // The next transfer would start paused
+        curl_easy_cleanup(h);
+        return;
+    }
+
+    target->handle_mirrors->easy_handles = g_slist_prepend(
+                                    target->handle_mirrors->easy_handles, h);
+}
+
+/** Free the headers and validators of the last conditional request
+ * of the target.
+ */
+static void
+conditional_free(LrTarget *target)
+{
+    curl_slist_free_all(target->curl_httpheader);
+    target->curl_httpheader = NULL;
+    g_free(target->etag);
+    target->etag = NULL;
+    g_free(target->lastmodified);
+    target->lastmodified = NULL;
+}
+
+/** Stop the running transfer of the target. The state of the target
+ * is not changed.
+ */
+static void
+stop_transfer(LrDownload *dd, LrTarget *target)
+{
+    assert(target->curl_handle);
+
+    release_easy_handle(dd, target);
+    g_free(target->headercb_interrupt_reason);
+    target->headercb_interrupt_reason = NULL;
+    if (target->f) {  // Segments don't have their own file
+        fclose(target->f);
+        target->f = NULL;
+    }
+    checksum_ctxs_free(target);
+    decompressor_free(target);
+    dd->running_transfers = g_slist_remove(dd->running_transfers,
+                                           (gconstpointer) target);
+    if (target->mirror)
+        target->mirror->running_transfers--;
+    if (target->primary)
+        dd->hedge_bytes += target->writecb_recieved;
+}
+
+
+/** Stop the hedge of the target (if any) and remove its file.
+ */
+static void
+abort_hedge(LrDownload *dd, LrTarget *target)
+{
+    LrTarget *hedge = target->hedge;
+
+    if (!hedge)
+        return;
+
+    g_debug("%s: Stopping hedge of %s", __func__, target->target->path);
+
+    if (hedge->state == LR_DS_RUNNING)
+        stop_transfer(dd, hedge);
+    else if (hedge->state == LR_DS_WAITING)
+        g_queue_remove(waiting_targets_queue(dd, hedge), hedge);
+
+    hedge->state = LR_DS_FAILED;
+    target->hedge = NULL;
+
+    if (unlink(hedge->hedge_fn) != 0 && errno != ENOENT)
+        g_debug("%s: Error while removing %s: %s",
+                __func__, hedge->hedge_fn, strerror(errno));
+    g_free(hedge->hedge_fn);
+    hedge->hedge_fn = NULL;
+}
+
+
+/** Add file descriptors of all cancel tokens and of the wakeup pipe
+ * to the set, so that a cancellation or a finished copy of a local file
+ * wakes up select() immediately.
+ */
+static void
+wakeup_fdset(LrDownload *dd, fd_set *fdread, int *maxfd)
+{
+    for (GSList *elem = dd->cancel_tokens; elem; elem = g_slist_next(elem)) {
+        int cancel_fd = lr_cancel_token_get_fd(elem->data);
+        FD_SET(cancel_fd, fdread);
+        *maxfd = MAX(*maxfd, cancel_fd);
+    }
+
+    if (dd->wakeup_fds[0] != -1) {
+        FD_SET(dd->wakeup_fds[0], fdread);
+        *maxfd = MAX(*maxfd, dd->wakeup_fds[0]);
+    }
+}
+
+/** Check if the file descriptor belongs to a cancel token.
+ */
+static gboolean
+is_cancel_token_fd(LrDownload *dd, int fd)
+{
+    for (GSList *elem = dd->cancel_tokens; elem; elem = g_slist_next(elem))
+        if (lr_cancel_token_get_fd(elem->data) == fd)
+            return TRUE;
+    return FALSE;
+}
+
+/** Stop watching the cancel token, its handles don't have any running
+ * or waiting target anymore.
+ */
+static void
+forget_cancel_token(LrDownload *dd, LrCancelToken *token)
+{
+#ifdef LR_HAVE_EPOLL
+    if (dd->epoll_fd != -1)
+        epoll_ctl(dd->epoll_fd, EPOLL_CTL_DEL,
+                  lr_cancel_token_get_fd(token), NULL);
+#endif
+    dd->cancel_tokens = g_slist_remove(dd->cancel_tokens, token);
+}
+
+/** Check if the downloading of targets of the handle was cancelled by
+ * the cancel token of the handle or interrupted by SIGINT (if sigint
+ * is TRUE and the handle is interruptible).
+ */
+static gboolean
+handle_interrupted(LrHandle *handle, gboolean sigint, GError **err)
+{
+    if (!handle)
+        return FALSE;
+
+    if (handle->cancel_token
+        && lr_cancel_token_is_cancelled(handle->cancel_token)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CANCELLED,
+                    "Downloading was cancelled");
+        return TRUE;
+    }
+
+    if (!sigint || !handle->interruptible)
+        return FALSE;
+
+    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                "Interrupted by signal");
+    return TRUE;
+}
+
+/** Queue the target (which is finished successfully or not) to be
+ * returned by lr_download_context_get_finished().
+ */
+static void
+target_done(LrDownload *dd, LrTarget *target)
+{
+    g_queue_push_tail(&dd->finished_targets, target->target);
+}
+
+/** Mark the target as failed and call its end callback.
+ * The transfer_err is consumed. If the whole downloading should be
+ * interrupted (fail fast is enabled or the end callback returned
+ * LR_CB_ERROR), the error is moved to fail_fast_error.
+ */
+static void
+target_failed(LrDownload *dd,
+              LrTarget *target,
+              GError *transfer_err,
+              GError **fail_fast_error)
+{
+    abort_hedge(dd, target);
+    target->state = LR_DS_FAILED;
+    target_done(dd, target);
+
+    // Call end callback
+    LrEndCb end_cb =  target->target->endcb;
+    if (end_cb) {
+        int rc = end_cb(target->target->cbdata,
+                        LR_TRANSFER_ERROR,
+                        transfer_err->message);
+        if (rc == LR_CB_ERROR) {
+            target->cb_return_code = LR_CB_ERROR;
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                    "from end callback", __func__);
+        }
+    }
+
+    lr_downloadtarget_set_error(target->target,
+                                transfer_err->code,
+                                "Download failed: %s",
+                                transfer_err->message);
+    if (dd->failfast) {
+        // Fail fast is enabled, fail on any error
+        g_propagate_error(fail_fast_error, transfer_err);
+    } else if (target->cb_return_code == LR_CB_ERROR) {
+        // Callback returned LR_CB_ERROR, abort the downloading
+        g_debug("%s: Downloading was aborted by LR_CB_ERROR", __func__);
+        g_propagate_error(fail_fast_error, transfer_err);
+    } else {
+        // Fail fast is disabled and callback doesn't repor serious
+        // error, so this download is aborted, but other download
+        // can continue (do not abort whole downloading)
+        g_error_free(transfer_err);
+    }
+}
+
+
+/** Check if the target could be downloaded by segments.
+ */
+static gboolean
+target_can_be_segmented(LrDownload *dd, LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (dd->max_segments < 2
+        || target->parent
+        || target->storedpath
+        || target->segmentation_disabled)
+        return FALSE;
+
+    if (dtarget->expectedsize < 2 * LR_SEGMENT_MINSIZE)
+        return FALSE;  // Unknown size or too small file
+
+    if (target->resume
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0)
+        return FALSE;
+
+    // Segments are downloaded from different mirrors
+    if (dtarget->baseurl
+        || !target->lrmirrors
+        || strstr(dtarget->path, "://"))
+        return FALSE;
+
+    // Segments are written at absolute offsets, supplied file descriptor
+    // must point at the beginning of the file
+    if (dtarget->fd != -1 && lseek(dtarget->fd, 0, SEEK_CUR) != 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+
+/** Create a new segment of the target. The segment is added to
+ * the head of the queue of waiting targets and to the head of the list
+ * of segments of the target.
+ */
+static LrTarget *
+segment_new(LrDownload *dd, LrTarget *target, gint64 start, gint64 end)
+{
+    LrTarget *segment = lr_malloc0(sizeof(*segment));
+    segment->target          = target->target;
+    segment->original_offset = -1;
+    segment->resume          = FALSE;
+    segment->lrmirrors       = target->lrmirrors;
+    segment->handle          = target->handle;
+    segment->handle_mirrors  = target->handle_mirrors;
+    segment->parent          = target;
+    segment->segment_start   = start;
+    segment->segment_end     = end;
+    segment->segment_pos     = start;
+
+    dd->targets = g_slist_prepend(dd->targets, segment);
+    target->segments = g_slist_prepend(target->segments, segment);
+    set_target_waiting(dd, segment, TRUE);
+
+    return segment;
+}
+
+
+/** Open and preallocate the file of the target and split the target
+ * into segments. The segments are appended to the list of targets
+ * as waiting targets, the target itself is running until all its
+ * segments are finished.
+ */
+static gboolean
+prepare_segments(LrDownload *dd, LrTarget *target, GError **err)
+{
+    int fd;
+    int rc;
+    gint64 size = target->target->expectedsize;
+    gint64 count = MIN(dd->max_segments, size / LR_SEGMENT_MINSIZE);
+    gint64 segment_size = size / count;
+
+    assert(!err || *err == NULL);
+    assert(count > 1);
+
+    if (target->target->fd != -1) {
+        // Use supplied filedescriptor
+        fd = dup(target->target->fd);
+        if (fd == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "dup(%d) failed: %s",
+                        target->target->fd, strerror(errno));
+            return FALSE;
+        }
+
+        if (ftruncate(fd, 0) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "ftruncate() failed: %s", strerror(errno));
+            close(fd);
+            return FALSE;
+        }
+    } else {
+        // Use supplied filename
+        fd = open(target->target->fn, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (fd < 0) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot open %s: %s",
+                        target->target->fn, strerror(errno));
+            return FALSE;
+        }
+    }
+
+    // Preallocate the file, segments are written at their offsets
+    rc = posix_fallocate(fd, 0, (off_t) size);
+    if (rc != 0) {
+        g_debug("%s: posix_fallocate() failed: %s", __func__, strerror(rc));
+        if (ftruncate(fd, (off_t) size) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "ftruncate() failed: %s", strerror(errno));
+            close(fd);
+            return FALSE;
+        }
+    }
+
+    FILE *f = fdopen(fd, "w+b");
+    if (!f) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "fdopen(%d) failed: %s",
+                    fd, strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    target->f = f;
+
+    g_debug("%s: Downloading %s (%"G_GINT64_FORMAT" bytes) "
+            "in %"G_GINT64_FORMAT" segments",
+            __func__, target->target->path, size, count);
+
+    // Segments are created from the last one, because each of them
+    // is added to the head of the queue of waiting targets
+    for (gint64 x = count - 1; x >= 0; x--) {
+        gint64 start = x * segment_size;
+        gint64 end = (x == count - 1) ? size - 1 : start + segment_size - 1;
+        segment_new(dd, target, start, end);
+    }
+
+    target->state = LR_DS_RUNNING;
+
+    return TRUE;
+}
+
+
+/** Stop all transfers of segments of the target.
+ */
+static void
+abort_segments(LrDownload *dd, LrTarget *target)
+{
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem)) {
+        LrTarget *segment = elem->data;
+
+        if (segment->state == LR_DS_RUNNING) {
+            stop_transfer(dd, segment);
+        } else if (segment->state == LR_DS_WAITING) {
+            // Segments are near the head of the queue
+            g_queue_remove(waiting_targets_queue(dd, segment), segment);
+        }
+
+        segment->state = LR_DS_FAILED;
+    }
+
+    g_slist_free(target->segments);
+    target->segments = NULL;
+}
+
+
+/** Handle a segment that cannot be downloaded.
+ * Other segments of the file are stopped. If the error is not fatal,
+ * the file is downloaded again as a whole (e.g. mirrors could
+ * not support byte ranges), otherwise the whole target fails.
+ * The transfer_err is consumed.
+ */
+static gboolean
+segment_failed(LrDownload *dd,
+               LrTarget *segment,
+               GError *transfer_err,
+               gboolean fatal_error,
+               GError **fail_fast_error,
+               GError **err)
+{
+    LrTarget *target = segment->parent;
+
+    assert(!err || *err == NULL);
+
+    g_debug("%s: Segment %"G_GINT64_FORMAT"-%"G_GINT64_FORMAT" of %s "
+            "failed: %s", __func__, segment->segment_start,
+            segment->segment_end, target->target->path,
+            transfer_err->message);
+
+    segment->state = LR_DS_FAILED;
+    abort_segments(dd, target);
+    fclose(target->f);
+    target->f = NULL;
+
+    if (segment->cb_return_code == LR_CB_ERROR)
+        target->cb_return_code = LR_CB_ERROR;
+
+    if (fatal_error) {
+        target_failed(dd, target, transfer_err, fail_fast_error);
+        return TRUE;
+    }
+
+    g_debug("%s: Segmented download disabled for %s",
+            __func__, target->target->path);
+    g_error_free(transfer_err);
+    target->segmentation_disabled = TRUE;
+    set_target_waiting(dd, target, TRUE);
+
+    // Remove the preallocated file content
+    return truncate_transfer_file(target, err);
+}
+
+
+/** Check if the mirror is used by another running segment of the same file.
+ */
+static gboolean
+mirror_used_by_segments(LrTarget *segment, LrMirror *mirror)
+{
+    for (GSList *elem = segment->parent->segments; elem; elem = g_slist_next(elem)) {
+        LrTarget *sibling = elem->data;
+        if (sibling->state == LR_DS_RUNNING && sibling->mirror == mirror)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/** Return upper bound of the concurrency window of a mirror.
+ * It is the LRO_MAXDOWNLOADSPERMIRROR or the maximal number of
+ * parallel connections (or its hard cap if the number is autotuned)
+ * if the number of connections per mirror is not limited or if
+ * the transfers are multiplexed (LRO_MAXDOWNLOADSPERMIRROR limits
+ * the connections to the mirror then, not the streams over them).
+ */
+static int
+mirror_window_limit(LrDownload *dd)
+{
+    if (dd->max_connection_per_host != -1 && !dd->multiplex)
+        return dd->max_connection_per_host;
+    if (dd->autotune_limit)
+        return dd->autotune_limit;
+    return dd->max_parallel_connections;
+}
+
+/** Return how many transfers could run from the mirror at once.
+ */
+static int
+mirror_window(LrDownload *dd, LrMirror *mirror)
+{
+    return MIN((int) mirror->window, mirror_window_limit(dd));
+}
+
+/** Return number of bytes that remain to be downloaded for the target
+ * or its estimate if the size is not known.
+ */
+static gint64
+target_remaining_size(LrTarget *target)
+{
+    if (target->parent)
+        return target->segment_end - target->segment_pos + 1;
+    if (target->target->expectedsize > 0)
+        return target->target->expectedsize;
+    return LR_MIRROR_DEFAULT_SIZE;
+}
+
+
+/** Return expected time (in seconds) of a download of size bytes from
+ * the mirror.
+ * A mirror without measured statistics gets the average values of the
+ * mirrors of its handle, so it is neither preferred nor avoided and
+ * the order from the mirrorlist decides.
+ */
+static gdouble
+mirror_expected_time(LrHandleMirrors *handle_mirrors,
+                     LrMirror *mirror,
+                     gint64 size)
+{
+    gdouble throughput = mirror->throughput;
+    gdouble ttfb = mirror->ttfb;
+    gdouble time = 0.0;
+
+    if (throughput <= 0.0 && handle_mirrors->throughput_count)
+        throughput = handle_mirrors->throughput_sum
+                     / handle_mirrors->throughput_count;
+    if (ttfb < 0.0 && handle_mirrors->ttfb_count)
+        ttfb = handle_mirrors->ttfb_sum / handle_mirrors->ttfb_count;
+
+    if (ttfb > 0.0)
+        time += ttfb;
+
+    // Bandwidth of the mirror is shared by all its running transfers
+    if (throughput > 0.0)
+        time += size * (mirror->running_transfers + 1) / throughput;
+
+    if (time <= 0.0)
+        time = 1.0;  // Nothing measured yet - only the error rate matters
+
+    // Each failure means a retry from another mirror
+    return time / (1.0 - MIN(mirror->error_rate, LR_MIRROR_MAX_ERROR_RATE));
+}
+
+
+/** Select a suitable mirror.
+ * If adaptive mirror sorting is enabled, the mirror with the shortest
+ * expected download time of the target is selected, otherwise the first
+ * usable mirror from the list is selected.
+ */
+static gboolean
+select_suitable_mirror(LrDownload *dd,
+                       LrTarget *target,
+                       LrMirror **selected_mirror,
+                       GError **err)
+{
+
+    gboolean at_least_one_suitable_mirror_found = FALSE;
+    //  ^^^ This variable is used to indentify that all possible mirrors
+    // were already tried and the transfer shoud be marked as failed.
+    LrMirror *mirror_used_by_other_segment = NULL;
+    gdouble selected_time = 0.0;
+    gdouble other_segment_time = 0.0;
+    gint64 size = target_remaining_size(target);
+
+    assert(dd);
+    assert(target);
+    assert(selected_mirror);
+    assert(!err || *err == NULL);
+
+    *selected_mirror = NULL;
+
+    // Iterate over mirror for the target
+    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *c_mirror = elem->data;
+        gchar *mirrorurl = c_mirror->mirror->url; // shortcut
+
+        if (mirror_was_tried(target, c_mirror)) {
+            // This mirror was already tried for this target
+            continue;
+        }
+
+        if (c_mirror->mirror->protocol == LR_PROTOCOL_RSYNC) {
+            // Skip rsync mirrors
+            g_debug("%s: Skipping rsync url: %s", __func__, mirrorurl);
+            continue;
         }
 
         if (target->handle
@@ -586,26 +2041,87 @@ select_suitable_mirror(LrDownload *dd,
 
         // Number of transfers which are downloading from the mirror
         // should always be lower or equal than maximum allowed number
-        // of connection to a single host.
-        assert(dd->max_connection_per_host == -1 ||
-               c_mirror->running_transfers <= dd->max_connection_per_host);
+        // of transfers from a single mirror.
+        assert(c_mirror->running_transfers <= mirror_window_limit(dd));
 
         // Check number of connections to the mirror
-        if (dd->max_connection_per_host != -1 &&
-            c_mirror->running_transfers >= dd->max_connection_per_host)
-        {
+        if (c_mirror->running_transfers >= mirror_window(dd, c_mirror))
             continue;
+
+        if (!dd->adaptivemirrorsorting) {
+            // Segments of a file should be downloaded from different mirrors
+            if (target->parent && mirror_used_by_segments(target, c_mirror)) {
+                if (!mirror_used_by_other_segment)
+                    mirror_used_by_other_segment = c_mirror;
+                continue;
+            }
+
+            // This mirror looks suitable - use it
+            *selected_mirror = c_mirror;
+            return TRUE;
         }
 
-        // This mirror looks suitable - use it
-        *selected_mirror = c_mirror;
+        gdouble time = mirror_expected_time(target->handle_mirrors,
+                                            c_mirror,
+                                            size);
+
+        // Segments of a file should be downloaded from different mirrors
+        if (target->parent && mirror_used_by_segments(target, c_mirror)) {
+            if (!mirror_used_by_other_segment || time < other_segment_time) {
+                mirror_used_by_other_segment = c_mirror;
+                other_segment_time = time;
+            }
+            continue;
+        }
+
+        if (!*selected_mirror || time < selected_time) {
+            *selected_mirror = c_mirror;
+            selected_time = time;
+        }
+    }
+
+    if (*selected_mirror) {
+        if (g_getenv("LIBREPO_DEBUG_ADAPTIVEMIRRORSORTING"))
+            g_debug("%s: Selected mirror %s (expected time %.3f s)",
+                    __func__, (*selected_mirror)->mirror->url, selected_time);
+        return TRUE;
+    }
+
+    if (mirror_used_by_other_segment) {
+        // No better mirror is available
+        *selected_mirror = mirror_used_by_other_segment;
         return TRUE;
     }
 
     if (!at_least_one_suitable_mirror_found) {
         // No suitable mirror even exists => Set transfer as failed
         g_debug("%s: All mirrors were tried without success", __func__);
+
+        if (target->primary) {
+            // Hedge - the primary transfer continues
+            target->state = LR_DS_FAILED;
+            return TRUE;
+        }
+
+        if (target->hedge) {
+            // The file could be still downloaded by its hedge
+            g_debug("%s: Waiting for the hedge of %s",
+                    __func__, target->target->path);
+            target->state = LR_DS_RUNNING;
+            return TRUE;
+        }
+
+        if (target->parent) {
+            // Segment of a file - whole file is handled
+            GError *transfer_err = NULL;
+            g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_NOURL,
+                        "Cannot download, all mirrors were already tried "
+                        "without success");
+            return segment_failed(dd, target, transfer_err, FALSE, NULL, err);
+        }
+
         target->state = LR_DS_FAILED;
+        target_done(dd, target);
 
         lr_downloadtarget_set_error(target->target, LRE_NOURL,
                     "Cannot download, all mirrors were already tried "
@@ -642,15 +2158,18 @@ select_suitable_mirror(LrDownload *dd,
 }
 
 
-/** Select next target
+/** Select next target from the queue of waiting targets.
+ * The selected target is removed from the queue.
  */
 static gboolean
-select_next_target(LrDownload *dd,
-                   LrTarget **selected_target,
-                   char **selected_full_url,
-                   GError **err)
+select_next_target_from_queue(LrDownload *dd,
+                              GQueue *queue,
+                              LrTarget **selected_target,
+                              char **selected_full_url,
+                              GError **err)
 {
     assert(dd);
+    assert(queue);
     assert(selected_target);
     assert(selected_full_url);
     assert(!err || *err == NULL);
@@ -658,14 +2177,15 @@ select_next_target(LrDownload *dd,
     *selected_target = NULL;
     *selected_full_url = NULL;
 
-    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
-        LrTarget *target = elem->data;
+    GList *link = g_queue_peek_head_link(queue);
+    while (link) {
+        LrTarget *target = link->data;
+        GList *next = link->next;
         LrMirror *mirror = NULL;
         char *full_url = NULL;
         int complete_url_in_path = 0;
 
-        if (target->state != LR_DS_WAITING)  // Pick only waiting targets
-            continue;
+        assert(target->state == LR_DS_WAITING);
 
         // Determine if path is a complete URL
 
@@ -685,11 +2205,24 @@ select_next_target(LrDownload *dd,
             return FALSE;
         }
 
+        if (target_can_be_segmented(dd, target)) {
+            // Segments are added to the head of the queue and they
+            // will be picked up by this loop
+            g_queue_delete_link(queue, link);
+            if (!prepare_segments(dd, target, err))
+                return FALSE;
+            link = g_queue_peek_head_link(queue);
+            continue;
+        }
+
         g_debug("%s: Selecting mirror for: %s", __func__, target->target->path);
 
         // Prepare full target URL
 
-        if (complete_url_in_path) {
+        if (target->storedpath) {
+            // File is copied from the content store
+            full_url = g_strconcat("file://", target->storedpath, NULL);
+        } else if (complete_url_in_path) {
             // Path is a complete URL (do not use mirror nor base URL)
             full_url = g_strdup(target->target->path);
         } else if (target->target->baseurl) {
@@ -702,6 +2235,23 @@ select_next_target(LrDownload *dd,
             if (!select_suitable_mirror(dd, target, &mirror , err))
                 return FALSE;
 
+            if (target->state != LR_DS_WAITING) {
+                // All mirrors were tried without success
+                g_queue_delete_link(queue, link);
+
+                if (target->parent) {
+                    // Segmented download of the file failed and the file
+                    // will be downloaded as a whole. Other segments of
+                    // the file were removed from the queue and the file
+                    // was added to its head.
+                    link = g_queue_peek_head_link(queue);
+                    continue;
+                }
+
+                link = next;
+                continue;
+            }
+
             if (mirror) {
                 // A mirror was found
                 full_url = lr_pathconcat(mirror->mirror->url,
@@ -711,6 +2261,17 @@ select_next_target(LrDownload *dd,
                 // No free mirror
                 g_debug("%s: Currently there is no free mirror for: %s",
                         __func__, target->target->path);
+
+                if (!target->tried_mirrors) {
+                    // No mirror was tried by the target, so there is
+                    // no free mirror for the rest of the queue either
+                    // (only targets which already tried some mirrors
+                    // are queued before it).
+                    break;
+                }
+
+                link = next;
+                continue;
             }
         }
 
@@ -729,6 +2290,7 @@ select_next_target(LrDownload *dd,
 
             // Mark the target as failed
             target->state = LR_DS_FAILED;
+            target_done(dd, target);
             lr_downloadtarget_set_error(target->target, LRE_NOURL,
                     "Cannot download, offline mode is specified and no "
                     "local URL is available");
@@ -758,16 +2320,22 @@ select_next_target(LrDownload *dd,
                             target->target->path);
                 return FALSE;
             }
+
+            lr_free(full_url);
+            g_queue_delete_link(queue, link);
+            link = next;
+            continue;
         }
 
-        if (full_url) {  // A waiting target found
-            target->mirror = mirror;  // Note: mirror is NULL if baseurl is used
+        // A waiting target found
+        assert(full_url);
+        g_queue_delete_link(queue, link);
+        target->mirror = mirror;  // Note: mirror is NULL if baseurl is used
 
-            *selected_target = target;
-            *selected_full_url = full_url;
+        *selected_target = target;
+        *selected_full_url = full_url;
 
-            return TRUE;
-        }
+        return TRUE;
     }
 
     // No suitable target found
@@ -775,6 +2343,41 @@ select_next_target(LrDownload *dd,
 }
 
 
+/** Select next target.
+ * Targets that don't use mirrors are preferred, then targets of
+ * particular handles are tried.
+ */
+static gboolean
+select_next_target(LrDownload *dd,
+                   LrTarget **selected_target,
+                   char **selected_full_url,
+                   GError **err)
+{
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    if (!select_next_target_from_queue(dd, &dd->waiting_targets,
+                                       selected_target, selected_full_url,
+                                       err))
+        return FALSE;
+
+    for (GSList *elem = dd->handle_mirrors;
+         elem && !*selected_target;
+         elem = g_slist_next(elem))
+    {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        if (!select_next_target_from_queue(dd,
+                                           &handle_mirrors->waiting_targets,
+                                           selected_target,
+                                           selected_full_url,
+                                           err))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
 #define XATTR_LIBREPO   "user.Librepo.DownloadInProgress"
 
 /** Add an extendend attribute that indiciates that
@@ -822,6 +2425,169 @@ remove_librepo_xattr(int fd)
 }
 
 
+/** Reset the options of an easy handle set by prepare_next_transfer()
+ * to the libcurl defaults, the handle is then the same as a new copy
+ * of the curl handle of the LrHandle (which sets none of them).
+ * curl_easy_reset() cannot be used, it would drop the options of
+ * the LrHandle too. Every option set per transfer must be reset here.
+ */
+static void
+reset_easy_handle(CURL *h)
+{
+    curl_easy_setopt(h, CURLOPT_URL, NULL);
+    curl_easy_setopt(h, CURLOPT_ERRORBUFFER, NULL);
+    curl_easy_setopt(h, CURLOPT_RANGE, NULL);
+    curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) 0);
+    curl_easy_setopt(h, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(h, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(h, CURLOPT_PROGRESSFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_PROGRESSDATA, NULL);
+    curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_HEADERDATA, NULL);
+    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_WRITEDATA, NULL);
+#if LR_CURL_VERSION_CHECK(7, 43, 0)
+#if LR_CURL_VERSION_CHECK(7, 47, 0)
+    curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_NONE);
+#endif
+    curl_easy_setopt(h, CURLOPT_PIPEWAIT, 0L);
+#endif
+    curl_easy_setopt(h, CURLOPT_HTTPHEADER, NULL);
+    curl_easy_setopt(h, CURLOPT_PRIVATE, NULL);
+}
+
+/** Return a curl easy handle for a transfer of the target.
+ * An idle handle from the pool of the target's handle is reused if
+ * there is one, its per transfer options are reset (see
+ * reset_easy_handle()) and the options of the LrHandle are kept.
+ * Otherwise a new easy handle is created as a copy of the curl handle
+ * of the LrHandle.
+ */
+static CURL *
+get_easy_handle(LrTarget *target)
+{
+    LrHandleMirrors *handle_mirrors = target->handle_mirrors;
+    CURL *h;
+
+    if (handle_mirrors->easy_handles) {
+        GSList *first = handle_mirrors->easy_handles;
+        h = first->data;
+        handle_mirrors->easy_handles = g_slist_delete_link(first, first);
+        reset_easy_handle(h);
+        return h;
+    }
+
+    if (target->handle)
+        h = curl_easy_duphandle(target->handle->curl_handle);
+    else
+        h = lr_get_curl_handle();
+    if (!h)
+        return NULL;
+
+    // The share is not copied by curl_easy_duphandle(). Use it to take
+    // connections from (and leave them in) the cache of the handle.
+    CURLSH *share = lr_handle_get_curl_share(target->handle);
+    if (share)
+        curl_easy_setopt(h, CURLOPT_SHARE, share);
+
+    return h;
+}
+
+/** Return the write end of the pipe which wakes up the waiting for
+ * the sockets (see LrDownload.wakeup_fds), create it if it doesn't
+ * exist yet.
+ * @return          File descriptor or -1 on error.
+ */
+static int
+wakeup_pipe(LrDownload *dd)
+{
+    if (dd->wakeup_fds[1] != -1)
+        return dd->wakeup_fds[1];
+
+    if (pipe(dd->wakeup_fds) == -1) {
+        g_debug("%s: pipe() failed: %s", __func__, strerror(errno));
+        dd->wakeup_fds[0] = dd->wakeup_fds[1] = -1;
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(dd->wakeup_fds[i], F_SETFL,
+              fcntl(dd->wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(dd->wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+#ifdef LR_HAVE_EPOLL
+    if (dd->epoll_fd != -1) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = dd->wakeup_fds[0];
+        if (epoll_ctl(dd->epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+            g_debug("%s: epoll_ctl() failed: %s", __func__, strerror(errno));
+            close(dd->wakeup_fds[0]);
+            close(dd->wakeup_fds[1]);
+            dd->wakeup_fds[0] = dd->wakeup_fds[1] = -1;
+            return -1;
+        }
+    }
+#endif
+
+    return dd->wakeup_fds[1];
+}
+
+/** Start copying the local file (path of a file:// URL) into the fd of
+ * the target in a thread. The data are not read by libcurl and written
+ * by lr_writecb() - if possible, they are shared by a reflink or copied
+ * by the kernel (see lr_copy_content()). The fd must point at
+ * the beginning of the file.
+ * @return          TRUE if the copy was started, FALSE if the file should
+ *                  be transferred by libcurl as usual (e.g. the file
+ *                  doesn't exist, libcurl then reports the error).
+ */
+static gboolean
+start_local_copy(LrDownload *dd, LrTarget *target, int fd, const char *path)
+{
+    LrLocalCopy *copy;
+    struct stat st;
+    int src, wakeup_fd;
+    GError *tmp_err = NULL;
+
+    if (!path || path[0] != '/')
+        return FALSE;  // E.g. file://host/path
+
+    src = open(path, O_RDONLY);
+    if (src == -1)
+        return FALSE;
+
+    if (fstat(src, &st) == -1 || !S_ISREG(st.st_mode)
+        || (wakeup_fd = wakeup_pipe(dd)) == -1)
+    {
+        close(src);
+        return FALSE;
+    }
+
+    copy = lr_malloc0(sizeof(*copy));
+    copy->src = src;
+    copy->dst = fd;
+    copy->wakeup_fd = wakeup_fd;
+    copy->thread = g_thread_try_new("librepo-copy", local_copy_worker,
+                                    copy, &tmp_err);
+    if (!copy->thread) {
+        g_debug("%s: Cannot start a thread: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        close(src);
+        lr_free(copy);
+        return FALSE;
+    }
+
+    g_debug("%s: Copying %s (%"G_GINT64_FORMAT" bytes)",
+            __func__, path, (gint64) st.st_size);
+    target->local_copy_size = st.st_size;
+    target->copy = copy;
+    dd->local_copies++;
+    return TRUE;
+}
+
 /** Prepares next transfer
  */
 static gboolean
@@ -829,6 +2595,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 {
     LrTarget *target;
     char *full_url = NULL;
+    _cleanup_free_ gchar *local_path = NULL;
     LrProtocol protocol = LR_PROTOCOL_OTHER;
     gboolean ret;
 
@@ -849,14 +2616,13 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     g_debug("%s: URL: %s", __func__, full_url);
 
     protocol = lr_detect_protocol(full_url);
+    if (protocol == LR_PROTOCOL_FILE)
+        local_path = g_uri_unescape_string(full_url + STRLEN("file://"), NULL);
 
     // Prepare CURL easy handle
+    // Every option set below must be reset by reset_easy_handle()
     CURLcode c_rc;
-    CURL *h;
-    if (target->handle)
-        h = curl_easy_duphandle(target->handle->curl_handle);
-    else
-        h = lr_get_curl_handle();
+    CURL *h = get_easy_handle(target);
     if (!h) {
         // Something went wrong
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
@@ -889,8 +2655,32 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 
     lr_free(full_url);
 
+    if (target->parent) {
+        // Segment of a file - data are written to the file of the parent
+        _cleanup_free_ gchar *range = NULL;
+
+        range = g_strdup_printf("%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+                                target->segment_pos, target->segment_end);
+        g_debug("%s: Segment range: %s", __func__, range);
+
+        c_rc = curl_easy_setopt(h, CURLOPT_RANGE, range);
+        if (c_rc != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                        "curl_easy_setopt(h, CURLOPT_RANGE, %s) failed: %s",
+                        range, curl_easy_strerror(c_rc));
+            curl_easy_cleanup(h);
+            return FALSE;
+        }
+
+        target->writecb_recieved = 0;
+        target->writecb_required_range_written = FALSE;
+        target->segment_transfer_pos = target->segment_pos;
+        goto file_prepared;
+    }
+
     // Prepare FILE
     int fd;
+    const char *fn = NULL;
 
     if (target->target->fd != -1) {
         // Use supplied filedescriptor
@@ -903,16 +2693,18 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
             return FALSE;
         }
     } else {
-        // Use supplied filename
+        // Use supplied filename (hedge uses its own temporary file)
         int open_flags = O_CREAT|O_TRUNC|O_RDWR;
         if (target->resume)
             open_flags &= ~O_TRUNC;
 
-        fd = open(target->target->fn, open_flags, 0666);
+        fn = target->hedge_fn ? target->hedge_fn : target->target->fn;
+
+        fd = open(fn, open_flags, 0666);
         if (fd < 0) {
             g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
                         "Cannot open %s: %s",
-                        target->target->fn, strerror(errno));
+                        fn, strerror(errno));
             curl_easy_cleanup(h);
             return FALSE;
         }
@@ -983,13 +2775,36 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         }
     }
 
+    // Local file is copied in a thread, the transfer only checks that
+    // the file exists (it's needed for the usual handling of errors)
+    target->local_copy = FALSE;
+    if (local_path && !target->resume
+        && target->target->byterangestart == 0
+        && target->target->byterangeend == 0
+        && ftell(f) == 0
+        && start_local_copy(dd, target, fd, local_path))
+    {
+        target->local_copy = TRUE;
+        curl_easy_setopt(h, CURLOPT_NOBODY, 1L);
+    }
+
+    // Prepare incremental checksum calculation and decompression
+    // (A local copy is checked and decompressed from the file)
+    if (target->local_copy) {
+        checksum_ctxs_free(target);
+        decompressor_free(target);
+    } else {
+        prepare_checksum_ctxs(target, fd, ftell(f));
+        prepare_decompressor(target, ftell(f));
+    }
+
     // Add librepo extended attribute to the file
     // This xattr states that file is being downloaded by librepo
     // This xattr is removed once the file is completly downloaded
     // If librepo tries to resume a download, it checks if the xattr is present.
     // If it isn't the download is not resumed, but whole file is
     // downloaded again.
-    add_librepo_xattr(fd, target->target->fn);
+    add_librepo_xattr(fd, fn);
 
     if (target->target->byterangestart > 0) {
         assert(!target->target->resume);
@@ -999,30 +2814,83 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
                                 (curl_off_t) target->target->byterangestart);
     }
 
+file_prepared:
+
+    target->transfer_start_time = g_get_monotonic_time();
+
     // Prepare progress callback
+    // Progress of a file is reported by its primary transfer only
     target->cb_return_code = LR_CB_OK;
-    if (target->target->progresscb) {
+    if (target->target->progresscb && !target->primary) {
         curl_easy_setopt(h, CURLOPT_PROGRESSFUNCTION, lr_progresscb);
         curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0);
         curl_easy_setopt(h, CURLOPT_PROGRESSDATA, target);
     }
 
     // Prepare header callback
-    if (target->target->expectedsize > 0) {
+    // Segments are not checked, their Content-Length is the size
+    // of the range
+    if ((target->target->expectedsize > 0 || target->target->conditional)
+        && !target->parent) {
         curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, lr_headercb);
         curl_easy_setopt(h, CURLOPT_HEADERDATA, target);
     }
 
     // Prepare write callback
-    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, lr_writecb);
+    if (target->parent)
+        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, lr_segment_writecb);
+    else
+        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, lr_writecb);
     curl_easy_setopt(h, CURLOPT_WRITEDATA, target);
 
+#if LR_CURL_VERSION_CHECK(7, 43, 0)
+    // Prefer waiting for a connection to the mirror that could be
+    // multiplexed over opening a new one
+    if (dd->multiplex) {
+#if LR_CURL_VERSION_CHECK(7, 47, 0)
+        curl_easy_setopt(h, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+        curl_easy_setopt(h, CURLOPT_PIPEWAIT,
+                         (long) (protocol == LR_PROTOCOL_HTTP));
+    }
+#endif
+
     // Set http headers if handle is available and headers are specified
     if (target->handle)
         curl_easy_setopt(h, CURLOPT_HTTPHEADER, target->handle->curl_httpheader);
 
+    // Conditional request - the validators of the file are sent
+    // in addition to the headers of the handle
+    target->target->notmodified = FALSE;
+    conditional_free(target);
+    if (target->target->conditional && !target->parent
+        && protocol == LR_PROTOCOL_HTTP
+        && (target->target->etag || target->target->lastmodified)) {
+        struct curl_slist *headers = NULL;
+        if (target->handle)
+            for (struct curl_slist *elem = target->handle->curl_httpheader;
+                 elem; elem = elem->next)
+                headers = curl_slist_append(headers, elem->data);
+        if (target->target->etag) {
+            gchar *header = g_strconcat("If-None-Match: ",
+                                        target->target->etag, NULL);
+            headers = curl_slist_append(headers, header);
+            g_free(header);
+        }
+        if (target->target->lastmodified) {
+            gchar *header = g_strconcat("If-Modified-Since: ",
+                                        target->target->lastmodified, NULL);
+            headers = curl_slist_append(headers, header);
+            g_free(header);
+        }
+        target->curl_httpheader = headers;
+        curl_easy_setopt(h, CURLOPT_HTTPHEADER, headers);
+    }
+
     // Add the new handle to the curl multi handle
-    curl_multi_add_handle(dd->multi_handle, h);
+    // (the handle of a local copy is added once the file is copied)
+    if (!target->copy)
+        curl_multi_add_handle(dd->multi_handle, h);
 
     // Set the state of transfer as running
     target->state = LR_DS_RUNNING;
@@ -1035,72 +2903,706 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     // Set protocol of the target
     target->protocol = protocol;
 
+    // Transfer gets its tokens with the next distribution of the bandwidth.
+    // Local files are not limited (curl cannot pause file:// transfers).
+    target->rate_limited = dd->max_speed > 0
+                           && protocol != LR_PROTOCOL_FILE;
+    target->tokens = 0.0;
+    target->paused = FALSE;
+
     // Save curl handle for the current transfer
     target->curl_handle = h;
+    curl_easy_setopt(h, CURLOPT_PRIVATE, target);
+
+    // Update number of transfers from the mirror
+    if (target->mirror)
+        target->mirror->running_transfers++;
 
     // Add the transfer to the list of running transfers
-    dd->running_transfers = g_slist_append(dd->running_transfers, target);
+    dd->running_transfers = g_slist_prepend(dd->running_transfers, target);
+
+    return TRUE;
+}
+
+/** Return weight of the target in the distribution of the bandwidth.
+ */
+static gdouble
+target_weight(LrTarget *target)
+{
+    return (gdouble) MAX(1, target->target->weight);
+}
+
+/** Distribute the bandwidth (LRO_MAXSPEED) among running transfers.
+ * Tokens for the time elapsed since the last distribution are split
+ * among the transfers in proportion to their weights. A transfer that
+ * doesn't use its tokens (e.g. it's stalled) saves them only up to
+ * LR_BANDWIDTH_BURST of its share, the rest is redistributed among
+ * the other transfers right away. Paused transfers that got tokens
+ * are resumed.
+ */
+static gboolean
+distribute_bandwidth(LrDownload *dd, GError **err)
+{
+    gint64 now = g_get_monotonic_time();
+    gdouble budget = 0.0;
+    gdouble total_weight = 0.0;
+    GPtrArray *open;
+
+    assert(!err || *err == NULL);
+
+    if (!dd->max_speed)  // Nothing to do
+        return TRUE;
+
+    if (dd->bandwidth_time)
+        budget = dd->max_speed * (gdouble) (now - dd->bandwidth_time)
+                 / G_USEC_PER_SEC;
+    dd->bandwidth_time = now;
+
+    open = g_ptr_array_new();
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        if (!target->curl_handle || !target->rate_limited)
+            continue;
+        g_ptr_array_add(open, target);
+        total_weight += target_weight(target);
+    }
+
+    // Water-filling - tokens that don't fit into a full bucket
+    // are split among the transfers with room in their buckets
+    gdouble all_weight = total_weight;
+    while (budget > 0.0 && open->len > 0) {
+        gdouble overflow = 0.0;
+        gdouble open_weight = total_weight;
+
+        for (guint i = 0; i < open->len;) {
+            LrTarget *target = g_ptr_array_index(open, i);
+            gdouble weight = target_weight(target);
+            gdouble share = budget * weight / open_weight;
+            gdouble capacity = MAX(CURL_MAX_WRITE_SIZE,
+                                   dd->max_speed * weight / all_weight
+                                   * LR_BANDWIDTH_BURST);
+
+            gdouble room = capacity - target->tokens;
+
+            if (share >= room) {
+                // Bucket is full
+                overflow += share - MAX(room, 0.0);
+                if (room > 0.0)
+                    target->tokens = capacity;
+                total_weight -= weight;
+                g_ptr_array_remove_index_fast(open, i);
+                continue;
+            }
+            target->tokens += share;
+            i++;
+        }
+
+        budget = overflow;
+    }
+    g_ptr_array_free(open, TRUE);
+
+    // Resume paused transfers
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        if (!target->paused || target->tokens <= 0)
+            continue;
+        target->paused = FALSE;
+        CURLcode code = curl_easy_pause(target->curl_handle, CURLPAUSE_CONT);
+        if (code != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                        "Cannot resume a paused transfer: %s",
+                        curl_easy_strerror(code));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/** Remove a new target for which no mirror was available (e.g. a new
+ * segment or hedge) and free it.
+ */
+static void
+discard_target(LrDownload *dd, LrTarget *target)
+{
+    if (target->state == LR_DS_WAITING)
+        g_queue_remove(waiting_targets_queue(dd, target), target);
+    dd->targets = g_slist_remove(dd->targets, target);
+    if (target->hedge_fn)
+        unlink(target->hedge_fn);
+    g_free(target->hedge_fn);
+    conditional_free(target);
+    decompressor_free(target);
+    lr_free(target->tried_mirrors);
+    lr_free(target);
+}
+
+
+/** Minimal time (in microseconds) a segment has to be transferred,
+ * before it could be split. Speed of the transfer is not known earlier. */
+#define LR_SEGMENT_SPLIT_DELAY  G_USEC_PER_SEC
+
+/** Split the running segment which is expected to finish as the last one
+ * and start a download of its second half from another mirror.
+ * This way, mirrors which already downloaded their segments help
+ * with the slow ones.
+ */
+static gboolean
+split_running_segment(LrDownload *dd, gboolean *candidatefound, GError **err)
+{
+    LrTarget *slowest = NULL;
+    gdouble slowest_eta = 0.0;
+    gint64 now = g_get_monotonic_time();
+
+    assert(!err || *err == NULL);
+
+    *candidatefound = FALSE;
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *segment = elem->data;
+        guint running_segments = 0;
+        gint64 remaining, downloaded;
+        gdouble eta;
+
+        if (!segment->parent)
+            continue;
+
+        remaining = segment->segment_end - segment->segment_pos + 1;
+        if (remaining < 2 * LR_SEGMENT_MINSIZE)
+            continue;  // Not worth to split
+
+        if (now - segment->transfer_start_time < LR_SEGMENT_SPLIT_DELAY)
+            continue;  // Too early to judge
+
+        for (GSList *el = segment->parent->segments; el; el = g_slist_next(el))
+            if (((LrTarget *) el->data)->state == LR_DS_RUNNING)
+                running_segments++;
+        if (running_segments >= dd->max_segments)
+            continue;
+
+        // Estimate remaining time from the speed of the current transfer
+        downloaded = segment->segment_pos - segment->segment_transfer_pos;
+        if (downloaded > 0)
+            eta = remaining * ((gdouble) (now - segment->transfer_start_time)
+                               / downloaded);
+        else
+            eta = G_MAXDOUBLE;  // Nothing was downloaded yet
+
+        if (!slowest || eta > slowest_eta) {
+            slowest = segment;
+            slowest_eta = eta;
+        }
+    }
+
+    if (!slowest)
+        return TRUE;
+
+    LrTarget *target = slowest->parent;
+    gint64 end = slowest->segment_end;
+    gint64 middle = slowest->segment_pos + (end - slowest->segment_pos + 1) / 2;
+
+    LrTarget *segment = segment_new(dd, target, middle, end);
+    slowest->segment_end = middle - 1;
+
+    if (!prepare_next_transfer(dd, candidatefound, err))
+        return FALSE;
+
+    if (segment->state == LR_DS_WAITING) {
+        // No mirror is available for the new segment, revert the split
+        slowest->segment_end = end;
+        target->segments = g_slist_remove(target->segments, segment);
+        discard_target(dd, segment);
+        *candidatefound = FALSE;
+        return TRUE;
+    }
+
+    g_debug("%s: Segment %"G_GINT64_FORMAT"-%"G_GINT64_FORMAT
+            " of %s was split at %"G_GINT64_FORMAT, __func__,
+            slowest->segment_pos, end, target->target->path, middle);
+
+    return TRUE;
+}
+
+/** Minimal time (in microseconds) a transfer has to run, before it could
+ * be hedged. Speed of the transfer is not known earlier. */
+#define LR_HEDGE_DELAY          G_USEC_PER_SEC
+
+/** A transfer is hedged if its speed is lower than this fraction of
+ * the median speed of running transfers or of the throughput
+ * of its mirror. */
+#define LR_HEDGE_SLOWDOWN       0.25
+
+/** Check if the running target could be hedged.
+ */
+/** Number of bytes charged to the hedge budget. The hedges that ended
+ * are charged by the bytes they received, the running hedges by their
+ * expected size, as they could still download the whole file.
+ */
+static gint64
+hedge_bytes_charged(LrDownload *dd)
+{
+    gint64 bytes = dd->hedge_bytes;
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        if (target->primary)
+            bytes += target->target->expectedsize;
+    }
+
+    return bytes;
+}
+
+
+static gboolean
+target_can_be_hedged(LrDownload *dd, LrTarget *target, gint64 now)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (target->parent || target->primary || target->hedge)
+        return FALSE;  // Segment, hedge or already hedged target
+
+    if (!target->curl_handle || target->local_copy || target->storedpath
+        || !target_uses_mirrors(target))
+        return FALSE;
+
+    // Hedge is downloaded into a temporary file, which replaces the file
+    // of the target, so the file has to be specified by its name.
+    // Decompressed data could be written by a single transfer only.
+    if (!dtarget->fn
+        || dtarget->decompress
+        || target->resume
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0)
+        return FALSE;
+
+    if (dtarget->expectedsize <= 0
+        || dtarget->expectedsize <= target->writecb_recieved)
+        return FALSE;
+
+    if ((hedge_bytes_charged(dd) + dtarget->expectedsize) * 100
+            > dd->total_bytes * dd->hedge_budget)
+        return FALSE;  // Out of budget
+
+    if (now - target->transfer_start_time < LR_HEDGE_DELAY)
+        return FALSE;  // Too early to judge
+
+    return TRUE;
+}
+
+
+static gint
+compare_speeds(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *((const gdouble *) a);
+    gdouble y = *((const gdouble *) b);
+    return (x > y) - (x < y);
+}
+
+
+/** Create a new hedge of the target. The hedge is added to the head
+ * of the queue of waiting targets. Its temporary file is created
+ * next to the file of the target with the same permissions.
+ * NULL is returned if the temporary file cannot be created.
+ */
+static LrTarget *
+hedge_new(LrDownload *dd, LrTarget *target)
+{
+    gchar *hedge_fn = g_strconcat(target->target->fn, ".hedge-XXXXXX", NULL);
+    struct stat st;
+    int fd;
+
+    fd = mkstemp(hedge_fn);
+    if (fd == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, hedge_fn,
+                strerror(errno));
+        g_free(hedge_fn);
+        return NULL;
+    }
+    if (fstat(fileno(target->f), &st) == 0)
+        fchmod(fd, st.st_mode & 0777);
+    close(fd);
+
+    LrTarget *hedge = lr_malloc0(sizeof(*hedge));
+    hedge->target          = target->target;
+    hedge->original_offset = -1;
+    hedge->resume          = FALSE;
+    hedge->lrmirrors       = target->lrmirrors;
+    hedge->handle          = target->handle;
+    hedge->handle_mirrors  = target->handle_mirrors;
+    hedge->primary         = target;
+    hedge->hedge_fn        = hedge_fn;
+
+    // Hedge doesn't use mirrors tried by the target
+    if (target->tried_mirrors) {
+        gsize len = (target->handle_mirrors->lrmirrors_count + 7) / 8;
+        hedge->tried_mirrors = lr_malloc0(len);
+        memcpy(hedge->tried_mirrors, target->tried_mirrors, len);
+    }
+    set_mirror_tried(hedge, target->mirror);
+
+    dd->targets = g_slist_prepend(dd->targets, hedge);
+    target->hedge = hedge;
+    set_target_waiting(dd, hedge, TRUE);
+
+    return hedge;
+}
+
+
+/** Start a hedge of the running transfer which lags behind the median
+ * speed of running transfers or behind the throughput of its mirror
+ * (average throughput of mirrors if the mirror wasn't measured yet)
+ * the most.
+ */
+static gboolean
+hedge_slow_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
+{
+    LrTarget *slowest = NULL;
+    gdouble slowest_eta = 0.0;
+    gdouble median = 0.0;
+    gint64 now = g_get_monotonic_time();
+    GArray *speeds = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
+    assert(!err || *err == NULL);
+
+    *candidatefound = FALSE;
+
+    // Median speed of transfers of whole files
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        gint64 elapsed = now - target->transfer_start_time;
+
+        if (target->parent || elapsed < LR_HEDGE_DELAY)
+            continue;
+
+        gdouble speed = target->writecb_recieved
+                        / ((gdouble) elapsed / G_USEC_PER_SEC);
+        g_array_append_val(speeds, speed);
+    }
+
+    if (speeds->len > 1) {
+        g_array_sort(speeds, compare_speeds);
+        median = g_array_index(speeds, gdouble, speeds->len / 2);
+    }
+    g_array_free(speeds, TRUE);
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        gint64 remaining;
+        gdouble speed, eta;
+
+        if (!target_can_be_hedged(dd, target, now))
+            continue;
+
+        speed = target->writecb_recieved
+                / ((gdouble) (now - target->transfer_start_time)
+                   / G_USEC_PER_SEC);
+
+        // Throughput of the mirror or average throughput of the mirrors
+        // of the handle if the mirror wasn't measured yet
+        gdouble throughput = target->mirror->throughput;
+        LrHandleMirrors *handle_mirrors = target->handle_mirrors;
+        if (throughput <= 0.0 && handle_mirrors->throughput_count)
+            throughput = handle_mirrors->throughput_sum
+                         / handle_mirrors->throughput_count;
+
+        if (!(median > 0.0 && speed < median * LR_HEDGE_SLOWDOWN)
+            && !(throughput > 0.0 && speed < throughput * LR_HEDGE_SLOWDOWN))
+            continue;  // Not slow enough
+
+        remaining = target->target->expectedsize - target->writecb_recieved;
+        eta = (speed > 0.0) ? remaining / speed : G_MAXDOUBLE;
+
+        if (!slowest || eta > slowest_eta) {
+            slowest = target;
+            slowest_eta = eta;
+        }
+    }
+
+    if (!slowest)
+        return TRUE;
+
+    LrTarget *hedge = hedge_new(dd, slowest);
+    if (!hedge)
+        return TRUE;
+
+    if (!prepare_next_transfer(dd, candidatefound, err))
+        return FALSE;
+
+    if (hedge->state != LR_DS_RUNNING) {
+        // No mirror is available for the hedge
+        slowest->hedge = NULL;
+        discard_target(dd, hedge);
+        *candidatefound = FALSE;
+        return TRUE;
+    }
+
+    g_debug("%s: Hedging %s (%"G_GINT64_FORMAT"/%"G_GINT64_FORMAT
+            " bytes downloaded from %s) from %s", __func__,
+            slowest->target->path, slowest->writecb_recieved,
+            slowest->target->expectedsize, slowest->mirror->mirror->url,
+            hedge->mirror->mirror->url);
+
+    return TRUE;
+}
+
+/** Tune the number of parallel downloads according to the total
+ * throughput (goodput) of all transfers.
+ * The goodput is measured over intervals of LR_AUTOTUNE_INTERVAL.
+ * If all slots were used during the interval and the goodput improved,
+ * the number of parallel downloads is raised (doubled during the slow
+ * start, then increased by one). If the last increase didn't improve
+ * the goodput, it is reverted. If the goodput drops, the number is
+ * lowered by a quarter. If the goodput stays the same, one more slot
+ * is probed.
+ */
+static void
+autotune_parallel_downloads(LrDownload *dd)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 bytes = 0;
+    gdouble elapsed, goodput;
+    int limit = dd->max_parallel_connections;
+    const char *reason = NULL;
+
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        bytes += handle_mirrors->bytes_received;
+    }
+
+    if (dd->autotune_time == 0) {
+        // Start the first measurement interval
+        dd->autotune_time = now;
+        dd->autotune_bytes = bytes;
+        dd->autotune_saturated = FALSE;
+        return;
+    }
+
+    elapsed = (gdouble) (now - dd->autotune_time) / G_USEC_PER_SEC;
+    if (elapsed < LR_AUTOTUNE_INTERVAL)
+        return;
+
+    goodput = (bytes - dd->autotune_bytes) / elapsed;
+
+    if (!dd->autotune_saturated) {
+        // Not enough targets or mirrors - the number of parallel
+        // downloads doesn't limit the goodput
+        reason = "not saturated";
+        dd->autotune_prev_limit = 0;
+    } else if (goodput > dd->autotune_goodput * LR_AUTOTUNE_GROWTH) {
+        reason = "goodput improved";
+        dd->autotune_prev_limit = limit;
+        if (dd->autotune_slow_start)
+            limit *= 2;
+        else
+            limit += 1;
+    } else if (goodput < dd->autotune_goodput * LR_AUTOTUNE_DROP) {
+        reason = "goodput dropped";
+        dd->autotune_prev_limit = 0;
+        dd->autotune_slow_start = FALSE;
+        limit -= MAX(1, limit / 4);
+    } else if (dd->autotune_prev_limit) {
+        reason = "increase didn't help";
+        limit = dd->autotune_prev_limit;
+        dd->autotune_prev_limit = 0;
+        dd->autotune_slow_start = FALSE;
+    } else {
+        reason = "probing";
+        dd->autotune_prev_limit = limit;
+        limit += 1;
+    }
+
+    limit = CLAMP(limit, LRO_MAXPARALLELDOWNLOADS_MIN, dd->autotune_limit);
+
+    g_debug("%s: Parallel downloads: %d -> %d (%s, goodput: %.0f B/s, "
+            "previous: %.0f B/s, running: %u)",
+            __func__, dd->max_parallel_connections, limit, reason, goodput,
+            dd->autotune_goodput, g_slist_length(dd->running_transfers));
+
+    dd->max_parallel_connections = limit;
+    dd->autotune_goodput = goodput;
+    dd->autotune_time = now;
+    dd->autotune_bytes = bytes;
+    dd->autotune_saturated = FALSE;
+}
+
+/** Tick of the downloading loop, done on each wakeup of the loop before
+ * the finished transfers are checked (and the free slots are used).
+ * The loop wakes up at least every loop_timeout() milliseconds, so
+ * the autotuner keeps its measurement intervals even if no transfer
+ * finishes for a long time.
+ */
+static void
+download_tick(LrDownload *dd)
+{
+    if (dd->autotune_limit)
+        autotune_parallel_downloads(dd);
+}
+
+/** Maximal time (in milliseconds) the downloading loop could wait for
+ * an activity of the transfers. It is capped to 1 sec to check for
+ * SIGINT regularly, to LR_BANDWIDTH_TICK to resume paused transfers
+ * and to the end of the measurement interval of the autotuner.
+ */
+static long
+loop_timeout(LrDownload *dd)
+{
+    long timeout = dd->max_speed ? LR_BANDWIDTH_TICK : 1000;
+
+    if (dd->autotune_limit && dd->autotune_time) {
+        gint64 end = dd->autotune_time
+                     + (gint64) (LR_AUTOTUNE_INTERVAL * G_USEC_PER_SEC);
+        gint64 left = (end - g_get_monotonic_time() + 999) / 1000;
+        timeout = CLAMP(left, 0, timeout);
+    }
+
+    return timeout;
+}
+
+static gboolean
+prepare_next_transfers(LrDownload *dd, GError **err)
+{
+    guint length, free_slots;
+
+    assert(!err || *err == NULL);
+
+    // The number of parallel downloads could be lowered by the autotuner
+    // below the number of running transfers
+    length = g_slist_length(dd->running_transfers);
+    free_slots = (length < (guint) dd->max_parallel_connections)
+                 ? dd->max_parallel_connections - length : 0;
+
+    gboolean candidatefound = TRUE;
+    while (free_slots > 0 && candidatefound) {
+        gboolean ret = prepare_next_transfer(dd, &candidatefound, err);
+        if (!ret)
+            return FALSE;
+        if (!candidatefound && dd->max_segments > 1) {
+            // No waiting target, use the free slot for a slow segment
+            if (!split_running_segment(dd, &candidatefound, err))
+                return FALSE;
+        }
+        if (!candidatefound && dd->hedge_budget > 0) {
+            // No waiting target, use the free slot for a hedge
+            if (!hedge_slow_transfer(dd, &candidatefound, err))
+                return FALSE;
+        }
+        free_slots--;
+    }
+
+    // All slots are used if the loop wasn't stopped by a lack of candidates
+    if (candidatefound)
+        dd->autotune_saturated = TRUE;
+
+    // Share the maximal speed among the transfers
+    if (!distribute_bandwidth(dd, err))
+        return FALSE;
 
     return TRUE;
 }
 
+
+/** Stop the waiting or running target including all its segments.
+ * The state of the target is not changed.
+ */
+static void
+stop_target(LrDownload *dd, LrTarget *target)
+{
+    if (target->state == LR_DS_WAITING) {
+        g_queue_remove(waiting_targets_queue(dd, target), target);
+    } else if (target->segments) {
+        abort_segments(dd, target);
+        fclose(target->f);
+        target->f = NULL;
+    } else if (target->curl_handle) {
+        stop_transfer(dd, target);
+    }
+}
+
+
+/** Check if the downloading was interrupted by SIGINT or cancelled
+ * by a cancel token. Only interruptible handles (and only by signals
+ * caught after the start) are interrupted, downloads of other handles
+ * (in this call or running in parallel in other threads) are not
+ * affected.
+ * Targets of the interrupted handles are stopped and fail with
+ * LRE_INTERRUPTED or LRE_CANCELLED, targets of other handles continue.
+ * If no other target is left, the whole downloading is interrupted.
+ * @return          TRUE if the whole downloading was interrupted or
+ *                  an error occured (err is set), FALSE otherwise.
+ */
 static gboolean
-set_max_speeds_to_transfers(LrDownload *dd, GError **err)
+download_interrupted(LrDownload *dd, GError **err)
 {
-    guint length;
-    gint64 single_target_speed;
+    gboolean sigint = dd->interruptible && lr_interrupted(dd->sigint_count);
+    gboolean cancelled = FALSE;
+    gboolean others = FALSE;
+    GSList *stopped = NULL;
+    GError *fail_fast_error = NULL;
 
     assert(!err || *err == NULL);
 
-    if (!dd->max_speed)  // Nothing to do
-        return TRUE;
+    for (GSList *elem = dd->cancel_tokens; elem; elem = g_slist_next(elem))
+        if (lr_cancel_token_is_cancelled(elem->data))
+            cancelled = TRUE;
 
-    length = g_slist_length(dd->running_transfers);
-    if (!length)  // Nothing to do
-        return TRUE;
+    if (!sigint && !cancelled)
+        return FALSE;
 
-    // Calculate a max speed (rounded up) per target
-    single_target_speed = (dd->max_speed + (length - 1)) / length;
+    // Unfinished targets of the interrupted handles
+    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
 
-    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-        LrTarget *ltarget = elem->data;
-        CURL *curl_handle = ltarget->curl_handle;
-        CURLcode code = curl_easy_setopt(curl_handle,
-                                         CURLOPT_MAX_RECV_SPEED_LARGE,
-                                         (curl_off_t) single_target_speed);
-        if (code != CURLE_OK) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLSETOPT,
-                        "Cannot set CURLOPT_MAX_RECV_SPEED_LARGE option: %s",
-                        curl_easy_strerror(code));
-            return FALSE;
-        }
+        if (target->parent || target->primary)
+            continue;  // Segment or hedge - stopped with its target
+        if (target->state != LR_DS_WAITING && target->state != LR_DS_RUNNING)
+            continue;
+
+        if (handle_interrupted(target->target->handle, sigint, NULL))
+            stopped = g_slist_prepend(stopped, target);
+        else
+            others = TRUE;
     }
 
-    return TRUE;
-}
+    if (!others) {
+        g_slist_free(stopped);
+        g_set_error(err, LR_DOWNLOADER_ERROR,
+                    cancelled ? LRE_CANCELLED : LRE_INTERRUPTED,
+                    cancelled ? "Downloading was cancelled"
+                              : "Interrupted by signal");
+        return TRUE;
+    }
 
-static gboolean
-prepare_next_transfers(LrDownload *dd, GError **err)
-{
-    guint length = g_slist_length(dd->running_transfers);
-    guint free_slots = dd->max_parallel_connections - length;
+    stopped = g_slist_reverse(stopped);
+    for (GSList *elem = stopped; elem && !fail_fast_error; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        GError *transfer_err = NULL;
 
-    assert(!err || *err == NULL);
+        handle_interrupted(target->target->handle, sigint, &transfer_err);
+        g_debug("%s: Stopping %s: %s", __func__,
+                target->target->path, transfer_err->message);
+        stop_target(dd, target);
+        target_failed(dd, target, transfer_err, &fail_fast_error);
+    }
+    g_slist_free(stopped);
 
-    gboolean candidatefound = TRUE;
-    while (free_slots > 0 && candidatefound) {
-        gboolean ret = prepare_next_transfer(dd, &candidatefound, err);
-        if (!ret)
-            return FALSE;
-        free_slots--;
+    if (fail_fast_error) {
+        g_propagate_error(err, fail_fast_error);
+        return TRUE;
     }
 
-    // Set maximal speed for each target
-    if (dd->max_speed)
-        if (!set_max_speeds_to_transfers(dd, err))
-            return FALSE;
+    // Handles of the cancelled tokens and interruptible handles don't
+    // have any target left, nothing more to watch
+    for (GSList *elem = dd->cancel_tokens; elem; ) {
+        LrCancelToken *token = elem->data;
+        elem = g_slist_next(elem);
+        if (lr_cancel_token_is_cancelled(token))
+            forget_cancel_token(dd, token);
+    }
+    if (sigint)
+        dd->sigint_count = lr_interrupt;
 
-    return TRUE;
+    // Use the free slots for targets of other handles
+    return !prepare_next_transfers(dd, err);
 }
 
 
@@ -1215,7 +3717,13 @@ check_finished_transfer_status(CURLMsg *msg,
         // Check status codes for some protocols
         if (effective_url && g_str_has_prefix(effective_url, "http")) {
             // Check HTTP(S) code
-            if (code/100 != 2) {
+            if (code == 304 && target->target->conditional
+                && target->curl_httpheader) {
+                // The file was not modified since the version identified
+                // by the validators sent in the request
+                g_debug("%s: Not modified: %s", __func__, effective_url);
+                target->target->notmodified = TRUE;
+            } else if (code/100 != 2) {
                 g_set_error(transfer_err,
                             LR_DOWNLOADER_ERROR,
                             LRE_BADSTATUS,
@@ -1269,44 +3777,268 @@ list_of_checksums_to_str(GSList *checksums)
 }
 
 
+/** Finish incremental checksums of the target.
+ * calculated_chksums is set to a list of calculated checksums
+ * (LrDownloadTargetChecksum *) or to NULL if the incremental checksums
+ * are not available or if they don't cover the whole file. In that case,
+ * checksums must be calculated from the file.
+ */
+static gboolean
+finish_checksum_ctxs(LrTarget *target,
+                     int fd,
+                     GSList **calculated_chksums,
+                     GError **err)
+{
+    struct stat st;
+
+    assert(!err || *err == NULL);
+
+    *calculated_chksums = NULL;
+
+    if (!target->checksum_ctxs)
+        return TRUE;
+
+    if (fstat(fd, &st) != 0 || st.st_size != target->checksummed_bytes) {
+        g_debug("%s: Incremental checksum doesn't cover the whole file "
+                "(%"G_GINT64_FORMAT" bytes) - Checksum will be recalculated",
+                __func__, target->checksummed_bytes);
+        return TRUE;
+    }
+
+    for (GSList *elem = target->checksum_ctxs; elem; elem = g_slist_next(elem)) {
+        LrChecksumCtx *ctx = elem->data;
+        gchar *calculated = lr_checksumctx_final(ctx, err);
+        if (!calculated) {
+            g_slist_free_full(*calculated_chksums,
+                              (GDestroyNotify) lr_downloadtargetchecksum_free);
+            *calculated_chksums = NULL;
+            return FALSE;
+        }
+
+        *calculated_chksums = g_slist_append(*calculated_chksums,
+                lr_downloadtargetchecksum_new(lr_checksumctx_type(ctx),
+                                              calculated));
+        lr_free(calculated);
+    }
+
+    return TRUE;
+}
+
+
+/** Calculate all types of checksums from the list by reading the file once.
+ */
+static gboolean
+calculate_checksums(int fd,
+                    GSList *checksums,
+                    GSList **calculated_chksums,
+                    GError **err)
+{
+    gboolean ret;
+    gsize count = 0;
+    guint length = g_slist_length(checksums);
+    _cleanup_free_ LrChecksumType *types = NULL;
+    _cleanup_free_ gchar **values = NULL;
+
+    assert(!err || *err == NULL);
+
+    *calculated_chksums = NULL;
+
+    types = lr_malloc0(sizeof(*types) * (length + 1));
+    values = lr_malloc0(sizeof(*values) * (length + 1));
+
+    for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        gboolean exists = FALSE;
+
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        for (gsize x = 0; x < count; x++)
+            if (types[x] == chksum->type)
+                exists = TRUE;
+
+        if (!exists)
+            types[count++] = chksum->type;
+    }
+
+    if (!count)
+        return TRUE;
+
+    ret = lr_checksum_fd_multi(fd, types, count, TRUE, values, err);
+    if (!ret)
+        return FALSE;
+
+    for (gsize x = 0; x < count; x++) {
+        *calculated_chksums = g_slist_append(*calculated_chksums,
+                lr_downloadtargetchecksum_new(types[x], values[x]));
+        lr_free(values[x]);
+    }
+
+    return TRUE;
+}
+
+
+/** Check the decompressed data of the finished transfer (see
+ * LrDownloadTarget.decompress). If the whole file was not decompressed
+ * during the transfer, it is decompressed from the file now.
+ * @param target        Target
+ * @param fd            File descriptor of the downloaded file
+ * @param transfer_err  Set if the data are corrupted or if the decompressed
+ *                      data don't match checksums_open or expectedsize_open
+ * @param err           Set on a fatal error (e.g. the decompressed data
+ *                      cannot be written)
+ * @return              FALSE if err is set
+ */
+static gboolean
+check_decompressed_data(LrTarget *target,
+                        int fd,
+                        GError **transfer_err,
+                        GError **err)
+{
+    LrDownloadTarget *dtarget = target->target;
+    GSList *calculated_chksums = NULL;
+    GError *tmp_err = NULL;
+    gboolean matches = TRUE;
+    struct stat st;
+    gint64 size;
+
+    assert(!err || *err == NULL);
+
+    if (!target->decompressor
+        || fstat(fd, &st) != 0
+        || st.st_size != lr_decompressor_consumed(target->decompressor))
+    {
+        // The file was not (completely) decompressed during the transfer
+        g_debug("%s: Decompressing %s", __func__, dtarget->path);
+        if (!decompressor_start(target, &tmp_err))
+            goto decompress_error;
+        if (!lr_decompressor_write_fd(target->decompressor, fd, &tmp_err))
+            goto decompress_error;
+    }
+
+    if (!lr_decompressor_finish(target->decompressor, &tmp_err))
+        goto decompress_error;
+
+    size = lr_decompressor_produced(target->decompressor);
+    if (dtarget->expectedsize_open > 0 && size != dtarget->expectedsize_open) {
+        g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                    "Downloading successful, but size of decompressed data "
+                    "doesn't match. Decompressed: %"G_GINT64_FORMAT
+                    " Expected: %"G_GINT64_FORMAT,
+                    size, dtarget->expectedsize_open);
+        return TRUE;
+    }
+
+    for (GSList *elem = target->checksum_open_ctxs; elem; elem = g_slist_next(elem)) {
+        LrChecksumCtx *ctx = elem->data;
+        char *value = lr_checksumctx_final(ctx, err);
+        if (!value) {
+            g_slist_free_full(calculated_chksums,
+                              (GDestroyNotify) lr_downloadtargetchecksum_free);
+            return FALSE;
+        }
+        calculated_chksums = g_slist_append(calculated_chksums,
+                lr_downloadtargetchecksum_new(lr_checksumctx_type(ctx), value));
+        lr_free(value);
+    }
+
+    for (GSList *elem = dtarget->checksums_open; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        LrDownloadTargetChecksum *calculated_chksum = NULL;
+
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        for (GSList *el = calculated_chksums; el; el = g_slist_next(el)) {
+            calculated_chksum = el->data;
+            if (calculated_chksum->type == chksum->type)
+                break;
+        }
+
+        assert(calculated_chksum && calculated_chksum->type == chksum->type);
+
+        matches = strcmp(chksum->value, calculated_chksum->value) ? FALSE : TRUE;
+        if (matches) {
+            // At least one checksum matches
+            g_debug("%s: Checksum (%s) %s of decompressed data is OK",
+                    __func__, lr_checksum_type_to_str(chksum->type),
+                    chksum->value);
+            break;
+        }
+    }
+
+    if (!matches) {
+        _cleanup_free_ gchar *calculated = NULL;
+        _cleanup_free_ gchar *expected = NULL;
+
+        calculated = list_of_checksums_to_str(calculated_chksums);
+        expected = list_of_checksums_to_str(dtarget->checksums_open);
+
+        g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                    "Downloading successful, but checksum of decompressed "
+                    "data doesn't match. Calculated: %s Expected: %s",
+                    calculated, expected);
+    }
+
+    g_slist_free_full(calculated_chksums,
+                      (GDestroyNotify) lr_downloadtargetchecksum_free);
+
+    return TRUE;
+
+decompress_error:
+    if (tmp_err->code == LRE_IO) {
+        // The decompressed data cannot be written (or the file read)
+        g_propagate_error(err, tmp_err);
+        return FALSE;
+    }
+
+    // Corrupted data
+    g_propagate_error(transfer_err, tmp_err);
+    return TRUE;
+}
+
+
 static gboolean
-check_finished_trasfer_checksum(int fd,
-                                GSList *checksums,
+check_finished_trasfer_checksum(LrTarget *target,
+                                int fd,
                                 gboolean *checksum_matches,
                                 GError **transfer_err,
                                 GError **err)
 {
     gboolean matches = TRUE;
+    GSList *checksums = target->target->checksums;
     GSList *calculated_chksums = NULL;
 
+    target->verified_checksum = NULL;
+
+    // Use checksums calculated during the download if available
+    if (!finish_checksum_ctxs(target, fd, &calculated_chksums, err))
+        return FALSE;
+
+    if (!calculated_chksums)
+        if (!calculate_checksums(fd, checksums, &calculated_chksums, err))
+            return FALSE;
+
     for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
         LrDownloadTargetChecksum *chksum = elem->data;
         LrDownloadTargetChecksum *calculated_chksum = NULL;
-        gchar *calculated = NULL;
 
         if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
             continue;  // Bad checksum
 
-        lseek(fd, 0, SEEK_SET);
-        gboolean ret = lr_checksum_fd_compare(chksum->type,
-                                              fd,
-                                              chksum->value,
-                                              1,
-                                              &matches,
-                                              &calculated,
-                                              err);
-        if (!ret)
-            return FALSE;
+        for (GSList *el = calculated_chksums; el; el = g_slist_next(el)) {
+            calculated_chksum = el->data;
+            if (calculated_chksum->type == chksum->type)
+                break;
+        }
 
-        // Store calculated checksum
-        calculated_chksum = lr_downloadtargetchecksum_new(chksum->type,
-                                                          calculated);
-        g_free(calculated);
-        calculated_chksums = g_slist_append(calculated_chksums,
-                                            calculated_chksum);
+        assert(calculated_chksum && calculated_chksum->type == chksum->type);
 
+        matches = strcmp(chksum->value, calculated_chksum->value) ? FALSE : TRUE;
         if (matches) {
             // At least one checksum matches
+            lr_checksum_cache_store(fd, chksum->type, calculated_chksum->value);
+            target->verified_checksum = chksum;
             g_debug("%s: Checksum (%s) %s is OK", __func__,
                     lr_checksum_type_to_str(chksum->type),
                     chksum->value);
@@ -1321,166 +4053,513 @@ check_finished_trasfer_checksum(int fd,
         _cleanup_free_ gchar *calculated = NULL;
         _cleanup_free_ gchar *expected = NULL;
 
-        calculated = list_of_checksums_to_str(calculated_chksums);
-        expected = list_of_checksums_to_str(checksums);
+        calculated = list_of_checksums_to_str(calculated_chksums);
+        expected = list_of_checksums_to_str(checksums);
+
+        // Set error message
+        g_set_error(transfer_err,
+                LR_DOWNLOADER_ERROR,
+                LRE_BADCHECKSUM,
+                "Downloading successful, but checksum doesn't match. "
+                "Calculated: %s Expected: %s", calculated, expected);
+    } else if (target->target->decompress) {
+        GError *decompress_err = NULL;
+
+        if (!check_decompressed_data(target, fd, &decompress_err, err)) {
+            g_slist_free_full(calculated_chksums,
+                              (GDestroyNotify) lr_downloadtargetchecksum_free);
+            return FALSE;
+        }
+
+        if (decompress_err) {
+            target->verified_checksum = NULL;
+            *checksum_matches = FALSE;
+            g_propagate_error(transfer_err, decompress_err);
+        }
+    }
+
+    g_slist_free_full(calculated_chksums,
+                      (GDestroyNotify) lr_downloadtargetchecksum_free);
+
+    return TRUE;
+}
+
+
+/** Update an exponentially weighted moving average.
+ * @param avg       The average
+ * @param sample    A new sample
+ * @param known     FALSE if no sample was taken before
+ */
+static gdouble
+ewma_update(gdouble avg, gdouble sample, gboolean known)
+{
+    if (!known)
+        return sample;
+    return LR_MIRROR_EWMA_ALPHA * sample + (1.0 - LR_MIRROR_EWMA_ALPHA) * avg;
+}
+
+
+/** Update statistics of the mirror from the finished transfer.
+ * @param handle_mirrors    Mirrors of the handle the mirror belongs to
+ * @param mirror            Mirror of just finished transfer
+ * @param curl_handle       Curl handle of the finished transfer
+ * @param success           Was download from the mirror successful
+ * @param serious           If success is FALSE, serious mean that error was
+ *                          serious (like connection timeout), and the mirror
+ *                          should be penalized more that usual.
+ */
+static void
+update_mirror_stats(LrHandleMirrors *handle_mirrors,
+                    LrMirror *mirror,
+                    CURL *curl_handle,
+                    gboolean success,
+                    gboolean serious)
+{
+    double size = 0.0;
+    double total_time = 0.0;
+    double starttransfer_time = 0.0;
+
+    assert(handle_mirrors);
+    assert(mirror);
+
+    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD, &size);
+    curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME, &total_time);
+    curl_easy_getinfo(curl_handle, CURLINFO_STARTTRANSFER_TIME,
+                      &starttransfer_time);
+
+    if (success)
+        mirror->successful_transfers++;
+    else
+        mirror->failed_transfers++;
+
+    // Time to first byte is a latency of the mirror even if the transfer
+    // failed (e.g. 404 response)
+    if (starttransfer_time > 0.0) {
+        gboolean known = mirror->ttfb >= 0.0;
+        gdouble ttfb = ewma_update(mirror->ttfb, starttransfer_time, known);
+        handle_mirrors->ttfb_sum += ttfb - (known ? mirror->ttfb : 0.0);
+        if (!known)
+            handle_mirrors->ttfb_count++;
+        mirror->ttfb = ttfb;
+    }
+
+    if (success
+        && size >= LR_MIRROR_MIN_THROUGHPUT_SAMPLE
+        && total_time > starttransfer_time)
+    {
+        gboolean known = mirror->throughput > 0.0;
+        gdouble sample = size / (total_time - starttransfer_time);
+        gdouble throughput = ewma_update(mirror->throughput, sample, known);
+        handle_mirrors->throughput_sum += throughput - mirror->throughput;
+        if (!known)
+            handle_mirrors->throughput_count++;
+        mirror->throughput = throughput;
+    }
+
+    if (!success && serious && mirror->successful_transfers == 0) {
+        // Mirror that encounter a serious error and has no successfull
+        // transfers is probably down/broken/buggy
+        mirror->error_rate = 1.0;
+    } else {
+        mirror->error_rate = ewma_update(mirror->error_rate,
+                                         success ? 0.0 : 1.0,
+                                         TRUE);
+    }
+
+    if (g_getenv("LIBREPO_DEBUG_ADAPTIVEMIRRORSORTING")) {
+        // Debug
+        g_debug("%s: Statistics of mirrors (for %p):", __func__, handle_mirrors);
+        for (GSList *elem = handle_mirrors->lrmirrors;
+             elem;
+             elem = g_slist_next(elem))
+        {
+            LrMirror *m = elem->data;
+            g_debug(" %s (s: %d f: %d err: %.2f thr: %.0f B/s ttfb: %.3f s "
+                    "win: %.0f)",
+                    m->mirror->url, m->successful_transfers,
+                    m->failed_transfers, m->error_rate, m->throughput,
+                    m->ttfb, m->window);
+        }
+    }
+}
+
+/** Adjust the concurrency window of the mirror after a finished transfer.
+ * The window is halved when the mirror throttles us (HTTP 429 or 503),
+ * when a serious error occurs or when throughput collapses. Then it is
+ * additively increased (up to its upper bound) while the aggregate
+ * throughput of the mirror keeps improving.
+ * @param dd                Download data
+ * @param mirror            Mirror of just finished transfer
+ * @param curl_handle       Curl handle of the finished transfer
+ * @param success           Was download from the mirror successful
+ * @param serious           Was the error serious (see update_mirror_stats)
+ * @return                  TRUE if the mirror throttled the transfer
+ *                          and the window was reduced - the transfer
+ *                          could be tried from the mirror again.
+ */
+static gboolean
+update_mirror_window(LrDownload *dd,
+                     LrMirror *mirror,
+                     CURL *curl_handle,
+                     gboolean success,
+                     gboolean serious)
+{
+    long code = 0;
+    gint64 now = g_get_monotonic_time();
+    gdouble window = mirror->window;
+    gboolean throttled = FALSE;
+
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &code);
+
+    if (mirror->mirror->protocol == LR_PROTOCOL_HTTP
+        && (code == 429 || code == 503))
+        throttled = mirror_window(dd, mirror) > 1;
+
+    if ((!success && serious)
+        || (mirror->mirror->protocol == LR_PROTOCOL_HTTP
+            && (code == 429 || code == 503)))
+    {
+        // Mirror is overloaded or throttles us
+        window = MAX(1.0, window / 2);
+        mirror->window_throughput = 0.0;
+        mirror->window_time = 0;
+    } else if (mirror->window_time == 0) {
+        // Start the first measurement interval
+        mirror->window_time = now;
+        mirror->window_bytes = mirror->bytes_received;
+    } else if (now - mirror->window_time
+               >= LR_MIRROR_WINDOW_INTERVAL * G_USEC_PER_SEC)
+    {
+        gdouble elapsed = (gdouble) (now - mirror->window_time)
+                          / G_USEC_PER_SEC;
+        gdouble throughput = (mirror->bytes_received - mirror->window_bytes)
+                             / elapsed;
+
+        // Throughput says nothing about the window if the window
+        // wasn't fully used (the just finished transfer is still counted
+        // in the running_transfers)
+        if (mirror->running_transfers >= mirror_window(dd, mirror)) {
+            if (throughput > mirror->window_throughput
+                             * LR_MIRROR_WINDOW_GROWTH)
+                window = MIN(window + 1.0, mirror_window_limit(dd));
+            else if (throughput < mirror->window_throughput
+                                  * LR_MIRROR_WINDOW_COLLAPSE)
+                window = MAX(1.0, window / 2);
+        }
+
+        mirror->window_throughput = throughput;
+        mirror->window_time = now;
+        mirror->window_bytes = mirror->bytes_received;
+    }
+
+    if (window != mirror->window)
+        g_debug("%s: Concurrency window of %s: %.0f -> %.0f (code: %ld)",
+                __func__, mirror->mirror->url, mirror->window, window, code);
+
+    mirror->window = window;
+    return throttled;
+}
+
+/** Return new LrMirrorStats of the mirror.
+ */
+static LrMirrorStats *
+mirror_stats_new(LrDownload *dd, LrMirror *mirror)
+{
+    LrMirrorStats *stats = lr_malloc0(sizeof(*stats));
+    stats->url = g_strdup(mirror->mirror->url);
+    stats->window = mirror_window(dd, mirror);
+    stats->successful_transfers = mirror->successful_transfers;
+    stats->failed_transfers = mirror->failed_transfers;
+    stats->throughput = mirror->throughput;
+    stats->ttfb = mirror->ttfb;
+    stats->error_rate = mirror->error_rate;
+    return stats;
+}
+
+
+
+/** Store validators from the response of the finished transfer to
+ * the download target. The server doesn't have to repeat them in
+ * the 304 response, the sent ones are kept then.
+ */
+static void
+store_validators(LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (!dtarget->notmodified || target->etag)
+        dtarget->etag = lr_string_chunk_insert(dtarget->chunk, target->etag);
+    if (!dtarget->notmodified || target->lastmodified)
+        dtarget->lastmodified = lr_string_chunk_insert(dtarget->chunk,
+                                                       target->lastmodified);
+}
+
+
+/** Add the verified file of the target to the content store
+ * of its handle.
+ */
+static void
+contentstore_publish(LrDownload *dd, LrTarget *target)
+{
+    LrHandle *handle = target->handle;
+    LrDownloadTarget *dtarget = target->target;
+
+    lr_contentstore_publish(handle->contentstore,
+                            target->verified_checksum->type,
+                            target->verified_checksum->value,
+                            dtarget->fd,
+                            dtarget->fn);
 
-        // Set error message
-        g_set_error(transfer_err,
-                LR_DOWNLOADER_ERROR,
-                LRE_BADCHECKSUM,
-                "Downloading successful, but checksum doesn't match. "
-                "Calculated: %s Expected: %s", calculated, expected);
-    }
+    if (!g_slist_find(dd->contentstore_handles, handle))
+        dd->contentstore_handles = g_slist_prepend(dd->contentstore_handles,
+                                                   handle);
+}
 
-    g_slist_free_full(calculated_chksums,
-                      (GDestroyNotify) lr_downloadtargetchecksum_free);
 
-    return TRUE;
+/** Mark the target as successfully downloaded and call its end callback.
+ */
+static void
+target_finished(LrDownload *dd,
+                LrTarget *target,
+                const char *effective_url,
+                GError **fail_fast_error)
+{
+    target->state = LR_DS_FINISHED;
+    target_done(dd, target);
+    lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
+    if (target->mirror)
+        lr_downloadtarget_set_usedmirror(target->target,
+                                         target->mirror->mirror->url);
+    lr_downloadtarget_set_effectiveurl(target->target,
+                                       effective_url);
+
+    // Remove xattr that states that the file is being downloaded
+    // by librepo, because the file is now completly downloaded
+    // and the xattr is not needed (is is useful only for resuming)
+    remove_librepo_xattr(target->target->fd);
+
+    // Make the file available to other downloads before the end callback
+    // could move it elsewhere
+    if (target->verified_checksum && !target->storedpath && target->handle
+        && target->handle->contentstore)
+        contentstore_publish(dd, target);
+
+    // Call end callback
+    LrEndCb end_cb = target->target->endcb;
+    if (end_cb) {
+        int rc = end_cb(target->target->cbdata,
+                        LR_TRANSFER_SUCCESSFUL,
+                        NULL);
+        if (rc == LR_CB_ERROR) {
+            target->cb_return_code = LR_CB_ERROR;
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                    "from end callback", __func__);
+            g_set_error(fail_fast_error, LR_DOWNLOADER_ERROR,
+                        LRE_CBINTERRUPTED,
+                        "Interupted by LR_CB_ERROR from end callback");
+        }
+    }
 }
 
 
-/** Truncate file - Used to remove downloaded garbage (error html pages, etc.)
+/** Mark the segment as finished. If it was the last unfinished segment
+ * of the file, verify the file. If the file is corrupted, it is
+ * downloaded again as a whole.
  */
 static gboolean
-truncate_transfer_file(LrTarget *target, GError **err)
+segment_finished(LrDownload *dd,
+                 LrTarget *segment,
+                 const char *effective_url,
+                 GError **fail_fast_error,
+                 GError **err)
 {
-    off_t original_offset = 0;  // Truncate whole file by default
-    int rc;
+    LrTarget *target = segment->parent;
+    int fd = fileno(target->f);
+    gboolean matches = TRUE;
+    GError *transfer_err = NULL;
+    GError *tmp_err = NULL;
 
+    assert(dd);
     assert(!err || *err == NULL);
 
-    if (target->original_offset > -1)
-        // If resume is enabled -> truncate file to its original position
-        original_offset = target->original_offset;
+    segment->state = LR_DS_FINISHED;
 
-    if (target->target->fn)  // Truncate by filename
-        rc = truncate(target->target->fn, original_offset);
-    else  // Truncate by file descriptor number
-        rc = ftruncate(target->target->fd, original_offset);
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem))
+        if (((LrTarget *) elem->data)->state != LR_DS_FINISHED)
+            return TRUE;  // Other segments are still being downloaded
 
-    if (rc == -1) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                    "ftruncate() failed: %s", strerror(errno));
+    g_debug("%s: All segments of %s were downloaded",
+            __func__, target->target->path);
+
+    g_slist_free(target->segments);
+    target->segments = NULL;
+    target->mirror = segment->mirror;
+
+    if (!check_finished_trasfer_checksum(target, fd, &matches,
+                                         &transfer_err, &tmp_err))
+    {
+        g_propagate_prefixed_error(err, tmp_err, "Downloading of %s "
+                "was successful but error encountered while "
+                "checksuming: ", target->target->path);
         return FALSE;
     }
 
-    if (!target->target->fn) {
-        // In case fd is used, seek to the original offset
-        if (lseek(target->target->fd, original_offset, SEEK_SET) == -1) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                        "lseek() failed: %s", strerror(errno));
-            return FALSE;
-        }
+    // Leave the file offset at the end of the file as the non segmented
+    // download does
+    lseek(fd, 0, SEEK_END);
+    fclose(target->f);
+    target->f = NULL;
+
+    if (transfer_err) {
+        // It's not known which mirror served the corrupted data
+        g_debug("%s: %s - Downloading the file again without segments",
+                __func__, transfer_err->message);
+        g_error_free(transfer_err);
+        target->segmentation_disabled = TRUE;
+        target->mirror = NULL;
+        set_target_waiting(dd, target, TRUE);
+        return truncate_transfer_file(target, err);
     }
 
+    target_finished(dd, target, effective_url, fail_fast_error);
+
     return TRUE;
 }
 
 
-/** Return mirror rank or -1.0 if the rank cannot be determined
- * (e.g. when is too early)
- * Rank is currently just success rate for the mirror
+/** Handle a failed hedge. The primary transfer of the file continues.
+ * If the primary transfer already failed and waits for the result
+ * of the hedge, it is tried again (or it fails if no more mirrors could
+ * be tried). The transfer_err is consumed.
  */
-static gdouble
-mirror_rank(LrMirror *mirror)
+static void
+hedge_failed(LrDownload *dd,
+             LrTarget *hedge,
+             GError *transfer_err,
+             GError **fail_fast_error)
 {
-    gdouble rank = -1.0;
-
-    int successful = mirror->successful_transfers;
-    int failed = mirror->failed_transfers;
-    int finished_transfers = successful + failed;
-
-    if (finished_transfers < 3)
-        return rank; // Do not judge too early
+    LrTarget *target = hedge->primary;
+
+    g_debug("%s: Hedge of %s failed: %s", __func__,
+            target->target->path, transfer_err->message);
+
+    hedge->state = LR_DS_FAILED;
+    abort_hedge(dd, target);  // Removes the file of the hedge
+
+    // Mirror of the hedge is not tried again by the primary transfer
+    set_mirror_tried(target, hedge->mirror);
+
+    if (hedge->cb_return_code == LR_CB_ERROR) {
+        // Downloading was aborted by a callback
+        target->cb_return_code = LR_CB_ERROR;
+        if (target->state == LR_DS_WAITING)
+            g_queue_remove(waiting_targets_queue(dd, target), target);
+        else if (target->curl_handle)
+            stop_transfer(dd, target);
+        target_failed(dd, target, transfer_err, fail_fast_error);
+        return;
+    }
 
-    rank = successful / (double) finished_transfers;
+    if (target->state == LR_DS_RUNNING && !target->curl_handle) {
+        // The primary transfer already failed and waits for the hedge
+        if (dd->max_mirrors_to_try <= 0
+            || target->tried_mirrors_count < (guint) dd->max_mirrors_to_try)
+        {
+            // Try another mirror
+            set_target_waiting(dd, target, TRUE);
+            g_error_free(transfer_err);
+        } else {
+            target_failed(dd, target, transfer_err, fail_fast_error);
+        }
+        return;
+    }
 
-    return rank;
+    // The primary transfer is still running or waiting
+    g_error_free(transfer_err);
 }
 
 
-/** Sort mirrors. Penalize the error ones.
- * In fact only move the current finished mirror forward or backward
- * by one position.
- * @param mirrors   GSList of mirrors (order of list elements won't be
- *                  changed, only data pointers)
- * @param mirror    Mirror of just finished transfer
- * @param success   Was download from the mirror successful
- * @param serious   If success is FALSE, serious mean that error was serious
- *                  (like connection timeout), and the mirror should be
- *                  penalized more that usual.
+/** Use the successfully downloaded file of the hedge as the file of its
+ * primary target and stop the primary transfer.
  */
 static gboolean
-sort_mirrors(GSList *mirrors, LrMirror *mirror, gboolean success, gboolean serious)
+hedge_finished(LrDownload *dd,
+               LrTarget *hedge,
+               const char *effective_url,
+               GError **fail_fast_error,
+               GError **err)
 {
-    GSList *elem = mirrors;
-    GSList *prev = NULL;
-    GSList *next = NULL;
-    gdouble rank_cur;
-
-    assert(mirrors);
-    assert(mirror);
+    LrTarget *target = hedge->primary;
 
-    for (; elem && elem->data != mirror; elem = g_slist_next(elem))
-        prev = elem;
+    assert(!err || *err == NULL);
 
-    assert(elem);  // Mirror should always exists in the list of mirrors
+    g_debug("%s: Hedge of %s finished first", __func__, target->target->path);
 
-    next = g_slist_next(elem);
+    hedge->state = LR_DS_FINISHED;
+    target->hedge = NULL;
 
-    if (!success && !next)
-        goto exit; // Penalization not needed - Mirror is already the last one
-    if (success && !prev)
-        goto exit; // Bonus not needed - Mirror is already the first one
+    if (target->state == LR_DS_RUNNING && target->curl_handle)
+        stop_transfer(dd, target);
+    else if (target->state == LR_DS_WAITING)
+        g_queue_remove(waiting_targets_queue(dd, target), target);
 
-    // Serious errors
-    if (serious && mirror->successful_transfers == 0) {
-        // Mirror that encounter a serious error and has no successfull
-        // transfers should be moved at the end of the list
-        // (such mirror is probably down/broken/buggy)
-        GSList *last = g_slist_last(elem);
-        elem->data = last->data;
-        last->data = (gpointer) mirror;
-        g_debug("%s: Mirror %s was moved at the end", __func__, mirror->mirror->url);
-        goto exit; // No more hadling needed
+    if (rename(hedge->hedge_fn, target->target->fn) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot rename %s to %s: %s", hedge->hedge_fn,
+                    target->target->fn, strerror(errno));
+        target->state = LR_DS_FAILED;
+        target_done(dd, target);
+        return FALSE;
     }
 
-    // Calculate ranks
-    rank_cur  = mirror_rank(mirror);
-    if (rank_cur < 0.0)
-        goto exit; // Too early to judge
+    g_free(hedge->hedge_fn);
+    hedge->hedge_fn = NULL;
 
+    target->mirror = hedge->mirror;
+    target->verified_checksum = hedge->verified_checksum;
+    target_finished(dd, target, effective_url, fail_fast_error);
 
-    if (!success) {
-        // Penalize
-        gdouble rank_next = mirror_rank(next->data);
-        if (rank_next < 0.0 || rank_next > rank_cur) {
-            elem->data = next->data;
-            next->data = (gpointer) mirror;
-            g_debug("%s: Mirror %s was penalized", __func__, mirror->mirror->url);
-        }
-    } else {
-        // Bonus
-        gdouble rank_prev = mirror_rank(prev->data);
-        if (rank_prev < rank_cur) {
-            elem->data = prev->data;
-            prev->data = mirror;
-            g_debug("%s: Mirror %s was awarded", __func__, mirror->mirror->url);
-        }
-    }
+    return TRUE;
+}
 
-exit:
-    if (g_getenv("LIBREPO_DEBUG_ADAPTIVEMIRRORSORTING")) {
-        // Debug
-        g_debug("%s: Updated order of mirrors (for %p):", __func__, mirrors);
-        for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
-            LrMirror *m = elem->data;
-            g_debug(" %s (s: %d f: %d)", m->mirror->url,
-                   m->successful_transfers, m->failed_transfers);
+
+/** Add the curl handles of the transfers whose local files are copied
+ * to the multi handle. If a copy failed, the file is transferred
+ * by libcurl as usual.
+ */
+static void
+check_local_copies(LrDownload *dd)
+{
+    char buf[64];
+
+    if (dd->wakeup_fds[0] == -1)
+        return;
+
+    // The pipe is emptied first (also of the wakeups of stopped copies),
+    // a copy finished later wakes up the next waiting
+    while (read(dd->wakeup_fds[0], buf, sizeof(buf)) > 0)
+        ;
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+
+        if (!target->copy || !g_atomic_int_get(&target->copy->done))
+            continue;
+
+        if (!finish_local_copy(dd, target)) {
+            // Drop the partially copied data, libcurl downloads the file
+            int fd = fileno(target->f);
+            if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1)
+                g_warning("%s: Cannot truncate the target file: %s",
+                          __func__, strerror(errno));
+            target->local_copy = FALSE;
+            curl_easy_setopt(target->curl_handle, CURLOPT_NOBODY, 0L);
+            prepare_checksum_ctxs(target, fd, 0);
+            prepare_decompressor(target, 0);
         }
-    }
 
-    return TRUE;
+        curl_multi_add_handle(dd->multi_handle, target->curl_handle);
+    }
 }
 
 
@@ -1493,6 +4572,8 @@ check_transfer_statuses(LrDownload *dd, GError **err)
     int msgs_in_queue;
     CURLMsg *msg;
 
+    check_local_copies(dd);
+
     while ((msg = curl_multi_info_read(dd->multi_handle, &msgs_in_queue))) {
         LrTarget *target = NULL;
         char *effective_url = NULL;
@@ -1502,6 +4583,7 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         GError *tmp_err = NULL;
         gboolean ret;
         gboolean serious_error = FALSE;
+        gboolean throttled = FALSE;
         gboolean fatal_error = FALSE;
         GError *fail_fast_error = NULL;
 
@@ -1511,15 +4593,12 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         }
 
         // Find the target with this curl easy handle
-        for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-            LrTarget *ltarget = elem->data;
-            if (ltarget->curl_handle == msg->easy_handle)
-                target = ltarget;
-        }
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &target);
 
         assert(target);  // Each easy handle used in the multi handle
                          // should always belong to some target from
                          // the running_transfers list
+        assert(target->curl_handle == msg->easy_handle);
 
         curl_easy_getinfo(msg->easy_handle,
                           CURLINFO_EFFECTIVE_URL,
@@ -1543,13 +4622,28 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         if (transfer_err)  // Transfer was unsuccessful
             goto transfer_error;
 
+        if (target->target->notmodified)
+            // Nothing was downloaded, there is nothing to check
+            goto transfer_error;
+
+        if (target->parent) {
+            // Segment of a file - the file is checked when all
+            // its segments are downloaded
+            if (target->segment_pos <= target->segment_end)
+                g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                            "Incomplete segment: %"G_GINT64_FORMAT
+                            " bytes of the range were not received",
+                            target->segment_end - target->segment_pos + 1);
+            goto transfer_error;
+        }
+
         //
         // Checksum checking
         //
         fflush(target->f);
         fd = fileno(target->f);
-        ret = check_finished_trasfer_checksum(fd,
-                                              target->target->checksums,
+        ret = check_finished_trasfer_checksum(target,
+                                              fd,
                                               &matches,
                                               &transfer_err,
                                               &tmp_err);
@@ -1569,38 +4663,53 @@ check_transfer_statuses(LrDownload *dd, GError **err)
 
 transfer_error:
 
+        // Update mirror statistics
+        if (target->mirror)
+            update_mirror_stats(target->handle_mirrors,
+                                target->mirror,
+                                target->curl_handle,
+                                transfer_err == NULL,
+                                serious_error);
+        if (target->mirror)
+            throttled = update_mirror_window(dd,
+                                             target->mirror,
+                                             target->curl_handle,
+                                             transfer_err == NULL,
+                                             serious_error);
+
         //
         // Cleanup
         //
-        curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
-        curl_easy_cleanup(target->curl_handle);
-        target->curl_handle = NULL;
+        release_easy_handle(dd, target);
         g_free(target->headercb_interrupt_reason);
         target->headercb_interrupt_reason = NULL;
-        fclose(target->f);
-        target->f = NULL;
+        if (target->f) {  // Segments don't have their own file
+            fclose(target->f);
+            target->f = NULL;
+        }
+        checksum_ctxs_free(target);
+        decompressor_free(target);
 
         dd->running_transfers = g_slist_remove(dd->running_transfers,
                                                (gconstpointer) target);
-        target->tried_mirrors = g_slist_append(target->tried_mirrors,
-                                               target->mirror);
+        // A mirror that throttled the transfer is tried again
+        // with the reduced window (the content store isn't a mirror)
+        if (!throttled && !target->storedpath)
+            set_mirror_tried(target, target->mirror);
+        if (target->mirror)
+            target->mirror->running_transfers--;
+        if (target->primary)
+            dd->hedge_bytes += target->writecb_recieved;
 
         if (transfer_err) {  // There was an error during transfer
             int complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
-            guint num_of_tried_mirrors = g_slist_length(target->tried_mirrors);
+            guint num_of_tried_mirrors = target->tried_mirrors_count;
 
             g_debug("%s: Error during transfer: %s", __func__, transfer_err->message);
 
-            // Update mirror statistics
-            if (target->mirror) {
-                target->mirror->failed_transfers++;
-                if (dd->adaptivemirrorsorting)
-                    sort_mirrors(target->lrmirrors, target->mirror, FALSE, serious_error);
-            }
-
             // Call mirrorfailure callback
             LrMirrorFailureCb mf_cb =  target->target->mirrorfailurecb;
-            if (mf_cb) {
+            if (mf_cb && !target->storedpath) {
                 int rc = mf_cb(target->target->cbdata,
                                transfer_err->message,
                                effective_url);
@@ -1623,7 +4732,19 @@ transfer_error:
                 }
             }
 
-            if (!fatal_error &&
+            if (target->primary) {
+                // Hedge is not tried again
+                hedge_failed(dd, target, transfer_err, &fail_fast_error);
+            } else if (target->storedpath) {
+                // The file is downloaded as if it wasn't in the store
+                g_debug("%s: Copy from the content store failed", __func__);
+                g_free(target->storedpath);
+                target->storedpath = NULL;
+                set_target_waiting(dd, target, TRUE);
+                g_error_free(transfer_err);
+                if (!truncate_transfer_file(target, err))
+                    return FALSE;
+            } else if (!fatal_error &&
                 !complete_url_in_path &&
                 !target->target->baseurl &&
                 (dd->max_mirrors_to_try <= 0 ||
@@ -1631,86 +4752,49 @@ transfer_error:
             {
                 // Try another mirror
                 g_debug("%s: Ignore error - Try another mirror", __func__);
-                target->state = LR_DS_WAITING;
+                set_target_waiting(dd, target, TRUE);
                 g_error_free(transfer_err);  // Ignore the error
 
                 // Truncate file - remove downloaded garbage (error html page etc.)
-                if (!truncate_transfer_file(target, err))
+                // Segment continues from the last received byte
+                if (!target->parent && !truncate_transfer_file(target, err))
+                    return FALSE;
+            } else if (target->parent) {
+                // No more mirrors to try for the segment
+                g_debug("%s: No more retries for the segment (tried: %d)",
+                        __func__, num_of_tried_mirrors);
+                if (!segment_failed(dd, target, transfer_err, fatal_error,
+                                    &fail_fast_error, err))
                     return FALSE;
+            } else if (target->hedge && !fatal_error) {
+                // The file could be still downloaded by its hedge
+                g_debug("%s: No more retries (tried: %d), waiting for "
+                        "the hedge", __func__, num_of_tried_mirrors);
+                target->state = LR_DS_RUNNING;
+                g_error_free(transfer_err);
             } else {
                 // No more mirrors to try or baseurl used or fatal error
                 g_debug("%s: No more retries (tried: %d)",
                         __func__, num_of_tried_mirrors);
-                target->state = LR_DS_FAILED;
-
-                // Call end callback
-                LrEndCb end_cb =  target->target->endcb;
-                if (end_cb) {
-                    int rc = end_cb(target->target->cbdata,
-                                    LR_TRANSFER_ERROR,
-                                    transfer_err->message);
-                    if (rc == LR_CB_ERROR) {
-                        target->cb_return_code = LR_CB_ERROR;
-                        g_debug("%s: Downloading was aborted by LR_CB_ERROR "
-                                "from end callback", __func__);
-                    }
-                }
-
-                lr_downloadtarget_set_error(target->target,
-                                            transfer_err->code,
-                                            "Download failed: %s",
-                                            transfer_err->message);
-                if (dd->failfast) {
-                    // Fail fast is enabled, fail on any error
-                    g_propagate_error(&fail_fast_error, transfer_err);
-                } else if (target->cb_return_code == LR_CB_ERROR) {
-                    // Callback returned LR_CB_ERROR, abort the downloading
-                    g_debug("%s: Downloading was aborted by LR_CB_ERROR", __func__);
-                    g_propagate_error(&fail_fast_error, transfer_err);
-                } else {
-                    // Fail fast is disabled and callback doesn't repor serious
-                    // error, so this download is aborted, but other download
-                    // can continue (do not abort whole downloading)
-                    g_error_free(transfer_err);
-                }
+                target_failed(dd, target, transfer_err, &fail_fast_error);
             }
 
         } else {
             // No error encountered, transfer finished successfully
-            target->state = LR_DS_FINISHED;
-            lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
-            if (target->mirror)
-                lr_downloadtarget_set_usedmirror(target->target,
-                                                 target->mirror->mirror->url);
-            lr_downloadtarget_set_effectiveurl(target->target,
-                                               effective_url);
-
-            // Remove xattr that states that the file is being downloaded
-            // by librepo, because the file is now completly downloaded
-            // and the xattr is not needed (is is useful only for resuming)
-            remove_librepo_xattr(target->target->fd);
-
-            // Call end callback
-            LrEndCb end_cb = target->target->endcb;
-            if (end_cb) {
-                int rc = end_cb(target->target->cbdata,
-                                LR_TRANSFER_SUCCESSFUL,
-                                NULL);
-                if (rc == LR_CB_ERROR) {
-                    target->cb_return_code = LR_CB_ERROR;
-                    g_debug("%s: Downloading was aborted by LR_CB_ERROR "
-                            "from end callback", __func__);
-                    g_set_error(&fail_fast_error, LR_DOWNLOADER_ERROR,
-                                LRE_CBINTERRUPTED,
-                                "Interupted by LR_CB_ERROR from end callback");
-                }
-            }
+            if (target->target->conditional && !target->parent)
+                store_validators(target);
 
-            // Update mirror statistics
-            if (target->mirror) {
-                target->mirror->successful_transfers++;
-                if (dd->adaptivemirrorsorting)
-                    sort_mirrors(target->lrmirrors, target->mirror, TRUE, serious_error);
+            if (target->parent) {
+                if (!segment_finished(dd, target, effective_url,
+                                      &fail_fast_error, err))
+                    return FALSE;
+            } else if (target->primary) {
+                if (!hedge_finished(dd, target, effective_url,
+                                    &fail_fast_error, err))
+                    return FALSE;
+            } else {
+                abort_hedge(dd, target);
+                target_finished(dd, target, effective_url, &fail_fast_error);
             }
         }
 
@@ -1730,8 +4814,11 @@ transfer_error:
 }
 
 
+/** Main downloading loop based on curl_multi_fdset() and select().
+ * This is a fallback used if the event driven loop is not available.
+ */
 static gboolean
-lr_perform(LrDownload *dd, GError **err)
+lr_perform_select(LrDownload *dd, GError **err)
 {
     CURLMcode cm_rc;    // CurlM_ReturnCode
     int still_running;
@@ -1750,17 +4837,15 @@ lr_perform(LrDownload *dd, GError **err)
         return FALSE;
     }
 
-    if (lr_interrupt) {
-        // Check interrupt after each call of curl_multi_perform
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                    "Interrupted by signal");
+    // Check interrupt after each call of curl_multi_perform
+    if (download_interrupted(dd, err))
         return FALSE;
-    }
 
     while (dd->running_transfers) {
         int rc;
         int maxfd = -1;
         long curl_timeout = -1;
+        long max_timeout = loop_timeout(dd);
         struct timeval timeout;
         fd_set fdread, fdwrite, fdexcep;
 
@@ -1788,6 +4873,13 @@ lr_perform(LrDownload *dd, GError **err)
                 timeout.tv_usec = (curl_timeout % 1000) * 1000;
         }
 
+        // Paused transfers are resumed by distribute_bandwidth()
+        // and the parallel downloads are tuned by download_tick()
+        if (timeout.tv_sec * 1000 + timeout.tv_usec / 1000 > max_timeout) {
+            timeout.tv_sec = max_timeout / 1000;
+            timeout.tv_usec = (max_timeout % 1000) * 1000;
+        }
+
         // Get file descriptors from the transfers
         cm_rc = curl_multi_fdset(dd->multi_handle, &fdread, &fdwrite,
                                  &fdexcep, &maxfd);
@@ -1798,6 +4890,10 @@ lr_perform(LrDownload *dd, GError **err)
             return FALSE;
         }
 
+        // Cancellation of a token or a finished copy wakes up
+        // the select() immediately
+        wakeup_fdset(dd, &fdread, &maxfd);
+
         rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
         if (rc < 0) {
             if (errno == EINTR) {
@@ -1819,27 +4915,23 @@ lr_perform(LrDownload *dd, GError **err)
         // then the next iteration of main downloding loop cause a 1sec
         // waiting on the select() call.
         do {
+            download_tick(dd);
+
             // Check if any handle finished and potentialy add one or more
             // waiting downloads to the multi_handle.
             rc = check_transfer_statuses(dd, err);
             if (!rc)
                 return FALSE;
 
-            if (lr_interrupt) {
-                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                            "Interrupted by signal");
+            if (download_interrupted(dd, err))
                 return FALSE;
-            }
 
             // Do curl_multi_perform()
             do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
                 cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
-                if (lr_interrupt) {
-                    // Check interrupt after each call of curl_multi_perform
-                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                                "Interrupted by signal");
+                // Check interrupt after each call of curl_multi_perform
+                if (download_interrupted(dd, err))
                     return FALSE;
-                }
             } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
 
             if (cm_rc != CURLM_OK) {
@@ -1848,70 +4940,399 @@ lr_perform(LrDownload *dd, GError **err)
                             curl_multi_strerror(cm_rc));
                 return FALSE;
             }
-        } while (still_running == 0 && dd->running_transfers);
+        } while (still_running == 0 && dd->running_transfers
+                 && !dd->local_copies);
     }
 
     return check_transfer_statuses(dd, err);
 }
 
-gboolean
-lr_download(GSList *targets,
-            gboolean failfast,
-            GError **err)
+#ifdef LR_HAVE_EPOLL
+
+#define LR_EPOLL_MAXEVENTS      64
+
+/** Socket callback for the curl multi handle.
+ * Keeps the epoll set in sync with sockets curl is interested in.
+ */
+static int
+lr_multi_socketcb(G_GNUC_UNUSED CURL *easy,
+                  curl_socket_t s,
+                  int what,
+                  void *userp,
+                  G_GNUC_UNUSED void *socketp)
 {
-    gboolean ret = FALSE;
-    LrDownload dd;             // dd stands for Download Data
-    GError *tmp_err = NULL;
+    LrDownload *dd = userp;
+    struct epoll_event ev;
 
-    assert(!err || *err == NULL);
+    if (what == CURL_POLL_REMOVE) {
+        // The socket could be already closed by curl, ignore errors
+        epoll_ctl(dd->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = s;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)
+        ev.events |= EPOLLIN;
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT)
+        ev.events |= EPOLLOUT;
+
+    if (epoll_ctl(dd->epoll_fd, EPOLL_CTL_MOD, s, &ev) == -1) {
+        if (errno != ENOENT
+            || epoll_ctl(dd->epoll_fd, EPOLL_CTL_ADD, s, &ev) == -1)
+        {
+            g_debug("%s: epoll_ctl() for socket %d failed: %s",
+                    __func__, (int) s, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/** Timer callback for the curl multi handle.
+ * Arms (or disarms if timeout_ms is -1) the timerfd.
+ */
+static int
+lr_multi_timercb(G_GNUC_UNUSED CURLM *multi, long timeout_ms, void *userp)
+{
+    LrDownload *dd = userp;
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (timeout_ms > 0) {
+        its.it_value.tv_sec  = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    } else if (timeout_ms == 0) {
+        // Zero it_value would disarm the timer, expire it as soon as possible
+        its.it_value.tv_nsec = 1;
+    }
+
+    if (timerfd_settime(dd->timer_fd, 0, &its, NULL) == -1) {
+        g_debug("%s: timerfd_settime() failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/** Prepare epoll set and timerfd and register socket and timer callbacks
+ * to the multi handle. On failure, the select() loop is used.
+ * Must be called before any easy handle is added to the multi handle.
+ */
+static void
+lr_multi_epoll_init(LrDownload *dd)
+{
+    struct epoll_event ev;
+
+    dd->epoll_fd = -1;
+    dd->timer_fd = -1;
+
+    if (g_getenv("LIBREPO_DEBUG_SELECTLOOP")) {
+        g_debug("%s: LIBREPO_DEBUG_SELECTLOOP is set - using select()", __func__);
+        return;
+    }
+
+    dd->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (dd->epoll_fd == -1) {
+        g_debug("%s: epoll_create1() failed: %s", __func__, strerror(errno));
+        goto fallback;
+    }
+
+    dd->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (dd->timer_fd == -1) {
+        g_debug("%s: timerfd_create() failed: %s", __func__, strerror(errno));
+        goto fallback;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = dd->timer_fd;
+    if (epoll_ctl(dd->epoll_fd, EPOLL_CTL_ADD, dd->timer_fd, &ev) == -1) {
+        g_debug("%s: epoll_ctl() failed: %s", __func__, strerror(errno));
+        goto fallback;
+    }
+
+    // Cancellation of a token wakes up the waiting immediately
+    for (GSList *elem = dd->cancel_tokens; elem; elem = g_slist_next(elem)) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = lr_cancel_token_get_fd(elem->data);
+        if (epoll_ctl(dd->epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+            g_debug("%s: epoll_ctl() failed: %s", __func__, strerror(errno));
+            goto fallback;
+        }
+    }
+
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETFUNCTION, lr_multi_socketcb);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETDATA, dd);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERFUNCTION, lr_multi_timercb);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERDATA, dd);
+    return;
+
+fallback:
+    g_debug("%s: Event driven loop is not available - using select()", __func__);
+    if (dd->timer_fd != -1)
+        close(dd->timer_fd);
+    if (dd->epoll_fd != -1)
+        close(dd->epoll_fd);
+    dd->epoll_fd = -1;
+    dd->timer_fd = -1;
+}
+
+/** Tell curl about an activity on a socket (or about an expired timeout
+ * if sockfd is CURL_SOCKET_TIMEOUT).
+ */
+static gboolean
+lr_multi_socket_action(LrDownload *dd,
+                       curl_socket_t sockfd,
+                       int ev_bitmask,
+                       GError **err)
+{
+    CURLMcode cm_rc;
+    int still_running;
+
+    do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
+        cm_rc = curl_multi_socket_action(dd->multi_handle, sockfd,
+                                         ev_bitmask, &still_running);
+    } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
 
-    if (lr_interrupt) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                    "Interrupted by signal");
+    if (cm_rc != CURLM_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_socket_action() error: %s",
+                    curl_multi_strerror(cm_rc));
         return FALSE;
     }
 
-    if (!targets) {
-        g_debug("%s: No targets", __func__);
-        return TRUE;
+    return TRUE;
+}
+
+/** Wait (at most timeout_ms) for activity on the sockets of the running
+ * transfers or for the curl timer and pass it to curl.
+ */
+static gboolean
+lr_epoll_dispatch(LrDownload *dd, int timeout_ms, GError **err)
+{
+    struct epoll_event events[LR_EPOLL_MAXEVENTS];
+    int nfds;
+
+    nfds = epoll_wait(dd->epoll_fd, events, LR_EPOLL_MAXEVENTS, timeout_ms);
+    if (nfds < 0) {
+        if (errno == EINTR) {
+            g_debug("%s: epoll_wait() interrupted by signal", __func__);
+            return TRUE;
+        }
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_SELECT,
+                    "epoll_wait() error: %s", strerror(errno));
+        return FALSE;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        curl_socket_t sockfd = events[i].data.fd;
+        int ev_bitmask = 0;
+
+        if (is_cancel_token_fd(dd, sockfd) || sockfd == dd->wakeup_fds[0])
+            continue;  // Checked by the caller
+
+        if (sockfd == dd->timer_fd) {
+            guint64 expirations;
+            if (read(dd->timer_fd, &expirations, sizeof(expirations)) == -1
+                && errno != EAGAIN)
+            {
+                g_debug("%s: read() from timerfd failed: %s",
+                        __func__, strerror(errno));
+            }
+            sockfd = CURL_SOCKET_TIMEOUT;
+        } else {
+            if (events[i].events & EPOLLIN)
+                ev_bitmask |= CURL_CSELECT_IN;
+            if (events[i].events & EPOLLOUT)
+                ev_bitmask |= CURL_CSELECT_OUT;
+            if (events[i].events & (EPOLLERR|EPOLLHUP))
+                ev_bitmask |= CURL_CSELECT_ERR;
+        }
+
+        if (!lr_multi_socket_action(dd, sockfd, ev_bitmask, err))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Event driven downloading loop.
+ * Only sockets which are ready are passed to curl and the cost of
+ * a wakeup doesn't depend on the number of running transfers.
+ * There is also no FD_SETSIZE limitation.
+ */
+static gboolean
+lr_perform_epoll(LrDownload *dd, GError **err)
+{
+    assert(dd);
+    assert(dd->epoll_fd != -1);
+    assert(!err || *err == NULL);
+
+    // Kick off transfers that were already added to the multi handle
+    if (!lr_multi_socket_action(dd, CURL_SOCKET_TIMEOUT, 0, err))
+        return FALSE;
+
+    while (dd->running_transfers) {
+        if (download_interrupted(dd, err))
+            return FALSE;
+
+        download_tick(dd);
+
+        // Check if any handle finished and potentialy add one or more
+        // waiting downloads to the multi_handle.
+        if (!check_transfer_statuses(dd, err))
+            return FALSE;
+
+        if (!dd->running_transfers)
+            break;
+
+        if (!lr_epoll_dispatch(dd, loop_timeout(dd), err))
+            return FALSE;
     }
 
+    return check_transfer_statuses(dd, err);
+}
+
+#endif // LR_HAVE_EPOLL
+
+static gboolean
+lr_perform(LrDownload *dd, GError **err)
+{
+#ifdef LR_HAVE_EPOLL
+    if (dd->epoll_fd != -1)
+        return lr_perform_epoll(dd, err);
+#endif
+    return lr_perform_select(dd, err);
+}
+
+/** Prepare the download data - the curl multi handle and LrTargets
+ * for all targets.
+ */
+static gboolean
+download_init(LrDownload *dd,
+              GSList *targets,
+              gboolean failfast,
+              GError **err)
+{
+    assert(targets);
+    assert(!err || *err == NULL);
+
     // XXX: Downloader configuration (max parallel connections etc.)
     // is taken from the handle of the first target.
     LrHandle *lr_handle = ((LrDownloadTarget *) targets->data)->handle;
 
     // Prepare download data
-    dd.failfast = failfast;
+    dd->failfast = failfast;
 
     if (lr_handle) {
-        dd.max_parallel_connections = lr_handle->maxparalleldownloads;
-        dd.max_connection_per_host = lr_handle->maxdownloadspermirror;
-        dd.max_mirrors_to_try = lr_handle->maxmirrortries;
-        dd.max_speed = lr_handle->maxspeed;
-        dd.allowed_mirror_failures = lr_handle->allowed_mirror_failures;
-        dd.adaptivemirrorsorting = lr_handle->adaptivemirrorsorting;
+        dd->max_parallel_connections = lr_handle->maxparalleldownloads;
+        dd->max_connection_per_host = lr_handle->maxdownloadspermirror;
+        dd->max_mirrors_to_try = lr_handle->maxmirrortries;
+        dd->max_speed = lr_handle->maxspeed;
+        dd->allowed_mirror_failures = lr_handle->allowed_mirror_failures;
+        dd->adaptivemirrorsorting = lr_handle->adaptivemirrorsorting;
+        dd->max_segments = lr_handle->maxsegments;
+        dd->hedge_budget = lr_handle->hedgebudget;
+        dd->autotune_limit = lr_handle->autotuneparalleldownloads;
+        dd->multiplex = lr_handle->multiplex;
     } else {
         // No handle, this is allowed when a complete URL is passed
         // via relative_url param.
-        dd.max_parallel_connections = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
-        dd.max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
-        dd.max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
-        dd.max_speed = LRO_MAXSPEED_DEFAULT;
-        dd.allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
-        dd.adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
+        dd->max_parallel_connections = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
+        dd->max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
+        dd->max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
+        dd->max_speed = LRO_MAXSPEED_DEFAULT;
+        dd->allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
+        dd->adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
+        dd->max_segments = LRO_MAXSEGMENTS_DEFAULT;
+        dd->hedge_budget = LRO_HEDGEBUDGET_DEFAULT;
+        dd->autotune_limit = LRO_AUTOTUNEPARALLELDOWNLOADS_DEFAULT;
+        dd->multiplex = LRO_MULTIPLEX_DEFAULT;
     }
 
-    dd.multi_handle = curl_multi_init();
-    if (!dd.multi_handle) {
+    dd->interruptible = FALSE;
+    dd->cancel_tokens = NULL;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *dtarget = elem->data;
+        LrCancelToken *token;
+        if (!dtarget->handle)
+            continue;
+        if (dtarget->handle->interruptible)
+            dd->interruptible = TRUE;
+        token = dtarget->handle->cancel_token;
+        if (token && !g_slist_find(dd->cancel_tokens, token))
+            dd->cancel_tokens = g_slist_prepend(dd->cancel_tokens, token);
+    }
+
+    if (dd->interruptible && !lr_interruptible_begin(&dd->sigint_count)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_SIGACTION,
+                    "Cannot set Librepo SIGINT handler");
+        g_slist_free(dd->cancel_tokens);
+        dd->cancel_tokens = NULL;
+        return FALSE;
+    }
+
+    dd->multi_handle = curl_multi_init();
+    if (!dd->multi_handle) {
         // Something went wrong
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
                     "curl_multi_init() call failed");
+        if (dd->interruptible)
+            lr_interruptible_end();
+        g_slist_free(dd->cancel_tokens);
+        dd->cancel_tokens = NULL;
         return FALSE;
     }
 
+    if (dd->multiplex) {
+#if LR_CURL_VERSION_CHECK(7, 43, 0)
+        // Transfers to the same host share a connection as HTTP/2 streams.
+        // The number of streams per mirror is not limited by
+        // LRO_MAXDOWNLOADSPERMIRROR (see mirror_window_limit()), it limits
+        // the connections instead. Transfers over the limit wait in curl
+        // for a free connection of a mirror that doesn't multiplex.
+        curl_multi_setopt(dd->multi_handle, CURLMOPT_PIPELINING,
+                          CURLPIPE_MULTIPLEX);
+        if (dd->max_connection_per_host != -1)
+            curl_multi_setopt(dd->multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS,
+                              (long) dd->max_connection_per_host);
+#else
+        g_debug("%s: LRO_MULTIPLEX is not supported by this libcurl",
+                __func__);
+        dd->multiplex = FALSE;
+#endif
+    }
+
+    // Event driven loop must be set up before the first easy handle
+    // is added to the multi handle
+    dd->epoll_fd = -1;
+    dd->timer_fd = -1;
+#ifdef LR_HAVE_EPOLL
+    lr_multi_epoll_init(dd);
+#endif
+    dd->wakeup_fds[0] = dd->wakeup_fds[1] = -1;
+    dd->local_copies = 0;
+
     // Prepare list of LrTargets and LrHandleMirrors
-    dd.handle_mirrors = NULL;
-    dd.targets = NULL;
+    dd->handle_mirrors = NULL;
+    dd->targets = NULL;
+    dd->total_bytes = 0;
+    dd->hedge_bytes = 0;
+    dd->autotune_time = 0;
+    dd->autotune_bytes = 0;
+    dd->autotune_goodput = 0.0;
+    dd->autotune_saturated = FALSE;
+    dd->autotune_slow_start = TRUE;
+    dd->autotune_prev_limit = 0;
+    dd->bandwidth_time = 0;
+    dd->contentstore_handles = NULL;
+    if (dd->autotune_limit)
+        dd->max_parallel_connections = MIN(dd->max_parallel_connections,
+                                          dd->autotune_limit);
+    g_queue_init(&dd->waiting_targets);
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
         LrDownloadTarget *dtarget = elem->data;
 
@@ -1928,48 +5349,69 @@ lr_download(GSList *targets,
 
         // Create and fill LrTarget
         LrTarget *target = lr_malloc0(sizeof(*target));
-        target->state           = LR_DS_WAITING;
         target->target          = dtarget;
         target->original_offset = -1;
         target->resume          = dtarget->resume;
         target->target->rcode   = LRE_UNFINISHED;
         target->target->err     = "Not finished";
         target->handle          = dtarget->handle;
-        dd.targets = g_slist_append(dd.targets, target);
-        // Add list of handle internal mirrors to dd.handle_mirrors
+        dd->targets = g_slist_prepend(dd->targets, target);
+        if (dtarget->expectedsize > 0)
+            dd->total_bytes += dtarget->expectedsize;
+        // Add list of handle internal mirrors to dd->handle_mirrors
         // if doesn't exists yet and set the list reference
         // to the target.
-        dd.handle_mirrors = lr_prepare_lrmirrors(dd.handle_mirrors, target);
+        dd->handle_mirrors = lr_prepare_lrmirrors(dd->handle_mirrors, target);
+        // Add the target to the end of its queue of waiting targets
+        set_target_waiting(dd, target, FALSE);
     }
+    // Targets (and their callbacks) keep the order of the list
+    dd->targets = g_slist_reverse(dd->targets);
 
-    dd.running_transfers = NULL;
-
-    // Prepare the first set of transfers
-    if (!prepare_next_transfers(&dd, &tmp_err))
-        goto lr_download_cleanup;
-
-    // Perform!
-    g_debug("%s: Downloading started", __func__);
-    ret = lr_perform(&dd, &tmp_err);
+    // Mirrors start with the full concurrency window, it is reduced only
+    // when a mirror fails or throttles the downloads
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        for (GSList *m = handle_mirrors->lrmirrors; m; m = g_slist_next(m)) {
+            LrMirror *mirror = m->data;
+            mirror->window = mirror_window_limit(dd);
+        }
+    }
 
-    assert(ret || tmp_err);
+    dd->running_transfers = NULL;
+    g_queue_init(&dd->finished_targets);
 
-lr_download_cleanup:
+    return TRUE;
+}
 
+/** Stop all running transfers if the downloading was interrupted
+ * by the tmp_err (which is consumed and moved to err) and free
+ * the download data. Files of unfinished targets are removed.
+ */
+static void
+download_cleanup(LrDownload *dd, GError *tmp_err, GError **err)
+{
     if (tmp_err) {
         // If there was an error, stop all transfers that are in progress.
         g_debug("%s: Error while downloading: %s", __func__, tmp_err->message);
 
-        for (GSList *elem = dd.running_transfers; elem; elem = g_slist_next(elem)){
+        for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)){
             LrTarget *target = elem->data;
 
-            curl_multi_remove_handle(dd.multi_handle, target->curl_handle);
-            curl_easy_cleanup(target->curl_handle);
-            target->curl_handle = NULL;
-            fclose(target->f);
-            target->f = NULL;
+            release_easy_handle(dd, target);
             g_free(target->headercb_interrupt_reason);
             target->headercb_interrupt_reason = NULL;
+            checksum_ctxs_free(target);
+            decompressor_free(target);
+
+            if (target->parent)
+                continue;  // Segment - its parent is handled below
+
+            fclose(target->f);
+            target->f = NULL;
+
+            if (target->primary)
+                continue;  // Hedge - its file is removed below
 
             // Call end callback
             LrEndCb end_cb =  target->target->endcb;
@@ -1985,36 +5427,120 @@ lr_download_cleanup:
             lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
                     "Not finished - interrupted by error: %s",
                     tmp_err->message);
+            target->state = LR_DS_FAILED;
+            target_done(dd, target);
         }
 
-        g_slist_free(dd.running_transfers);
-        dd.running_transfers = NULL;
+        g_slist_free(dd->running_transfers);
+        dd->running_transfers = NULL;
+
+        // Targets which are being downloaded by segments or which
+        // wait for their hedges
+        for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
+            LrTarget *target = elem->data;
+
+            if (target->state != LR_DS_RUNNING
+                || target->parent
+                || target->primary
+                || (!target->f && !target->hedge))
+                continue;
+
+            target->state = LR_DS_FAILED;
+            target_done(dd, target);
+            if (target->f) {
+                fclose(target->f);
+                target->f = NULL;
+            }
+            g_slist_free(target->segments);
+            target->segments = NULL;
+
+            // Call end callback
+            LrEndCb end_cb =  target->target->endcb;
+            if (end_cb) {
+                gchar *msg = g_strdup_printf("Not finished - interrupted by "
+                                             "error: %s", tmp_err->message);
+                end_cb(target->target->cbdata, LR_TRANSFER_ERROR, msg);
+                g_free(msg);
+            }
+
+            lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
+                    "Not finished - interrupted by error: %s",
+                    tmp_err->message);
+        }
 
         g_propagate_error(err, tmp_err);
     }
 
-    assert(dd.running_transfers == NULL);
-
-    curl_multi_cleanup(dd.multi_handle);
+    assert(dd->running_transfers == NULL);
+
+    curl_multi_cleanup(dd->multi_handle);
+    if (dd->interruptible)
+        lr_interruptible_end();
+    g_slist_free(dd->cancel_tokens);
+    dd->cancel_tokens = NULL;
+    if (dd->timer_fd != -1)
+        close(dd->timer_fd);
+    if (dd->epoll_fd != -1)
+        close(dd->epoll_fd);
+    if (dd->wakeup_fds[0] != -1) {
+        close(dd->wakeup_fds[0]);
+        close(dd->wakeup_fds[1]);
+    }
 
-    // Clean up dd.handle_mirrors
-    for (GSList *elem = dd.handle_mirrors; elem; elem = g_slist_next(elem)) {
+    // Clean up dd->handle_mirrors
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
         LrHandleMirrors *handle_mirrors = elem->data;
+        LrHandle *handle = handle_mirrors->handle;
+        GSList *mirrorstats = NULL;
         for (GSList *el = handle_mirrors->lrmirrors; el; el = g_slist_next(el)) {
             LrMirror *mirror = el->data;
+            if (handle)
+                mirrorstats = g_slist_prepend(mirrorstats,
+                                              mirror_stats_new(dd, mirror));
             lr_free(mirror);
         }
+        if (handle) {
+            // Keep statistics of mirrors of the last download
+            lr_mirrorstatslist_free(handle->mirrorstats);
+            handle->mirrorstats = g_slist_reverse(mirrorstats);
+        }
         g_slist_free(handle_mirrors->lrmirrors);
+        g_queue_clear(&handle_mirrors->waiting_targets);
+        g_slist_free_full(handle_mirrors->easy_handles,
+                          (GDestroyNotify) curl_easy_cleanup);
         lr_free(handle_mirrors);
     }
-    g_slist_free(dd.handle_mirrors);
+    g_slist_free(dd->handle_mirrors);
+    g_queue_clear(&dd->waiting_targets);
 
     // Clean up targets
-    for (GSList *elem = dd.targets; elem; elem = g_slist_next(elem)) {
+    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
         LrTarget *target = elem->data;
         assert(target->curl_handle == NULL);
         assert(target->f == NULL);
 
+        if (target->parent) {
+            // Segment - the file belongs to its parent
+            decompressor_free(target);
+            lr_free(target->tried_mirrors);
+            lr_free(target);
+            continue;
+        }
+
+        if (target->primary) {
+            // Hedge - remove its temporary file if it wasn't used
+            if (target->hedge_fn && unlink(target->hedge_fn) != 0
+                && errno != ENOENT)
+                g_debug("%s: Error while removing: %s",
+                        __func__, strerror(errno));
+            g_free(target->hedge_fn);
+            conditional_free(target);
+            decompressor_free(target);
+            lr_free(target->tried_mirrors);
+            lr_free(target);
+            continue;
+        }
+
         // Remove file created for the target if download was
         // unsuccessful and the file doesn't exists before or
         // its original content was overwritten
@@ -2032,14 +5558,468 @@ lr_download_cleanup:
             }
         }
 
-        g_slist_free(target->tried_mirrors);
+        conditional_free(target);
+        decompressor_free(target);
+        g_free(target->storedpath);
+        lr_free(target->tried_mirrors);
         lr_free(target);
     }
-    g_slist_free(dd.targets);
+    g_slist_free(dd->targets);
+
+    // Keep the content stores which got new files in their size limits
+    for (GSList *elem = dd->contentstore_handles; elem; elem = g_slist_next(elem)) {
+        LrHandle *handle = elem->data;
+        lr_contentstore_evict(handle->contentstore,
+                              handle->contentstoremaxsize);
+    }
+    g_slist_free(dd->contentstore_handles);
+}
+
+/** Look up the targets with checksums in the content stores of their
+ * handles. A target found in the store is moved to the head of its
+ * queue and it's copied from the store by its transfer (in a thread,
+ * see start_local_copy()), the downloading loop is not blocked.
+ */
+static void
+lookup_in_contentstores(LrDownload *dd)
+{
+    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        LrDownloadTarget *dtarget = target->target;
+
+        if (target->state != LR_DS_WAITING
+            || !target->handle
+            || !target->handle->contentstore)
+            continue;
+
+        if (dtarget->byterangestart || dtarget->byterangeend
+            || dtarget->conditional
+            || (dtarget->resume && dtarget->fd != -1))
+            continue;  // Not (only) the complete file is wanted
+
+        if (dtarget->decompress)
+            continue;  // Decompressed data are produced by the transfer
+
+        for (GSList *el = dtarget->checksums; el && !target->storedpath; el = g_slist_next(el)) {
+            LrDownloadTargetChecksum *chksum = el->data;
+
+            if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+                continue;  // Bad checksum
+
+            target->storedpath = lr_contentstore_lookup(
+                                        target->handle->contentstore,
+                                        chksum->type,
+                                        chksum->value);
+        }
+
+        if (!target->storedpath)
+            continue;
+
+        g_debug("%s: %s found in the content store: %s",
+                __func__, dtarget->path, target->storedpath);
+
+        g_queue_remove(waiting_targets_queue(dd, target), target);
+        set_target_waiting(dd, target, TRUE);
+        if (dtarget->expectedsize > 0)
+            dd->total_bytes -= dtarget->expectedsize;
+    }
+}
+
+gboolean
+lr_download(GSList *targets,
+            gboolean failfast,
+            GError **err)
+{
+    gboolean ret = FALSE;
+    LrDownload dd;             // dd stands for Download Data
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!targets) {
+        g_debug("%s: No targets", __func__);
+        return TRUE;
+    }
+
+    if (!download_init(&dd, targets, failfast, err))
+        return FALSE;
+
+    // Prepare the first set of transfers
+    lookup_in_contentstores(&dd);
+    if (!download_interrupted(&dd, &tmp_err)
+        && prepare_next_transfers(&dd, &tmp_err)) {
+        // Perform!
+        g_debug("%s: Downloading started", __func__);
+        ret = lr_perform(&dd, &tmp_err);
+    }
+
+    assert(ret || tmp_err);
+
+    download_cleanup(&dd, tmp_err, err);
+    g_queue_clear(&dd.finished_targets);
 
     return ret;
 }
 
+struct _LrDownloadContext {
+    LrDownload dd; /*!<
+        Download data */
+    gboolean running; /*!<
+        TRUE until the downloading is finished and dd is cleaned up */
+    gboolean started; /*!<
+        TRUE if transfers in the multi handle were kicked off */
+};
+
+LrDownloadContext *
+lr_download_context_new(GSList *targets, gboolean failfast, GError **err)
+{
+    LrDownloadContext *ctx;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    ctx = lr_malloc0(sizeof(*ctx));
+    g_queue_init(&ctx->dd.finished_targets);
+
+    if (!targets) {
+        g_debug("%s: No targets", __func__);
+        return ctx;
+    }
+
+    if (!download_init(&ctx->dd, targets, failfast, err)) {
+        lr_free(ctx);
+        return NULL;
+    }
+
+    ctx->running = TRUE;
+
+    // Prepare the first set of transfers
+    lookup_in_contentstores(&ctx->dd);
+    if (download_interrupted(&ctx->dd, &tmp_err)
+        || !prepare_next_transfers(&ctx->dd, &tmp_err)) {
+        download_cleanup(&ctx->dd, tmp_err, err);
+        g_queue_clear(&ctx->dd.finished_targets);
+        lr_free(ctx);
+        return NULL;
+    }
+
+    g_debug("%s: Downloading started", __func__);
+    return ctx;
+}
+
+guint
+lr_download_context_query(LrDownloadContext *ctx,
+                          gint *timeout,
+                          GPollFD *fds,
+                          guint n_fds)
+{
+    LrDownload *dd = &ctx->dd;
+    guint count = 0;
+
+    if (!ctx->running || !ctx->started) {
+        // lr_download_context_process() should be called right away
+        *timeout = 0;
+        return 0;
+    }
+
+    *timeout = loop_timeout(dd);
+
+#ifdef LR_HAVE_EPOLL
+    if (dd->epoll_fd != -1) {
+        // The epoll set (with the curl timer) is readable if any of
+        // the sockets is ready
+        if (n_fds > 0) {
+            fds[0].fd = dd->epoll_fd;
+            fds[0].events = G_IO_IN;
+            fds[0].revents = 0;
+        }
+        return 1;
+    }
+#endif
+
+    int maxfd = -1;
+    long curl_timeout = -1;
+    fd_set fdread, fdwrite, fdexcep;
+
+    FD_ZERO(&fdread);
+    FD_ZERO(&fdwrite);
+    FD_ZERO(&fdexcep);
+
+    if (curl_multi_timeout(dd->multi_handle, &curl_timeout) == CURLM_OK
+        && curl_timeout >= 0 && curl_timeout < *timeout)
+        *timeout = (gint) curl_timeout;
+
+    if (curl_multi_fdset(dd->multi_handle, &fdread, &fdwrite,
+                         &fdexcep, &maxfd) != CURLM_OK)
+        return 0;
+
+    wakeup_fdset(dd, &fdread, &maxfd);
+
+    for (int fd = 0; fd <= maxfd; fd++) {
+        gushort events = 0;
+        if (FD_ISSET(fd, &fdread))
+            events |= G_IO_IN;
+        if (FD_ISSET(fd, &fdwrite))
+            events |= G_IO_OUT;
+        if (FD_ISSET(fd, &fdexcep))
+            events |= G_IO_PRI;
+        if (!events)
+            continue;
+        if (count < n_fds) {
+            fds[count].fd = fd;
+            fds[count].events = events;
+            fds[count].revents = 0;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/** Do one non-blocking step of the downloading. Pass the activity on
+ * the sockets (and expired timeouts) to curl, check finished transfers
+ * and start the next ones.
+ */
+static gboolean
+download_step(LrDownloadContext *ctx, GError **err)
+{
+    LrDownload *dd = &ctx->dd;
+    CURLMcode cm_rc;
+    int still_running;
+
+    if (download_interrupted(dd, err))
+        return FALSE;
+
+#ifdef LR_HAVE_EPOLL
+    if (dd->epoll_fd != -1) {
+        if (!ctx->started) {
+            // Kick off transfers that were already added to the multi handle
+            ctx->started = TRUE;
+            if (!lr_multi_socket_action(dd, CURL_SOCKET_TIMEOUT, 0, err))
+                return FALSE;
+        }
+
+        if (!lr_epoll_dispatch(dd, 0, err))
+            return FALSE;
+
+        download_tick(dd);
+        return check_transfer_statuses(dd, err);
+    }
+#endif
+
+    ctx->started = TRUE;
+
+    // See lr_perform_select() for why this is a loop
+    do {
+        do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
+            cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
+        } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
+
+        if (cm_rc != CURLM_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                        "curl_multi_perform() error: %s",
+                        curl_multi_strerror(cm_rc));
+            return FALSE;
+        }
+
+        download_tick(dd);
+
+        if (!check_transfer_statuses(dd, err))
+            return FALSE;
+    } while (still_running == 0 && dd->running_transfers
+             && !dd->local_copies);
+
+    return TRUE;
+}
+
+gboolean
+lr_download_context_process(LrDownloadContext *ctx, GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(ctx);
+    assert(!err || *err == NULL);
+
+    if (!ctx->running)
+        return TRUE;
+
+    if (!download_step(ctx, &tmp_err)) {
+        ctx->running = FALSE;
+        download_cleanup(&ctx->dd, tmp_err, err);
+        return FALSE;
+    }
+
+    if (!ctx->dd.running_transfers) {
+        g_debug("%s: Downloading finished", __func__);
+        ctx->running = FALSE;
+        download_cleanup(&ctx->dd, NULL, NULL);
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_download_context_is_finished(LrDownloadContext *ctx)
+{
+    return !ctx->running;
+}
+
+GSList *
+lr_download_context_get_finished(LrDownloadContext *ctx)
+{
+    GSList *list = NULL;
+    LrDownloadTarget *target;
+
+    while ((target = g_queue_pop_tail(&ctx->dd.finished_targets)))
+        list = g_slist_prepend(list, target);
+
+    return list;
+}
+
+void
+lr_download_context_free(LrDownloadContext *ctx)
+{
+    if (!ctx)
+        return;
+
+    if (ctx->running) {
+        GError *tmp_err = NULL;
+        g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Downloading was cancelled");
+        download_cleanup(&ctx->dd, tmp_err, NULL);
+    }
+
+    g_queue_clear(&ctx->dd.finished_targets);
+    lr_free(ctx);
+}
+
+/** Maximal number of file descriptors polled by LrDownloadSource */
+#define LR_DOWNLOAD_SOURCE_MAXFDS   64
+
+/** GSource which drives a LrDownloadContext */
+typedef struct {
+    GSource source;
+    LrDownloadContext *ctx; /*!<
+        Download context (not owned by the source) */
+    GPollFD *fds; /*!<
+        File descriptors added to the source */
+    guint n_fds; /*!<
+        Number of the file descriptors in fds */
+    gint64 deadline; /*!<
+        Monotonic time (in microseconds) when the context should
+        be processed even if none of the fds is ready */
+} LrDownloadSource;
+
+static gboolean
+lr_download_source_prepare(GSource *source, gint *timeout)
+{
+    LrDownloadSource *dsource = (LrDownloadSource *) source;
+    GPollFD fds[LR_DOWNLOAD_SOURCE_MAXFDS];
+    guint n_fds;
+
+    if (!dsource->ctx->running)
+        return TRUE;  // Let the callback know about the end
+
+    n_fds = lr_download_context_query(dsource->ctx, timeout,
+                                      fds, LR_DOWNLOAD_SOURCE_MAXFDS);
+    if (n_fds > LR_DOWNLOAD_SOURCE_MAXFDS) {
+        // Too many sockets (select() loop only) - poll them regularly
+        n_fds = 0;
+        *timeout = MIN(*timeout, LR_BANDWIDTH_TICK);
+    }
+
+    gboolean changed = (n_fds != dsource->n_fds);
+    for (guint i = 0; !changed && i < n_fds; i++)
+        changed = fds[i].fd != dsource->fds[i].fd
+                  || fds[i].events != dsource->fds[i].events;
+
+    if (changed) {
+        // Set of the file descriptors changed
+        for (guint i = 0; i < dsource->n_fds; i++)
+            g_source_remove_poll(source, &dsource->fds[i]);
+        dsource->fds = g_renew(GPollFD, dsource->fds, n_fds);
+        memcpy(dsource->fds, fds, n_fds * sizeof(GPollFD));
+        dsource->n_fds = n_fds;
+        for (guint i = 0; i < n_fds; i++)
+            g_source_add_poll(source, &dsource->fds[i]);
+    }
+
+    dsource->deadline = g_source_get_time(source)
+                        + (gint64) *timeout * 1000;
+    return *timeout == 0;
+}
+
+static gboolean
+lr_download_source_check(GSource *source)
+{
+    LrDownloadSource *dsource = (LrDownloadSource *) source;
+
+    for (guint i = 0; i < dsource->n_fds; i++)
+        if (dsource->fds[i].revents)
+            return TRUE;
+
+    return g_source_get_time(source) >= dsource->deadline;
+}
+
+static gboolean
+lr_download_source_dispatch(GSource *source,
+                            GSourceFunc callback,
+                            gpointer user_data)
+{
+    LrDownloadSource *dsource = (LrDownloadSource *) source;
+    LrDownloadSourceFunc func = (LrDownloadSourceFunc) callback;
+    LrDownloadContext *ctx = dsource->ctx;
+    GError *tmp_err = NULL;
+    gboolean ret = G_SOURCE_CONTINUE;
+    gboolean finished;
+
+    lr_download_context_process(ctx, &tmp_err);
+    finished = !ctx->running;
+
+    // The callback is allowed to free the context when it's finished
+    if (func && (finished || ctx->dd.finished_targets.length))
+        ret = func(ctx, tmp_err, user_data);
+
+    g_clear_error(&tmp_err);
+    return finished ? G_SOURCE_REMOVE : ret;
+}
+
+static void
+lr_download_source_finalize(GSource *source)
+{
+    LrDownloadSource *dsource = (LrDownloadSource *) source;
+    g_free(dsource->fds);
+}
+
+static GSourceFuncs lr_download_source_funcs = {
+    lr_download_source_prepare,
+    lr_download_source_check,
+    lr_download_source_dispatch,
+    lr_download_source_finalize,
+    NULL,
+    NULL,
+};
+
+GSource *
+lr_download_source_new(LrDownloadContext *ctx)
+{
+    GSource *source;
+    LrDownloadSource *dsource;
+
+    assert(ctx);
+
+    source = g_source_new(&lr_download_source_funcs,
+                          sizeof(LrDownloadSource));
+    g_source_set_name(source, "LrDownloadSource");
+    dsource = (LrDownloadSource *) source;
+    dsource->ctx = ctx;
+    dsource->fds = NULL;
+    dsource->n_fds = 0;
+    dsource->deadline = 0;
+
+    return source;
+}
+
 gboolean
 lr_download_target(LrDownloadTarget *target,
                    GError **err)
@@ -2195,10 +6175,12 @@ lr_download_single_cb(GSList *targets,
         target->mirrorfailurecb = (mfcb) ? lr_multi_mf_func : NULL;
         target->cbdata          = lrcbdata;
 
-        shared_cbdata.singlecbdata = g_slist_append(shared_cbdata.singlecbdata,
-                                                    lrcbdata);
+        shared_cbdata.singlecbdata = g_slist_prepend(shared_cbdata.singlecbdata,
+                                                     lrcbdata);
     }
 
+    shared_cbdata.singlecbdata = g_slist_reverse(shared_cbdata.singlecbdata);
+
     ret = lr_download(targets, failfast, err);
 
     // Remove callbacks and callback data
@@ -35,11 +35,16 @@ G_BEGIN_DECLS
 
 #define LR_DOWNLOADER_MAXIMAL_RESUME_COUNT      1
 
-/** Global variable signalizing if SIGINT was catched.
+/** Number of SIGINT signals catched by Librepo. Interruptible
+ * operations (see LRO_INTERRUPTIBLE) remember its value when they start
+ * and they are interrupted when it changes.
  */
 extern volatile sig_atomic_t lr_interrupt;
 
-/** SIGINT Signal handler.
+/** SIGINT Signal handler. Increments lr_interrupt, i.e. interrupts
+ * all running interruptible operations. Librepo installs its own
+ * handler by itself, this one is useful if an application wants
+ * to forward SIGINT to Librepo from its own handler.
  * @param sig       Signal number.
  */
 void
@@ -102,6 +107,104 @@ lr_download_single_cb(GSList *targets,
                       LrMirrorFailureCb mfcb,
                       GError **err);
 
+/** Download context of a non-blocking download. It allows to drive
+ * the downloading from an external event loop (e.g. GMainLoop) instead
+ * of blocking in ::lr_download.
+ */
+typedef struct _LrDownloadContext LrDownloadContext;
+
+/** Create a new download context and start downloading of the targets.
+ * The function doesn't block, the downloading is driven by
+ * ::lr_download_context_process calls.
+ * @param targets   See ::lr_download
+ * @param failfast  See ::lr_download
+ * @param err       GError **
+ * @return          New download context or NULL if err is set.
+ */
+LrDownloadContext *
+lr_download_context_new(GSList *targets, gboolean failfast, GError **err);
+
+/** Get file descriptors the context waits for and the timeout after
+ * which ::lr_download_context_process should be called even if none
+ * of the file descriptors is ready. Like g_main_context_query(), if
+ * the returned number is greater than n_fds, only n_fds file
+ * descriptors are stored and the call should be repeated with a bigger
+ * array. The set of file descriptors can change after each
+ * ::lr_download_context_process call.
+ * @param ctx       Download context.
+ * @param timeout   Timeout in milliseconds.
+ * @param fds       Array of GPollFD to fill.
+ * @param n_fds     Size of the fds array.
+ * @return          Number of file descriptors to poll.
+ */
+guint
+lr_download_context_query(LrDownloadContext *ctx,
+                          gint *timeout,
+                          GPollFD *fds,
+                          guint n_fds);
+
+/** Process the activity on the file descriptors (the ready ones are
+ * found out by the context itself) and expired timeouts: finish done
+ * transfers and start the next ones. The function doesn't block.
+ * @param ctx       Download context.
+ * @param err       GError **
+ * @return          FALSE if the whole downloading failed (err is set).
+ *                  The context is finished then.
+ *                  See ::lr_download for the meaning of the errors.
+ */
+gboolean
+lr_download_context_process(LrDownloadContext *ctx, GError **err);
+
+/** Check if the downloading is finished (successfully or not).
+ * @param ctx       Download context.
+ * @return          TRUE if there is nothing more to do.
+ */
+gboolean
+lr_download_context_is_finished(LrDownloadContext *ctx);
+
+/** Get targets that were finished (successfully or not) since the last
+ * call of this function. Check rcode of the targets.
+ * @param ctx       Download context.
+ * @return          GSList of ::LrDownloadTarget. Free the list (but not
+ *                  the targets) by g_slist_free().
+ */
+GSList *
+lr_download_context_get_finished(LrDownloadContext *ctx);
+
+/** Free the download context. If the downloading is not finished yet,
+ * it is cancelled and the unfinished targets fail with LRE_UNFINISHED.
+ * @param ctx       Download context or NULL.
+ */
+void
+lr_download_context_free(LrDownloadContext *ctx);
+
+/** Callback of the GSource created by ::lr_download_source_new.
+ * It is called when some targets were finished (use
+ * ::lr_download_context_get_finished) and once when the whole
+ * downloading is finished. The context can be freed by the callback
+ * if it is finished.
+ * @param ctx       Download context.
+ * @param error     NULL or error that made the downloading fail.
+ * @param user_data User data.
+ * @return          G_SOURCE_REMOVE to stop driving the context.
+ *                  The source is removed after the downloading is
+ *                  finished anyway.
+ */
+typedef gboolean (*LrDownloadSourceFunc)(LrDownloadContext *ctx,
+                                         const GError *error,
+                                         gpointer user_data);
+
+/** Create a GSource that drives the download context in a GMainContext.
+ * Set the ::LrDownloadSourceFunc callback by g_source_set_callback()
+ * (cast to GSourceFunc) and attach it by g_source_attach(). Many
+ * downloads can run in a single thread this way. The source doesn't
+ * own the context, the context must exist while the source is attached.
+ * @param ctx       Download context.
+ * @return          New GSource.
+ */
+GSource *
+lr_download_source_new(LrDownloadContext *ctx);
+
 /** @} */
 
 G_END_DECLS
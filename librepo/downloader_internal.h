@@ -0,0 +1,58 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_DOWNLOADER_INTERNAL_H__
+#define __LR_DOWNLOADER_INTERNAL_H__
+
+#include <glib.h>
+#include <signal.h>
+
+G_BEGIN_DECLS
+
+/** Start an interruptible operation (an operation with a handle that
+ * has LRO_INTERRUPTIBLE enabled). The SIGINT handler of librepo is
+ * installed if it isn't installed already. The handler is never
+ * uninstalled, while no interruptible operation is running it passes
+ * SIGINT to the handler which was installed before it.
+ * Every successful call must be paired with ::lr_interruptible_end.
+ * Thread-safe.
+ * @param sigint_count  Set to the current value of lr_interrupt,
+ *                      see ::lr_interrupted.
+ * @return              FALSE if the handler cannot be installed.
+ */
+gboolean
+lr_interruptible_begin(sig_atomic_t *sigint_count);
+
+/** End an interruptible operation started by ::lr_interruptible_begin.
+ */
+void
+lr_interruptible_end(void);
+
+/** Check if a SIGINT was caught since the start of an interruptible
+ * operation.
+ * @param sigint_count  Value set by ::lr_interruptible_begin.
+ * @return              TRUE if the operation should be interrupted.
+ */
+gboolean
+lr_interrupted(sig_atomic_t sigint_count);
+
+G_END_DECLS
+
+#endif
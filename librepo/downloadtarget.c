@@ -106,6 +106,8 @@ lr_downloadtarget_new(LrHandle *handle,
     target->userdata        = userdata;
     target->byterangestart  = byterangestart;
     target->byterangeend    = byterangeend;
+    target->weight          = 1;
+    target->decompressfd    = -1;
 
     return target;
 }
@@ -118,6 +120,7 @@ lr_downloadtarget_reset(LrDownloadTarget *target)
 
     target->usedmirror = NULL;
     target->effectiveurl = NULL;
+    target->notmodified = FALSE;
     target->rcode = LRE_OK;
     target->err = NULL;
 }
@@ -130,6 +133,8 @@ lr_downloadtarget_free(LrDownloadTarget *target)
 
     g_slist_free_full(target->checksums,
                       (GDestroyNotify) lr_downloadtargetchecksum_free);
+    g_slist_free_full(target->checksums_open,
+                      (GDestroyNotify) lr_downloadtargetchecksum_free);
     g_string_chunk_free(target->chunk);
     lr_free(target);
 }
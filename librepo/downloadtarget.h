@@ -130,6 +130,55 @@ typedef struct {
         User data - This data are not used by lr_downloader or touched
         by lr_downloadtarget_free. */
 
+    int weight; /*!<
+        Weight of the target in the distribution of the maximal
+        download speed (LRO_MAXSPEED) among transfers of a single
+        lr_download() call. A target with weight 4 gets four times more
+        bandwidth than a target with weight 1. Bandwidth unused by
+        a target is redistributed among the others.
+        Default value is 1. */
+
+    gboolean conditional; /*!<
+        If TRUE, validators of the file (etag and lastmodified) are
+        filled from the HTTP response. If a validator is already set,
+        the file is requested conditionally (If-None-Match,
+        If-Modified-Since) and the server could reply that the file
+        was not modified (see notmodified). Default value is FALSE. */
+
+    char *etag; /*!<
+        ETag of the file or NULL. Used only if conditional is TRUE. */
+
+    char *lastmodified; /*!<
+        Last modification date of the file as sent by the server
+        (Last-Modified) or NULL. Used only if conditional is TRUE. */
+
+    gboolean notmodified; /*!<
+        TRUE if the server replied to the conditional request that
+        the file was not modified (304). The file was not downloaded
+        then and its validators were kept. */
+
+    gboolean decompress; /*!<
+        If TRUE, the file is decompressed while it's being downloaded.
+        The compression is detected from the suffix of the path (.gz, .xz,
+        .bz2 or .zst). The decompressed data are written into decompressfd
+        and verified by checksums_open and expectedsize_open. If they don't
+        match, the file is handled as if its checksum didn't match.
+        Default value is FALSE. */
+
+    int decompressfd; /*!<
+        Opened file descriptor where the decompressed data are written
+        or -1. Used only if decompress is TRUE. Default value is -1. */
+
+    GSList *checksums_open; /*!<
+        NULL or GSList with pointers to LrDownloadTargetChecksum
+        structures. Possible checksums of the decompressed data.
+        Used only if decompress is TRUE. The list is freed by
+        lr_downloadtarget_free(). */
+
+    gint64 expectedsize_open; /*!<
+        Expected size of the decompressed data or 0 (not checked).
+        Used only if decompress is TRUE. */
+
 } LrDownloadTarget;
 
 /** Create new empty ::LrDownloadTarget.
@@ -346,6 +346,11 @@ lr_fastestmirror_prepare(LrHandle *handle,
             break;
         }
 
+        // Resolved names and TLS sessions are reused by the downloads
+        CURLSH *share = lr_handle_get_curl_share(handle);
+        if (share)
+            curl_easy_setopt(curlh, CURLOPT_SHARE, share);
+
         LrFastestMirror *mirror = lr_lrfastestmirror_new();
         mirror->url = url;
         mirror->curl = curlh;
@@ -32,6 +32,22 @@
 #include "util.h"
 #include "gpg.h"
 
+static gpointer
+lr_gpg_init_once_cb(gpointer user_data G_GNUC_UNUSED)
+{
+    // The first call of gpgme_check_version() initializes gpgme
+    // and it is not thread-safe
+    gpgme_check_version(NULL);
+    return GINT_TO_POINTER(1);
+}
+
+static void
+lr_gpg_init(void)
+{
+    static GOnce init_once = G_ONCE_INIT;
+    g_once(&init_once, lr_gpg_init_once_cb, NULL);
+}
+
 gboolean
 lr_gpg_check_signature_fd(int signature_fd,
                           int data_fd,
@@ -48,7 +64,7 @@ lr_gpg_check_signature_fd(int signature_fd,
     assert(!err || *err == NULL);
 
     // Initialization
-    gpgme_check_version(NULL);
+    lr_gpg_init();
     gpgerr = gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP);
     if (gpgerr != GPG_ERR_NO_ERROR) {
         g_debug("%s: gpgme_engine_check_version: %s",
@@ -216,7 +232,7 @@ lr_gpg_import_key(const char *key_fn, const char *home_dir, GError **err)
     assert(!err || *err == NULL);
 
     // Initialization
-    gpgme_check_version(NULL);
+    lr_gpg_init();
     gpgerr = gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP);
     if (gpgerr != GPG_ERR_NO_ERROR) {
         g_debug("%s: gpgme_engine_check_version: %s",
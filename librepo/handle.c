@@ -45,6 +45,7 @@
 #include "yum_internal.h"
 #include "url_substitution.h"
 #include "downloader.h"
+#include "downloader_internal.h"
 #include "fastestmirror_internal.h"
 #include "cleanup.h"
 
@@ -77,6 +78,96 @@ lr_handle_free_list(char ***list)
     *list = NULL;
 }
 
+/** Process-wide CURL share used by handles with LRO_SHAREDCACHE enabled.
+ * It is created on the first use and replaced when flushed.
+ */
+static CURLSH *lr_global_share = NULL;
+G_LOCK_DEFINE_STATIC(lr_global_share);
+
+/** Locks of the data shared by the lr_global_share */
+static GMutex lr_global_share_locks[CURL_LOCK_DATA_LAST];
+
+static void
+lr_global_share_lock(G_GNUC_UNUSED CURL *curl,
+                     curl_lock_data data,
+                     G_GNUC_UNUSED curl_lock_access access,
+                     G_GNUC_UNUSED void *userptr)
+{
+    g_mutex_lock(&lr_global_share_locks[data]);
+}
+
+static void
+lr_global_share_unlock(G_GNUC_UNUSED CURL *curl,
+                       curl_lock_data data,
+                       G_GNUC_UNUSED void *userptr)
+{
+    g_mutex_unlock(&lr_global_share_locks[data]);
+}
+
+/** Free the process-wide share when the library is unloaded (or the
+ * process exits). If it is still used by a handle which was not freed,
+ * curl_share_cleanup() refuses to free it and it is left as is.
+ */
+#ifdef __GNUC__
+__attribute__((destructor))
+#endif
+static void
+lr_global_share_cleanup(void)
+{
+    G_LOCK(lr_global_share);
+    if (lr_global_share && curl_share_cleanup(lr_global_share) == CURLSHE_OK)
+        lr_global_share = NULL;
+    G_UNLOCK(lr_global_share);
+}
+
+/** Return a new CURL share object with the DNS cache, TLS session IDs
+ * and the connection cache (if supported by libcurl).
+ * @param locked        If TRUE, the share can be used from more threads.
+ *                      Each kind of shared data is guarded by its own lock.
+ * @return              New share or NULL on error.
+ */
+static CURLSH *
+lr_handle_curl_share_new(gboolean locked)
+{
+    CURLSH *share = curl_share_init();
+    if (!share)
+        return NULL;
+
+    if (locked) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lr_global_share_lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC,
+                          lr_global_share_unlock);
+    }
+
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LR_CURL_VERSION_CHECK(7, 57, 0)
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+    return share;
+}
+
+CURLSH *
+lr_handle_get_curl_share(LrHandle *handle)
+{
+    CURLSH *share;
+
+    if (!handle)
+        return NULL;
+
+    if (!handle->sharedcache)
+        return handle->curl_share;
+
+    G_LOCK(lr_global_share);
+    if (!lr_global_share)
+        lr_global_share = lr_handle_curl_share_new(TRUE);
+    share = lr_global_share;
+    G_UNLOCK(lr_global_share);
+
+    return share;
+}
+
 LrHandle *
 lr_handle_init()
 {
@@ -88,9 +179,12 @@ lr_handle_init()
 
     handle = lr_malloc0(sizeof(LrHandle));
     handle->curl_handle = curl;
+    handle->curl_share = lr_handle_curl_share_new(FALSE);
     handle->fastestmirrormaxage = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
     handle->mirrorlist_fd = -1;
+    handle->mirrorlist_prefetch_fd = -1;
     handle->metalink_fd = -1;
+    handle->metalink_prefetch_fd = -1;
     handle->checks |= LR_CHECK_CHECKSUM;
     handle->maxparalleldownloads = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
     handle->maxdownloadspermirror = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
@@ -103,6 +197,13 @@ lr_handle_init()
     handle->gnupghomedir = g_strdup(LRO_GNUPGHOMEDIR_DEFAULT);
     handle->fastestmirrortimeout = LRO_FASTESTMIRRORTIMEOUT_DEFAULT;
     handle->offline = LRO_OFFLINE_DEFAULT;
+    handle->maxsegments = LRO_MAXSEGMENTS_DEFAULT;
+    handle->hedgebudget = LRO_HEDGEBUDGET_DEFAULT;
+    handle->autotuneparalleldownloads = LRO_AUTOTUNEPARALLELDOWNLOADS_DEFAULT;
+    handle->multiplex = LRO_MULTIPLEX_DEFAULT;
+    handle->sharedcache = LRO_SHAREDCACHE_DEFAULT;
+    handle->contentstoremaxsize = LRO_CONTENTSTOREMAXSIZE_DEFAULT;
+    handle->decompress = LRO_DECOMPRESS_DEFAULT;
 
     return handle;
 }
@@ -114,10 +215,16 @@ lr_handle_free(LrHandle *handle)
         return;
     if (handle->curl_handle)
         curl_easy_cleanup(handle->curl_handle);
+    if (handle->curl_share)
+        curl_share_cleanup(handle->curl_share);
     if (handle->mirrorlist_fd != -1)
         close(handle->mirrorlist_fd);
     if (handle->metalink_fd != -1)
         close(handle->metalink_fd);
+    if (handle->mirrorlist_prefetch_fd != -1)
+        close(handle->mirrorlist_prefetch_fd);
+    if (handle->metalink_prefetch_fd != -1)
+        close(handle->metalink_prefetch_fd);
     lr_handle_free_list(&handle->urls);
     lr_free(handle->fastestmirrorcache);
     lr_free(handle->mirrorlist);
@@ -136,11 +243,29 @@ lr_handle_free(LrHandle *handle)
     lr_handle_free_list(&handle->yumblist);
     lr_urlvars_free(handle->urlvars);
     lr_free(handle->gnupghomedir);
+    lr_free(handle->cachedrepo);
+    lr_free(handle->contentstore);
     lr_handle_free_list(&handle->httpheader);
     curl_slist_free_all(handle->curl_httpheader);
+    lr_mirrorstatslist_free(handle->mirrorstats);
     lr_free(handle);
 }
 
+void
+lr_mirrorstats_free(LrMirrorStats *stats)
+{
+    if (!stats)
+        return;
+    lr_free(stats->url);
+    lr_free(stats);
+}
+
+void
+lr_mirrorstatslist_free(GSList *list)
+{
+    g_slist_free_full(list, (GDestroyNotify) lr_mirrorstats_free);
+}
+
 typedef enum {
     LR_REMOTESOURCE_URLS,
     LR_REMOTESOURCE_MIRRORLIST,
@@ -630,6 +755,93 @@ lr_handle_setopt(LrHandle *handle,
         handle->offline = va_arg(arg, long) ? 1 : 0;
         break;
 
+    case LRO_MAXSEGMENTS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_MAXSEGMENTS_MIN ||
+            val_long > LRO_MAXSEGMENTS_MAX) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_MAXSEGMENTS.");
+            ret = FALSE;
+        } else {
+            handle->maxsegments = val_long;
+        }
+
+        break;
+
+    case LRO_HEDGEBUDGET:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_HEDGEBUDGET_MIN ||
+            val_long > LRO_HEDGEBUDGET_MAX) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_HEDGEBUDGET.");
+            ret = FALSE;
+        } else {
+            handle->hedgebudget = val_long;
+        }
+
+        break;
+
+    case LRO_AUTOTUNEPARALLELDOWNLOADS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_AUTOTUNEPARALLELDOWNLOADS_MIN ||
+            val_long > LRO_AUTOTUNEPARALLELDOWNLOADS_MAX) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_AUTOTUNEPARALLELDOWNLOADS.");
+            ret = FALSE;
+        } else {
+            handle->autotuneparalleldownloads = val_long;
+        }
+
+        break;
+
+    case LRO_MULTIPLEX:
+        handle->multiplex = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_SHAREDCACHE:
+        handle->sharedcache = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_CANCELTOKEN:
+        handle->cancel_token = va_arg(arg, LrCancelToken *);
+        break;
+
+    case LRO_CACHEDREPO:
+        lr_free(handle->cachedrepo);
+        handle->cachedrepo = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_CONTENTSTORE:
+        lr_free(handle->contentstore);
+        handle->contentstore = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_CONTENTSTOREMAXSIZE:
+        val_gint64 = va_arg(arg, gint64);
+        if (val_gint64 < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_CONTENTSTOREMAXSIZE");
+            ret = FALSE;
+            break;
+        }
+        handle->contentstoremaxsize = val_gint64;
+        break;
+
+    case LRO_DECOMPRESS: {
+        long type = va_arg(arg, LrDecompressType);
+        if (type < LR_DECOMPRESS_NONE || type > LR_DECOMPRESS_BOTH) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_DECOMPRESS value");
+            ret = FALSE;
+            break;
+        }
+        handle->decompress = type;
+        break;
+    }
+
     default:
         g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
                     "Unknown option");
@@ -754,6 +966,10 @@ lr_handle_prepare_mirrorlist(LrHandle *handle, gchar *localpath, GError **err)
         g_debug("%s: LRO_LOCAL used, remote mirrorlist ignored: %s",
                 __func__, handle->mirrorlisturl);
         return TRUE;
+    } else if (handle->mirrorlist_prefetch_fd != -1) {
+        // Already downloaded by lr_handles_perform_multi()
+        fd = handle->mirrorlist_prefetch_fd;
+        handle->mirrorlist_prefetch_fd = -1;
     } else if (handle->mirrorlisturl) {
         // Download remote mirrorlist
         _cleanup_free_ gchar *url = NULL;
@@ -870,6 +1086,10 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
         g_debug("%s: LRO_LOCAL used, remote metalink ignored: %s",
                 __func__, handle->metalinkurl);
         return TRUE;
+    } else if (handle->metalink_prefetch_fd != -1) {
+        // Already downloaded by lr_handles_perform_multi()
+        fd = handle->metalink_prefetch_fd;
+        handle->metalink_prefetch_fd = -1;
     } else if (handle->metalinkurl) {
         // Download remote metalink
         _cleanup_free_ gchar *url = NULL;
@@ -1063,12 +1283,11 @@ lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
     return TRUE;
 }
 
-gboolean
-lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
+/** Check the handle and prepare its destination directory.
+ */
+static gboolean
+lr_handle_perform_init(LrHandle *handle, LrResult *result, GError **err)
 {
-    int ret = TRUE;
-    GError *tmp_err = NULL;
-
     assert(handle);
     assert(!err || *err == NULL);
 
@@ -1109,23 +1328,26 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
     }
 
     g_debug("%s: Using dir: %s", __func__, handle->destdir);
+    return TRUE;
+}
 
-    struct sigaction old_sigact;
-    if (handle->interruptible) {
-        /* Setup sighandler */
-        struct sigaction sigact;
-        g_debug("%s: Using own SIGINT handler", __func__);
-        memset(&sigact, 0, sizeof(old_sigact));
-        memset(&sigact, 0, sizeof(sigact));
-        sigemptyset(&sigact.sa_mask);
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = 0;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
-            g_set_error(err, LR_HANDLE_ERROR, LRE_SIGACTION,
-                        "sigaction(SIGINT,,) error");
-            return FALSE;
-        }
+gboolean
+lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
+{
+    int ret = TRUE;
+    GError *tmp_err = NULL;
+
+    assert(handle);
+    assert(!err || *err == NULL);
+
+    if (!lr_handle_perform_init(handle, result, err))
+        return FALSE;
+
+    sig_atomic_t sigint_count = 0;
+    if (handle->interruptible && !lr_interruptible_begin(&sigint_count)) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_SIGACTION,
+                    "sigaction(SIGINT,,) error");
+        return FALSE;
     }
 
     ret = lr_handle_prepare_internal_mirrorlist(handle,
@@ -1135,6 +1357,8 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
         g_debug("Cannot prepare internal mirrorlist: %s", tmp_err->message);
         g_propagate_prefixed_error(err, tmp_err,
                                    "Cannot prepare internal mirrorlist: ");
+        if (handle->interruptible)
+            lr_interruptible_end();
         return FALSE;
     }
 
@@ -1159,11 +1383,9 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
     }
 
     if (handle->interruptible) {
-        /* Restore signal handler */
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
+        lr_interruptible_end();
 
-        if (lr_interrupt) {
+        if (lr_interrupted(sigint_count)) {
             g_set_error(err, LR_HANDLE_ERROR, LRE_INTERRUPTED,
                         "Librepo was interrupted by a signal");
             g_error_free(tmp_err);
@@ -1171,6 +1393,16 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
         }
     }
 
+    if (!ret && tmp_err && handle->cancel_token
+        && lr_cancel_token_is_cancelled(handle->cancel_token))
+    {
+        // Report the cancellation regardless of where it was noticed
+        g_set_error(err, LR_HANDLE_ERROR, LRE_CANCELLED,
+                    "Librepo was cancelled: %s", tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
+    }
+
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (tmp_err)
@@ -1179,6 +1411,269 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
     return ret;
 }
 
+/** Download remote mirrorlists and metalinks of all the handles
+ * by a single lr_download() call. The files are parsed later by
+ * lr_handle_prepare_internal_mirrorlist().
+ */
+static void
+lr_handles_prefetch_mirrorlists(LrHandle **handles,
+                                GError **errors,
+                                guint count)
+{
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        LrHandle *handle = handles[i];
+
+        if (errors[i] || handle->internal_mirrorlist)
+            continue;
+
+        const char *urls[] = {
+            (handle->mirrorlist_mirrors) ? NULL : handle->mirrorlisturl,
+            (handle->metalink_mirrors) ? NULL : handle->metalinkurl,
+        };
+        int *fds[] = {
+            &handle->mirrorlist_prefetch_fd,
+            &handle->metalink_prefetch_fd,
+        };
+
+        for (guint x = 0; x < G_N_ELEMENTS(urls); x++) {
+            _cleanup_free_ gchar *url = NULL;
+
+            if (!urls[x] || *fds[x] != -1)
+                continue;
+            if ((handle->offline || handle->local)
+                && !lr_is_local_path(urls[x]))
+                continue;  // Ignored by lr_handle_prepare_*()
+
+            int fd = lr_gettmpfile();
+            if (fd < 0) {
+                g_debug("%s: Cannot create a temporary file", __func__);
+                g_set_error(&errors[i], LR_HANDLE_ERROR, LRE_IO,
+                            "Cannot create a temporary file");
+                break;
+            }
+
+            url = lr_prepend_url_protocol(urls[x]);
+            targets = g_slist_prepend(targets,
+                            lr_downloadtarget_new(handle, url, NULL, fd,
+                                                  NULL, NULL, 0, 0, NULL,
+                                                  NULL, NULL, NULL, fds[x],
+                                                  0, 0));
+        }
+    }
+
+    if (!targets)
+        return;
+
+    g_debug("%s: Downloading %u mirrorlists/metalinks",
+            __func__, g_slist_length(targets));
+
+    lr_download(targets, FALSE, &tmp_err);
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        guint i = 0;
+
+        while (handles[i] != target->handle)
+            i++;
+
+        // The error of the whole download belongs only to the handles
+        // of unfinished targets, other targets report their own errors
+        if (target->rcode != LRE_OK) {
+            gboolean unfinished = tmp_err && target->rcode == LRE_UNFINISHED;
+            if (!errors[i])
+                g_set_error(&errors[i], LR_DOWNLOADER_ERROR,
+                            (unfinished) ? tmp_err->code : target->rcode,
+                            "Cannot prepare internal mirrorlist: %s",
+                            (unfinished) ? tmp_err->message : target->err);
+            close(target->fd);
+        } else {
+            lseek(target->fd, 0, SEEK_SET);
+            *((int *) target->userdata) = target->fd;
+        }
+    }
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+    g_clear_error(&tmp_err);
+}
+
+gboolean
+lr_handles_perform_multi(LrHandle **handles,
+                         LrResult **results,
+                         GError **errors,
+                         GError **err)
+{
+    guint count = 0;
+    guint failed = 0;
+    gboolean interruptible = FALSE;
+    sig_atomic_t sigint_count = 0;
+    GSList *fmr_handles = NULL;
+    GError **errs;
+
+    assert(!err || *err == NULL);
+
+    if (!handles || !results) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "No handles or results argument passed");
+        return FALSE;
+    }
+
+    // The SIGINT handler is installed if any of the handles is
+    // interruptible, but only the interruptible ones are interrupted
+    while (handles[count]) {
+        interruptible |= handles[count]->interruptible;
+        count++;
+    }
+
+    if (!count)
+        return TRUE;
+
+    errs = g_new0(GError *, count);
+
+    for (guint i = 0; i < count; i++)
+        lr_handle_perform_init(handles[i], results[i], &errs[i]);
+
+    if (interruptible && !lr_interruptible_begin(&sigint_count)) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_SIGACTION,
+                    "sigaction(SIGINT,,) error");
+        for (guint i = 0; i < count; i++)
+            g_clear_error(&errs[i]);
+        g_free(errs);
+        return FALSE;
+    }
+
+    // Mirrorlists and metalinks of all the repositories
+
+    lr_handles_prefetch_mirrorlists(handles, errs, count);
+
+    for (guint i = 0; i < count; i++) {
+        LrHandle *handle = handles[i];
+        GError *tmp_err = NULL;
+
+        if (!errs[i]
+            && !lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err))
+        {
+            g_debug("Cannot prepare internal mirrorlist: %s", tmp_err->message);
+            g_propagate_prefixed_error(&errs[i], tmp_err,
+                                       "Cannot prepare internal mirrorlist: ");
+        }
+
+        // Prefetched, but not used because of an error
+        if (handle->mirrorlist_prefetch_fd != -1) {
+            close(handle->mirrorlist_prefetch_fd);
+            handle->mirrorlist_prefetch_fd = -1;
+        }
+        if (handle->metalink_prefetch_fd != -1) {
+            close(handle->metalink_prefetch_fd);
+            handle->metalink_prefetch_fd = -1;
+        }
+
+        if (!errs[i] && handle->fastestmirror)
+            fmr_handles = g_slist_prepend(fmr_handles, handle);
+    }
+
+    // Do Fastest Mirror resolving for all handles in one shot
+    if (fmr_handles) {
+        GError *tmp_err = NULL;
+        fmr_handles = g_slist_reverse(fmr_handles);
+        if (!lr_fastestmirror_sort_internalmirrorlists(fmr_handles, &tmp_err)) {
+            for (guint i = 0; i < count; i++)
+                if (!errs[i] && g_slist_find(fmr_handles, handles[i]))
+                    g_set_error(&errs[i], tmp_err->domain, tmp_err->code,
+                                "Cannot prepare internal mirrorlist: %s",
+                                tmp_err->message);
+            g_error_free(tmp_err);
+        }
+        g_slist_free(fmr_handles);
+    }
+
+    // Repomd.xml files and metadata of all the repositories
+
+    GPtrArray *yum_handles = g_ptr_array_new();
+    GPtrArray *yum_results = g_ptr_array_new();
+    GArray *yum_indexes = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    for (guint i = 0; i < count; i++) {
+        if (errs[i])
+            continue;
+        if (handles[i]->fetchmirrors) {
+            /* Only download and parse mirrorlist */
+            g_debug("%s: Only fetching mirrorlist/metalink", __func__);
+            continue;
+        }
+        g_ptr_array_add(yum_handles, handles[i]);
+        g_ptr_array_add(yum_results, results[i]);
+        g_array_append_val(yum_indexes, i);
+    }
+
+    if (yum_handles->len) {
+        GError **yum_errs = g_new0(GError *, yum_handles->len);
+        g_debug("%s: Downloading/Locating %u yum repos",
+                __func__, yum_handles->len);
+        lr_yum_perform_multi((LrHandle **) yum_handles->pdata,
+                             (LrResult **) yum_results->pdata,
+                             yum_errs,
+                             yum_handles->len);
+        for (guint x = 0; x < yum_handles->len; x++)
+            errs[g_array_index(yum_indexes, guint, x)] = yum_errs[x];
+        g_free(yum_errs);
+    }
+
+    g_ptr_array_free(yum_handles, TRUE);
+    g_ptr_array_free(yum_results, TRUE);
+    g_array_free(yum_indexes, TRUE);
+
+    if (interruptible)
+        lr_interruptible_end();
+
+    // Report errors of the repositories
+
+    for (guint i = 0; i < count; i++) {
+        LrHandle *handle = handles[i];
+
+        if (!errs[i])
+            continue;
+
+        failed++;
+
+        if (handle->interruptible && lr_interrupted(sigint_count)) {
+            g_clear_error(&errs[i]);
+            g_set_error(&errs[i], LR_HANDLE_ERROR, LRE_INTERRUPTED,
+                        "Librepo was interrupted by a signal");
+        } else if (handle->cancel_token
+                   && lr_cancel_token_is_cancelled(handle->cancel_token)) {
+            GError *tmp_err = errs[i];
+            errs[i] = NULL;
+            g_set_error(&errs[i], LR_HANDLE_ERROR, LRE_CANCELLED,
+                        "Librepo was cancelled: %s", tmp_err->message);
+            g_error_free(tmp_err);
+        }
+
+        g_debug("%s: Repository %u failed: %s", __func__, i, errs[i]->message);
+    }
+
+    if (failed) {
+        guint first = 0;
+        while (!errs[first])
+            first++;
+        g_set_error(err, errs[first]->domain, errs[first]->code,
+                    "%u of %u repositories failed (first error: %s)",
+                    failed, count, errs[first]->message);
+    }
+
+    for (guint i = 0; i < count; i++) {
+        if (errors)
+            errors[i] = errs[i];
+        else
+            g_clear_error(&errs[i]);
+    }
+    g_free(errs);
+
+    return !failed;
+}
+
 gboolean
 lr_handle_getinfo(LrHandle *handle,
                   GError **err,
@@ -1386,6 +1881,59 @@ lr_handle_getinfo(LrHandle *handle,
         *lnum = (long) handle->offline;
         break;
 
+    case LRI_MAXSEGMENTS:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->maxsegments;
+        break;
+
+    case LRI_HEDGEBUDGET:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->hedgebudget;
+        break;
+
+    case LRI_AUTOTUNEPARALLELDOWNLOADS:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->autotuneparalleldownloads;
+        break;
+
+    case LRI_MULTIPLEX:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->multiplex;
+        break;
+
+    case LRI_SHAREDCACHE:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->sharedcache;
+        break;
+
+    case LRI_CANCELTOKEN: {
+        LrCancelToken **token = va_arg(arg, LrCancelToken **);
+        *token = handle->cancel_token;
+        break;
+    }
+
+    case LRI_CACHEDREPO:
+        str = va_arg(arg, char **);
+        *str = handle->cachedrepo;
+        break;
+
+    case LRI_CONTENTSTORE:
+        str = va_arg(arg, char **);
+        *str = handle->contentstore;
+        break;
+
+    case LRI_DECOMPRESS: {
+        LrDecompressType *type = va_arg(arg, LrDecompressType *);
+        *type = handle->decompress;
+        break;
+    }
+
+    case LRI_MIRRORSTATS: {
+        GSList **list = va_arg(arg, GSList **);
+        *list = handle->mirrorstats;
+        break;
+    }
+
     default:
         rc = FALSE;
         g_set_error(err, LR_HANDLE_ERROR, LRE_UNKNOWNOPT,
@@ -1396,3 +1944,43 @@ lr_handle_getinfo(LrHandle *handle,
     va_end(arg);
     return rc;
 }
+
+gboolean
+lr_handle_flush_connections(LrHandle *handle, GError **err)
+{
+    CURLSHcode rc = CURLSHE_OK;
+
+    assert(!err || *err == NULL);
+
+    if (!handle) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "No handle specified");
+        return FALSE;
+    }
+
+    if (handle->sharedcache) {
+        // The shared cache is created again by the next download
+        G_LOCK(lr_global_share);
+        if (lr_global_share)
+            rc = curl_share_cleanup(lr_global_share);
+        if (rc == CURLSHE_OK)
+            lr_global_share = NULL;
+        G_UNLOCK(lr_global_share);
+    } else if (handle->curl_share) {
+        rc = curl_share_cleanup(handle->curl_share);
+        if (rc == CURLSHE_OK)
+            handle->curl_share = lr_handle_curl_share_new(FALSE);
+    }
+
+    if (rc != CURLSHE_OK) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_CURL,
+                    "curl_share_cleanup() failed: %s",
+                    curl_share_strerror(rc));
+        return FALSE;
+    }
+
+    g_debug("%s: Connections %sclosed", __func__,
+            handle->sharedcache ? "of all handles with shared cache " : "");
+
+    return TRUE;
+}
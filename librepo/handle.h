@@ -24,6 +24,7 @@
 #include <glib.h>
 
 #include "result.h"
+#include "cancel.h"
 
 G_BEGIN_DECLS
 
@@ -34,9 +35,36 @@ G_BEGIN_DECLS
 
 /** Handle object containing configration for repository metadata and
  * package downloading.
+ *
+ * Thread-safety: A handle must not be used by more threads at once,
+ * but different handles (and their results) can be used in parallel
+ * threads, e.g. many lr_handle_perform() calls can run concurrently,
+ * each with its own handle. Handles with LRO_SHAREDCACHE enabled can
+ * be used from different threads too.
  */
 typedef struct _LrHandle LrHandle;
 
+/** Statistics of a mirror collected during a download.
+ */
+typedef struct {
+    char *url; /*!<
+        URL of the mirror */
+    long window; /*!<
+        Number of parallel downloads the mirror was allowed
+        at the end of the download */
+    long successful_transfers; /*!<
+        Number of successful transfers from the mirror */
+    long failed_transfers; /*!<
+        Number of failed transfers from the mirror */
+    double throughput; /*!<
+        Estimated throughput of the mirror in bytes per second
+        (0.0 if not measured) */
+    double ttfb; /*!<
+        Estimated time to first byte in seconds (-1.0 if not measured) */
+    double error_rate; /*!<
+        Estimated error rate of the mirror (0.0 - 1.0) */
+} LrMirrorStats;
+
 /** LRO_FASTESTMIRRORMAXAGE default value */
 #define LRO_FASTESTMIRRORMAXAGE_DEFAULT     2592000L // 30 days
 
@@ -52,6 +80,12 @@ typedef struct _LrHandle LrHandle;
 /** LRO_MAXSPEED default value (0 == unlimited speed) */
 #define LRO_MAXSPEED_DEFAULT                G_GINT64_CONSTANT(0)
 
+/** LRO_CONTENTSTOREMAXSIZE default value (0 == unlimited size) */
+#define LRO_CONTENTSTOREMAXSIZE_DEFAULT     G_GINT64_CONSTANT(0)
+
+/** LRO_DECOMPRESS default value */
+#define LRO_DECOMPRESS_DEFAULT              LR_DECOMPRESS_NONE
+
 /** LRO_CONNECTTIMEOUT default value */
 #define LRO_CONNECTTIMEOUT_DEFAULT          120L
 
@@ -106,6 +140,39 @@ typedef struct _LrHandle LrHandle;
 /** LRO_OFFLINE default value */
 #define LRO_OFFLINE_DEFAULT                 0L
 
+/** LRO_MAXSEGMENTS default value */
+#define LRO_MAXSEGMENTS_DEFAULT             1L
+
+/** LRO_MAXSEGMENTS minimal allowed value */
+#define LRO_MAXSEGMENTS_MIN                 1L
+
+/** LRO_MAXSEGMENTS maximal allowed value */
+#define LRO_MAXSEGMENTS_MAX                 16L
+
+/** LRO_HEDGEBUDGET default value */
+#define LRO_HEDGEBUDGET_DEFAULT             0L
+
+/** LRO_HEDGEBUDGET minimal allowed value */
+#define LRO_HEDGEBUDGET_MIN                 0L
+
+/** LRO_HEDGEBUDGET maximal allowed value */
+#define LRO_HEDGEBUDGET_MAX                 100L
+
+/** LRO_AUTOTUNEPARALLELDOWNLOADS default value (0 == disabled) */
+#define LRO_AUTOTUNEPARALLELDOWNLOADS_DEFAULT   0L
+
+/** LRO_AUTOTUNEPARALLELDOWNLOADS minimal allowed value */
+#define LRO_AUTOTUNEPARALLELDOWNLOADS_MIN       0L
+
+/** LRO_AUTOTUNEPARALLELDOWNLOADS maximal allowed value */
+#define LRO_AUTOTUNEPARALLELDOWNLOADS_MAX       256L
+
+/** LRO_MULTIPLEX default value */
+#define LRO_MULTIPLEX_DEFAULT               0L
+
+/** LRO_SHAREDCACHE default value */
+#define LRO_SHAREDCACHE_DEFAULT             0L
+
 /** Handle options for the ::lr_handle_setopt function. */
 typedef enum {
 
@@ -157,7 +224,9 @@ typedef enum {
 
     LRO_MAXSPEED,  /*!< (gint64)
         Maximum download speed in bytes per second. Default is 0 = unlimited
-        download speed. */
+        download speed. The speed is shared by all transfers of
+        a download according to weights of their targets (see
+        LrDownloadTarget.weight). */
 
     LRO_DESTDIR,  /*!< (char *)
         Where to save downloaded files */
@@ -176,10 +245,18 @@ typedef enum {
         option. */
 
     LRO_INTERRUPTIBLE,  /*!< (long 1 or 0)
-        If true, Librepo setups its own signal handler for SIGTERM and stops
-        downloading if SIGTERM is catched. In this case current operation
+        If true, Librepo setups its own signal handler for SIGINT and stops
+        downloading if SIGINT is catched. In this case current operation
         could return any kind of error code. Handle which operation was
-        interrupted shoud never be used again! */
+        interrupted shoud never be used again!
+        The handler is installed by the first interruptible operation
+        and stays installed. While no interruptible operation is running,
+        it passes SIGINT to the handler that was installed before.
+        A SIGINT interrupts all interruptible operations running at that
+        moment (in any thread), operations on handles without this
+        option are not affected. If targets of several handles are
+        downloaded at once, only the targets of the interruptible
+        handles are stopped. */
 
     LRO_USERAGENT,  /*!< (char *)
         String for  User-Agent: header in the http request sent to
@@ -194,10 +271,16 @@ typedef enum {
         0 means try all available mirrors. */
 
     LRO_MAXPARALLELDOWNLOADS,  /*!< (long)
-        Maximum number of parallel downloads. */
+        Maximum number of parallel downloads.
+        If LRO_AUTOTUNEPARALLELDOWNLOADS is enabled, this is
+        the initial number of parallel downloads. */
 
     LRO_MAXDOWNLOADSPERMIRROR,  /*!< (long)
-        Maximum number of parallel downloads per mirror. */
+        Maximum number of parallel downloads per mirror.
+        Number of parallel downloads from a mirror starts at this value.
+        It is reduced when the mirror fails or throttles downloads
+        (HTTP 429 or 503) and then it grows back while throughput
+        of the mirror improves. See LRI_MIRRORSTATS. */
 
     LRO_VARSUB,  /*!< (LrUrlVars *)
         Variables and its substitutions for repo URL.
@@ -289,10 +372,11 @@ typedef enum {
         Set -1 or 0 to disable this option */
 
     LRO_ADAPTIVEMIRRORSORTING, /*!< (long 1 or 0)
-        If enabled, internal list of mirrors for each handle is
-        re-sorted after each finished transfer.
-        The the sorting is based on mirror
-        error rate etc. */
+        If enabled, throughput, time to first byte and error rate
+        of each mirror are measured during the download and
+        the mirror with the shortest expected download time of
+        a target (based on its expected size) is used.
+        If disabled, mirrors are used in order of the mirrorlist. */
 
     LRO_GNUPGHOMEDIR, /*!< (char *)
         Configuration directory for GNUPG (a directory with keyring) */
@@ -310,6 +394,122 @@ typedef enum {
         Remote mirrorlists/metalinks (if they are specified) are ignored.
         Fastest mirror check (if enabled) is skiped. */
 
+    LRO_MAXSEGMENTS, /*!< (long)
+        Maximal number of segments a single file can be split into.
+        If greater than 1, a file with a known expected size
+        is downloaded by parts (byte ranges) concurrently from
+        several mirrors. The parts are written directly into
+        a preallocated file and the file is verified once, when
+        all parts are downloaded. Slow parts are split again and
+        downloaded from other mirrors.
+        Only files that are downloaded from a mirrorlist (not from
+        a base URL) and that are not resumed are segmented.
+        Default value is 1 (segmented download is disabled). */
+
+    LRO_HEDGEBUDGET, /*!< (long)
+        Hedge budget in percents of the expected size of all
+        downloaded files. If a transfer is much slower than other
+        running transfers or than the usual throughput of its mirror,
+        a duplicate transfer (hedge) of the file is started from
+        another mirror. The one which finishes first with a valid
+        checksum is used and the other one is stopped. The budget
+        is charged by the bytes the hedges actually downloaded.
+        A hedge is started only if the whole file still fits into
+        the budget, together with the files of running hedges.
+        Only files with a known expected size that are downloaded
+        from a mirrorlist into a file specified by its name and
+        that are not resumed are hedged.
+        Default value is 0 (hedging is disabled). */
+
+    LRO_AUTOTUNEPARALLELDOWNLOADS, /*!< (long)
+        If greater than 0, the number of parallel downloads is tuned
+        during the download according to the measured total throughput
+        (goodput). It starts at LRO_MAXPARALLELDOWNLOADS and it is
+        raised while the goodput improves and lowered when the goodput
+        drops. The value of this option is the hard cap of the number
+        of parallel downloads and it could be greater than
+        LRO_MAXPARALLELDOWNLOADS_MAX.
+        Decisions of the tuner are logged by g_debug().
+        Default value is 0 (autotuning is disabled). */
+
+    LRO_MULTIPLEX, /*!< (long 1 or 0)
+        Multiplex transfers from a mirror as HTTP/2 streams over a few
+        connections. A new transfer rather waits for a connection to
+        the mirror that is being established (to find out if it supports
+        multiplexing) than opens a new one, so the handshake is not done
+        for each connection. LRO_MAXDOWNLOADSPERMIRROR then limits
+        the number of connections per mirror, the number of streams
+        per mirror is limited only by LRO_MAXPARALLELDOWNLOADS.
+        Transfers from a mirror that doesn't support HTTP/2 wait for
+        a free connection. HTTP/2 is negotiated only for https:// URLs. Note that libcurl
+        7.62.0 and newer multiplexes by default, but without waiting
+        for a connection, so a burst of transfers opens several ones. */
+
+    LRO_SHAREDCACHE, /*!< (long 1 or 0)
+        Share the DNS cache, TLS session IDs and open connections with
+        all other handles in the process that have this option enabled
+        (e.g. handles of different repositories on the same CDN).
+        By default these are shared only by the downloads issued through
+        the handle. The shared data are guarded by locks, so the handles
+        can be used from different threads. The fastest mirror detection
+        (LRO_FASTESTMIRROR) uses the shared caches too, so the resolved
+        names, TLS sessions and connections of its probes are reused
+        by the following downloads. */
+
+    LRO_CANCELTOKEN, /*!< (LrCancelToken *)
+        Cancel token (see ::lr_cancel_token_new) that stops downloading
+        of this handle when it is cancelled. The running operation
+        (e.g. lr_handle_perform() or lr_download_packages()) returns
+        with LRE_CANCELLED within milliseconds, running transfers are
+        aborted. If targets of several handles are downloaded at once
+        (e.g. by lr_handles_perform_multi()), only the targets of this
+        handle fail with LRE_CANCELLED and the others continue.
+        The token is not owned by the handle, it must not be
+        freed while the handle uses it. NULL to unset. */
+
+    LRO_CACHEDREPO, /*!< (char *)
+        Path to a local copy of the repository from its previous
+        download (e.g. the destination directory of the previous
+        lr_handle_perform()). The repomd.xml is requested conditionally
+        with the validators (ETag, Last-Modified) stored with the copy
+        of the repomd.xml. If the server replies that it was not
+        modified, or if it matches the checksum from the metalink
+        (then it is not requested at all), no metadata are downloaded
+        and the local copy is used instead - as with LRO_LOCAL.
+        The result then has LRR_UNCHANGED set. The local copy must
+        contain all the requested metadata files. It must not be
+        the destination directory (LRO_DESTDIR). It is not used
+        with LRO_UPDATE. NULL to unset. */
+
+    LRO_CONTENTSTORE, /*!< (char *)
+        Path to a content store - a directory with downloaded files
+        keyed by their checksums, which could be shared by handles
+        and processes. Before a target with a checksum is downloaded,
+        it is looked up in the store. If it is there, it is made
+        available at its destination by a reflink or a copy and it is
+        not downloaded at all. Files downloaded and verified by their
+        checksum are added to the store as its own read-only copies
+        (reflinks where possible), destination files never share
+        an inode with the store. NULL to unset (default). */
+
+    LRO_CONTENTSTOREMAXSIZE, /*!< (gint64)
+        Maximal size of the content store (LRO_CONTENTSTORE) in bytes.
+        When files were added to the store by a download, the least
+        recently used files are removed until the store fits into
+        the limit. Default is 0 = unlimited. */
+
+    LRO_DECOMPRESS, /*!< (LrDecompressType)
+        Decompress metadata files (gz, xz, bz2 and, if librepo was built
+        with zstd, zst) while they are being downloaded and verify
+        the decompressed data by the open-checksum and open-size from
+        repomd.xml. Files which don't match are downloaded again from
+        another mirror. With LR_DECOMPRESS_OPEN and LR_DECOMPRESS_BOTH
+        the decompressed file (the path without the compression suffix)
+        is stored and it is the path of the record in the result,
+        with LR_DECOMPRESS_OPEN the compressed file is not stored.
+        Only files downloaded from a remote repository are decompressed.
+        Default is LR_DECOMPRESS_NONE. */
+
     LRO_SENTINEL,    /*!< Sentinel */
 
 } LrHandleOption; /*!< Handle config options */
@@ -366,6 +566,19 @@ typedef enum {
         NOTE: Returned list must be freed as well as all its items!
         You could use g_strfreev() function. */
     LRI_OFFLINE,                /*!< (long *) */
+    LRI_MAXSEGMENTS,            /*!< (long *) */
+    LRI_HEDGEBUDGET,            /*!< (long *) */
+    LRI_MIRRORSTATS,            /*!< (GSList **)
+        List of LrMirrorStats of mirrors used by the last download
+        of this handle.
+        NOTE: Returned list belongs to the handle and must not be freed! */
+    LRI_AUTOTUNEPARALLELDOWNLOADS, /*!< (long *) */
+    LRI_MULTIPLEX,              /*!< (long *) */
+    LRI_SHAREDCACHE,            /*!< (long *) */
+    LRI_CANCELTOKEN,            /*!< (LrCancelToken **) */
+    LRI_CACHEDREPO,             /*!< (char **) */
+    LRI_CONTENTSTORE,           /*!< (char **) */
+    LRI_DECOMPRESS,             /*!< (LrDecompressType *) */
     LRI_SENTINEL,
 } LrHandleInfoOption; /*!< Handle info options */
 
@@ -422,6 +635,46 @@ lr_handle_getinfo(LrHandle *handle,
 gboolean
 lr_handle_perform(LrHandle *handle, LrResult *result, GError **err);
 
+/** Perform repodata download or location of several repositories
+ * at once. Like calling lr_handle_perform() for every handle, but
+ * mirrorlists/metalinks of all the repositories, then all their
+ * repomd.xml files and then all their metadata files are downloaded
+ * together, so that transfers of different repositories run in parallel.
+ * Metadata files of a repository are not downloaded until repomd.xml
+ * files of all the repositories are done.
+ * Downloader configuration (LRO_MAXPARALLELDOWNLOADS, ...) is taken
+ * from the first handle.
+ * @param handles       NULL terminated array of librepo handles.
+ * @param results       Array of librepo results (one for every handle).
+ * @param errors        Array of GError * (one for every handle, all
+ *                      of them NULL) where the error of every repository
+ *                      is stored, or NULL.
+ * @param err           GError **
+ * @return              TRUE if all repositories are ok, FALSE if err
+ *                      is set (error of the first failed repository).
+ */
+gboolean
+lr_handles_perform_multi(LrHandle **handles,
+                         LrResult **results,
+                         GError **errors,
+                         GError **err);
+
+/** Close all connections that the handle keeps open for reuse.
+ * Connections to the mirrors are kept by the handle after each download
+ * (lr_handle_perform(), lr_download_packages(), ...) so the following
+ * downloads from the same mirrors don't have to connect again.
+ * The DNS cache and TLS session IDs are dropped as well.
+ * Use this function e.g. after a change of the network configuration.
+ * It must not be called while a download with the handle is running.
+ * If LRO_SHAREDCACHE is enabled, the cache shared by all such handles
+ * is flushed and none of them may be downloading.
+ * @param handle        Librepo handle.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_handle_flush_connections(LrHandle *handle, GError **err);
+
 /** @} */
 
 G_END_DECLS
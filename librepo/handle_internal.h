@@ -38,6 +38,13 @@ struct _LrHandle {
     CURL *curl_handle; /*!<
         CURL handle */
 
+    CURLSH *curl_share; /*!<
+        CURL share with the DNS cache, TLS session IDs and connection
+        cache of the handle. Transfers of all downloads issued through
+        the handle use it (unless sharedcache is enabled), so
+        connections to the mirrors are reused across lr_download()
+        calls. Use lr_handle_get_curl_share() to get the share. */
+
     int update; /*!<
         Just update existing repo */
 
@@ -77,6 +84,10 @@ struct _LrHandle {
     int mirrorlist_fd; /*!<
         Raw downloaded mirrorlist file */
 
+    int mirrorlist_prefetch_fd; /*!<
+        Mirrorlist already downloaded by lr_handles_perform_multi()
+        and not parsed yet or -1 */
+
     LrInternalMirrorlist *mirrorlist_mirrors; /*!<
         Mirrors from mirrorlist */
 
@@ -88,6 +99,10 @@ struct _LrHandle {
     int metalink_fd; /*!<
         Raw downloaded metalink file */
 
+    int metalink_prefetch_fd; /*!<
+        Metalink already downloaded by lr_handles_perform_multi()
+        and not parsed yet or -1 */
+
     LrInternalMirrorlist *metalink_mirrors; /*!<
         Mirrors from metalink */
 
@@ -196,13 +211,68 @@ struct _LrHandle {
     gboolean offline; /*!<
         If TRUE, librepo should work offline - ignore all
         non local URLs, etc. */
+
+    long maxsegments; /*!<
+        See: LRO_MAXSEGMENTS */
+
+    long hedgebudget; /*!<
+        See: LRO_HEDGEBUDGET */
+
+    long autotuneparalleldownloads; /*!<
+        See: LRO_AUTOTUNEPARALLELDOWNLOADS */
+
+    gboolean multiplex; /*!<
+        See: LRO_MULTIPLEX */
+
+    gboolean sharedcache; /*!<
+        See: LRO_SHAREDCACHE */
+
+    LrCancelToken *cancel_token; /*!<
+        See: LRO_CANCELTOKEN */
+
+    char *cachedrepo; /*!<
+        See: LRO_CACHEDREPO */
+
+    char *contentstore; /*!<
+        See: LRO_CONTENTSTORE */
+
+    gint64 contentstoremaxsize; /*!<
+        See: LRO_CONTENTSTOREMAXSIZE */
+
+    LrDecompressType decompress; /*!<
+        See: LRO_DECOMPRESS */
+
+    GSList *mirrorstats; /*!<
+        List of LrMirrorStats from the last download.
+        See: LRI_MIRRORSTATS */
 };
 
+/** Free LrMirrorStats.
+ */
+void
+lr_mirrorstats_free(LrMirrorStats *stats);
+
+/** Free list of LrMirrorStats.
+ */
+void
+lr_mirrorstatslist_free(GSList *list);
+
 /** Return new CURL easy handle with some default options setted.
  */
 CURL *
 lr_get_curl_handle();
 
+/**
+ * Return CURL share which should be set (CURLOPT_SHARE) to all CURL
+ * easy handles of transfers issued through the handle. This is either
+ * the share of the handle or the process-wide one (LRO_SHAREDCACHE).
+ * Note: CURLOPT_SHARE is not copied by curl_easy_duphandle().
+ * @param handle        Handle or NULL.
+ * @return              Share or NULL.
+ */
+CURLSH *
+lr_handle_get_curl_share(LrHandle *handle);
+
 /**
  * Create (if do not exists) internal mirrorlist. Insert baseurl (if
  * specified) and download, parse and insert mirrors from mirrorlist url.
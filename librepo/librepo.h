@@ -23,6 +23,7 @@
 
 #include <glib.h>
 
+#include "cancel.h"
 #include "checksum.h"
 #include "fastestmirror.h"
 #include "gpg.h"
@@ -34,6 +34,7 @@
 #include "package_downloader.h"
 #include "handle_internal.h"
 #include "downloader.h"
+#include "downloader_internal.h"
 #include "fastestmirror_internal.h"
 
 /* Do NOT use resume on successfully downloaded files - download will fail */
@@ -155,6 +156,7 @@ lr_packagetarget_new_v3(LrHandle *handle,
 
     target->byterangestart = byterangestart;
     target->byterangeend = byterangeend;
+    target->weight = 1;
 
     return target;
 }
@@ -180,7 +182,7 @@ lr_download_packages(GSList *targets,
 {
     gboolean ret;
     gboolean failfast = flags & LR_PACKAGEDOWNLOAD_FAILFAST;
-    struct sigaction old_sigact;
+    sig_atomic_t sigint_count = 0;
     GSList *downloadtargets = NULL;
     gboolean interruptible = FALSE;
 
@@ -218,20 +220,10 @@ lr_download_packages(GSList *targets,
     }
 
     // Setup sighandler
-    if (interruptible) {
-        struct sigaction sigact;
-        g_debug("%s: Using own SIGINT handler", __func__);
-        memset(&sigact, 0, sizeof(old_sigact));
-        memset(&sigact, 0, sizeof(sigact));
-        sigemptyset(&sigact.sa_mask);
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = SA_RESTART;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
-            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
-                        "Cannot set Librepo SIGINT handler");
-            return FALSE;
-        }
+    if (interruptible && !lr_interruptible_begin(&sigint_count)) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
+                    "Cannot set Librepo SIGINT handler");
+        return FALSE;
     }
 
     // List of handles for fastest mirror resolving
@@ -279,6 +271,8 @@ lr_download_packages(GSList *targets,
                 g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
                         "Cannot stat %s: %s", packagetarget->local_path,
                         strerror(errno));
+                if (interruptible)
+                    lr_interruptible_end();
                 return FALSE;
             }
 
@@ -392,10 +386,13 @@ lr_download_packages(GSList *targets,
                                                packagetarget,
                                                packagetarget->byterangestart,
                                                packagetarget->byterangeend);
+        downloadtarget->weight = packagetarget->weight;
 
-        downloadtargets = g_slist_append(downloadtargets, downloadtarget);
+        downloadtargets = g_slist_prepend(downloadtargets, downloadtarget);
     }
 
+    downloadtargets = g_slist_reverse(downloadtargets);
+
     // Do Fastest Mirror resolving for all handles in one shot
     if (fmr_handles) {
         fmr_handles = g_slist_reverse(fmr_handles);
@@ -403,6 +400,8 @@ lr_download_packages(GSList *targets,
         g_slist_free(fmr_handles);
 
         if (!ret) {
+            if (interruptible)
+                lr_interruptible_end();
             return FALSE;
         }
     }
@@ -424,11 +423,10 @@ cleanup:
     // Free downloadtargets list
     g_slist_free_full(downloadtargets, (GDestroyNotify)lr_downloadtarget_free);
 
-    // Restore original signal handler
+    // End of the interruptible operation
     if (interruptible) {
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
-        if (lr_interrupt) {
+        lr_interruptible_end();
+        if (lr_interrupted(sigint_count)) {
             if (err && *err != NULL)
                 g_clear_error(err);
             g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_INTERRUPTED,
@@ -481,6 +479,52 @@ lr_download_package(LrHandle *handle,
 }
 
 
+/** Data of check_packages_cb() */
+typedef struct {
+    gboolean failfast;          /*!< LR_PACKAGECHECK_FAILFAST */
+    gboolean interruptible;     /*!< SIGINT handler is used */
+    sig_atomic_t sigint_count;  /*!< See lr_interruptible_begin() */
+    GError *err;                /*!< Set if the check failed (failfast) */
+} CheckPackagesData;
+
+/** Store result of a checksum check of a package into its target.
+ */
+static gboolean
+check_packages_cb(LrChecksumCheck *check, void *cbdata)
+{
+    CheckPackagesData *data = cbdata;
+    LrPackageTarget *packagetarget = check->cbdata;
+
+    if (check->rcode == LRE_IO) {
+        // Cannot open the file
+        packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                               "Cannot be opened");
+        if (data->failfast) {
+            g_set_error(&data->err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
+                        "%s", check->err->message);
+            return FALSE;
+        }
+    } else if (check->rcode != LRE_OK || !check->matches) {
+        // Checksum doesn't match or checksuming error
+        packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                   "Checksum of doesn't match");
+        if (data->failfast) {
+            g_set_error(&data->err, LR_PACKAGE_DOWNLOADER_ERROR,
+                        LRE_BADCHECKSUM,
+                        "File with nonmatching checksum found");
+            return FALSE;
+        }
+    } else {
+        // Checksum is ok
+        packagetarget->err = NULL;
+        g_debug("%s: Package %s is already downloaded (checksum matches)",
+                __func__, packagetarget->local_path);
+    }
+
+    // Stop checking of the remaining files on SIGINT
+    return !(data->interruptible && lr_interrupted(data->sigint_count));
+}
+
 gboolean
 lr_check_packages(GSList *targets,
                   LrPackageCheckFlag flags,
@@ -488,8 +532,10 @@ lr_check_packages(GSList *targets,
 {
     gboolean ret = TRUE;
     gboolean failfast = flags & LR_PACKAGECHECK_FAILFAST;
-    struct sigaction old_sigact;
+    sig_atomic_t sigint_count = 0;
     gboolean interruptible = FALSE;
+    LrChecksumCheck *checks;
+    gsize count = 0;
 
     assert(!err || *err == NULL);
 
@@ -515,19 +561,14 @@ lr_check_packages(GSList *targets,
     }
 
     // Setup sighandler
-    if (interruptible) {
-        g_debug("%s: Using own SIGINT handler", __func__);
-        struct sigaction sigact;
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = SA_RESTART;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
-            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
-                        "Cannot set Librepo SIGINT handler");
-            return FALSE;
-        }
+    if (interruptible && !lr_interruptible_begin(&sigint_count)) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
+                    "Cannot set Librepo SIGINT handler");
+        return FALSE;
     }
 
+    checks = g_new0(LrChecksumCheck, g_slist_length(targets));
+
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
         gchar *local_path;
         LrPackageTarget *packagetarget = elem->data;
@@ -551,49 +592,16 @@ lr_check_packages(GSList *targets,
 
         packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
                                                           local_path);
+        g_free(local_path);
 
         if (g_access(packagetarget->local_path, R_OK) == 0) {
-            // If the file exists check its checksum
-            int fd_r = open(packagetarget->local_path, O_RDONLY);
-            if (fd_r != -1) {
-                // File was successfully opened
-                gboolean matches;
-                ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
-                                         fd_r,
-                                         packagetarget->checksum,
-                                         1,
-                                         &matches,
-                                         NULL);
-                close(fd_r);
-                if (ret && matches) {
-                    // Checksum is ok
-                    packagetarget->err = NULL;
-                    g_debug("%s: Package %s is already downloaded (checksum matches)",
-                            __func__, packagetarget->local_path);
-                } else {
-                    // Checksum doesn't match or checksuming error
-                    packagetarget->err = g_string_chunk_insert(
-                                                packagetarget->chunk,
-                                                "Checksum of doesn't match");
-                    if (failfast) {
-                        ret = FALSE;
-                        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR,
-                                    LRE_BADCHECKSUM,
-                                    "File with nonmatching checksum found");
-                        break;
-                    }
-                }
-            } else {
-                // Cannot open the file
-                packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
-                                       "Cannot be opened");
-                if (failfast) {
-                    ret = FALSE;
-                    g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
-                                "Cannot open %s", packagetarget->local_path);
-                    break;
-                }
-            }
+            // If the file exists its checksum is checked
+            LrChecksumCheck *check = &checks[count++];
+            check->path = packagetarget->local_path;
+            check->type = packagetarget->checksum_type;
+            check->expected = packagetarget->checksum;
+            check->caching = TRUE;
+            check->cbdata = packagetarget;
         } else {
             // File doesn't exists
             packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
@@ -607,11 +615,31 @@ lr_check_packages(GSList *targets,
         }
     }
 
-    // Restore original signal handler
+    if (ret) {
+        // Check checksums of existing files in parallel
+        CheckPackagesData data = {
+            .failfast = failfast,
+            .interruptible = interruptible,
+            .sigint_count = sigint_count,
+            .err = NULL,
+        };
+
+        ret = lr_checksum_check_files(checks, count, check_packages_cb,
+                                      &data, err);
+        for (gsize x = 0; x < count; x++)
+            g_clear_error(&checks[x].err);
+        if (ret && data.err) {
+            ret = FALSE;
+            g_propagate_error(err, data.err);
+        }
+    }
+
+    g_free(checks);
+
+    // End of the interruptible operation
     if (interruptible) {
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
-        if (lr_interrupt) {
+        lr_interruptible_end();
+        if (lr_interrupted(sigint_count)) {
             if (err && *err != NULL)
                 g_clear_error(err);
             g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_INTERRUPTED,
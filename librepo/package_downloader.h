@@ -131,6 +131,12 @@ typedef struct {
     GStringChunk *chunk; /*!<
         String chunk */
 
+    int weight; /*!<
+        Weight of the package in the distribution of the maximal download
+        speed (LRO_MAXSPEED). E.g. foreground packages could outrank
+        packages that are only prefetched. Default value is 1.
+        See LrDownloadTarget.weight */
+
 } LrPackageTarget;
 
 /** Create new LrPackageTarget object.
@@ -289,7 +295,8 @@ typedef enum {
 /** Check if targets locally exist and checksums match.
  * If target locally exists, then its err is NULL,
  * if it doesn't exists, or checksum is differ. Then target->err is
- * an error message.
+ * an error message. Checksums are checked in parallel
+ * (see ::lr_checksum_check_files).
  */
 gboolean
 lr_check_packages(GSList *targets,
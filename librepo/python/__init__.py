@@ -133,6 +133,8 @@ Version contants
 .. data:: LRO_MAXSPEED
 
     *Long or None*. Set maximal allowed speed per download in bytes per second.
+    The speed is shared by all transfers of the download according to
+    weights of their targets (see :class:`.PackageTarget`).
     0 = unlimited speed - the default value.
 
 .. data:: LRO_DESTDIR
@@ -181,12 +183,17 @@ Version contants
 .. data:: LRO_MAXPARALLELDOWNLOADS
 
     *Integer or None*. Maximum number of parallel downloads.
+    If :data:`.LRO_AUTOTUNEPARALLELDOWNLOADS` is enabled, this is
+    the initial number of parallel downloads.
     ``None`` sets default value.
 
 .. data:: LRO_MAXDOWNLOADSPERMIRROR
 
     *Integer or None*. Maximum number of parallel downloads per mirror.
-    ``None`` sets default value.
+    Number of parallel downloads from a mirror starts at this value.
+    It is reduced when the mirror fails or throttles downloads (HTTP 429
+    or 503) and then it grows back while throughput of the mirror
+    improves. See :data:`.LRI_MIRRORSTATS`. ``None`` sets default value.
 
 .. data:: LRO_VARSUB
 
@@ -304,9 +311,11 @@ Version contants
 
 .. data:: LRO_ADAPTIVEMIRRORSORTING
 
-    *Integer or None* If enabled, internal list of mirrors for each
-    handle is re-sorted after each finished transfer.
-    The the sorting is based on mirror error rate etc.
+    *Integer or None* If enabled, throughput, time to first byte
+    and error rate of each mirror are measured during the download
+    and the mirror with the shortest expected download time of
+    a target (based on its expected size) is used.
+    If disabled, mirrors are used in order of the mirrorlist.
 
 .. data:: LRO_GNUPGHOMEDIR
 
@@ -334,6 +343,89 @@ Version contants
     ignored. Remote mirrorlists/metalinks (if they are specified)
     are ignored. Fastest mirror check (if enabled) is skiped.
 
+.. data:: LRO_MAXSEGMENTS
+
+    *Integer or None* Maximal number of segments a single file can be
+    split into. If greater than 1, a file with a known expected size
+    is downloaded by parts (byte ranges) concurrently from several
+    mirrors. The file is verified once, when all parts are downloaded.
+    Default value is 1 (segmented download is disabled).
+
+.. data:: LRO_HEDGEBUDGET
+
+    *Integer or None* Hedge budget in percents of the expected size
+    of all downloaded files. If a transfer is much slower than other
+    transfers or than the usual throughput of its mirror, a duplicate
+    transfer of the file is started from another mirror and the one
+    which finishes first with a valid checksum is used. The budget is
+    charged by the bytes the hedges actually downloaded.
+    Default value is 0 (hedging is disabled).
+
+.. data:: LRO_AUTOTUNEPARALLELDOWNLOADS
+
+    *Integer or None* If greater than 0, the number of parallel downloads
+    is tuned during the download according to the measured total
+    throughput. It starts at :data:`.LRO_MAXPARALLELDOWNLOADS` and it is
+    raised while the throughput improves and lowered when it drops.
+    The value is the hard cap of the number of parallel downloads
+    (up to 256). Default value is 0 (autotuning is disabled).
+
+.. data:: LRO_MULTIPLEX
+
+    *Boolean* Multiplex transfers from a mirror as HTTP/2 streams over
+    a few connections. A new transfer rather waits for a connection
+    to the mirror that is being established than opens a new one.
+    :data:`.LRO_MAXDOWNLOADSPERMIRROR` then limits the number of
+    connections per mirror, the number of streams per mirror is limited
+    only by :data:`.LRO_MAXPARALLELDOWNLOADS`. HTTP/2 is negotiated only
+    for https:// URLs.
+    Default value is False.
+
+.. data:: LRO_SHAREDCACHE
+
+    *Boolean* Share the DNS cache, TLS session IDs and open connections
+    with all other handles in the process that have this option enabled.
+    By default these are shared only by the downloads issued through
+    the handle (see :meth:`~.Handle.flush_connections`).
+    Default value is False.
+
+.. data:: LRO_CACHEDREPO
+
+    *String or None* Path to a local copy of the repository from its
+    previous download (e.g. the destdir of the previous
+    :meth:`~.Handle.perform`). The repomd.xml is requested conditionally
+    (If-None-Match, If-Modified-Since). If it was not modified, or if it
+    matches the checksum from the metalink, no metadata are downloaded
+    and the local copy is used instead (see :data:`.LRR_UNCHANGED`).
+    The local copy must contain all the requested metadata files.
+    It must not be the :data:`.LRO_DESTDIR`. It is not used with
+    :data:`.LRO_UPDATE`.
+
+.. data:: LRO_CONTENTSTORE
+
+    *String or None* Path to a content store - a directory with
+    downloaded files keyed by their checksums, which could be shared
+    by handles and processes. A file with a checksum which is in
+    the store is not downloaded, it is made available at its destination
+    by a reflink or a copy. Files downloaded and verified by their
+    checksum are added to the store as its own read-only copies
+    (reflinks where possible), destination files never share an inode
+    with the store.
+
+.. data:: LRO_CONTENTSTOREMAXSIZE
+
+    *Long or None* Maximal size of the :data:`.LRO_CONTENTSTORE`
+    in bytes. The least recently used files are removed from the store
+    when it grows over the limit. Default value is 0 = unlimited.
+
+.. data:: LRO_DECOMPRESS
+
+    *Integer or None* Decompress metadata files (gz, xz, bz2 and zst if
+    librepo was built with zstd) while they are being downloaded and
+    verify the decompressed data by the open-checksum and open-size from
+    repomd.xml. Could be one of: :ref:`decompress-type-label`.
+    Only files downloaded from a remote repository are decompressed.
+
 
 .. _handle-info-options-label:
 
@@ -374,6 +466,23 @@ Version contants
 .. data:: LRI_FASTESTMIRRORTIMEOUT
 .. data:: LRI_HTTPHEADER
 .. data:: LRI_OFFLINE
+.. data:: LRI_MAXSEGMENTS
+.. data:: LRI_HEDGEBUDGET
+.. data:: LRI_MIRRORSTATS
+
+    List of dicts with statistics of mirrors used by the last download
+    of the handle. Keys of the dicts are: ``url``, ``window`` (number of
+    parallel downloads the mirror was allowed at the end of the download),
+    ``successful_transfers``, ``failed_transfers``, ``throughput``
+    (bytes per second, 0.0 if not measured), ``ttfb`` (time to first byte
+    in seconds, -1.0 if not measured) and ``error_rate``.
+
+.. data:: LRI_AUTOTUNEPARALLELDOWNLOADS
+.. data:: LRI_MULTIPLEX
+.. data:: LRI_SHAREDCACHE
+.. data:: LRI_CACHEDREPO
+.. data:: LRI_CONTENTSTORE
+.. data:: LRI_DECOMPRESS
 
 .. _proxy-type-label:
 
@@ -405,6 +514,29 @@ Supported IP resolving
 
     Resolve to IPv6 addresses.
 
+.. _decompress-type-label:
+
+Decompression of metadata
+-------------------------
+
+.. data:: DECOMPRESS_NONE
+
+    Default value, metadata files are only downloaded.
+
+.. data:: DECOMPRESS_VERIFY
+
+    Decompressed data are verified, only compressed files are stored.
+
+.. data:: DECOMPRESS_OPEN
+
+    Only decompressed files (paths without the compression suffix)
+    are stored. They are the paths of the records in the result.
+
+.. data:: DECOMPRESS_BOTH
+
+    Compressed and decompressed files are stored. The decompressed
+    files are the paths of the records in the result.
+
 .. _repotype-constants-label:
 
 Repo type constants
@@ -646,6 +778,14 @@ LibRepo Error codes.
 
     (35) Interrupted by user cb.
 
+.. data:: LRE_CANCELLED
+
+    (41) Cancelled by a cancel token.
+
+.. data:: LRE_DECOMPRESS
+
+    (42) Decompression error.
+
 .. data:: LRE_UNKNOWNERROR
 
     An unknown error.
@@ -672,6 +812,18 @@ LibRepo Result options for use in :meth:`~.Result.getinfo` method.
     Return the highest timestamp from all records in the repomd.
     See: http://yum.baseurl.org/gitweb?p=yum.git;a=commitdiff;h=59d3d67f
 
+.. data:: LRR_UNCHANGED
+
+    Return True if the repository was not changed since its previous
+    download and the local copy (:data:`.LRO_CACHEDREPO`) is used.
+
+.. data:: LRR_YUM_REUSED
+
+    Return a list of types of metadata files (records) which were not
+    downloaded, because their files with the right checksum already
+    existed in the destdir (e.g. in update mode) or in the cached
+    repository (:data:`.LRO_CACHEDREPO`).
+
 .. _endcb-statuses-label:
 
 Transfer statuses for endcb of :class:`~.PackageTarget`
@@ -872,7 +1024,8 @@ class PackageTarget(_librepo.PackageTarget):
     def __init__(self, relative_url, dest=None, checksum_type=CHECKSUM_UNKNOWN,
                  checksum=None, expectedsize=0, base_url=None, resume=False,
                  progresscb=None, cbdata=None, handle=None, endcb=None,
-                 mirrorfailurecb=None, byterangestart=0, byterangeend=0):
+                 mirrorfailurecb=None, byterangestart=0, byterangeend=0,
+                 weight=1):
         """
         :param relative_url: Target URL. If *handle* or *base_url* specified,
             the *url* can be (and logically should be) only a relative part of path.
@@ -896,12 +1049,16 @@ class PackageTarget(_librepo.PackageTarget):
         :param byterangeend: Stop downloading at the specified byte.
             *Note: If the byterangeend is less or equal to byterangestart,
             then it is ignored!*
+        :param weight: Weight of the package in the distribution of
+            :data:`.LRO_MAXSPEED` among packages downloaded at once.
+            E.g. a package with weight 4 gets four times more bandwidth
+            than a package with weight 1.
         """
         _librepo.PackageTarget.__init__(self, handle, relative_url, dest,
                                         checksum_type, checksum, expectedsize,
                                         base_url, resume, progresscb, cbdata,
                                         endcb, mirrorfailurecb, byterangestart,
-                                        byterangeend)
+                                        byterangeend, weight)
 
 
 class Handle(_librepo.Handle):
@@ -1103,6 +1260,46 @@ class Handle(_librepo.Handle):
 
         See :data:`.LRO_OFFLINE`
 
+    .. attribute:: maxsegments:
+
+        See :data:`.LRO_MAXSEGMENTS`
+
+    .. attribute:: hedgebudget:
+
+        See :data:`.LRO_HEDGEBUDGET`
+
+    .. attribute:: autotuneparalleldownloads:
+
+        See :data:`.LRO_AUTOTUNEPARALLELDOWNLOADS`
+
+    .. attribute:: multiplex:
+
+        See :data:`.LRO_MULTIPLEX`
+
+    .. attribute:: sharedcache:
+
+        See :data:`.LRO_SHAREDCACHE`
+
+    .. attribute:: cachedrepo:
+
+        See :data:`.LRO_CACHEDREPO`
+
+    .. attribute:: contentstore:
+
+        See :data:`.LRO_CONTENTSTORE`
+
+    .. attribute:: contentstoremaxsize:
+
+        See :data:`.LRO_CONTENTSTOREMAXSIZE`
+
+    .. attribute:: decompress:
+
+        See :data:`.LRO_DECOMPRESS`
+
+    .. attribute:: mirrorstats:
+
+        See :data:`.LRI_MIRRORSTATS`
+
     """
 
     def setopt(self, option, val):
@@ -1215,6 +1412,15 @@ class Handle(_librepo.Handle):
         _librepo.Handle.perform(self, result)
         return result
 
+    def flush_connections(self):
+        """
+        Close all connections to the mirrors that the handle keeps open
+        for reuse by the following downloads.
+
+        :returns: *None*
+        """
+        _librepo.Handle.flush_connections(self)
+
     def new_packagetarget(self, relative_url, **kwargs):
         """
         Shortcut for creating a new :Class:`~librepo.PackageTarget` objects.
@@ -1244,6 +1450,14 @@ class Result(_librepo.Result):
     .. attribute:: yum_timestamp
 
         See: :data:`.LRR_YUM_TIMESTAMP`
+
+    .. attribute:: unchanged
+
+        See: :data:`.LRR_UNCHANGED`
+
+    .. attribute:: yum_reused
+
+        See: :data:`.LRR_YUM_REUSED`
     """
 
     def getinfo(self, option):
@@ -306,6 +306,8 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_USERAGENT:
     case LRO_FASTESTMIRRORCACHE:
     case LRO_GNUPGHOMEDIR:
+    case LRO_CACHEDREPO:
+    case LRO_CONTENTSTORE:
     {
         char *str = NULL, *alloced = NULL;
 
@@ -382,6 +384,8 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_SSLVERIFYHOST:
     case LRO_ADAPTIVEMIRRORSORTING:
     case LRO_OFFLINE:
+    case LRO_MULTIPLEX:
+    case LRO_SHAREDCACHE:
     {
         long d;
 
@@ -419,6 +423,7 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_LOWSPEEDLIMIT:
     case LRO_IPRESOLVE:
     case LRO_ALLOWEDMIRRORFAILURES:
+    case LRO_DECOMPRESS:
     {
         int badarg = 0;
         long d;
@@ -450,6 +455,9 @@ py_setopt(_HandleObject *self, PyObject *args)
             case LRO_ALLOWEDMIRRORFAILURES:
                 d = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
                 break;
+            case LRO_DECOMPRESS:
+                d = LRO_DECOMPRESS_DEFAULT;
+                break;
             default:
                 badarg = 1;
             }
@@ -476,6 +484,9 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_MAXMIRRORTRIES:
     case LRO_MAXPARALLELDOWNLOADS:
     case LRO_MAXDOWNLOADSPERMIRROR:
+    case LRO_MAXSEGMENTS:
+    case LRO_HEDGEBUDGET:
+    case LRO_AUTOTUNEPARALLELDOWNLOADS:
     {
         long d;
 
@@ -497,6 +508,12 @@ py_setopt(_HandleObject *self, PyObject *args)
                 d = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
             else if (option == LRO_MAXDOWNLOADSPERMIRROR)
                 d = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
+            else if (option == LRO_MAXSEGMENTS)
+                d = LRO_MAXSEGMENTS_DEFAULT;
+            else if (option == LRO_HEDGEBUDGET)
+                d = LRO_HEDGEBUDGET_DEFAULT;
+            else if (option == LRO_AUTOTUNEPARALLELDOWNLOADS)
+                d = LRO_AUTOTUNEPARALLELDOWNLOADS_DEFAULT;
             else
                 assert(0);
         } else {
@@ -515,6 +532,7 @@ py_setopt(_HandleObject *self, PyObject *args)
      * Options with gint64/None arguments
      */
     case LRO_MAXSPEED:
+    case LRO_CONTENTSTOREMAXSIZE:
     {
         gint64 d;
 
@@ -528,6 +546,8 @@ py_setopt(_HandleObject *self, PyObject *args)
             /* Default options */
             if (option == LRO_MAXSPEED)
                 d = (gint64) LRO_MAXSPEED_DEFAULT;
+            else if (option == LRO_CONTENTSTOREMAXSIZE)
+                d = (gint64) LRO_CONTENTSTOREMAXSIZE_DEFAULT;
             else
                 assert(0);
         } else {
@@ -870,6 +890,8 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_USERAGENT:
     case LRI_FASTESTMIRRORCACHE:
     case LRI_GNUPGHOMEDIR:
+    case LRI_CACHEDREPO:
+    case LRI_CONTENTSTORE:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -901,6 +923,11 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_ALLOWEDMIRRORFAILURES:
     case LRI_ADAPTIVEMIRRORSORTING:
     case LRI_OFFLINE:
+    case LRI_MAXSEGMENTS:
+    case LRI_HEDGEBUDGET:
+    case LRI_AUTOTUNEPARALLELDOWNLOADS:
+    case LRI_MULTIPLEX:
+    case LRI_SHAREDCACHE:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -921,6 +948,18 @@ py_getinfo(_HandleObject *self, PyObject *args)
         return PyLong_FromLong((long) type);
     }
 
+    /* LrDecompressType* option  */
+    case LRI_DECOMPRESS: {
+        LrDecompressType type;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &type);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyLong_FromLong((long) type);
+    }
+
     /* List option */
     case LRI_VARSUB: {
         LrUrlVars *vars;
@@ -1027,6 +1066,29 @@ py_getinfo(_HandleObject *self, PyObject *args)
         return py_metalink;
     }
 
+    case LRI_MIRRORSTATS: {
+        PyObject *list;
+        GSList *mirrorstats;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &mirrorstats);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        if ((list = PyList_New(0)) == NULL)
+            return NULL;
+        for (GSList *elem = mirrorstats; elem; elem = g_slist_next(elem)) {
+            PyObject *py_stats = PyObject_FromMirrorStats(elem->data);
+            if (!py_stats) {
+                Py_DECREF(list);
+                return NULL;
+            }
+            PyList_Append(list, py_stats);
+            Py_DECREF(py_stats);
+        }
+        return list;
+    }
+
     default:
         PyErr_SetString(PyExc_ValueError, "Unknown option");
         return NULL;
@@ -1154,12 +1216,27 @@ py_download_package(_HandleObject *self, PyObject *args)
     }
 }
 
+static PyObject *
+py_flush_connections(_HandleObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    GError *tmp_err = NULL;
+
+    if (check_HandleStatus(self))
+        return NULL;
+
+    if (!lr_handle_flush_connections(self->handle, &tmp_err))
+        RETURN_ERROR(&tmp_err, -1, NULL);
+
+    Py_RETURN_NONE;
+}
+
 static struct
 PyMethodDef handle_methods[] = {
     { "setopt", (PyCFunction)py_setopt, METH_VARARGS, NULL },
     { "getinfo", (PyCFunction)py_getinfo, METH_VARARGS, NULL },
     { "perform", (PyCFunction)py_perform, METH_VARARGS, NULL },
     { "download_package", (PyCFunction)py_download_package, METH_VARARGS, NULL },
+    { "flush_connections", (PyCFunction)py_flush_connections, METH_NOARGS, NULL },
     { NULL }
 };
 
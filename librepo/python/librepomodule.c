@@ -280,6 +280,15 @@ init_librepo(void)
     PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORTIMEOUT);
     PYMODULE_ADDINTCONSTANT(LRO_HTTPHEADER);
     PYMODULE_ADDINTCONSTANT(LRO_OFFLINE);
+    PYMODULE_ADDINTCONSTANT(LRO_MAXSEGMENTS);
+    PYMODULE_ADDINTCONSTANT(LRO_HEDGEBUDGET);
+    PYMODULE_ADDINTCONSTANT(LRO_AUTOTUNEPARALLELDOWNLOADS);
+    PYMODULE_ADDINTCONSTANT(LRO_MULTIPLEX);
+    PYMODULE_ADDINTCONSTANT(LRO_SHAREDCACHE);
+    PYMODULE_ADDINTCONSTANT(LRO_CACHEDREPO);
+    PYMODULE_ADDINTCONSTANT(LRO_CONTENTSTORE);
+    PYMODULE_ADDINTCONSTANT(LRO_CONTENTSTOREMAXSIZE);
+    PYMODULE_ADDINTCONSTANT(LRO_DECOMPRESS);
     PYMODULE_ADDINTCONSTANT(LRO_SENTINEL);
 
     // Handle info options
@@ -314,6 +323,15 @@ init_librepo(void)
     PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORTIMEOUT);
     PYMODULE_ADDINTCONSTANT(LRI_HTTPHEADER);
     PYMODULE_ADDINTCONSTANT(LRI_OFFLINE);
+    PYMODULE_ADDINTCONSTANT(LRI_MAXSEGMENTS);
+    PYMODULE_ADDINTCONSTANT(LRI_HEDGEBUDGET);
+    PYMODULE_ADDINTCONSTANT(LRI_MIRRORSTATS);
+    PYMODULE_ADDINTCONSTANT(LRI_AUTOTUNEPARALLELDOWNLOADS);
+    PYMODULE_ADDINTCONSTANT(LRI_MULTIPLEX);
+    PYMODULE_ADDINTCONSTANT(LRI_SHAREDCACHE);
+    PYMODULE_ADDINTCONSTANT(LRI_CACHEDREPO);
+    PYMODULE_ADDINTCONSTANT(LRI_CONTENTSTORE);
+    PYMODULE_ADDINTCONSTANT(LRI_DECOMPRESS);
     PYMODULE_ADDINTCONSTANT(LRI_SENTINEL);
 
     // Check options
@@ -338,6 +356,12 @@ init_librepo(void)
     PYMODULE_ADDINTCONSTANT(LR_IPRESOLVE_V4);
     PYMODULE_ADDINTCONSTANT(LR_IPRESOLVE_V6);
 
+    // Decompress type
+    PYMODULE_ADDINTCONSTANT(LR_DECOMPRESS_NONE);
+    PYMODULE_ADDINTCONSTANT(LR_DECOMPRESS_VERIFY);
+    PYMODULE_ADDINTCONSTANT(LR_DECOMPRESS_OPEN);
+    PYMODULE_ADDINTCONSTANT(LR_DECOMPRESS_BOTH);
+
     // Return codes
     PYMODULE_ADDINTCONSTANT(LRE_OK);
     PYMODULE_ADDINTCONSTANT(LRE_BADFUNCARG);
@@ -380,6 +404,8 @@ init_librepo(void)
     PYMODULE_ADDINTCONSTANT(LRE_NOTSET);
     PYMODULE_ADDINTCONSTANT(LRE_FILE);
     PYMODULE_ADDINTCONSTANT(LRE_KEYFILE);
+    PYMODULE_ADDINTCONSTANT(LRE_CANCELLED);
+    PYMODULE_ADDINTCONSTANT(LRE_DECOMPRESS);
     PYMODULE_ADDINTCONSTANT(LRE_UNKNOWNERROR);
 
 
@@ -387,6 +413,8 @@ init_librepo(void)
     PYMODULE_ADDINTCONSTANT(LRR_YUM_REPO);
     PYMODULE_ADDINTCONSTANT(LRR_YUM_REPOMD);
     PYMODULE_ADDINTCONSTANT(LRR_YUM_TIMESTAMP);
+    PYMODULE_ADDINTCONSTANT(LRR_UNCHANGED);
+    PYMODULE_ADDINTCONSTANT(LRR_YUM_REUSED);
     PYMODULE_ADDINTCONSTANT(LRR_SENTINEL);
 
     // Checksums
@@ -268,7 +268,7 @@ packagetarget_init(_PackageTargetObject *self,
                    PyObject *kwds G_GNUC_UNUSED)
 {
     char *relative_url, *dest, *checksum, *base_url;
-    int checksum_type, resume;
+    int checksum_type, resume, weight = 1;
     PY_LONG_LONG expectedsize, byterangestart, byterangeend;
     PyObject *pyhandle, *py_progresscb, *py_cbdata;
     PyObject *py_endcb, *py_mirrorfailurecb;
@@ -280,12 +280,12 @@ packagetarget_init(_PackageTargetObject *self,
     PyObject *py_dest = NULL;
     PyObject *tmp_py_str = NULL;
 
-    if (!PyArg_ParseTuple(args, "OsOizLziOOOOLL:packagetarget_init",
+    if (!PyArg_ParseTuple(args, "OsOizLziOOOOLL|i:packagetarget_init",
                           &pyhandle, &relative_url, &py_dest, &checksum_type,
                           &checksum, &expectedsize, &base_url, &resume,
                           &py_progresscb, &py_cbdata, &py_endcb,
                           &py_mirrorfailurecb, &byterangestart,
-                          &byterangeend))
+                          &byterangeend, &weight))
         return -1;
 
     dest = PyAnyStr_AsString(py_dest, &tmp_py_str);
@@ -359,6 +359,8 @@ packagetarget_init(_PackageTargetObject *self,
         g_error_free(tmp_err);
         return -1;
     }
+
+    self->target->weight = weight;
     return 0;
 }
 
@@ -474,6 +476,7 @@ static PyGetSetDef packagetarget_getsetters[] = {
     {"mirrorfailurecb",(getter)get_pythonobj,NULL, NULL, OFFSET(mirrorfailurecb)},
     {"local_path",    (getter)get_str,       NULL, NULL, OFFSET(local_path)},
     {"err",           (getter)get_str,       NULL, NULL, OFFSET(err)},
+    {"weight",        (getter)get_int,       NULL, NULL, OFFSET(weight)},
     {NULL, NULL, NULL, NULL, NULL} /* sentinel */
 };
 
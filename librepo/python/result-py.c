@@ -157,6 +157,35 @@ getinfo(_ResultObject *self, PyObject *args)
         return PyLong_FromLongLong((PY_LONG_LONG) ts);
     }
 
+    case LRR_YUM_REUSED: {
+        PyObject *list;
+        char **strlist;
+        GError *tmp_err = NULL;
+        res = lr_result_getinfo(self->result,
+                                &tmp_err,
+                                (LrResultInfoOption)option,
+                                &strlist);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        list = PyList_New(0);
+        for (int x=0; strlist[x] != NULL; x++)
+            PyList_Append(list, PyStringOrNone_FromString(strlist[x]));
+        g_strfreev(strlist);
+        return list;
+    }
+
+    case LRR_UNCHANGED: {
+        long unchanged;
+        GError *tmp_err = NULL;
+        res = lr_result_getinfo(self->result,
+                                &tmp_err,
+                                (LrResultInfoOption)option,
+                                &unchanged);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyBool_FromLong(unchanged);
+    }
+
     /*
      * Unknown options
      */
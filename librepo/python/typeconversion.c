@@ -299,3 +299,32 @@ PyObject_FromMetalink(LrMetalink *metalink)
 
     return dict;
 }
+
+PyObject *
+PyObject_FromMirrorStats(LrMirrorStats *stats)
+{
+    PyObject *dict;
+
+    if (!stats)
+        Py_RETURN_NONE;
+
+    if ((dict = PyDict_New()) == NULL)
+        return NULL;
+
+    PyDict_SetItemString(dict, "url",
+            PyStringOrNone_FromString(stats->url));
+    PyDict_SetItemString(dict, "window",
+            PyLong_FromLong(stats->window));
+    PyDict_SetItemString(dict, "successful_transfers",
+            PyLong_FromLong(stats->successful_transfers));
+    PyDict_SetItemString(dict, "failed_transfers",
+            PyLong_FromLong(stats->failed_transfers));
+    PyDict_SetItemString(dict, "throughput",
+            PyFloat_FromDouble(stats->throughput));
+    PyDict_SetItemString(dict, "ttfb",
+            PyFloat_FromDouble(stats->ttfb));
+    PyDict_SetItemString(dict, "error_rate",
+            PyFloat_FromDouble(stats->error_rate));
+
+    return dict;
+}
@@ -24,11 +24,13 @@
 #include "librepo/repomd.h"
 #include "librepo/yum.h"
 #include "librepo/metalink.h"
+#include "librepo/handle.h"
 
 PyObject *PyStringOrNone_FromString(const char *str);
 PyObject *PyObject_FromYumRepo(LrYumRepo *repo);
 PyObject *PyObject_FromYumRepoMd(LrYumRepoMd *repomd);
 PyObject *PyObject_FromMetalink(LrMetalink *metalink);
+PyObject *PyObject_FromMirrorStats(LrMirrorStats *stats);
 char *PyAnyStr_AsString(PyObject *str, PyObject **tmp_py_str);
 
 #endif
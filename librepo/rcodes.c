@@ -106,6 +106,10 @@ lr_strerror(int rc)
         return "File operation error";
     case LRE_KEYFILE:
         return "Key file parsing error";
+    case LRE_CANCELLED:
+        return "Cancelled by a cancel token";
+    case LRE_DECOMPRESS:
+        return "Decompression error";
     }
 
     return "Unknown error";
@@ -117,6 +121,12 @@ lr_checksum_error_quark(void)
     return g_quark_from_static_string("lr_checksum_error");
 }
 
+GQuark
+lr_decompressor_error_quark(void)
+{
+    return g_quark_from_static_string("lr_decompressor_error");
+}
+
 GQuark
 lr_downloader_error_quark(void)
 {
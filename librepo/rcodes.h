@@ -123,6 +123,10 @@ typedef enum {
     LRE_KEYFILE, /*!<
         (40) Key file error (unknown encoding, ill-formed, file not found,
         key/group not found, ...) */
+    LRE_CANCELLED, /*!<
+        (41) Operation was cancelled by a cancel token (LRO_CANCELTOKEN) */
+    LRE_DECOMPRESS, /*!<
+        (42) Decompression error (corrupted or truncated compressed data) */
     LRE_UNKNOWNERROR, /*!<
         (xx) unknown error - sentinel of error codes enum */
 } LrRc; /*!< Return codes */
@@ -135,6 +139,7 @@ const char *lr_strerror(int rc);
 
 /** Error domains for GError */
 #define LR_CHECKSUM_ERROR           lr_checksum_error_quark()
+#define LR_DECOMPRESSOR_ERROR       lr_decompressor_error_quark()
 #define LR_DOWNLOADER_ERROR         lr_downloader_error_quark()
 #define LR_FASTESTMIRROR_ERROR      lr_fastestmirror_error_quark()
 #define LR_GPG_ERROR                lr_gpg_error_quark()
@@ -150,6 +155,7 @@ const char *lr_strerror(int rc);
 #define LR_YUM_ERROR                lr_yum_error_quark()
 
 GQuark lr_checksum_error_quark(void);
+GQuark lr_decompressor_error_quark(void);
 GQuark lr_downloader_error_quark(void);
 GQuark lr_fastestmirror_error_quark(void);
 GQuark lr_gpg_error_quark(void);
@@ -45,6 +45,7 @@ lr_result_clear(LrResult *result)
     lr_free(result->destdir);
     lr_yum_repomd_free(result->yum_repomd);
     lr_yum_repo_free(result->yum_repo);
+    g_slist_free_full(result->yum_reused, g_free);
     memset(result, 0, sizeof(struct _LrResult));
 }
 
@@ -108,6 +109,21 @@ lr_result_getinfo(LrResult *result,
         break;
     }
 
+    case LRR_YUM_REUSED: {
+        char ***strlist = va_arg(arg, char ***);
+        guint i = 0;
+        *strlist = g_new0(char *, g_slist_length(result->yum_reused) + 1);
+        for (GSList *elem = result->yum_reused; elem; elem = g_slist_next(elem))
+            (*strlist)[i++] = g_strdup(elem->data);
+        break;
+    }
+
+    case LRR_UNCHANGED: {
+        long *unchanged = va_arg(arg, long *);
+        *unchanged = (long) result->unchanged;
+        break;
+    }
+
     default:
         rc = FALSE;
         g_set_error(err, LR_RESULT_ERROR, LRE_UNKNOWNOPT,
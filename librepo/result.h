@@ -50,6 +50,18 @@ typedef enum {
         See: https://github.com/Tojaj/librepo/issues/25
         See: http://yum.baseurl.org/gitweb?p=yum.git;a=commitdiff;h=59d3d67f */
 
+    LRR_UNCHANGED,      /*!< (long *)
+        1 if the repository was not changed since its previous download
+        (LRO_CACHEDREPO) and the local copy is used, 0 otherwise */
+
+    LRR_YUM_REUSED,     /*!< (char *** Malloced)
+        Types of metadata files (records) which were not downloaded,
+        because their files with the right checksum already existed
+        in the destination directory (e.g. in update mode) or in the
+        cached repository (see LRO_CACHEDREPO).
+        NOTE: Returned list must be freed as well as all its items!
+        You could use g_strfreev() function. */
+
     LRR_SENTINEL,
 } LrResultInfoOption;
 
@@ -37,6 +37,14 @@ struct _LrResult {
 
     LrYumRepo      *yum_repo; /*!<
         Pointer to struct with info about yum repo */
+
+    GSList         *yum_reused; /*!<
+        Types (char *) of records which were not downloaded, because
+        their files already existed */
+
+    gboolean        unchanged; /*!<
+        Repository was not changed, the cached copy is used.
+        See: LRO_CACHEDREPO */
 };
 
 G_END_DECLS
@@ -64,6 +64,16 @@ typedef enum {
     LR_IPRESOLVE_V6,        /*!< Resolve to IPv6 addresses */
 } LrIpResolveType;
 
+/** Decompression of downloaded metadata files (LRO_DECOMPRESS) */
+typedef enum {
+    LR_DECOMPRESS_NONE,     /*!< Default - files are only downloaded */
+    LR_DECOMPRESS_VERIFY,   /*!< Decompressed data are verified,
+                                 only compressed files are stored */
+    LR_DECOMPRESS_OPEN,     /*!< Only decompressed files are stored */
+    LR_DECOMPRESS_BOTH,     /*!< Compressed and decompressed files
+                                 are stored */
+} LrDecompressType;
+
 /* Some common used arrays for LRO_YUMDLIST */
 
 /** Predefined value for LRO_YUMDLIST option - Download whole repo. */
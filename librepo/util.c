@@ -20,6 +20,7 @@
 
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 500
+#define _GNU_SOURCE     // for copy_file_range()
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <curl/curl.h>
@@ -30,8 +31,18 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdarg.h>
 #include <ftw.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#define LR_HAVE_SENDFILE        1
+#endif
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 27)
+#define LR_HAVE_COPY_FILE_RANGE 1
+#endif
 
 #include "util.h"
 #include "version.h"
@@ -39,6 +50,7 @@
 #include "cleanup.h"
 
 #define DIR_SEPARATOR   "/"
+#define COPY_CHUNK_SIZE (16 * 1024 * 1024)
 #define ENV_DEBUG       "LIBREPO_DEBUG"
 
 static void
@@ -292,6 +304,45 @@ lr_copy_content(int source, int dest)
     lseek(source, 0, SEEK_SET);
     lseek(dest, 0, SEEK_SET);
 
+#ifdef FICLONE
+    // Reflink shares the data with the source (copy on write), nothing
+    // is copied at all. Only some filesystems (e.g. Btrfs, XFS) support
+    // it and only within the same filesystem.
+    struct stat st;
+    if (fstat(dest, &st) == 0 && st.st_size == 0
+        && ioctl(dest, FICLONE, source) == 0)
+    {
+        lseek(source, 0, SEEK_END);
+        lseek(dest, 0, SEEK_END);
+        return 0;
+    }
+#endif
+
+#ifdef LR_HAVE_COPY_FILE_RANGE
+    // The data are copied by the kernel (NFS could copy them on
+    // the server). Older kernels don't support copying between
+    // different filesystems.
+    gboolean copied = FALSE;
+    while ((size = copy_file_range(source, NULL, dest, NULL,
+                                   COPY_CHUNK_SIZE, 0)) > 0)
+        copied = TRUE;
+    if (size == 0)
+        return 0;
+    if (copied)
+        return -1;
+#endif
+
+#ifdef LR_HAVE_SENDFILE
+    // The data are copied by the kernel, not through the user space
+    gboolean sent = FALSE;
+    while ((size = sendfile(dest, source, NULL, COPY_CHUNK_SIZE)) > 0)
+        sent = TRUE;
+    if (size == 0)
+        return 0;
+    if (sent)
+        return -1;
+#endif
+
     while ((size = read(source, buf, bufsize)) > 0)
         if (write(dest, buf, size) == -1)
             return -1;
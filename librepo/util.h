@@ -112,6 +112,9 @@ char *lr_pathconcat(const char *str, ...);
 int lr_remove_dir(const char *path);
 
 /** Copy content from source file descriptor to the dest file descriptor.
+ * If possible, the data are not copied through the user space - they are
+ * shared by a reflink (empty dest only) or copied by copy_file_range()
+ * or sendfile().
  * @param source        Source opened file descriptor
  * @param dest          Destination openede file descriptor
  * @return              0 on succes, -1 on error
@@ -32,6 +32,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
+#include <attr/xattr.h>
 
 #include "util.h"
 #include "metalink.h"
@@ -39,12 +40,17 @@
 #include "repomd.h"
 #include "downloader.h"
 #include "checksum.h"
+#include "decompressor.h"
 #include "handle_internal.h"
 #include "result_internal.h"
 #include "yum_internal.h"
 #include "gpg.h"
 #include "cleanup.h"
 
+/* Validators of a downloaded repomd.xml (see LRO_CACHEDREPO) */
+#define XATTR_ETAG          "user.Librepo.ETag"
+#define XATTR_LASTMODIFIED  "user.Librepo.LastModified"
+
 /* helper functions for YumRepo manipulation */
 
 LrYumRepo *
@@ -77,26 +83,39 @@ lr_yum_repo_free(LrYumRepo *repo)
     lr_free(repo);
 }
 
-const char *
-lr_yum_repo_path(LrYumRepo *repo, const char *type)
+/** Return the path item of the file of the type or NULL.
+ */
+static LrYumRepoPath *
+lr_yum_repo_path_item(LrYumRepo *repo, const char *type)
 {
     assert(repo);
     for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
         LrYumRepoPath *yumrepopath = elem->data;
         assert(yumrepopath);
         if (!strcmp(yumrepopath->type, type))
-            return yumrepopath->path;
+            return yumrepopath;
     }
     return NULL;
 }
 
+const char *
+lr_yum_repo_path(LrYumRepo *repo, const char *type)
+{
+    LrYumRepoPath *yumrepopath = lr_yum_repo_path_item(repo, type);
+    return yumrepopath ? yumrepopath->path : NULL;
+}
+
 /** Append path to the repository object.
  * @param repo          Yum repo object.
  * @param type          Type of file. E.g. "primary", "filelists", ...
  * @param path          Path to the file.
+ * @param decompressed  Is the file the decompressed file of the record.
  */
 static void
-lr_yum_repo_append(LrYumRepo *repo, const char *type, const char *path)
+lr_yum_repo_append(LrYumRepo *repo,
+                   const char *type,
+                   const char *path,
+                   gboolean decompressed)
 {
     assert(repo);
     assert(type);
@@ -105,28 +124,29 @@ lr_yum_repo_append(LrYumRepo *repo, const char *type, const char *path)
     LrYumRepoPath *yumrepopath = lr_malloc(sizeof(LrYumRepoPath));
     yumrepopath->type = g_strdup(type);
     yumrepopath->path = g_strdup(path);
+    yumrepopath->decompressed = decompressed;
     repo->paths = g_slist_append(repo->paths, yumrepopath);
 }
 
 static void
-lr_yum_repo_update(LrYumRepo *repo, const char *type, const char *path)
+lr_yum_repo_update(LrYumRepo *repo,
+                   const char *type,
+                   const char *path,
+                   gboolean decompressed)
 {
     assert(repo);
     assert(type);
     assert(path);
 
-    for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
-        LrYumRepoPath *yumrepopath = elem->data;
-        assert(yumrepopath);
-
-        if (!strcmp(yumrepopath->type, type)) {
-            lr_free(yumrepopath->path);
-            yumrepopath->path = g_strdup(path);
-            return;
-        }
+    LrYumRepoPath *yumrepopath = lr_yum_repo_path_item(repo, type);
+    if (yumrepopath) {
+        lr_free(yumrepopath->path);
+        yumrepopath->path = g_strdup(path);
+        yumrepopath->decompressed = decompressed;
+        return;
     }
 
-    lr_yum_repo_append(repo, type, path);
+    lr_yum_repo_append(repo, type, path, decompressed);
 }
 
 /* main bussines logic */
@@ -165,6 +185,11 @@ typedef struct CbData_s {
     LrProgressCb progresscb;        /*!< Progress callback */
     LrHandleMirrorFailureCb hmfcb;  /*!< Handle mirror failure callback */
     char *metadata;                 /*!< "primary", "filelists", ... */
+    double downloaded;              /*!< Downloaded bytes of the target */
+    double total;                   /*!< Total size of the target */
+    GSList **group;                 /*!< CbData of all targets of the same
+                                         repository (only used by
+                                         lr_yum_perform_multi()) */
 } CbData;
 
 static CbData *cbdata_new(void *userdata,
@@ -192,7 +217,7 @@ static int
 progresscb(void *clientp, double total_to_download, double downloaded)
 {
     CbData *data = clientp;
-    if (data->progresscb)
+    if (data && data->progresscb)
         return data->progresscb(data->userdata, total_to_download, downloaded);
     return LR_CB_OK;
 }
@@ -201,24 +226,135 @@ static int
 hmfcb(void *clientp, const char *msg, const char *url)
 {
     CbData *data = clientp;
-    if (data->hmfcb)
+    if (data && data->hmfcb)
         return data->hmfcb(data->userdata, msg, url, data->metadata);
     return LR_CB_OK;
 }
 
+/** Progress callback used when targets of several repositories are
+ * downloaded at once. Like lr_download_single_cb() it reports the sum
+ * of all targets, but only of the targets of the same repository.
+ */
+static int
+group_progresscb(void *clientp, double total_to_download, double downloaded)
+{
+    CbData *data = clientp;
+
+    if (!data->progresscb)
+        return LR_CB_OK;
+
+    if (data->downloaded > downloaded || data->total != total_to_download) {
+        // Another mirror is used for the target, the total size
+        // may have changed
+        data->total = total_to_download;
+        int ret = data->progresscb(data->userdata, 0.0, 0.0);
+        if (ret != LR_CB_OK)
+            return ret;
+    }
+
+    data->downloaded = downloaded;
+
+    double group_total = 0.0;
+    double group_downloaded = 0.0;
+    for (GSList *elem = *data->group; elem; elem = g_slist_next(elem)) {
+        CbData *member = elem->data;
+        group_total += member->total;
+        group_downloaded += member->downloaded;
+    }
+
+    if (group_downloaded > group_total)
+        group_total = group_downloaded;
+
+    return data->progresscb(data->userdata, group_total, group_downloaded);
+}
+
+/** Open repomd.xml of the cached repository (LRO_CACHEDREPO).
+ * Return -1 if there is no such file.
+ */
+static int
+lr_yum_cached_repomd_open(LrHandle *handle)
+{
+    _cleanup_free_ gchar *path = NULL;
+    int fd;
+
+    if (!handle->cachedrepo)
+        return -1;
+
+    path = lr_pathconcat(handle->cachedrepo, "repodata/repomd.xml", NULL);
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        g_debug("%s: Cannot open %s: %s", __func__, path, strerror(errno));
+    return fd;
+}
+
+/** Check if repomd.xml of the cached repository matches the checksum
+ * from the metalink. The repomd.xml is not requested at all then.
+ */
 static gboolean
-lr_yum_download_repomd(LrHandle *handle,
-                       LrMetalink *metalink,
-                       int fd,
-                       GError **err)
+lr_yum_cached_repomd_matches(LrHandle *handle, LrMetalink *metalink)
 {
-    int ret = TRUE;
+    LrChecksumType ch_type;
+    gchar *ch_value;
+    gboolean matches = FALSE;
     GError *tmp_err = NULL;
+    _cleanup_file_close_ int fd = -1;
 
-    assert(!err || *err == NULL);
+    if (!metalink || !lr_best_checksum(metalink->hashes, &ch_type, &ch_value))
+        return FALSE;
 
-    g_debug("%s: Downloading repomd.xml via mirrorlist", __func__);
+    fd = lr_yum_cached_repomd_open(handle);
+    if (fd == -1)
+        return FALSE;
+
+    // The repomd.xml is small, the checksum cache (which could be stale
+    // if the file was modified within a second) is not worth it
+    if (!lr_checksum_fd_cmp(ch_type, fd, ch_value, 0, &matches, &tmp_err)) {
+        g_debug("%s: Cannot compute checksum: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
+    }
+
+    g_debug("%s: Cached repomd.xml %s the metalink", __func__,
+            matches ? "matches" : "doesn't match");
+    return matches;
+}
+
+/** Get a validator stored in xattr of the repomd.xml or NULL.
+ */
+static gchar *
+lr_yum_validator_get(int fd, const char *name)
+{
+    char buf[1024];
+    ssize_t len = fgetxattr(fd, name, buf, sizeof(buf)-1);
+    if (len <= 0)
+        return NULL;
+    buf[len] = '\0';
+    return g_strdup(buf);
+}
+
+/** Store a validator to xattr of the repomd.xml.
+ */
+static void
+lr_yum_validator_set(int fd, const char *name, const char *value)
+{
+    if (!value) {
+        fremovexattr(fd, name);
+        return;
+    }
+
+    if (fsetxattr(fd, name, value, strlen(value)+1, 0) == -1)
+        g_debug("%s: Cannot set xattr %s: %s", __func__, name, strerror(errno));
+}
 
+/** Prepare a download target of repomd.xml. Callback data of the target
+ * (if any) must be freed by cbdata_free() after the download.
+ * The target is conditional, validators of the cached repomd.xml
+ * (if any) are used.
+ */
+static LrDownloadTarget *
+lr_yum_repomd_target_new(LrHandle *handle, LrMetalink *metalink, int fd)
+{
+    LrDownloadTarget *target;
     GSList *checksums = NULL;
     if (metalink && (handle->checks & LR_CHECK_CHECKSUM)) {
         // Select best checksum
@@ -259,64 +395,304 @@ lr_yum_download_repomd(LrHandle *handle,
                             "repomd.xml");
     }
 
-    LrDownloadTarget *target = lr_downloadtarget_new(handle,
-                                                     "repodata/repomd.xml",
-                                                     NULL,
-                                                     fd,
-                                                     NULL,
-                                                     checksums,
-                                                     0,
-                                                     0,
-                                                     NULL,
-                                                     cbdata,
-                                                     NULL,
-                                                     (cbdata) ? hmfcb : NULL,
-                                                     NULL,
-                                                     0,
-                                                     0);
-
-    ret = lr_download_target(target, &tmp_err);
-    assert((ret && !tmp_err) || (!ret && tmp_err));
+    target = lr_downloadtarget_new(handle,
+                                   "repodata/repomd.xml",
+                                   NULL,
+                                   fd,
+                                   NULL,
+                                   checksums,
+                                   0,
+                                   0,
+                                   NULL,
+                                   cbdata,
+                                   NULL,
+                                   (cbdata) ? hmfcb : NULL,
+                                   NULL,
+                                   0,
+                                   0);
+
+    target->conditional = TRUE;
+
+    _cleanup_file_close_ int cached_fd = lr_yum_cached_repomd_open(handle);
+    if (cached_fd != -1) {
+        gchar *etag = lr_yum_validator_get(cached_fd, XATTR_ETAG);
+        gchar *lastmodified = lr_yum_validator_get(cached_fd,
+                                                   XATTR_LASTMODIFIED);
+        g_debug("%s: Validators of the cached repomd.xml: ETag: %s, "
+                "Last-Modified: %s", __func__, etag, lastmodified);
+        target->etag = lr_string_chunk_insert(target->chunk, etag);
+        target->lastmodified = lr_string_chunk_insert(target->chunk,
+                                                      lastmodified);
+        g_free(etag);
+        g_free(lastmodified);
+    }
+
+    return target;
+}
+
+/** Check the result of a repomd.xml download and remember the mirror
+ * it was downloaded from. Validators of the downloaded repomd.xml
+ * are stored with it.
+ */
+static gboolean
+lr_yum_repomd_target_finished(LrHandle *handle,
+                              LrDownloadTarget *target,
+                              GError **err)
+{
+    if (target->rcode != LRE_OK) {
+        g_debug("%s: repomd.xml download was unsuccessful", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, target->rcode,
+                    "Cannot download repomd.xml: %s", target->err);
+        return FALSE;
+    }
+
+    // Set mirror used for download a repomd.xml to the handle
+    // TODO: Get rid of use_mirror attr
+    lr_free(handle->used_mirror);
+    handle->used_mirror = g_strdup(target->usedmirror);
+
+    if (target->notmodified) {
+        g_debug("%s: repomd.xml was not modified", __func__);
+        return TRUE;
+    }
+
+    lr_yum_validator_set(target->fd, XATTR_ETAG, target->etag);
+    lr_yum_validator_set(target->fd, XATTR_LASTMODIFIED, target->lastmodified);
+    return TRUE;
+}
+
+/** Download repomd.xml. If signature_target is specified, it is
+ * downloaded together with the repomd.xml and its result is not checked.
+ * If the server replies that the cached repomd.xml was not modified,
+ * notmodified is set to TRUE.
+ */
+static gboolean
+lr_yum_download_repomd(LrHandle *handle,
+                       LrMetalink *metalink,
+                       int fd,
+                       LrDownloadTarget *signature_target,
+                       gboolean *notmodified,
+                       GError **err)
+{
+    int ret = TRUE;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    g_debug("%s: Downloading repomd.xml via mirrorlist", __func__);
+
+    LrDownloadTarget *target = lr_yum_repomd_target_new(handle, metalink, fd);
 
-    if (cbdata)
-        cbdata_free(cbdata);
+    if (signature_target) {
+        // Missing signature must not stop download of the repomd.xml
+        GSList *targets = g_slist_prepend(NULL, signature_target);
+        targets = g_slist_prepend(targets, target);
+        ret = lr_download(targets, FALSE, &tmp_err);
+        g_slist_free(targets);
+    } else {
+        ret = lr_download_target(target, &tmp_err);
+    }
+    assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (tmp_err) {
+        g_debug("%s: repomd.xml download was unsuccessful", __func__);
         g_propagate_prefixed_error(err, tmp_err,
                                    "Cannot download repomd.xml: ");
-    } else if (target->err) {
-        assert(0); // This shoud not happend since failfast sould be TRUE
-        ret = FALSE;
-        g_set_error(err, LR_DOWNLOADER_ERROR, target->rcode,
-                    "Cannot download repomd.xml: %s",target->err);
     } else {
-        // Set mirror used for download a repomd.xml to the handle
-        // TODO: Get rid of use_mirror attr
-        lr_free(handle->used_mirror);
-        handle->used_mirror = g_strdup(target->usedmirror);
+        ret = lr_yum_repomd_target_finished(handle, target, err);
+        *notmodified = target->notmodified;
     }
 
+    cbdata_free(target->cbdata);
     lr_downloadtarget_free(target);
 
+    return ret;
+}
+
+/** Check if the file exists and matches the checksum from the repomd.xml
+ * (checksum of the record or its open-checksum). The checksum is cached
+ * in xattr of the file. Only the cache of the checksum type, which is
+ * validated by the mtime and size of the file, is used - never the type
+ * agnostic one (see lr_checksum_fd_compare()), which is keyed by the mtime
+ * in seconds only and could be stale.
+ */
+static gboolean
+lr_yum_record_file_matches(const char *checksum_type,
+                           const char *checksum,
+                           const char *path)
+{
+    int fd;
+    gboolean ret;
+    LrChecksumType type;
+    _cleanup_free_ gchar *calculated = NULL;
+    GError *tmp_err = NULL;
+
+    if (!checksum || !checksum_type)
+        return FALSE;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+
+    type = lr_checksum_type(checksum_type);
+    ret = lr_checksum_fd_multi(fd, &type, 1, TRUE, &calculated, &tmp_err);
+    close(fd);
+
     if (!ret) {
-        /* Download of repomd.xml was not successful */
-        g_debug("%s: repomd.xml download was unsuccessful", __func__);
+        g_debug("%s: Cannot check checksum of %s: %s",
+                __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
     }
 
-    return ret;
+    return !strcmp(calculated, checksum);
 }
 
+/** Check if the file (href) of a record doesn't have to be downloaded,
+ * because it already exists in the destdir (e.g. from the previous
+ * download in update mode) or in the cached repository (LRO_CACHEDREPO)
+ * and matches the checksum from the repomd.xml. The file from the cached
+ * repository is hard linked (or copied if it is not possible) to the path.
+ */
 static gboolean
-lr_yum_download_repo(LrHandle *handle,
-                     LrYumRepo *repo,
-                     LrYumRepoMd *repomd,
-                     GError **err)
+lr_yum_record_reuse(LrHandle *handle,
+                    const char *checksum_type,
+                    const char *checksum,
+                    const char *href,
+                    const char *path)
+{
+    _cleanup_free_ gchar *cached = NULL;
+
+    if (lr_yum_record_file_matches(checksum_type, checksum, path)) {
+        g_debug("%s: %s already exists", __func__, path);
+        return TRUE;
+    }
+
+    if (!handle->cachedrepo || handle->update)
+        return FALSE;
+
+    cached = lr_pathconcat(handle->cachedrepo, href, NULL);
+    if (!lr_yum_record_file_matches(checksum_type, checksum, cached))
+        return FALSE;
+
+    if (unlink(path) == -1 && errno != ENOENT) {
+        g_debug("%s: Cannot remove %s: %s", __func__, path, strerror(errno));
+        return FALSE;
+    }
+
+    if (link(cached, path) == 0) {
+        g_debug("%s: %s linked to %s", __func__, cached, path);
+        return TRUE;
+    }
+
+    g_debug("%s: Cannot link %s to %s (%s), copying it",
+            __func__, cached, path, strerror(errno));
+
+    _cleanup_file_close_ int fd_src = open(cached, O_RDONLY);
+    _cleanup_file_close_ int fd_dst = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (fd_src < 0 || fd_dst < 0 || lr_copy_content(fd_src, fd_dst) != 0) {
+        g_debug("%s: Cannot copy %s to %s: %s",
+                __func__, cached, path, strerror(errno));
+        unlink(path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Check if the record doesn't have to be downloaded (see
+ * lr_yum_record_reuse()). If the record is decompressed (open_path
+ * is not NULL), the decompressed file must match the open-checksum
+ * and with LR_DECOMPRESS_BOTH the compressed file must match as well.
+ */
+static gboolean
+lr_yum_record_reuse_all(LrHandle *handle,
+                        LrYumRepoMdRecord *record,
+                        const char *path,
+                        const char *open_path)
+{
+    _cleanup_free_ gchar *open_href = NULL;
+
+    if (!open_path)
+        return lr_yum_record_reuse(handle,
+                                   record->checksum_type,
+                                   record->checksum,
+                                   record->location_href,
+                                   path);
+
+    open_href = lr_compression_strip_suffix(record->location_href);
+    if (!lr_yum_record_reuse(handle,
+                             record->checksum_open_type,
+                             record->checksum_open,
+                             open_href,
+                             open_path))
+        return FALSE;
+
+    if (handle->decompress != LR_DECOMPRESS_BOTH)
+        return TRUE;
+
+    return lr_yum_record_reuse(handle,
+                               record->checksum_type,
+                               record->checksum,
+                               record->location_href,
+                               path);
+}
+
+/** Close file descriptors of a download target of a record.
+ */
+static void
+lr_yum_repo_target_close(LrDownloadTarget *target)
+{
+    close(target->fd);
+    if (target->decompressfd != -1)
+        close(target->decompressfd);
+}
+
+/** Open (create) a file of a record for writing. The file could be a hard
+ * link to a file of another repository (see lr_yum_record_reuse()),
+ * so it must not be overwritten in place.
+ */
+static int
+lr_yum_record_open(const char *path, GError **err)
+{
+    int fd;
+
+    assert(!err || *err == NULL);
+
+    if (unlink(path) == -1 && errno != ENOENT)
+        g_debug("%s: Cannot remove %s: %s",
+                __func__, path, strerror(errno));
+
+    fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (fd < 0) {
+        g_debug("%s: Cannot create/open %s (%s)",
+                __func__, path, strerror(errno));
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot create/open %s: %s", path, strerror(errno));
+    }
+
+    return fd;
+}
+
+/** Prepare download targets of all enabled metadata files (records)
+ * of the repository and append them to the targets list (and their
+ * callback data to the cbdata_list). Records which don't have to be
+ * downloaded (see lr_yum_record_reuse()) are added to the yum_reused
+ * of the result. Compressed records are decompressed during the download
+ * if LRO_DECOMPRESS is used.
+ */
+static gboolean
+lr_yum_repo_targets(LrHandle *handle,
+                    LrResult *result,
+                    GSList **targets,
+                    GSList **cbdata_list,
+                    GError **err)
 {
-    gboolean ret = TRUE;
     char *destdir;  /* Destination dir */
-    GSList *targets = NULL;
-    GSList *cbdata_list = NULL;
-    GError *tmp_err = NULL;
+    LrYumRepo *repo = result->yum_repo;
+    LrYumRepoMd *repomd = result->yum_repomd;
+    GSList *new_targets = NULL;
+    GSList *new_cbdata_list = NULL;
 
     destdir = handle->destdir;
     assert(destdir);
@@ -324,8 +700,10 @@ lr_yum_download_repo(LrHandle *handle,
     assert(!err || *err == NULL);
 
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
-        int fd;
+        int fd, decompressfd = -1;
         char *path;
+        _cleanup_free_ gchar *open_path = NULL;
+        gboolean decompress;
         LrDownloadTarget *target;
         LrYumRepoMdRecord *record = elem->data;
         CbData *cbdata = NULL;
@@ -336,14 +714,40 @@ lr_yum_download_repo(LrHandle *handle,
             continue;
 
         path = lr_pathconcat(destdir, record->location_href, NULL);
-        fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+
+        decompress = handle->decompress != LR_DECOMPRESS_NONE
+            && lr_compression_supported(lr_compression_type(record->location_href));
+        if (decompress && handle->decompress != LR_DECOMPRESS_VERIFY)
+            open_path = lr_compression_strip_suffix(path);
+
+        if (lr_yum_record_reuse_all(handle, record, path, open_path)) {
+            lr_yum_repo_update(repo, record->type,
+                               open_path ? open_path : path,
+                               open_path != NULL);
+            result->yum_reused = g_slist_append(result->yum_reused,
+                                                g_strdup(record->type));
+            lr_free(path);
+            continue;
+        }
+
+        fd = lr_yum_record_open(path, err);
+        if (fd >= 0 && open_path) {
+            decompressfd = lr_yum_record_open(open_path, err);
+            if (decompressfd < 0) {
+                close(fd);
+                fd = -1;
+            } else if (handle->decompress == LR_DECOMPRESS_OPEN) {
+                // Only the decompressed file is kept
+                unlink(path);
+            }
+        }
+
         if (fd < 0) {
-            g_debug("%s: Cannot create/open %s (%s)",
-                    __func__, path, strerror(errno));
-            g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot create/open %s: %s", path, strerror(errno));
             lr_free(path);
-            g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+            for (GSList *el = new_targets; el; el = g_slist_next(el))
+                lr_yum_repo_target_close(el->data);
+            g_slist_free_full(new_cbdata_list, (GDestroyNotify) cbdata_free);
+            g_slist_free_full(new_targets, (GDestroyNotify) lr_downloadtarget_free);
             return FALSE;
         }
 
@@ -362,7 +766,7 @@ lr_yum_download_repo(LrHandle *handle,
                                 handle->user_cb,
                                 handle->hmfcb,
                                 record->type);
-            cbdata_list = g_slist_append(cbdata_list, cbdata);
+            new_cbdata_list = g_slist_append(new_cbdata_list, cbdata);
         }
 
         target = lr_downloadtarget_new(handle,
@@ -381,13 +785,91 @@ lr_yum_download_repo(LrHandle *handle,
                                        0,
                                        0);
 
-        targets = g_slist_append(targets, target);
+        if (decompress) {
+            target->decompress = TRUE;
+            target->decompressfd = decompressfd;
+            target->expectedsize_open = record->size_open;
+            if ((handle->checks & LR_CHECK_CHECKSUM) && record->checksum_open) {
+                LrDownloadTargetChecksum *checksum;
+                checksum = lr_downloadtargetchecksum_new(
+                                lr_checksum_type(record->checksum_open_type),
+                                record->checksum_open);
+                target->checksums_open = g_slist_prepend(NULL, checksum);
+            }
+        }
+
+        new_targets = g_slist_append(new_targets, target);
 
         /* Because path may already exists in repo (while update) */
-        lr_yum_repo_update(repo, record->type, path);
+        lr_yum_repo_update(repo, record->type,
+                           open_path ? open_path : path,
+                           open_path != NULL);
         lr_free(path);
     }
 
+    *targets = g_slist_concat(*targets, new_targets);
+    *cbdata_list = g_slist_concat(*cbdata_list, new_cbdata_list);
+    return TRUE;
+}
+
+/** Check results of downloaded records of a repository and close
+ * their file descriptors.
+ */
+static gboolean
+lr_yum_repo_targets_finished(GSList *targets, GError **err)
+{
+    int code = LRE_OK;
+    char *error_summary = NULL;
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        if (target->rcode != LRE_OK) {
+            if (code == LRE_OK) {
+                // First failed download target found
+                code = target->rcode;
+                error_summary = g_strconcat(target->path,
+                                            " - ",
+                                            target->err,
+                                            NULL);
+            } else {
+                error_summary = g_strconcat(error_summary,
+                                            "; ",
+                                            target->path,
+                                            " - ",
+                                            target->err,
+                                            NULL);
+            }
+        }
+
+        lr_yum_repo_target_close(target);
+    }
+
+    if (code != LRE_OK) {
+        // At least one target failed
+        g_set_error(err, LR_DOWNLOADER_ERROR, code,
+                    "Downloading error(s): %s", error_summary);
+        g_free(error_summary);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+lr_yum_download_repo(LrHandle *handle,
+                     LrResult *result,
+                     GError **err)
+{
+    gboolean ret = TRUE;
+    GSList *targets = NULL;
+    GSList *cbdata_list = NULL;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!lr_yum_repo_targets(handle, result, &targets, &cbdata_list, err))
+        return FALSE;
+
     if (!targets)
         return TRUE;
 
@@ -405,39 +887,7 @@ lr_yum_download_repo(LrHandle *handle,
         g_propagate_prefixed_error(err, tmp_err,
                                    "Downloading error: ");
     } else {
-        int code = LRE_OK;
-        char *error_summary = NULL;
-
-        for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-            LrDownloadTarget *target = elem->data;
-            if (target->rcode != LRE_OK) {
-                if (code == LRE_OK) {
-                    // First failed download target found
-                    code = target->rcode;
-                    error_summary = g_strconcat(target->path,
-                                                " - ",
-                                                target->err,
-                                                NULL);
-                } else {
-                    error_summary = g_strconcat(error_summary,
-                                                "; ",
-                                                target->path,
-                                                " - ",
-                                                target->err,
-                                                NULL);
-                }
-            }
-
-            close(target->fd);
-        }
-
-        if (code != LRE_OK) {
-            // At least one target failed
-            ret = FALSE;
-            g_set_error(err, LR_DOWNLOADER_ERROR, code,
-                        "Downloading error(s): %s", error_summary);
-            g_free(error_summary);
-        }
+        ret = lr_yum_repo_targets_finished(targets, err);
     }
 
     g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
@@ -446,27 +896,41 @@ lr_yum_download_repo(LrHandle *handle,
     return ret;
 }
 
+/** Prepare the checksum check of the file of a record.
+ * @return          FALSE if err is set, TRUE otherwise. The check->path
+ *                  is NULL if the file doesn't have to be checked.
+ */
 static gboolean
-lr_yum_check_checksum_of_md_record(LrYumRepoMdRecord *rec,
-                                   const char *path,
-                                   GError **err)
+lr_yum_prepare_checksum_check_of_md_record(LrYumRepoMdRecord *rec,
+                                           const char *path,
+                                           gboolean decompressed,
+                                           LrChecksumCheck *check,
+                                           GError **err)
 {
-    int fd;
     char *expected_checksum;
+    char *checksum_type_str;
     LrChecksumType checksum_type;
-    gboolean ret, matches;
-    GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
 
+    check->path = NULL;
+
     if (!rec || !path)
         return TRUE;
 
     expected_checksum = rec->checksum;
-    checksum_type = lr_checksum_type(rec->checksum_type);
+    checksum_type_str = rec->checksum_type;
+
+    if (decompressed) {
+        // Decompressed file of the record (see LRO_DECOMPRESS)
+        expected_checksum = rec->checksum_open;
+        checksum_type_str = rec->checksum_open_type;
+    }
+
+    checksum_type = lr_checksum_type(checksum_type_str);
 
     g_debug("%s: Checking checksum of %s (expected: %s [%s])",
-                       __func__, path, expected_checksum, rec->checksum_type);
+                       __func__, path, expected_checksum, checksum_type_str);
 
     if (!expected_checksum) {
         // Empty checksum - suppose it's ok
@@ -475,71 +939,94 @@ lr_yum_check_checksum_of_md_record(LrYumRepoMdRecord *rec,
     }
 
     if (checksum_type == LR_CHECKSUM_UNKNOWN) {
-        g_debug("%s: Unknown checksum: %s", __func__, rec->checksum_type);
+        g_debug("%s: Unknown checksum: %s", __func__, checksum_type_str);
         g_set_error(err, LR_YUM_ERROR, LRE_UNKNOWNCHECKSUM,
                     "Unknown checksum type \"%s\" for %s",
-                    rec->checksum_type, path);
+                    checksum_type_str, path);
         return FALSE;
     }
 
-    fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        g_debug("%s: Cannot open %s", __func__, path);
-        g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                    "Cannot open %s: %s", path, strerror(errno));
-        return FALSE;
-    }
+    check->path = path;
+    check->type = checksum_type;
+    check->expected = expected_checksum;
+    check->caching = TRUE;
 
-    ret = lr_checksum_fd_cmp(checksum_type,
-                             fd,
-                             expected_checksum,
-                             1,
-                             &matches,
-                             &tmp_err);
+    return TRUE;
+}
 
-    close(fd);
-
-    assert(ret || tmp_err);
-
-    if (!ret) {
+/** Report a failed checksum check of a record.
+ */
+static gboolean
+lr_yum_checksum_check_result(LrChecksumCheck *check, GError **err)
+{
+    if (check->rcode == LRE_IO) {
+        g_debug("%s: Cannot open %s", __func__, check->path);
+        g_set_error(err, LR_YUM_ERROR, LRE_IO, "%s", check->err->message);
+        return FALSE;
+    } else if (check->rcode != LRE_OK) {
         // Checksum calculation error
-        g_debug("%s: Checksum check %s - Error: %s",
-                __func__, path, tmp_err->message);
-        g_propagate_prefixed_error(err, tmp_err,
-                                   "Checksum error %s: ", path);
+        g_debug("%s: Checksum check %s - Error", __func__, check->path);
+        g_set_error(err, LR_YUM_ERROR, check->rcode,
+                    "Checksum error %s: %s",
+                    check->path, check->err->message);
         return FALSE;
-    } else if (!matches) {
-        g_debug("%s: Checksum check %s - Mismatch", __func__, path);
+    } else if (!check->matches) {
+        g_debug("%s: Checksum check %s - Mismatch", __func__, check->path);
         g_set_error(err, LR_YUM_ERROR, LRE_BADCHECKSUM,
-                    "Checksum mismatch %s", path);
+                    "Checksum mismatch %s", check->path);
         return FALSE;
     }
 
-    g_debug("%s: Checksum check - Passed", __func__);
+    g_debug("%s: Checksum check %s - Passed", __func__, check->path);
 
     return TRUE;
 }
 
+/** Check checksums of files of all records of the repository. The files
+ * are checked in parallel (see lr_checksum_check_files()). All of them
+ * are checked and the first failure in the order of the records is
+ * reported, regardless of the order in which the checks finished.
+ */
 static gboolean
 lr_yum_check_repo_checksums(LrYumRepo *repo,
                             LrYumRepoMd *repomd,
                             GError **err)
 {
+    _cleanup_free_ LrChecksumCheck *checks = NULL;
+    gboolean ret = TRUE;
+    gsize count = 0;
+
     assert(!err || *err == NULL);
 
+    checks = g_new0(LrChecksumCheck, g_slist_length(repomd->records));
+
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
-        gboolean ret;
         LrYumRepoMdRecord *record = elem->data;
 
         assert(record);
 
-        const char *path = lr_yum_repo_path(repo, record->type);
-        ret = lr_yum_check_checksum_of_md_record(record, path, err);
-        if (!ret)
+        LrYumRepoPath *yumrepopath = lr_yum_repo_path_item(repo, record->type);
+        if (!yumrepopath)
+            continue;
+        if (!lr_yum_prepare_checksum_check_of_md_record(record,
+                                                        yumrepopath->path,
+                                                        yumrepopath->decompressed,
+                                                        &checks[count], err))
             return FALSE;
+        if (checks[count].path)
+            count++;
     }
 
-    return TRUE;
+    if (!lr_checksum_check_files(checks, count, NULL, NULL, err))
+        return FALSE;
+
+    for (gsize x = 0; x < count; x++) {
+        if (ret)
+            ret = lr_yum_checksum_check_result(&checks[x], err);
+        g_clear_error(&checks[x].err);
+    }
+
+    return ret;
 }
 
 static gboolean
@@ -556,8 +1043,8 @@ lr_yum_use_local_load_base(LrHandle *handle,
     _cleanup_free_ gchar *sig = NULL;
     _cleanup_file_close_ int fd = -1;
 
-    if (handle->mirrorlist_fd != -1) {
-        // Locate mirrorlist if available.
+    if (handle->mirrorlist_fd != -1 && !repo->mirrorlist) {
+        // Locate mirrorlist if available (and not stored yet).
         gchar *mrl_fn = lr_pathconcat(baseurl, "mirrorlist", NULL);
         if (g_file_test(mrl_fn, G_FILE_TEST_IS_REGULAR)) {
             g_debug("%s: Found local mirrorlist: %s", __func__, mrl_fn);
@@ -568,8 +1055,8 @@ lr_yum_use_local_load_base(LrHandle *handle,
         }
     }
 
-    if (handle->metalink_fd != -1) {
-        // Locate metalink.xml if available.
+    if (handle->metalink_fd != -1 && !repo->metalink) {
+        // Locate metalink.xml if available (and not stored yet).
         gchar *mtl_fn = lr_pathconcat(baseurl, "metalink.xml", NULL);
         if (g_file_test(mtl_fn, G_FILE_TEST_IS_REGULAR)) {
             g_debug("%s: Found local metalink: %s", __func__, mtl_fn);
@@ -642,34 +1129,21 @@ lr_yum_use_local_load_base(LrHandle *handle,
     return TRUE;
 }
 
-/* Do not duplicate repoata, just locate the local one */
+/** Locate metadata of the repository in the local directory */
 static gboolean
-lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
+lr_yum_use_local_dir(LrHandle *handle,
+                     LrResult *result,
+                     const char *baseurl,
+                     GError **err)
 {
-    char *baseurl;
     LrYumRepo *repo;
     LrYumRepoMd *repomd;
 
     assert(!err || *err == NULL);
 
-    g_debug("%s: Locating repo..", __func__);
-
     // Shortcuts
     repo   = result->yum_repo;
     repomd = result->yum_repomd;
-    baseurl = handle->urls[0];
-
-    // Skip "file://" prefix if present
-    if (g_str_has_prefix(baseurl, "file://"))
-        baseurl += 7;
-
-    // Check sanity
-    if (strstr(baseurl, "://")) {
-        g_set_error(err, LR_YUM_ERROR, LRE_NOTLOCAL,
-                    "URL: %s doesn't seem to be a local repository",
-                    baseurl);
-        return FALSE;
-    }
 
     if (!handle->update) {
         // Load repomd.xml and mirrorlist+metalink if locally available
@@ -680,6 +1154,7 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
     // Locate rest of metadata files
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
         _cleanup_free_ char *path = NULL;
+        gboolean decompressed = FALSE;
         LrYumRepoMdRecord *record = elem->data;
 
         assert(record);
@@ -690,6 +1165,20 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
             continue; // This path already exists in repo
 
         path = lr_pathconcat(baseurl, record->location_href, NULL);
+
+        if (handle->decompress == LR_DECOMPRESS_OPEN
+            || handle->decompress == LR_DECOMPRESS_BOTH) {
+            // Prefer the decompressed file (see LRO_DECOMPRESS)
+            gchar *open_path = lr_compression_strip_suffix(path);
+            if (open_path && access(open_path, F_OK) == 0) {
+                g_free(path);
+                path = open_path;
+                decompressed = TRUE;
+            } else {
+                g_free(open_path);
+            }
+        }
+
         if (access(path, F_OK) == -1) {
             // A repo file is missing
             if (!handle->ignoremissing) {
@@ -704,31 +1193,104 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
             continue;
         }
 
-        lr_yum_repo_append(repo, record->type, path);
+        lr_yum_repo_append(repo, record->type, path, decompressed);
     }
 
     g_debug("%s: Repository was successfully located", __func__);
     return TRUE;
 }
 
+/* Do not duplicate repoata, just locate the local one */
 static gboolean
-lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
+lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
+{
+    char *baseurl;
+
+    assert(!err || *err == NULL);
+
+    g_debug("%s: Locating repo..", __func__);
+
+    baseurl = handle->urls[0];
+
+    // Skip "file://" prefix if present
+    if (g_str_has_prefix(baseurl, "file://"))
+        baseurl += 7;
+
+    // Check sanity
+    if (strstr(baseurl, "://")) {
+        g_set_error(err, LR_YUM_ERROR, LRE_NOTLOCAL,
+                    "URL: %s doesn't seem to be a local repository",
+                    baseurl);
+        return FALSE;
+    }
+
+    return lr_yum_use_local_dir(handle, result, baseurl, err);
+}
+
+/** Use the cached repository (LRO_CACHEDREPO) instead of the remote one,
+ * because its repomd.xml was not modified. The repomd.xml prepared
+ * in the destdir (fd, path) is removed and the path is freed.
+ */
+static gboolean
+lr_yum_use_cached(LrHandle *handle,
+                  LrResult *result,
+                  int fd,
+                  char *path,
+                  GError **err)
+{
+    _cleanup_free_ gchar *path_to_repodata = NULL;
+
+    assert(!err || *err == NULL);
+
+    g_debug("%s: Repository not modified, using %s",
+            __func__, handle->cachedrepo);
+
+    close(fd);
+    if (unlink(path) == -1)
+        g_debug("%s: Cannot remove %s: %s", __func__, path, strerror(errno));
+    lr_free(path);
+
+    // Remove the repodata/ subdir if it is empty
+    path_to_repodata = lr_pathconcat(handle->destdir, "repodata", NULL);
+    rmdir(path_to_repodata);
+
+    if (!lr_yum_use_local_dir(handle, result, handle->cachedrepo, err))
+        return FALSE;
+
+    if (handle->checks & LR_CHECK_CHECKSUM
+        && !lr_yum_check_repo_checksums(result->yum_repo,
+                                        result->yum_repomd,
+                                        err))
+        return FALSE;
+
+    if (handle->used_mirror)
+        result->yum_repo->url = g_strdup(handle->used_mirror);
+    result->unchanged = TRUE;
+    return TRUE;
+}
+
+/** Prepare the destination directory of a remote repository.
+ * If not in update mode, store the mirrorlist and metalink and open
+ * a file for repomd.xml (repomd_fd, repomd_path), otherwise repomd_fd
+ * is set to -1.
+ */
+static gboolean
+lr_yum_prepare_remote(LrHandle *handle,
+                      LrResult *result,
+                      int *repomd_fd,
+                      char **repomd_path,
+                      GError **err)
 {
     int rc;
-    gboolean ret = TRUE;
     int fd;
     int create_repodata_dir = 1;
     char *path_to_repodata;
-    LrYumRepo *repo;
-    LrYumRepoMd *repomd;
-    GError *tmp_err = NULL;
+    LrYumRepo *repo = result->yum_repo;
 
     assert(!err || *err == NULL);
 
-    repo   = result->yum_repo;
-    repomd = result->yum_repomd;
-
-    g_debug("%s: Downloading/Copying repo..", __func__);
+    *repomd_fd = -1;
+    *repomd_path = NULL;
 
     path_to_repodata = lr_pathconcat(handle->destdir, "repodata", NULL);
 
@@ -754,75 +1316,270 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
     }
     lr_free(path_to_repodata);
 
-    if (!handle->update) {
-        char *path;
+    if (handle->update)
+        return TRUE;
 
-        /* Store mirrorlist file(s) */
-        if (handle->mirrorlist_fd != -1) {
-            char *ml_file_path = lr_pathconcat(handle->destdir,
-                                               "mirrorlist", NULL);
-            fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
-            if (fd < 0) {
-                g_debug("%s: Cannot create: %s", __func__, ml_file_path);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot create %s: %s", ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            rc = lr_copy_content(handle->mirrorlist_fd, fd);
-            close(fd);
-            if (rc != 0) {
-                g_debug("%s: Cannot copy content of mirrorlist file", __func__);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot copy content of mirrorlist file %s: %s",
-                        ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            repo->mirrorlist = ml_file_path;
-        }
-
-        if (handle->metalink_fd != -1) {
-            char *ml_file_path = lr_pathconcat(handle->destdir,
-                                               "metalink.xml", NULL);
-            fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
-            if (fd < 0) {
-                g_debug("%s: Cannot create: %s", __func__, ml_file_path);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot create %s: %s", ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            rc = lr_copy_content(handle->metalink_fd, fd);
-            close(fd);
-            if (rc != 0) {
-                g_debug("%s: Cannot copy content of metalink file", __func__);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot copy content of metalink file %s: %s",
-                        ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            repo->metalink = ml_file_path;
-        }
+    char *path;
 
-        /* Prepare repomd.xml file */
-        path = lr_pathconcat(handle->destdir, "/repodata/repomd.xml", NULL);
-        fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
-        if (fd == -1) {
+    /* Store mirrorlist file(s) */
+    if (handle->mirrorlist_fd != -1) {
+        char *ml_file_path = lr_pathconcat(handle->destdir,
+                                           "mirrorlist", NULL);
+        fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (fd < 0) {
+            g_debug("%s: Cannot create: %s", __func__, ml_file_path);
             g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot open %s: %s", path, strerror(errno));
-            lr_free(path);
+                    "Cannot create %s: %s", ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
             return FALSE;
         }
+        rc = lr_copy_content(handle->mirrorlist_fd, fd);
+        close(fd);
+        if (rc != 0) {
+            g_debug("%s: Cannot copy content of mirrorlist file", __func__);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot copy content of mirrorlist file %s: %s",
+                    ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
+            return FALSE;
+        }
+        repo->mirrorlist = ml_file_path;
+    }
 
-        /* Download repomd.xml */
-        ret = lr_yum_download_repomd(handle, handle->metalink, fd, err);
-        if (!ret) {
-            close(fd);
-            lr_free(path);
+    if (handle->metalink_fd != -1) {
+        char *ml_file_path = lr_pathconcat(handle->destdir,
+                                           "metalink.xml", NULL);
+        fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (fd < 0) {
+            g_debug("%s: Cannot create: %s", __func__, ml_file_path);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot create %s: %s", ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
             return FALSE;
         }
+        rc = lr_copy_content(handle->metalink_fd, fd);
+        close(fd);
+        if (rc != 0) {
+            g_debug("%s: Cannot copy content of metalink file", __func__);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot copy content of metalink file %s: %s",
+                    ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
+            return FALSE;
+        }
+        repo->metalink = ml_file_path;
+    }
+
+    /* Prepare repomd.xml file. An old one is removed, not truncated,
+     * it could be a hardlink to the cached repomd.xml (LRO_CACHEDREPO),
+     * which is read later. */
+    path = lr_pathconcat(handle->destdir, "/repodata/repomd.xml", NULL);
+    if (unlink(path) == -1 && errno != ENOENT)
+        g_debug("%s: Cannot remove %s: %s", __func__, path, strerror(errno));
+    fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (fd == -1) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, strerror(errno));
+        lr_free(path);
+        return FALSE;
+    }
+
+    *repomd_fd = fd;
+    *repomd_path = path;
+    return TRUE;
+}
+
+/** Open a file for repomd.xml.asc.
+ */
+static gboolean
+lr_yum_signature_open(LrHandle *handle,
+                      char **signature,
+                      int *fd,
+                      GError **err)
+{
+    char *path;
+
+    path = lr_pathconcat(handle->destdir, "repodata/repomd.xml.asc", NULL);
+    *fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (*fd == -1) {
+        g_debug("%s: Cannot open: %s", __func__, path);
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, strerror(errno));
+        lr_free(path);
+        return FALSE;
+    }
+
+    *signature = path;
+    return TRUE;
+}
+
+/** Prepare a download target of repomd.xml.asc from the given mirror.
+ */
+static LrDownloadTarget *
+lr_yum_signature_target_new(LrHandle *handle, const char *mirror, int fd)
+{
+    LrDownloadTarget *target;
+    char *url = lr_pathconcat(mirror, "repodata/repomd.xml.asc", NULL);
+    target = lr_downloadtarget_new(handle, url, NULL, fd, NULL, NULL, 0, 0,
+                                   NULL, NULL, NULL, NULL, NULL, 0, 0);
+    lr_free(url);
+    return target;
+}
+
+/** Verify the downloaded repomd.xml.asc. If the download failed,
+ * dl_err is the error of the download.
+ */
+static gboolean
+lr_yum_signature_finished(LrHandle *handle,
+                          LrYumRepo *repo,
+                          const char *signature,
+                          const char *path,
+                          GError *dl_err,
+                          GError **err)
+{
+    GError *tmp_err = NULL;
+
+    if (dl_err) {
+        // Signature doesn't exist
+        g_debug("%s: GPG signature doesn't exists: %s",
+                __func__, dl_err->message);
+        g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
+                    "GPG verification is enabled, but GPG signature "
+                    "repomd.xml.asc is not available: %s", dl_err->message);
+        unlink(signature);
+        return FALSE;
+    }
+
+    // Signature downloaded
+    repo->signature = g_strdup(signature);
+    if (!lr_gpg_check_signature(signature,
+                                path,
+                                handle->gnupghomedir,
+                                &tmp_err)) {
+        g_debug("%s: GPG signature verification failed: %s",
+                __func__, tmp_err->message);
+        g_propagate_prefixed_error(err, tmp_err,
+                "repomd.xml GPG signature verification error: ");
+        return FALSE;
+    }
+
+    g_debug("%s: GPG signature successfully verified", __func__);
+    return TRUE;
+}
+
+/** Check repomd.xml.asc which was downloaded from the mirror together
+ * with repomd.xml (see lr_yum_download_remote()). Since the signature
+ * must come from the mirror which served the repomd.xml, it is downloaded
+ * again if the repomd.xml came from another mirror (or if no target
+ * was prepared at all).
+ */
+static gboolean
+lr_yum_signature_target_finished(LrHandle *handle,
+                                 LrYumRepo *repo,
+                                 LrDownloadTarget *target,
+                                 const char *mirror,
+                                 int fd,
+                                 const char *signature,
+                                 const char *path,
+                                 GError **err)
+{
+    gboolean ret;
+    GError *dl_err = NULL;
+
+    if (!target || g_strcmp0(mirror, handle->used_mirror)) {
+        _cleanup_free_ char *url = NULL;
+        g_debug("%s: repomd.xml downloaded from %s, downloading signature "
+                "from there", __func__, handle->used_mirror);
+        url = lr_pathconcat(handle->used_mirror, "repodata/repomd.xml.asc", NULL);
+        if (ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0)
+            lr_download_url(handle, url, fd, &dl_err);
+        else
+            g_set_error(&dl_err, LR_YUM_ERROR, LRE_IO,
+                        "Cannot truncate %s: %s", signature, strerror(errno));
+    } else if (target->rcode != LRE_OK) {
+        dl_err = g_error_new(LR_DOWNLOADER_ERROR, target->rcode,
+                             "%s", target->err);
+    }
+
+    ret = lr_yum_signature_finished(handle, repo, signature, path,
+                                    dl_err, err);
+    g_clear_error(&dl_err);
+    return ret;
+}
+
+/** Parse downloaded repomd.xml and fill the result object.
+ * The fd is closed and the path is taken over by the result
+ * (or freed) in any case.
+ */
+static gboolean
+lr_yum_repomd_parse(LrHandle *handle,
+                    LrResult *result,
+                    int fd,
+                    char *path,
+                    GError **err)
+{
+    gboolean ret;
+    LrYumRepo *repo = result->yum_repo;
+    LrYumRepoMd *repomd = result->yum_repomd;
+    GError *tmp_err = NULL;
+
+    lseek(fd, 0, SEEK_SET);
+
+    /* Parse repomd */
+    g_debug("%s: Parsing repomd.xml", __func__);
+    ret = lr_yum_repomd_parse_file(repomd, fd, lr_xml_parser_warning_logger,
+                                   "Repomd xml parser", &tmp_err);
+    close(fd);
+    if (!ret) {
+        g_debug("%s: Parsing unsuccessful: %s", __func__, tmp_err->message);
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "repomd.xml parser error: ");
+        lr_free(path);
+        return FALSE;
+    }
+
+    /* Fill result object */
+    result->destdir = g_strdup(handle->destdir);
+    repo->destdir = g_strdup(handle->destdir);
+    repo->repomd = path;
+    if (handle->used_mirror)
+        repo->url = g_strdup(handle->used_mirror);
+    else
+        repo->url = g_strdup(handle->urls[0]);
+
+    g_debug("%s: Repomd revision: %s", __func__, repomd->revision);
+    return TRUE;
+}
+
+static gboolean
+lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
+{
+    gboolean ret = TRUE;
+    int fd;
+    char *path;
+    LrYumRepo *repo;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    repo   = result->yum_repo;
+
+    g_debug("%s: Downloading/Copying repo..", __func__);
+
+    if (!lr_yum_prepare_remote(handle, result, &fd, &path, err))
+        return FALSE;
+
+    if (!handle->update) {
+        int fd_sig = -1;
+        char *signature = NULL;
+        char *sig_mirror = NULL;
+        LrDownloadTarget *sig_target = NULL;
+        gboolean notmodified;
+
+        /* The cached repomd.xml which matches the metalink doesn't have
+         * to be requested at all. Otherwise it is requested conditionally.
+         **/
+        notmodified = lr_yum_cached_repomd_matches(handle, handle->metalink);
 
         /* Check repomd.xml.asc if available.
          * Try to download and verify GPG signature (repomd.xml.asc).
@@ -832,88 +1589,57 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
          * Every mirror would be tried because mirrorded_download function have
          * no clue if 404 for repomd.xml.asc means that no signature exists or
          * it is just error on the mirror and should try the next one.
+         * To save a round trip, the signature is downloaded from the first
+         * mirror together with repomd.xml, which is almost always downloaded
+         * from the first mirror too.
          **/
-        if (handle->checks & LR_CHECK_GPG) {
-            int fd_sig;
-            char *url, *signature;
-
-            signature = lr_pathconcat(handle->destdir, "repodata/repomd.xml.asc", NULL);
-            fd_sig = open(signature, O_CREAT|O_TRUNC|O_RDWR, 0666);
-            if (fd_sig == -1) {
-                g_debug("%s: Cannot open: %s", __func__, signature);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                            "Cannot open %s: %s", signature, strerror(errno));
+        if (!notmodified && handle->checks & LR_CHECK_GPG) {
+            if (!lr_yum_signature_open(handle, &signature, &fd_sig, err)) {
                 close(fd);
                 lr_free(path);
-                lr_free(signature);
                 return FALSE;
             }
 
-            url = lr_pathconcat(handle->used_mirror, "repodata/repomd.xml.asc", NULL);
-            ret = lr_download_url(handle, url, fd_sig, &tmp_err);
-            lr_free(url);
-            close(fd_sig);
-            if (!ret) {
-                // Signature doesn't exist
-                g_debug("%s: GPG signature doesn't exists: %s",
-                        __func__, tmp_err->message);
-                g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
-                            "GPG verification is enabled, but GPG signature "
-                            "repomd.xml.asc is not available: %s", tmp_err->message);
-                g_clear_error(&tmp_err);
-                unlink(signature);
-                lr_free(signature);
-                return FALSE;
-            } else {
-                // Signature downloaded
-                repo->signature = g_strdup(signature);
-                ret = lr_gpg_check_signature(signature,
-                                             path,
-                                             handle->gnupghomedir,
-                                             &tmp_err);
-                if (!ret) {
-                    g_debug("%s: GPG signature verification failed: %s",
-                            __func__, tmp_err->message);
-                    g_propagate_prefixed_error(err, tmp_err,
-                            "repomd.xml GPG signature verification error: ");
-                    close(fd);
-                    lr_free(path);
-                    lr_free(signature);
-                    return FALSE;
-                }
-                g_debug("%s: GPG signature successfully verified", __func__);
-            }
+            sig_mirror = g_strdup(lr_lrmirrorlist_nth_url(
+                                        handle->internal_mirrorlist, 0));
+            if (sig_mirror)
+                sig_target = lr_yum_signature_target_new(handle, sig_mirror,
+                                                         fd_sig);
         }
 
-        lseek(fd, 0, SEEK_SET);
+        /* Download repomd.xml */
+        if (!notmodified)
+            ret = lr_yum_download_repomd(handle, handle->metalink, fd,
+                                         sig_target, &notmodified, err);
+
+        if (ret && fd_sig != -1 && !notmodified)
+            ret = lr_yum_signature_target_finished(handle, repo, sig_target,
+                                                   sig_mirror, fd_sig,
+                                                   signature, path, err);
+        else if (fd_sig != -1)
+            unlink(signature);
+
+        if (fd_sig != -1)
+            close(fd_sig);
+        lr_downloadtarget_free(sig_target);
+        lr_free(sig_mirror);
+        lr_free(signature);
 
-        /* Parse repomd */
-        g_debug("%s: Parsing repomd.xml", __func__);
-        ret = lr_yum_repomd_parse_file(repomd, fd, lr_xml_parser_warning_logger,
-                                       "Repomd xml parser", &tmp_err);
-        close(fd);
         if (!ret) {
-            g_debug("%s: Parsing unsuccessful: %s", __func__, tmp_err->message);
-            g_propagate_prefixed_error(err, tmp_err,
-                                       "repomd.xml parser error: ");
+            close(fd);
             lr_free(path);
             return FALSE;
         }
 
-        /* Fill result object */
-        result->destdir = g_strdup(handle->destdir);
-        repo->destdir = g_strdup(handle->destdir);
-        repo->repomd = path;
-        if (handle->used_mirror)
-            repo->url = g_strdup(handle->used_mirror);
-        else
-            repo->url = g_strdup(handle->urls[0]);
+        if (notmodified)
+            return lr_yum_use_cached(handle, result, fd, path, err);
 
-        g_debug("%s: Repomd revision: %s", repomd->revision, __func__);
+        if (!lr_yum_repomd_parse(handle, result, fd, path, err))
+            return FALSE;
     }
 
     /* Download rest of metadata files */
-    ret = lr_yum_download_repo(handle, repo, repomd, &tmp_err);
+    ret = lr_yum_download_repo(handle, result, &tmp_err);
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (!ret) {
@@ -925,13 +1651,29 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
     return TRUE;
 }
 
-gboolean
-lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
+/** Check if the cached repository (LRO_CACHEDREPO) is the destination
+ * directory. Its repomd.xml would be replaced by the downloaded one.
+ */
+static gboolean
+lr_yum_cachedrepo_is_destdir(LrHandle *handle)
 {
-    int ret = TRUE;
-    LrYumRepo *repo;
-    LrYumRepoMd *repomd;
+    struct stat cached, dest;
 
+    if (!handle->cachedrepo || !handle->destdir)
+        return FALSE;
+
+    if (stat(handle->cachedrepo, &cached) == -1
+        || stat(handle->destdir, &dest) == -1)
+        return FALSE;
+
+    return cached.st_dev == dest.st_dev && cached.st_ino == dest.st_ino;
+}
+
+/** Check the handle and prepare the result object for lr_yum_perform().
+ */
+static gboolean
+lr_yum_perform_init(LrHandle *handle, LrResult *result, GError **err)
+{
     assert(handle);
     assert(!err || *err == NULL);
 
@@ -953,6 +1695,15 @@ lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
         return FALSE;
     }
 
+    if (!handle->local && !handle->update
+        && lr_yum_cachedrepo_is_destdir(handle))
+    {
+        g_set_error(err, LR_YUM_ERROR, LRE_BADOPTARG,
+                    "LRO_CACHEDREPO %s cannot be the destination directory",
+                    handle->cachedrepo);
+        return FALSE;
+    }
+
     if (handle->update) {
         // Download/Locate only specified files
         if (!result->yum_repo || !result->yum_repomd) {
@@ -973,24 +1724,324 @@ lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
         result->yum_repomd = lr_yum_repomd_init();
     }
 
-    repo   = result->yum_repo;
-    repomd = result->yum_repomd;
+    return TRUE;
+}
 
-    if (handle->local) {
-        // Do not duplicate repository, just use the existing local one
+/** Do not duplicate repository, just use the existing local one */
+static gboolean
+lr_yum_perform_local(LrHandle *handle, LrResult *result, GError **err)
+{
+    if (!lr_yum_use_local(handle, result, err))
+        return FALSE;
 
-        ret = lr_yum_use_local(handle, result, err);
-        if (!ret)
-            return FALSE;
+    if (handle->checks & LR_CHECK_CHECKSUM)
+        return lr_yum_check_repo_checksums(result->yum_repo,
+                                           result->yum_repomd,
+                                           err);
 
-        if (handle->checks & LR_CHECK_CHECKSUM)
-            ret = lr_yum_check_repo_checksums(repo, repomd, err);
-    } else {
-        // Download remote/Duplicate local repository
-        // Note: All checksums are checked while downloading
+    return TRUE;
+}
 
-        ret = lr_yum_download_remote(handle, result, err);
+gboolean
+lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
+{
+    assert(handle);
+    assert(!err || *err == NULL);
+
+    if (!lr_yum_perform_init(handle, result, err))
+        return FALSE;
+
+    if (handle->local)
+        return lr_yum_perform_local(handle, result, err);
+
+    // Download remote/Duplicate local repository
+    // Note: All checksums are checked while downloading
+    return lr_yum_download_remote(handle, result, err);
+}
+
+/** State of a repository in lr_yum_perform_multi()
+ */
+typedef struct {
+    LrHandle *handle;           /*!< Handle of the repository */
+    LrResult *result;           /*!< Result of the repository */
+    GError **err;               /*!< Error of the repository */
+    int fd;                     /*!< repomd.xml or -1 */
+    char *path;                 /*!< Path to the repomd.xml */
+    int sig_fd;                 /*!< repomd.xml.asc or -1 */
+    char *signature;            /*!< Path to the repomd.xml.asc */
+    char *sig_mirror;           /*!< Mirror of the sig_target */
+    LrDownloadTarget *target;   /*!< repomd.xml target */
+    LrDownloadTarget *sig_target; /*!< repomd.xml.asc target */
+    GSList *targets;            /*!< Targets of the records */
+    GSList *cbdata_list;        /*!< CbData of the records */
+    gboolean notmodified;       /*!< The cached repository is used */
+} LrYumMultiRepo;
+
+/** Repository is still processed by lr_yum_perform_multi() */
+static gboolean
+lr_yum_multi_pending(LrYumMultiRepo *r)
+{
+    return *r->err == NULL && !r->handle->local;
+}
+
+/** Check if a target of the repository was not finished by the download.
+ */
+static gboolean
+lr_yum_multi_unfinished(LrYumMultiRepo *r)
+{
+    if (r->target && r->target->rcode == LRE_UNFINISHED)
+        return TRUE;
+    if (r->sig_target && r->sig_target->rcode == LRE_UNFINISHED)
+        return TRUE;
+    for (GSList *elem = r->targets; elem; elem = g_slist_next(elem))
+        if (((LrDownloadTarget *) elem->data)->rcode == LRE_UNFINISHED)
+            return TRUE;
+    return FALSE;
+}
+
+/** Download targets of all repositories in a single lr_download() call.
+ * Errors of single targets (e.g. of a repository whose handle was
+ * cancelled) are reported by the targets. If the whole download fails,
+ * the error is reported to every repository which has an unfinished
+ * target in the list.
+ */
+static void
+lr_yum_multi_download(LrYumMultiRepo *repos,
+                      guint count,
+                      GSList *targets,
+                      const char *prefix)
+{
+    GError *tmp_err = NULL;
+
+    if (!targets)
+        return;
+
+    if (lr_download(targets, FALSE, &tmp_err))
+        return;
+
+    g_debug("%s: Download failed: %s", __func__, tmp_err->message);
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        if (!lr_yum_multi_unfinished(r))
+            continue;
+        g_set_error(r->err, tmp_err->domain, tmp_err->code,
+                    "%s%s", prefix, tmp_err->message);
     }
+    g_error_free(tmp_err);
+}
 
-    return ret;
+void
+lr_yum_perform_multi(LrHandle **handles,
+                     LrResult **results,
+                     GError **errors,
+                     guint count)
+{
+    GSList *targets = NULL;
+    LrYumMultiRepo *repos = g_new0(LrYumMultiRepo, count);
+
+    // Prepare the repositories, local ones are processed right away
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        r->handle = handles[i];
+        r->result = results[i];
+        r->err = &errors[i];
+        r->fd = -1;
+        r->sig_fd = -1;
+
+        if (!lr_yum_perform_init(r->handle, r->result, r->err))
+            continue;
+
+        if (r->handle->local) {
+            lr_yum_perform_local(r->handle, r->result, r->err);
+            continue;
+        }
+
+        lr_yum_prepare_remote(r->handle, r->result, &r->fd, &r->path, r->err);
+    }
+
+    // Download repomd.xml of all repositories
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        if (!lr_yum_multi_pending(r) || r->fd == -1)
+            continue;
+
+        if (lr_yum_cached_repomd_matches(r->handle, r->handle->metalink)) {
+            r->notmodified = TRUE;
+            continue;
+        }
+
+        r->target = lr_yum_repomd_target_new(r->handle, r->handle->metalink, r->fd);
+        targets = g_slist_prepend(targets, r->target);
+    }
+
+    g_debug("%s: Downloading %u repomd.xml files",
+            __func__, g_slist_length(targets));
+    lr_yum_multi_download(repos, count, targets, "Cannot download repomd.xml: ");
+    g_slist_free(targets);
+    targets = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        if (!r->target)
+            continue;
+
+        if (*r->err == NULL
+            && lr_yum_repomd_target_finished(r->handle, r->target, r->err))
+            r->notmodified = r->target->notmodified;
+
+        cbdata_free(r->target->cbdata);
+        lr_downloadtarget_free(r->target);
+        r->target = NULL;
+
+        if (*r->err) {
+            close(r->fd);
+            r->fd = -1;
+            lr_free(r->path);
+            r->path = NULL;
+        }
+    }
+
+    // Download repomd.xml.asc of all repositories, each of them from
+    // the mirror which served its repomd.xml. Unlike lr_yum_download_remote()
+    // (which saves a round trip of a single repository by downloading it
+    // from the first mirror together with the repomd.xml), the round trip
+    // is shared by all the repositories.
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        if (r->fd == -1 || r->notmodified
+            || !(r->handle->checks & LR_CHECK_GPG))
+            continue;
+
+        if (!lr_yum_signature_open(r->handle, &r->signature,
+                                   &r->sig_fd, r->err)) {
+            close(r->fd);
+            r->fd = -1;
+            lr_free(r->path);
+            r->path = NULL;
+            continue;
+        }
+
+        r->sig_mirror = g_strdup(r->handle->used_mirror);
+        if (r->sig_mirror) {
+            r->sig_target = lr_yum_signature_target_new(r->handle,
+                                                        r->sig_mirror,
+                                                        r->sig_fd);
+            targets = g_slist_prepend(targets, r->sig_target);
+        }
+    }
+
+    g_debug("%s: Downloading %u repomd.xml.asc files",
+            __func__, g_slist_length(targets));
+    lr_yum_multi_download(repos, count, targets,
+                          "Cannot download repomd.xml.asc: ");
+    g_slist_free(targets);
+    targets = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        if (r->sig_fd == -1)
+            continue;
+
+        if (*r->err == NULL)
+            lr_yum_signature_target_finished(r->handle, r->result->yum_repo,
+                                             r->sig_target, r->sig_mirror,
+                                             r->sig_fd, r->signature,
+                                             r->path, r->err);
+        else
+            unlink(r->signature);
+
+        lr_downloadtarget_free(r->sig_target);
+        r->sig_target = NULL;
+        close(r->sig_fd);
+        r->sig_fd = -1;
+        lr_free(r->sig_mirror);
+        r->sig_mirror = NULL;
+        lr_free(r->signature);
+        r->signature = NULL;
+
+        if (*r->err) {
+            close(r->fd);
+            r->fd = -1;
+            lr_free(r->path);
+            r->path = NULL;
+        }
+    }
+
+    // Parse repomd.xml files and prepare targets of the records.
+    // Records of all repositories are downloaded together, so they are
+    // queued only when repomd.xml files of all the repositories were
+    // downloaded (a slow repomd.xml delays the records of the others).
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        GError *tmp_err = NULL;
+
+        if (r->fd != -1) {
+            if (*r->err == NULL && r->notmodified) {
+                lr_yum_use_cached(r->handle, r->result, r->fd, r->path, r->err);
+            } else if (*r->err == NULL) {
+                lr_yum_repomd_parse(r->handle, r->result, r->fd, r->path, r->err);
+            } else {
+                close(r->fd);
+                lr_free(r->path);
+            }
+            r->fd = -1;
+            r->path = NULL;
+        }
+
+        if (!lr_yum_multi_pending(r) || r->notmodified)
+            continue;
+
+        if (!lr_yum_repo_targets(r->handle, r->result, &r->targets,
+                                 &r->cbdata_list, &tmp_err)) {
+            g_propagate_prefixed_error(r->err, tmp_err,
+                                       "Yum repo downloading error: ");
+            continue;
+        }
+
+        // Progress of the records is reported per repository
+        for (GSList *elem = r->targets; elem; elem = g_slist_next(elem)) {
+            LrDownloadTarget *target = elem->data;
+            CbData *cbdata = target->cbdata;
+            if (!cbdata)
+                continue;
+            cbdata->group = &r->cbdata_list;
+            target->progresscb = (cbdata->progresscb) ? group_progresscb : NULL;
+            target->mirrorfailurecb = (cbdata->hmfcb) ? hmfcb : NULL;
+        }
+
+        targets = g_slist_concat(targets, g_slist_copy(r->targets));
+    }
+
+    // Download records of all repositories
+
+    g_debug("%s: Downloading %u metadata files",
+            __func__, g_slist_length(targets));
+    lr_yum_multi_download(repos, count, targets,
+                          "Yum repo downloading error: Downloading error: ");
+    g_slist_free(targets);
+
+    for (guint i = 0; i < count; i++) {
+        LrYumMultiRepo *r = &repos[i];
+        GError *tmp_err = NULL;
+
+        if (*r->err == NULL
+            && !lr_yum_repo_targets_finished(r->targets, &tmp_err)) {
+            g_debug("%s: Repository download error: %s",
+                    __func__, tmp_err->message);
+            g_propagate_prefixed_error(r->err, tmp_err,
+                                       "Yum repo downloading error: ");
+        } else if (*r->err) {
+            for (GSList *elem = r->targets; elem; elem = g_slist_next(elem))
+                lr_yum_repo_target_close(elem->data);
+        }
+
+        g_slist_free_full(r->cbdata_list, (GDestroyNotify) cbdata_free);
+        g_slist_free_full(r->targets, (GDestroyNotify) lr_downloadtarget_free);
+    }
+
+    g_free(repos);
 }
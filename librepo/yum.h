@@ -37,6 +37,8 @@ G_BEGIN_DECLS
 typedef struct {
     char *type;  /*!< Type of record (e.g. "primary") */
     char *path;  /*!< Path to the file (e.g. foo/bar/repodata/primary.xml) */
+    gboolean decompressed; /*!< The file is the decompressed file
+                                of the record (see LRO_DECOMPRESS) */
 } LrYumRepoPath;
 
 /** Yum repository */
@@ -32,6 +32,22 @@ G_BEGIN_DECLS
 gboolean
 lr_yum_perform(LrHandle *handle, LrResult *result, GError **err);
 
+/** Like lr_yum_perform() for several repositories at once. Repomd.xml
+ * files of all repositories, then their signatures (from the mirrors
+ * which served the repomd.xml files) and then their metadata files are
+ * downloaded, each stage by a single lr_download() call. Metadata files
+ * of a repository are not downloaded until repomd.xml files of all
+ * the repositories are done. Error of every repository is reported
+ * via errors array (which must be cleared).
+ * Note: Downloader configuration (max parallel downloads, ...) is taken
+ * from the handle of the first repository.
+ */
+void
+lr_yum_perform_multi(LrHandle **handles,
+                     LrResult **results,
+                     GError **errors,
+                     guint count);
+
 G_END_DECLS
 
 #endif
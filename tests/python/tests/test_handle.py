@@ -164,6 +164,24 @@ class TestCaseHandle(unittest.TestCase):
         h.setopt(librepo.LRO_GNUPGHOMEDIR,  "")
         self.assertEqual(h.getinfo(librepo.LRI_GNUPGHOMEDIR), "")
 
+        self.assertEqual(h.getinfo(librepo.LRI_CACHEDREPO), None)
+        h.setopt(librepo.LRO_CACHEDREPO, "/var/cache/repo/")
+        self.assertEqual(h.getinfo(librepo.LRI_CACHEDREPO), "/var/cache/repo/")
+        h.setopt(librepo.LRO_CACHEDREPO, None)
+        self.assertEqual(h.getinfo(librepo.LRI_CACHEDREPO), None)
+
+        self.assertEqual(h.getinfo(librepo.LRI_CONTENTSTORE), None)
+        h.setopt(librepo.LRO_CONTENTSTORE, "/var/cache/store/")
+        self.assertEqual(h.getinfo(librepo.LRI_CONTENTSTORE), "/var/cache/store/")
+        h.setopt(librepo.LRO_CONTENTSTORE, None)
+        self.assertEqual(h.getinfo(librepo.LRI_CONTENTSTORE), None)
+
+        self.assertEqual(h.getinfo(librepo.LRI_DECOMPRESS), librepo.DECOMPRESS_NONE)
+        h.setopt(librepo.LRO_DECOMPRESS, librepo.DECOMPRESS_OPEN)
+        self.assertEqual(h.getinfo(librepo.LRI_DECOMPRESS), librepo.DECOMPRESS_OPEN)
+        h.setopt(librepo.LRO_DECOMPRESS, None)
+        self.assertEqual(h.getinfo(librepo.LRI_DECOMPRESS), librepo.DECOMPRESS_NONE)
+
         self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORTIMEOUT), 2.0)
         h.setopt(librepo.LRO_FASTESTMIRRORTIMEOUT,  32.256)
         self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORTIMEOUT), 32.256)
@@ -313,6 +331,36 @@ class TestCaseHandle(unittest.TestCase):
         h.adaptivemirrorsorting = None
         self.assertEqual(h.adaptivemirrorsorting, 1)
 
+        self.assertEqual(h.maxsegments, 1)
+        h.maxsegments = 4
+        self.assertEqual(h.maxsegments, 4)
+        h.maxsegments = None
+        self.assertEqual(h.maxsegments, 1)
+
+        self.assertEqual(h.hedgebudget, 0)
+        h.hedgebudget = 10
+        self.assertEqual(h.hedgebudget, 10)
+        h.hedgebudget = None
+        self.assertEqual(h.hedgebudget, 0)
+
+        self.assertEqual(h.autotuneparalleldownloads, 0)
+        h.autotuneparalleldownloads = 100
+        self.assertEqual(h.autotuneparalleldownloads, 100)
+        h.autotuneparalleldownloads = None
+        self.assertEqual(h.autotuneparalleldownloads, 0)
+
+        self.assertEqual(h.multiplex, 0)
+        h.multiplex = True
+        self.assertEqual(h.multiplex, 1)
+        h.multiplex = False
+        self.assertEqual(h.multiplex, 0)
+
+        self.assertEqual(h.sharedcache, 0)
+        h.sharedcache = True
+        self.assertEqual(h.sharedcache, 1)
+        h.sharedcache = False
+        self.assertEqual(h.sharedcache, 0)
+
         self.assertEqual(h.gnupghomedir, None)
         h.gnupghomedir =  "/tmp/keyring"
         self.assertEqual(h.gnupghomedir, "/tmp/keyring")
@@ -321,6 +369,24 @@ class TestCaseHandle(unittest.TestCase):
         h.gnupghomedir =  ""
         self.assertEqual(h.gnupghomedir, "")
 
+        self.assertEqual(h.cachedrepo, None)
+        h.cachedrepo = "/var/cache/repo/"
+        self.assertEqual(h.cachedrepo, "/var/cache/repo/")
+        h.cachedrepo = None
+        self.assertEqual(h.cachedrepo, None)
+
+        self.assertEqual(h.contentstore, None)
+        h.contentstore = "/var/cache/store/"
+        self.assertEqual(h.contentstore, "/var/cache/store/")
+        h.contentstore = None
+        self.assertEqual(h.contentstore, None)
+
+        self.assertEqual(h.decompress, librepo.DECOMPRESS_NONE)
+        h.decompress = librepo.DECOMPRESS_BOTH
+        self.assertEqual(h.decompress, librepo.DECOMPRESS_BOTH)
+        h.decompress = None
+        self.assertEqual(h.decompress, librepo.DECOMPRESS_NONE)
+
         self.assertEqual(h.fastestmirrortimeout, 2.0)
         h.fastestmirrortimeout = 3.14
         self.assertEqual(h.fastestmirrortimeout, 3.14)
@@ -426,10 +492,36 @@ class TestCaseHandle(unittest.TestCase):
         h.allowedmirrorfailures = None
         h.setopt(librepo.LRO_ADAPTIVEMIRRORSORTING, None)
         h.adaptivemirrorsorting = None
+        h.setopt(librepo.LRO_MAXSEGMENTS, None)
+        h.maxsegments = None
+        h.setopt(librepo.LRO_HEDGEBUDGET, None)
+        h.hedgebudget = None
+        h.setopt(librepo.LRO_AUTOTUNEPARALLELDOWNLOADS, None)
+        h.autotuneparalleldownloads = None
+        h.setopt(librepo.LRO_MULTIPLEX, None)
+        h.multiplex = None
+        h.setopt(librepo.LRO_SHAREDCACHE, None)
+        h.sharedcache = None
 
         h.setopt(librepo.LRO_GNUPGHOMEDIR, None)
         h.gnupghomedir = None
+        h.setopt(librepo.LRO_CACHEDREPO, None)
+        h.cachedrepo = None
+        h.setopt(librepo.LRO_CONTENTSTORE, None)
+        h.contentstore = None
+        h.setopt(librepo.LRO_CONTENTSTOREMAXSIZE, None)
+        h.contentstoremaxsize = None
+        h.setopt(librepo.LRO_DECOMPRESS, None)
+        h.decompress = None
         h.setopt(librepo.LRO_FASTESTMIRRORTIMEOUT, None)
         h.fastestmirrortimeout = None
         h.setopt(librepo.LRO_HTTPHEADER, None)
         h.httpheader = None
+
+    def test_handle_flush_connections(self):
+        """No exception should be raised."""
+        h = librepo.Handle()
+        h.flush_connections()
+        h.flush_connections()
+        h.sharedcache = True
+        h.flush_connections()
@@ -21,6 +21,7 @@ class TestCaseSanity(unittest.TestCase):
         self.assertEqual(h.mirrors, [])
         self.assertEqual(h.metalink, None)
         self.assertEqual(h.hmfcb, None)
+        self.assertEqual(h.mirrorstats, [])
 
     def test_raw_result_sanity(self):
         r = librepo.Result()
@@ -39,3 +40,12 @@ class TestCaseSanity(unittest.TestCase):
         self.assertEqual(t.cbdata, None)
         self.assertEqual(t.local_path, None)
         self.assertEqual(t.err, None)
+        self.assertEqual(t.weight, 1)
+
+    def test_raw_packagetarget_without_weight(self):
+        # Callers of the C type which don't know the weight get the default
+        t = librepo._librepo.PackageTarget(None, "foo", None,
+                                           librepo.CHECKSUM_UNKNOWN, None, 0,
+                                           None, False, None, None, None,
+                                           None, 0, 0)
+        self.assertEqual(t.weight, 1)
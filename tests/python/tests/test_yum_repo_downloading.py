@@ -5,6 +5,7 @@ import shutil
 import os.path
 import tempfile
 import unittest
+import threading
 
 import librepo
 
@@ -154,6 +155,117 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
         self.assertFalse(h.mirrors)
         self.assertFalse(h.metalink)
 
+        mirrorstats = h.mirrorstats
+        self.assertEqual(len(mirrorstats), 1)
+        self.assertTrue(mirrorstats[0]["successful_transfers"] > 0)
+        self.assertEqual(mirrorstats[0]["failed_transfers"], 0)
+        self.assertTrue(mirrorstats[0]["window"] >= 1)
+
+    def test_download_repo_01_with_cachedrepo(self):
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        cachedir = os.path.join(self.tmpdir, "cache")
+        destdir = os.path.join(self.tmpdir, "new")
+        os.mkdir(cachedir)
+        os.mkdir(destdir)
+
+        # The first download stores validators of the repomd.xml
+        h = librepo.Handle()
+        r = librepo.Result()
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = cachedir
+        h.perform(r)
+
+        self.assertFalse(r.getinfo(librepo.LRR_UNCHANGED))
+
+        # The repomd.xml was not modified - the cached repo is used
+        h = librepo.Handle()
+        r = librepo.Result()
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = destdir
+        h.cachedrepo = cachedir
+        h.checksum = True
+        h.perform(r)
+
+        yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+
+        self.assertTrue(r.getinfo(librepo.LRR_UNCHANGED))
+        self.assertTrue(r.unchanged)
+        self.assertEqual(yum_repo["destdir"], cachedir)
+        self.assertEqual(yum_repo["repomd"], cachedir+'/repodata/repomd.xml')
+        self.assertEqual(yum_repo["primary"],
+            cachedir+'/repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz')
+        self.assertEqual(os.listdir(destdir), [])
+
+    def test_download_repo_01_update_reuses_records(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = self.tmpdir
+        h.yumdlist = ["primary"]
+        h.perform(r)
+
+        self.assertEqual(r.getinfo(librepo.LRR_YUM_REUSED), [])
+
+        # Update repo - primary was already downloaded
+        h.update = True
+        h.yumdlist = ["primary", "filelists"]
+        h.perform(r)
+
+        yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+
+        self.assertEqual(r.getinfo(librepo.LRR_YUM_REUSED), ["primary"])
+        self.assertEqual(r.yum_reused, ["primary"])
+        self.assertTrue(os.path.exists(yum_repo["primary"]))
+        self.assertTrue(os.path.exists(yum_repo["filelists"]))
+
+    def test_download_repo_01_concurrently(self):
+        # Stress test - many repos are downloaded in parallel threads,
+        # each thread with its own handle
+        THREADS = 32
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        results = [None] * THREADS
+        errors = []
+
+        def download(i):
+            try:
+                destdir = os.path.join(self.tmpdir, "repo%d" % i)
+                os.mkdir(destdir)
+                h = librepo.Handle()
+                r = librepo.Result()
+                h.urls = [url]
+                h.repotype = librepo.LR_YUMREPO
+                h.destdir = destdir
+                # Interruptible and uninterruptible downloads are mixed
+                h.interruptible = bool(i % 2)
+                h.perform(r)
+                results[i] = r.getinfo(librepo.LRR_YUM_REPO)
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=download, args=(i,))
+                   for i in range(THREADS)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        self.assertEqual(errors, [])
+        for i, yum_repo in enumerate(results):
+            destdir = os.path.join(self.tmpdir, "repo%d" % i)
+            self.assertEqual(yum_repo["destdir"], destdir)
+            self.assertEqual(yum_repo["primary"], destdir+'/repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz')
+            self.assertEqual(yum_repo["other_db"], destdir+'/repodata/fd96942c919628895187778633001cff61e872b8-other.sqlite.bz2')
+            for path in (yum_repo["repomd"], yum_repo["primary"],
+                         yum_repo["filelists"], yum_repo["other"],
+                         yum_repo["primary_db"], yum_repo["filelists_db"],
+                         yum_repo["other_db"]):
+                self.assertTrue(os.path.isfile(path))
+
     def test_download_repo_02(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -1069,6 +1181,26 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
             if yum_repo[key] and (key not in ("url", "destdir")):
                 self.assertTrue(os.path.isfile(yum_repo[key]))
 
+    def test_download_repo_01_via_mirrorlist_badfirsturl_with_gpg_check(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        # The signature is speculatively downloaded from the first mirror,
+        # but it must be taken from the mirror which served repomd.xml
+        url = "%s%s" % (self.MOCKURL, config.MIRRORLIST_BADFIRSTURL)
+        h.mirrorlist = url
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = self.tmpdir
+        h.gpgcheck = True
+        h.perform(r)
+
+        yum_repo   = r.getinfo(librepo.LRR_YUM_REPO)
+
+        self.assertTrue(yum_repo)
+        self.assertEqual(yum_repo["url"], "http://127.0.0.1:%d/yum/static/01/" % self.PORT)
+        self.assertEqual(yum_repo["signature"], self.tmpdir+'/repodata/repomd.xml.asc')
+        self.assertTrue(os.path.isfile(yum_repo["signature"]))
+
     def test_download_repo_01_via_mirrorlist_firsturlhascorruptedfiles(self):
         h = librepo.Handle()
         r = librepo.Result()
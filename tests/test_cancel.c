@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "librepo/librepo.h"
+#include "librepo/cancel.h"
+#include "librepo/rcodes.h"
+#include "librepo/util.h"
+#include "librepo/handle_internal.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_cancel.h"
+
+START_TEST(test_cancel_token)
+{
+    LrCancelToken *token;
+    GError *err = NULL;
+    struct pollfd pfd;
+
+    token = lr_cancel_token_new(&err);
+    fail_if(!token);
+    fail_if(err);
+    fail_if(lr_cancel_token_is_cancelled(token));
+
+    // The fd is not readable until the token is cancelled
+    pfd.fd = lr_cancel_token_get_fd(token);
+    pfd.events = POLLIN;
+    fail_if(poll(&pfd, 1, 0) != 0);
+
+    lr_cancel_token_cancel(token);
+    fail_if(!lr_cancel_token_is_cancelled(token));
+    fail_if(poll(&pfd, 1, 0) != 1);
+
+    // Cancelling again is harmless and the token stays cancelled
+    lr_cancel_token_cancel(token);
+    fail_if(!lr_cancel_token_is_cancelled(token));
+    fail_if(poll(&pfd, 1, 0) != 1);
+
+    lr_cancel_token_free(token);
+}
+END_TEST
+
+START_TEST(test_cancel_download)
+{
+    LrHandle *handle;
+    LrCancelToken *token, *token2 = NULL;
+    LrDownloadTarget *target;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gboolean ret;
+    char *url, *tmpfn;
+
+    token = lr_cancel_token_new(&err);
+    fail_if(!token);
+
+    handle = lr_handle_init();
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_CANCELTOKEN, token));
+    fail_if(!lr_handle_getinfo(handle, NULL, LRI_CANCELTOKEN, &token2));
+    fail_if(token2 != token);
+
+    url = lr_pathconcat(test_globals.testdata_dir,
+                        "repo_yum_01/repodata", NULL);
+    char *urls[] = {url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+    lr_free(url);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "cancelled_repomd.xml", NULL);
+    target = lr_downloadtarget_new(handle, "repomd.xml", NULL, -1, tmpfn,
+                                   NULL, 0, 0, NULL, NULL, NULL, NULL, NULL,
+                                   0, 0);
+    list = g_slist_append(list, target);
+
+    // Download with a cancelled token fails and leaves nothing behind
+    lr_cancel_token_cancel(token);
+    ret = lr_download(list, FALSE, &err);
+    fail_if(ret);
+    fail_if(!err);
+    fail_if(err->code != LRE_CANCELLED);
+    g_clear_error(&err);
+    fail_if(target->rcode == LRE_OK);
+    fail_if(g_file_test(tmpfn, G_FILE_TEST_EXISTS));
+
+    // A download context isn't started either
+    fail_if(lr_download_context_new(list, FALSE, &err));
+    fail_if(!err);
+    fail_if(err->code != LRE_CANCELLED);
+    g_clear_error(&err);
+    fail_if(target->rcode == LRE_OK);
+    fail_if(g_file_test(tmpfn, G_FILE_TEST_EXISTS));
+
+    // The same download without the token succeeds
+    lr_handle_setopt(handle, NULL, LRO_CANCELTOKEN, NULL);
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(target->rcode != LRE_OK);
+    fail_if(!g_file_test(tmpfn, G_FILE_TEST_IS_REGULAR));
+
+    unlink(tmpfn);
+    lr_free(tmpfn);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    lr_cancel_token_free(token);
+}
+END_TEST
+
+/** Listen on a local port without ever accepting the connections.
+ * Connections are established by the kernel, so a request sent to the
+ * port is never answered and the transfer stays running.
+ */
+static int
+stalling_server(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    fail_if(sock < 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fail_if(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0);
+    fail_if(listen(sock, 16) != 0);
+    fail_if(getsockname(sock, (struct sockaddr *) &addr, &len) != 0);
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+typedef struct {
+    LrCancelToken *first;
+    LrCancelToken *second;
+    gint64 first_cancelled_at;
+    gint64 second_cancelled_at;
+} CancelLater;
+
+static gpointer
+cancel_later(gpointer data)
+{
+    CancelLater *cl = data;
+    g_usleep(200 * 1000);
+    cl->first_cancelled_at = g_get_monotonic_time();
+    lr_cancel_token_cancel(cl->first);
+    g_usleep(200 * 1000);
+    cl->second_cancelled_at = g_get_monotonic_time();
+    lr_cancel_token_cancel(cl->second);
+    return NULL;
+}
+
+static int
+stalled_endcb(void *clientp,
+              G_GNUC_UNUSED LrTransferStatus status,
+              G_GNUC_UNUSED const char *msg)
+{
+    *((gint64 *) clientp) = g_get_monotonic_time();
+    return LR_CB_OK;
+}
+
+static LrHandle *
+stalling_handle(const char *url, LrCancelToken *token)
+{
+    LrHandle *handle = lr_handle_init();
+    GError *err = NULL;
+    char *urls[] = {(char *) url, NULL};
+
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_CANCELTOKEN, token);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+    return handle;
+}
+
+START_TEST(test_cancel_running_download)
+{
+    LrHandle *handle_a, *handle_b;
+    LrCancelToken *token_a, *token_b;
+    LrDownloadTarget *target_a, *target_b;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GThread *thread;
+    CancelLater cl;
+    gint64 returned_at, a_end = 0, b_end = 0;
+    gboolean ret;
+    char *url, *fn_a, *fn_b;
+    int sock, port;
+
+    sock = stalling_server(&port);
+    url = g_strdup_printf("http://127.0.0.1:%d/", port);
+
+    token_a = lr_cancel_token_new(&err);
+    token_b = lr_cancel_token_new(&err);
+    fail_if(!token_a || !token_b);
+    handle_a = stalling_handle(url, token_a);
+    handle_b = stalling_handle(url, token_b);
+
+    fn_a = lr_pathconcat(test_globals.tmpdir, "stalled_a", NULL);
+    fn_b = lr_pathconcat(test_globals.tmpdir, "stalled_b", NULL);
+    target_a = lr_downloadtarget_new(handle_a, "a", NULL, -1, fn_a, NULL,
+                                     0, 0, NULL, &a_end, stalled_endcb,
+                                     NULL, NULL, 0, 0);
+    target_b = lr_downloadtarget_new(handle_b, "b", NULL, -1, fn_b, NULL,
+                                     0, 0, NULL, &b_end, stalled_endcb,
+                                     NULL, NULL, 0, 0);
+    list = g_slist_append(list, target_a);
+    list = g_slist_append(list, target_b);
+
+    // The token of the second handle and then the token of the first
+    // one are cancelled from another thread while both transfers wait
+    // for the server
+    cl.first = token_b;
+    cl.second = token_a;
+    cl.first_cancelled_at = 0;
+    cl.second_cancelled_at = 0;
+    thread = g_thread_new("cancel", cancel_later, &cl);
+
+    ret = lr_download(list, FALSE, &err);
+    returned_at = g_get_monotonic_time();
+    g_thread_join(thread);
+
+    fail_if(ret);
+    fail_if(!err);
+    fail_if(err->code != LRE_CANCELLED);
+    g_clear_error(&err);
+    fail_if(cl.first_cancelled_at == 0);
+    fail_if(cl.second_cancelled_at == 0);
+
+    // Only the target of the cancelled handle failed, the other one
+    // kept running until its own token was cancelled
+    fail_if(target_b->rcode != LRE_CANCELLED);
+    fail_if(b_end == 0);
+    fail_if(b_end >= cl.second_cancelled_at);
+    fail_if(target_a->rcode == LRE_OK);
+    fail_if(target_a->rcode == LRE_CANCELLED);
+    fail_if(a_end != 0 && a_end < cl.second_cancelled_at);
+
+    // The loop is woken up by the tokens, not by the select()/epoll timeout
+    fail_if(b_end - cl.first_cancelled_at > 200 * 1000,
+            "Cancellation took %"G_GINT64_FORMAT" us",
+            b_end - cl.first_cancelled_at);
+    fail_if(returned_at - cl.second_cancelled_at > 200 * 1000,
+            "Cancellation took %"G_GINT64_FORMAT" us",
+            returned_at - cl.second_cancelled_at);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle_a);
+    lr_handle_free(handle_b);
+    lr_cancel_token_free(token_a);
+    lr_cancel_token_free(token_b);
+    unlink(fn_a);
+    unlink(fn_b);
+    lr_free(fn_a);
+    lr_free(fn_b);
+    g_free(url);
+    close(sock);
+}
+END_TEST
+
+typedef struct {
+    GString *order;
+    const char *name;
+} EndOrder;
+
+static int
+order_endcb(void *clientp,
+            G_GNUC_UNUSED LrTransferStatus status,
+            G_GNUC_UNUSED const char *msg)
+{
+    EndOrder *end = clientp;
+    g_string_append(end->order, end->name);
+    return LR_CB_OK;
+}
+
+START_TEST(test_cancel_callback_order)
+{
+    LrHandle *handle_a, *handle_b;
+    LrCancelToken *token_a, *token_b;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GThread *thread;
+    CancelLater cl;
+    GString *order = g_string_new(NULL);
+    EndOrder ends[] = {{order, "a"}, {order, "1"}, {order, "2"},
+                       {order, "3"}, {order, "4"}};
+    char *url;
+    int sock, port;
+
+    sock = stalling_server(&port);
+    url = g_strdup_printf("http://127.0.0.1:%d/", port);
+
+    token_a = lr_cancel_token_new(&err);
+    token_b = lr_cancel_token_new(&err);
+    fail_if(!token_a || !token_b);
+    handle_a = stalling_handle(url, token_a);
+    handle_b = stalling_handle(url, token_b);
+
+    for (int i = 0; i < 5; i++) {
+        gchar *fn = g_strdup_printf("%s/stalled_order_%d",
+                                    test_globals.tmpdir, i);
+        LrDownloadTarget *target = lr_downloadtarget_new(
+                i ? handle_b : handle_a, ends[i].name, NULL, -1, fn, NULL,
+                0, 0, NULL, &ends[i], order_endcb, NULL, NULL, 0, 0);
+        list = g_slist_append(list, target);
+        g_free(fn);
+    }
+
+    // Running and waiting targets of the cancelled handle are stopped
+    // in the order of the list, then the other handle is cancelled
+    cl.first = token_b;
+    cl.second = token_a;
+    thread = g_thread_new("cancel", cancel_later, &cl);
+    fail_if(lr_download(list, FALSE, &err));
+    g_thread_join(thread);
+    fail_if(!err);
+    g_clear_error(&err);
+
+    fail_if(strncmp(order->str, "1234", 4) != 0, "Order: %s", order->str);
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem))
+        unlink(((LrDownloadTarget *) elem->data)->fn);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle_a);
+    lr_handle_free(handle_b);
+    lr_cancel_token_free(token_a);
+    lr_cancel_token_free(token_b);
+    g_string_free(order, TRUE);
+    g_free(url);
+    close(sock);
+}
+END_TEST
+
+Suite *
+cancel_suite(void)
+{
+    Suite *s = suite_create("cancel");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_cancel_token);
+    tcase_add_test(tc, test_cancel_download);
+    tcase_add_test(tc, test_cancel_running_download);
+    tcase_add_test(tc, test_cancel_callback_order);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_CANCEL_H
+#define LR_TEST_CANCEL_H
+
+#include <check.h>
+
+Suite *cancel_suite(void);
+
+#endif
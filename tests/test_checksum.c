@@ -10,6 +10,7 @@
 
 #include "librepo/util.h"
 #include "librepo/checksum.h"
+#include "librepo/rcodes.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -169,6 +170,203 @@ exit_label:
 }
 END_TEST
 
+START_TEST(test_cached_checksum_outdated)
+{
+    int fd;
+    char *file;
+    gchar *checksum;
+    LrChecksumType sha256 = LR_CHECKSUM_SHA256;
+    LrChecksumType sha1 = LR_CHECKSUM_SHA1;
+    GError *tmp_err = NULL;
+
+    file = lr_pathconcat(test_globals.tmpdir, "/test_checksum_outdated", NULL);
+
+    // Cache checksum of one type
+    build_test_file(file, CHKS_CONTENT_00);
+    fd = open(file, O_RDWR);
+    fail_if(fd < 0);
+    fail_if(!lr_checksum_fd_multi(fd, &sha256, 1, TRUE, &checksum, &tmp_err));
+    fail_if(strcmp(checksum, CHKS_VAL_00_SHA256));
+    lr_free(checksum);
+
+    // Modify the file and cache checksum of another type
+    fail_if(pwrite(fd, CHKS_CONTENT_01, strlen(CHKS_CONTENT_01), 0) < 0);
+    fail_if(!lr_checksum_fd_multi(fd, &sha1, 1, TRUE, &checksum, &tmp_err));
+    fail_if(strcmp(checksum, CHKS_VAL_01_SHA1));
+    lr_free(checksum);
+
+    // The checksum cached for the original content must not be used
+    fail_if(!lr_checksum_fd_multi(fd, &sha256, 1, TRUE, &checksum, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(strcmp(checksum, CHKS_VAL_01_SHA256));
+    lr_free(checksum);
+
+    close(fd);
+    fail_if(remove(file) != 0, "Cannot delete temporary test file");
+    lr_free(file);
+}
+END_TEST
+
+START_TEST(test_checksumctx)
+{
+    int fd;
+    char *file;
+    char *checksum;
+    GSList *ctxs = NULL;
+    LrChecksumCtx *ctx;
+    GError *tmp_err = NULL;
+    const char *content = CHKS_CONTENT_01;
+    size_t len = strlen(content);
+
+    file = lr_pathconcat(test_globals.tmpdir, "/test_checksumctx", NULL);
+    build_test_file(file, content);
+
+    // Data passed in chunks
+    ctx = lr_checksumctx_new(LR_CHECKSUM_SHA256, &tmp_err);
+    fail_if(!ctx);
+    fail_if(tmp_err);
+    fail_if(lr_checksumctx_type(ctx) != LR_CHECKSUM_SHA256);
+    fail_if(!lr_checksumctx_update(ctx, content, 3, &tmp_err));
+    fail_if(!lr_checksumctx_update(ctx, content + 3, len - 3, &tmp_err));
+    checksum = lr_checksumctx_final(ctx, &tmp_err);
+    fail_if(!checksum);
+    fail_if(tmp_err);
+    fail_if(strcmp(checksum, CHKS_VAL_01_SHA256));
+    lr_free(checksum);
+    lr_checksumctx_free(ctx);
+
+    // Prefix read from file and rest passed as data
+    fd = open(file, O_RDONLY);
+    fail_if(fd < 0);
+    ctxs = g_slist_append(ctxs, lr_checksumctx_new(LR_CHECKSUM_MD5, NULL));
+    ctxs = g_slist_append(ctxs, lr_checksumctx_new(LR_CHECKSUM_SHA1, NULL));
+    fail_if(!lr_checksumctx_list_update_fd(ctxs, fd, 4, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(lseek(fd, 0, SEEK_CUR) != 0);
+    for (GSList *elem = ctxs; elem; elem = g_slist_next(elem))
+        fail_if(!lr_checksumctx_update(elem->data, content + 4, len - 4, NULL));
+    checksum = lr_checksumctx_final(ctxs->data, NULL);
+    fail_if(strcmp(checksum, CHKS_VAL_01_MD5));
+    lr_free(checksum);
+    checksum = lr_checksumctx_final(ctxs->next->data, NULL);
+    fail_if(strcmp(checksum, CHKS_VAL_01_SHA1));
+    lr_free(checksum);
+    g_slist_free_full(ctxs, (GDestroyNotify) lr_checksumctx_free);
+    ctxs = NULL;
+
+    // Whole file
+    ctx = lr_checksumctx_new(LR_CHECKSUM_SHA512, NULL);
+    ctxs = g_slist_append(ctxs, ctx);
+    fail_if(!lr_checksumctx_list_update_fd(ctxs, fd, -1, &tmp_err));
+    fail_if(tmp_err);
+    checksum = lr_checksumctx_final(ctx, NULL);
+    fail_if(strcmp(checksum, CHKS_VAL_01_SHA512));
+    lr_free(checksum);
+    g_slist_free_full(ctxs, (GDestroyNotify) lr_checksumctx_free);
+    close(fd);
+
+    fail_if(remove(file) != 0, "Cannot delete temporary test file");
+    lr_free(file);
+}
+END_TEST
+
+START_TEST(test_checksum_fd_multi)
+{
+    int fd;
+    char *file;
+    gchar *checksums[4];
+    LrChecksumType types[] = { LR_CHECKSUM_SHA256,
+                               LR_CHECKSUM_MD5,
+                               LR_CHECKSUM_SHA256,
+                               LR_CHECKSUM_SHA512 };
+    GError *tmp_err = NULL;
+
+    file = lr_pathconcat(test_globals.tmpdir, "/test_checksum_multi", NULL);
+    build_test_file(file, CHKS_CONTENT_01);
+
+    fd = open(file, O_RDONLY);
+    fail_if(fd < 0);
+
+    // Without and with caching (second call with caching could use cache)
+    for (int i = 0; i < 3; i++) {
+        fail_if(!lr_checksum_fd_multi(fd, types, 4, i > 0, checksums, &tmp_err));
+        fail_if(tmp_err);
+        fail_if(strcmp(checksums[0], CHKS_VAL_01_SHA256));
+        fail_if(strcmp(checksums[1], CHKS_VAL_01_MD5));
+        fail_if(strcmp(checksums[2], CHKS_VAL_01_SHA256));
+        fail_if(strcmp(checksums[3], CHKS_VAL_01_SHA512));
+        for (int x = 0; x < 4; x++)
+            lr_free(checksums[x]);
+    }
+
+    fail_if(lseek(fd, 0, SEEK_CUR) != 0);
+    close(fd);
+
+    fail_if(remove(file) != 0, "Cannot delete temporary test file");
+    lr_free(file);
+}
+END_TEST
+
+static gboolean
+check_files_cb(LrChecksumCheck *check, void *cbdata)
+{
+    int *calls = cbdata;
+    (*calls)++;
+    return check->matches;
+}
+
+START_TEST(test_checksum_check_files)
+{
+    LrChecksumCheck checks[33];
+    char *files[33];
+    int calls = 0;
+    GError *tmp_err = NULL;
+
+    // Every third file has a bad checksum, the last file doesn't exist
+    for (int x = 0; x < 33; x++) {
+        gchar *name = g_strdup_printf("/test_checksum_check_files_%d", x);
+        files[x] = lr_pathconcat(test_globals.tmpdir, name, NULL);
+        g_free(name);
+        if (x < 32)
+            build_test_file(files[x], CHKS_CONTENT_01);
+        checks[x].path = files[x];
+        checks[x].type = LR_CHECKSUM_SHA256;
+        checks[x].expected = (x % 3) ? CHKS_VAL_01_SHA256 : CHKS_VAL_00_SHA256;
+        checks[x].caching = FALSE;
+        checks[x].cbdata = NULL;
+    }
+
+    fail_if(!lr_checksum_check_files(checks, 33, NULL, NULL, &tmp_err));
+    fail_if(tmp_err);
+    for (int x = 0; x < 32; x++) {
+        fail_if(!checks[x].checked);
+        fail_if(checks[x].rcode != LRE_OK);
+        fail_if(checks[x].matches != ((x % 3) ? TRUE : FALSE));
+    }
+    fail_if(!checks[32].checked);
+    fail_if(checks[32].rcode != LRE_IO);
+    fail_if(!checks[32].err);
+    fail_if(!strstr(checks[32].err->message, files[32]));
+    fail_if(checks[32].matches);
+    g_clear_error(&checks[32].err);
+
+    // The callback stops the check at the first mismatch
+    for (int x = 0; x < 33; x++)
+        checks[x].expected = CHKS_VAL_00_SHA256;
+    fail_if(!lr_checksum_check_files(checks, 33, check_files_cb, &calls,
+                                     &tmp_err));
+    fail_if(tmp_err);
+    fail_if(calls != 1);
+    for (int x = 0; x < 33; x++)
+        g_clear_error(&checks[x].err);
+
+    for (int x = 0; x < 33; x++) {
+        remove(files[x]);
+        lr_free(files[x]);
+    }
+}
+END_TEST
+
 Suite *
 checksum_suite(void)
 {
@@ -176,6 +374,10 @@ checksum_suite(void)
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_checksum_fd);
     tcase_add_test(tc, test_cached_checksum);
+    tcase_add_test(tc, test_cached_checksum_outdated);
+    tcase_add_test(tc, test_checksumctx);
+    tcase_add_test(tc, test_checksum_fd_multi);
+    tcase_add_test(tc, test_checksum_check_files);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -7,6 +7,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <attr/xattr.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
 
 #include "librepo/librepo.h"
 #include "librepo/rcodes.h"
@@ -290,6 +295,1333 @@ START_TEST(test_downloader_three_files_with_error)
 }
 END_TEST
 
+START_TEST(test_downloader_context)
+{
+    LrHandle *handle;
+    LrDownloadContext *ctx;
+    GSList *list = NULL;
+    GSList *finished = NULL;
+    GError *err = NULL;
+    char *url;
+    char *tmpfn;
+    int fd1, fd2;
+    LrDownloadTarget *t1, *t2;
+    GPollFD fds[16];
+
+    // Prepare handle with a local mirror
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+
+    url = lr_pathconcat(test_globals.testdata_dir,
+                        "repo_yum_01/repodata", NULL);
+    char *urls[] = {url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+    lr_free(url);
+
+    // Prepare list of download targets
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "context_1_XXXXXX", NULL);
+    mktemp(tmpfn);
+    fd1 = open(tmpfn, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    lr_free(tmpfn);
+    fail_if(fd1 < 0);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "context_2_XXXXXX", NULL);
+    mktemp(tmpfn);
+    fd2 = open(tmpfn, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    lr_free(tmpfn);
+    fail_if(fd2 < 0);
+
+    t1 = lr_downloadtarget_new(handle, "repomd.xml", NULL, fd1, NULL, NULL,
+                               0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    t2 = lr_downloadtarget_new(handle, "repomd.xml.asc", NULL, fd2, NULL,
+                               NULL, 0, 0, NULL, NULL, NULL, NULL, NULL,
+                               0, 0);
+    fail_if(!t2);
+
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    // Download by driving the context from a poll loop
+
+    ctx = lr_download_context_new(list, FALSE, &err);
+    fail_if(!ctx);
+    fail_if(err);
+
+    while (!lr_download_context_is_finished(ctx)) {
+        gint timeout;
+        guint n_fds = lr_download_context_query(ctx, &timeout, fds,
+                                                G_N_ELEMENTS(fds));
+        fail_if(n_fds > G_N_ELEMENTS(fds));
+        g_poll(fds, n_fds, timeout);
+        fail_if(!lr_download_context_process(ctx, &err));
+        fail_if(err);
+        finished = g_slist_concat(finished,
+                                  lr_download_context_get_finished(ctx));
+    }
+
+    lr_download_context_free(ctx);
+    lr_handle_free(handle);
+
+    // Check results
+
+    fail_if(g_slist_length(finished) != 2);
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *dtarget = elem->data;
+        fail_if(!g_slist_find(finished, dtarget));
+        if (dtarget->err) {
+            printf("Error msg: %s\n", dtarget->err);
+            ck_abort();
+        }
+    }
+
+    g_slist_free(finished);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+static LrDownloadTarget *
+contentstore_download(LrHandle *handle, const char *relative_url,
+                      const char *fn, const char *checksum)
+{
+    GSList *list = NULL;
+    GSList *checksums = NULL;
+    GError *err = NULL;
+    LrDownloadTarget *target;
+
+    checksums = g_slist_append(checksums,
+            lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256, checksum));
+    target = lr_downloadtarget_new(handle, relative_url, NULL, -1, fn,
+                                   checksums, 0, 0, NULL, NULL, NULL, NULL,
+                                   NULL, 0, 0);
+    fail_if(!target);
+
+    list = g_slist_append(list, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    g_slist_free(list);
+
+    if (target->err) {
+        printf("Error msg: %s\n", target->err);
+        ck_abort();
+    }
+
+    return target;
+}
+
+static char *
+contentstore_checksum(const char *path)
+{
+    GError *err = NULL;
+    char *checksum;
+    int fd = open(path, O_RDONLY);
+
+    fail_if(fd < 0);
+    checksum = lr_checksum_fd(LR_CHECKSUM_SHA256, fd, &err);
+    fail_if(!checksum);
+    fail_if(err);
+    close(fd);
+
+    return checksum;
+}
+
+START_TEST(test_downloader_contentstore)
+{
+    LrHandle *handle;
+    LrDownloadTarget *target;
+    GError *err = NULL;
+    char *repodata, *store, *url, *fn, *path, *storedurl;
+    char *repomd_checksum, *primary_checksum;
+    char prefix[3] = {0};
+    struct stat st;
+
+    repodata = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata", NULL);
+    store = lr_pathconcat(test_globals.tmpdir, "contentstore", NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "contentstore_repomd.xml", NULL);
+
+    path = lr_pathconcat(repodata, "repomd.xml", NULL);
+    repomd_checksum = contentstore_checksum(path);
+    lr_free(path);
+    path = lr_pathconcat(repodata,
+                "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                NULL);
+    primary_checksum = contentstore_checksum(path);
+    lr_free(path);
+
+    // Downloaded file is added to the store
+
+    handle = lr_handle_init();
+    char *urls[] = {repodata, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_CONTENTSTORE, store);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    target = contentstore_download(handle, "repomd.xml", fn, repomd_checksum);
+    lr_downloadtarget_free(target);
+    lr_handle_free(handle);
+
+    memcpy(prefix, repomd_checksum, 2);
+    path = lr_pathconcat(store, "sha256", prefix, repomd_checksum, NULL);
+    fail_if(stat(path, &st) != 0);
+
+    // The store has its own read-only copy, the downloaded file
+    // could be modified without damaging the store
+    struct stat fn_st;
+    fail_if(stat(fn, &fn_st) != 0);
+    fail_if(fn_st.st_ino == st.st_ino);
+    fail_if((st.st_mode & 0777) != 0444);
+    FILE *f = fopen(fn, "r+");
+    fail_if(!f);
+    fputs("modified", f);
+    fclose(f);
+    char *stored_checksum = contentstore_checksum(path);
+    fail_if(strcmp(stored_checksum, repomd_checksum));
+    lr_free(stored_checksum);
+    unlink(fn);
+
+    // The file is taken from the store, the mirror is not used at all
+
+    handle = lr_handle_init();
+    url = lr_pathconcat(test_globals.tmpdir, "contentstore_no_mirror", NULL);
+    char *bad_urls[] = {url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, bad_urls);
+    lr_handle_setopt(handle, NULL, LRO_CONTENTSTORE, store);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    target = contentstore_download(handle, "repomd.xml", fn, repomd_checksum);
+    storedurl = g_strconcat("file://", path, NULL);
+    fail_if(g_strcmp0(target->effectiveurl, storedurl));
+    lr_downloadtarget_free(target);
+    lr_handle_free(handle);
+    g_free(storedurl);
+    lr_free(url);
+
+    char *checksum = contentstore_checksum(fn);
+    fail_if(strcmp(checksum, repomd_checksum));
+    lr_free(checksum);
+    unlink(fn);
+
+    // The least recently used file is evicted when the store is too big
+
+    fail_if(stat(path, &st) != 0);
+    handle = lr_handle_init();
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_CONTENTSTORE, store);
+    lr_handle_setopt(handle, NULL, LRO_CONTENTSTOREMAXSIZE, (gint64) 1000);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    target = contentstore_download(handle,
+                "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                fn, primary_checksum);
+    lr_downloadtarget_free(target);
+    lr_handle_free(handle);
+
+    fail_if(stat(path, &st) == 0);
+    lr_free(path);
+    memcpy(prefix, primary_checksum, 2);
+    path = lr_pathconcat(store, "sha256", prefix, primary_checksum, NULL);
+    fail_if(stat(path, &st) != 0);
+    unlink(fn);
+
+    lr_remove_dir(store);
+    lr_free(path);
+    lr_free(fn);
+    lr_free(store);
+    lr_free(repodata);
+    lr_free(repomd_checksum);
+    lr_free(primary_checksum);
+}
+END_TEST
+
+static int
+local_copy_progresscb(void *clientp, double total_to_download,
+                      double now_downloaded)
+{
+    double *progress = clientp;
+    progress[0] = total_to_download;
+    progress[1] = now_downloaded;
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_local_copy)
+{
+    LrHandle *handle;
+    LrDownloadTarget *target;
+    GSList *list = NULL;
+    GError *err = NULL;
+    char *repodata, *path, *fn, *checksum, *repomd_checksum;
+    double progress[2] = {0.0, 0.0};
+    struct stat st;
+
+    repodata = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata", NULL);
+    path = lr_pathconcat(repodata, "repomd.xml", NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "local_copy_repomd.xml", NULL);
+    repomd_checksum = contentstore_checksum(path);
+    fail_if(stat(path, &st) != 0);
+
+    handle = lr_handle_init();
+    char *urls[] = {repodata, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    // Local file is copied and verified
+
+    GSList *checksums = g_slist_append(NULL,
+            lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256,
+                                          repomd_checksum));
+    target = lr_downloadtarget_new(handle, "repomd.xml", NULL, -1, fn,
+                                   checksums, 0, 0, local_copy_progresscb,
+                                   progress, NULL, NULL, NULL, 0, 0);
+    list = g_slist_append(list, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(target->err);
+    fail_if(progress[0] != (double) st.st_size);
+    fail_if(progress[1] != (double) st.st_size);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+
+    checksum = contentstore_checksum(fn);
+    fail_if(strcmp(checksum, repomd_checksum));
+    lr_free(checksum);
+
+    // More local files are copied in parallel (each by its own thread)
+
+    for (int i = 0; i < 8; i++) {
+        gchar *copy_fn = g_strdup_printf("%s.%d", fn, i);
+        checksums = g_slist_append(NULL,
+                lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256,
+                                              repomd_checksum));
+        target = lr_downloadtarget_new(handle, "repomd.xml", NULL, -1,
+                                       copy_fn, checksums, 0, 0, NULL, NULL,
+                                       NULL, NULL, NULL, 0, 0);
+        list = g_slist_append(list, target);
+        g_free(copy_fn);
+    }
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *dtarget = elem->data;
+        fail_if(dtarget->err);
+        checksum = contentstore_checksum(dtarget->fn);
+        fail_if(strcmp(checksum, repomd_checksum));
+        lr_free(checksum);
+        unlink(dtarget->fn);
+    }
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+
+    // Copy with a bad checksum fails
+
+    checksums = g_slist_append(NULL,
+            lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256,
+                "0000000000000000000000000000000000000000000000000000000000000000"));
+    target = lr_downloadtarget_new(handle, "repomd.xml", NULL, -1, fn,
+                                   checksums, 0, 0, NULL, NULL, NULL, NULL,
+                                   NULL, 0, 0);
+    list = g_slist_append(list, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(!target->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+
+    // Missing local file is reported as usual
+
+    target = lr_downloadtarget_new(handle, "missing.xml", NULL, -1, fn,
+                                   NULL, 0, 0, NULL, NULL, NULL, NULL,
+                                   NULL, 0, 0);
+    list = g_slist_append(list, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(!target->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+
+    lr_handle_free(handle);
+    unlink(fn);
+    lr_free(repomd_checksum);
+    lr_free(fn);
+    lr_free(path);
+    lr_free(repodata);
+}
+END_TEST
+
+static LrDownloadTarget *
+decompress_target(LrHandle *handle, const char *path, const char *fn,
+                  gboolean resume, int decompressfd, const char *checksum_open,
+                  gint64 size_open)
+{
+    LrDownloadTarget *target;
+
+    target = lr_downloadtarget_new(handle, path, NULL, -1, fn, NULL, 0,
+                                   resume, NULL, NULL, NULL, NULL, NULL, 0, 0);
+    target->decompress = TRUE;
+    target->decompressfd = decompressfd;
+    target->expectedsize_open = size_open;
+    if (checksum_open)
+        target->checksums_open = g_slist_append(NULL,
+                lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA1, checksum_open));
+    return target;
+}
+
+START_TEST(test_downloader_decompress)
+{
+    LrHandle *handle;
+    LrDownloadTarget *target;
+    GSList *list = NULL;
+    GError *err = NULL;
+    char *repodata, *fn, *open_fn, *checksum;
+    int fd;
+    struct stat st;
+    const char *primary = "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz";
+    const char *primary_open = "68457ceb8e20bda004d46e0a4dfa4a69ce71db48";
+    const char *primary_db = "735cd6294df08bdf28e2ba113915ca05a151118e-primary.sqlite.bz2";
+
+    repodata = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata", NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "decompress_primary.xml.gz", NULL);
+    open_fn = lr_pathconcat(test_globals.tmpdir, "decompress_primary.xml", NULL);
+
+    handle = lr_handle_init();
+    char *urls[] = {repodata, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    // A local copy is decompressed once it's complete, a file transferred
+    // by libcurl (a resumed download of an empty file) during the transfer
+
+    for (int resume = 0; resume < 2; resume++) {
+        unlink(fn);
+        if (resume) {
+            fd = open(fn, O_CREAT|O_TRUNC|O_RDWR, 0666);
+            fail_if(fd < 0);
+            fail_if(fsetxattr(fd, "user.Librepo.DownloadInProgress", "", 1, 0));
+            close(fd);
+        }
+        fd = open(open_fn, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        fail_if(fd < 0);
+        target = decompress_target(handle, primary, fn, resume, fd,
+                                   primary_open, 3385);
+        list = g_slist_append(NULL, target);
+        fail_if(!lr_download(list, FALSE, &err));
+        fail_if(err);
+        fail_if(target->err);
+        fail_if(fstat(fd, &st) != 0);
+        fail_if(st.st_size != 3385);
+        close(fd);
+        g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+
+        fd = open(open_fn, O_RDONLY);
+        fail_if(fd < 0);
+        checksum = lr_checksum_fd(LR_CHECKSUM_SHA1, fd, &err);
+        fail_if(err);
+        fail_if(strcmp(checksum, primary_open));
+        lr_free(checksum);
+        close(fd);
+    }
+
+    // Decompressed data which don't match the open checksum
+
+    fd = open(open_fn, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    fail_if(fd < 0);
+    target = decompress_target(handle, primary, fn, FALSE, fd,
+                        "0000000000000000000000000000000000000000", 0);
+    list = g_slist_append(NULL, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(!target->err);
+    close(fd);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+
+    // Only verify the decompressed size of a bzip2 file
+
+    target = decompress_target(handle, primary_db, fn, FALSE, -1, NULL, 23552);
+    list = g_slist_append(NULL, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(target->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+
+    target = decompress_target(handle, primary_db, fn, FALSE, -1, NULL, 1);
+    list = g_slist_append(NULL, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(!target->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+
+    // Data which are not compressed
+
+    target = decompress_target(handle, "repomd.xml", fn, FALSE,
+                               -1, NULL, 0);
+    list = g_slist_append(NULL, target);
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(!target->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+
+    lr_handle_free(handle);
+    unlink(fn);
+    unlink(open_fn);
+    lr_free(open_fn);
+    lr_free(fn);
+    lr_free(repodata);
+}
+END_TEST
+
+/** A minimal HTTP server, which serves the same content at any path
+ * (or its range if requested) over one connection per request. It runs
+ * in its own thread until its socket is shut down by http_server_stop().
+ * A stalling server sends only the first half of the content and then
+ * waits until the client closes the connection. A keep-alive server
+ * serves more requests over a connection, until it is idle for 500 ms.
+ * A delayed server waits before the response and before each 64 KiB
+ * of the content. Paths containing the missing string are answered
+ * with 404. Requested ranges are recorded as pairs of their first and
+ * last byte.
+ */
+typedef struct {
+    int sock;
+    int port;
+    const char *content;
+    gsize size;
+    gboolean stall;
+    gboolean keepalive;
+    gint delay;
+    const char *missing;
+    gint connections;
+    gint requests;
+    gint range_requests;
+    GMutex lock;
+    GArray *ranges;
+    GThread *thread;
+} HttpServer;
+
+static gboolean
+http_server_respond(HttpServer *server, int conn)
+{
+    char request[4096];
+    gsize len = 0;
+    gint64 start = 0, end = server->size - 1;
+    gchar *header;
+    const char *range;
+    const char *connection = server->keepalive ? "" : "Connection: close\r\n";
+    ssize_t r;
+
+    while (len < sizeof(request) - 1) {
+        r = recv(conn, request + len, sizeof(request) - 1 - len, 0);
+        if (r <= 0)
+            return FALSE;
+        len += r;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n"))
+            break;
+    }
+
+    g_atomic_int_inc(&server->requests);
+    if (server->delay)
+        g_usleep(server->delay * 1000);
+
+    if (server->missing && strstr(request, server->missing)) {
+        header = g_strdup_printf("HTTP/1.1 404 Not Found\r\n"
+                    "Content-Length: 0\r\n"
+                    "%s\r\n", connection);
+        send(conn, header, strlen(header), MSG_NOSIGNAL);
+        g_free(header);
+        return TRUE;
+    }
+
+    range = strstr(request, "Range: bytes=");
+    if (range) {
+        g_atomic_int_inc(&server->range_requests);
+        sscanf(range, "Range: bytes=%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+               &start, &end);
+        end = MIN(end, (gint64) server->size - 1);
+        g_mutex_lock(&server->lock);
+        g_array_append_val(server->ranges, start);
+        g_array_append_val(server->ranges, end);
+        g_mutex_unlock(&server->lock);
+        header = g_strdup_printf("HTTP/1.1 206 Partial Content\r\n"
+                    "Content-Length: %"G_GINT64_FORMAT"\r\n"
+                    "Content-Range: bytes %"G_GINT64_FORMAT"-%"
+                    G_GINT64_FORMAT"/%"G_GSIZE_FORMAT"\r\n"
+                    "%s\r\n",
+                    end - start + 1, start, end, server->size, connection);
+    } else {
+        header = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                    "Content-Length: %"G_GSIZE_FORMAT"\r\n"
+                    "%s\r\n", server->size, connection);
+    }
+
+    if (server->stall)
+        end = start + (end - start) / 2;
+
+    if (send(conn, header, strlen(header), MSG_NOSIGNAL) > 0) {
+        gint64 chunk = server->delay ? 64 * 1024 : end - start + 1;
+        for (gint64 pos = start; pos <= end; pos += chunk) {
+            if (pos > start)
+                g_usleep(server->delay * 1000);
+            if (send(conn, server->content + pos, MIN(chunk, end - pos + 1),
+                     MSG_NOSIGNAL) < 0)
+                break;
+        }
+    }
+    g_free(header);
+
+    if (server->stall)
+        while (recv(conn, request, sizeof(request), 0) > 0)
+            ;
+
+    return TRUE;
+}
+
+static gpointer
+http_server_run(gpointer data)
+{
+    HttpServer *server = data;
+    int conn;
+
+    while ((conn = accept(server->sock, NULL, NULL)) >= 0) {
+        struct pollfd pfd = { .fd = conn, .events = POLLIN };
+        g_atomic_int_inc(&server->connections);
+        while (http_server_respond(server, conn)
+               && server->keepalive
+               && poll(&pfd, 1, 500) > 0)
+            ;
+        close(conn);
+    }
+    return NULL;
+}
+
+static HttpServer *
+http_server_start(const char *content, gsize size)
+{
+    HttpServer *server = g_new0(HttpServer, 1);
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    server->content = content;
+    server->size = size;
+    g_mutex_init(&server->lock);
+    server->ranges = g_array_new(FALSE, FALSE, sizeof(gint64));
+    server->sock = socket(AF_INET, SOCK_STREAM, 0);
+    fail_if(server->sock < 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fail_if(bind(server->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0);
+    fail_if(listen(server->sock, 16) != 0);
+    fail_if(getsockname(server->sock, (struct sockaddr *) &addr, &len) != 0);
+    server->port = ntohs(addr.sin_port);
+    server->thread = g_thread_new("http", http_server_run, server);
+    return server;
+}
+
+static void
+http_server_stop(HttpServer *server)
+{
+    shutdown(server->sock, SHUT_RDWR);
+    g_thread_join(server->thread);
+    close(server->sock);
+    g_array_free(server->ranges, TRUE);
+    g_mutex_clear(&server->lock);
+    g_free(server);
+}
+
+static int
+bandwidth_endcb(void *clientp,
+                G_GNUC_UNUSED LrTransferStatus status,
+                G_GNUC_UNUSED const char *msg)
+{
+    *((gint64 *) clientp) = g_get_monotonic_time();
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_bandwidth_weights)
+{
+    LrHandle *handle;
+    LrDownloadTarget *heavy, *light;
+    GSList *list = NULL;
+    GError *err = NULL;
+    HttpServer *server;
+    gint64 start, heavy_end = 0, light_end = 0;
+    gsize size = 256 * 1024;
+    char *content, *url, *fn_heavy, *fn_light;
+    struct stat st;
+
+    content = g_malloc(size);
+    memset(content, 'x', size);
+    server = http_server_start(content, size);
+    url = g_strdup_printf("http://127.0.0.1:%d", server->port);
+    fn_heavy = lr_pathconcat(test_globals.tmpdir, "bandwidth_heavy", NULL);
+    fn_light = lr_pathconcat(test_globals.tmpdir, "bandwidth_light", NULL);
+
+    handle = lr_handle_init();
+    char *urls[] = {url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_MAXSPEED, (gint64) size);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    // Both files share the bandwidth 3:1, the heavy one finishes first
+    // and the light one gets the whole bandwidth then
+    heavy = lr_downloadtarget_new(handle, "heavy", NULL, -1, fn_heavy, NULL,
+                                  0, 0, NULL, &heavy_end, bandwidth_endcb,
+                                  NULL, NULL, 0, 0);
+    heavy->weight = 3;
+    light = lr_downloadtarget_new(handle, "light", NULL, -1, fn_light, NULL,
+                                  0, 0, NULL, &light_end, bandwidth_endcb,
+                                  NULL, NULL, 0, 0);
+    list = g_slist_append(list, heavy);
+    list = g_slist_append(list, light);
+
+    start = g_get_monotonic_time();
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(heavy->err);
+    fail_if(light->err);
+
+    // 512 kB at 256 kB/s, the heavy file after ~1.33 s, the light
+    // one after ~2 s (less the initial bursts of the transfers)
+    fail_if(light_end - start < 1500 * 1000,
+            "Download took %"G_GINT64_FORMAT" us", light_end - start);
+    fail_if(light_end - heavy_end < 300 * 1000,
+            "Heavy file finished %"G_GINT64_FORMAT" us before the light one",
+            light_end - heavy_end);
+
+    fail_if(stat(fn_heavy, &st) != 0 || st.st_size != (off_t) size);
+    fail_if(stat(fn_light, &st) != 0 || st.st_size != (off_t) size);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(server);
+    unlink(fn_heavy);
+    unlink(fn_light);
+    lr_free(fn_heavy);
+    lr_free(fn_light);
+    g_free(url);
+    g_free(content);
+}
+END_TEST
+
+/** Counts transfers of targets that run at the same time. A transfer
+ * is running from its first progress callback until its end callback.
+ */
+typedef struct {
+    gint *running;
+    gint *max_running;
+    gboolean started;
+} RunningTransfer;
+
+static int
+running_progresscb(void *clientp,
+                   G_GNUC_UNUSED double total_to_download,
+                   G_GNUC_UNUSED double now_downloaded)
+{
+    RunningTransfer *transfer = clientp;
+    if (!transfer->started) {
+        transfer->started = TRUE;
+        (*transfer->running)++;
+        *transfer->max_running = MAX(*transfer->max_running,
+                                     *transfer->running);
+    }
+    return LR_CB_OK;
+}
+
+static int
+running_endcb(void *clientp,
+              G_GNUC_UNUSED LrTransferStatus status,
+              G_GNUC_UNUSED const char *msg)
+{
+    RunningTransfer *transfer = clientp;
+    if (transfer->started) {
+        transfer->started = FALSE;
+        (*transfer->running)--;
+    }
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_max_downloads_per_mirror)
+{
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    HttpServer *server;
+    RunningTransfer transfers[6];
+    gint running = 0, max_running = 0;
+    gsize size = 64 * 1024;
+    char *content, *url;
+
+    content = g_malloc(size);
+    memset(content, 'x', size);
+    server = http_server_start(content, size);
+    url = g_strdup_printf("http://127.0.0.1:%d", server->port);
+
+    handle = lr_handle_init();
+    char *urls[] = {url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 6L);
+    lr_handle_setopt(handle, NULL, LRO_MAXDOWNLOADSPERMIRROR, 2L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    for (int i = 0; i < 6; i++) {
+        gchar *path = g_strdup_printf("per_mirror_%d", i);
+        gchar *fn = lr_pathconcat(test_globals.tmpdir, path, NULL);
+        transfers[i].running = &running;
+        transfers[i].max_running = &max_running;
+        transfers[i].started = FALSE;
+        list = g_slist_append(list,
+                lr_downloadtarget_new(handle, path, NULL, -1, fn, NULL, 0, 0,
+                                      running_progresscb, &transfers[i],
+                                      running_endcb, NULL, NULL, 0, 0));
+        g_free(path);
+        lr_free(fn);
+    }
+
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        fail_if(target->err, "%s", target->err);
+        unlink(target->fn);
+    }
+
+    // The only mirror runs at most 2 of the 6 allowed parallel downloads
+    fail_if(max_running != 2, "Running at once: %d", max_running);
+    fail_if(g_atomic_int_get(&server->requests) != 6);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(server);
+    g_free(url);
+    g_free(content);
+}
+END_TEST
+
+START_TEST(test_downloader_shared_connections)
+{
+    LrHandle *handles[2];
+    GSList *list;
+    GError *err = NULL;
+    HttpServer *server;
+    gsize size = 64 * 1024;
+    char *content, *url, *fn;
+
+    content = g_malloc(size);
+    memset(content, 'x', size);
+    server = http_server_start(content, size);
+    server->keepalive = TRUE;
+    url = g_strdup_printf("http://127.0.0.1:%d", server->port);
+    fn = lr_pathconcat(test_globals.tmpdir, "shared_connection", NULL);
+
+    // Handles with the shared cache download one after the other,
+    // the second one reuses the connection of the first one
+    for (int i = 0; i < 2; i++) {
+        LrDownloadTarget *target;
+        char *urls[] = {url, NULL};
+
+        handles[i] = lr_handle_init();
+        lr_handle_setopt(handles[i], NULL, LRO_URLS, urls);
+        lr_handle_setopt(handles[i], NULL, LRO_SHAREDCACHE, 1L);
+        lr_handle_prepare_internal_mirrorlist(handles[i], FALSE, &err);
+        fail_if(err);
+
+        target = lr_downloadtarget_new(handles[i], "file", NULL, -1, fn,
+                                       NULL, 0, 0, NULL, NULL, NULL, NULL,
+                                       NULL, 0, 0);
+        list = g_slist_append(NULL, target);
+        fail_if(!lr_download(list, FALSE, &err));
+        fail_if(err);
+        fail_if(target->err, "%s", target->err);
+        g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    }
+
+    fail_if(g_atomic_int_get(&server->requests) != 2);
+    fail_if(g_atomic_int_get(&server->connections) != 1,
+            "Connections: %d", g_atomic_int_get(&server->connections));
+
+    for (int i = 0; i < 2; i++)
+        lr_handle_free(handles[i]);
+    http_server_stop(server);
+    unlink(fn);
+    lr_free(fn);
+    g_free(url);
+    g_free(content);
+}
+END_TEST
+
+START_TEST(test_downloader_multiplex)
+{
+    LrHandle *handle;
+    GSList *list = NULL;
+    GSList *mirrorstats = NULL;
+    GError *err = NULL;
+    HttpServer *server;
+    gsize size = 16 * 1024;
+    char *content, *url;
+
+    content = g_malloc(size);
+    memset(content, 'x', size);
+    server = http_server_start(content, size);
+    server->keepalive = TRUE;
+    url = g_strdup_printf("http://127.0.0.1:%d", server->port);
+
+    handle = lr_handle_init();
+    char *urls[] = {url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_MULTIPLEX, 1L);
+    lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 6L);
+    lr_handle_setopt(handle, NULL, LRO_MAXDOWNLOADSPERMIRROR, 1L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    for (int i = 0; i < 6; i++) {
+        gchar *path = g_strdup_printf("multiplexed_%d", i);
+        gchar *fn = lr_pathconcat(test_globals.tmpdir, path, NULL);
+        list = g_slist_append(list,
+                lr_downloadtarget_new(handle, path, NULL, -1, fn, NULL, 0, 0,
+                                      NULL, NULL, NULL, NULL, NULL, 0, 0));
+        g_free(path);
+        lr_free(fn);
+    }
+
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        fail_if(target->err, "%s", target->err);
+        unlink(target->fn);
+    }
+
+    // All streams could run from the mirror at once, the mirror doesn't
+    // support HTTP/2, so they share its only connection one by one
+    fail_if(!lr_handle_getinfo(handle, NULL, LRI_MIRRORSTATS, &mirrorstats));
+    fail_if(g_slist_length(mirrorstats) != 1);
+    fail_if(((LrMirrorStats *) mirrorstats->data)->window != 6,
+            "Window: %ld", ((LrMirrorStats *) mirrorstats->data)->window);
+    fail_if(g_atomic_int_get(&server->requests) != 6);
+    fail_if(g_atomic_int_get(&server->connections) != 1,
+            "Connections: %d", g_atomic_int_get(&server->connections));
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(server);
+    g_free(url);
+    g_free(content);
+}
+END_TEST
+
+static gint
+compare_range_starts(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *((const gint64 *) a);
+    gint64 y = *((const gint64 *) b);
+    return (x > y) - (x < y);
+}
+
+/** Check that the ranges requested from the servers cover the whole
+ * content of the size (the ranges could overlap).
+ */
+static gboolean
+ranges_cover(HttpServer **servers, guint n_servers, gsize size)
+{
+    GArray *ranges = g_array_new(FALSE, FALSE, 2 * sizeof(gint64));
+    gint64 covered = 0;
+
+    for (guint i = 0; i < n_servers; i++) {
+        g_mutex_lock(&servers[i]->lock);
+        g_array_append_vals(ranges, servers[i]->ranges->data,
+                            servers[i]->ranges->len / 2);
+        g_mutex_unlock(&servers[i]->lock);
+    }
+    g_array_sort(ranges, compare_range_starts);
+
+    for (guint i = 0; i < ranges->len; i++) {
+        gint64 *range = &g_array_index(ranges, gint64, 2 * i);
+        if (range[0] > covered)
+            break;  // A gap
+        covered = MAX(covered, range[1] + 1);
+    }
+
+    g_array_free(ranges, TRUE);
+    return covered >= (gint64) size;
+}
+
+START_TEST(test_downloader_segments)
+{
+    LrHandle *handle;
+    LrDownloadTarget *target;
+    GSList *list = NULL;
+    GError *err = NULL;
+    HttpServer *first, *second;
+    gsize size = 4 * 1024 * 1024;
+    char *content, *first_url, *second_url, *fn, *checksum;
+    gchar *downloaded;
+    gsize downloaded_len;
+
+    content = g_malloc(size);
+    for (gsize x = 0; x < size; x++)
+        content[x] = (char) (x % 251);
+    checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                           (const guchar *) content, size);
+    first = http_server_start(content, size);
+    second = http_server_start(content, size);
+    first_url = g_strdup_printf("http://127.0.0.1:%d", first->port);
+    second_url = g_strdup_printf("http://127.0.0.1:%d", second->port);
+    fn = lr_pathconcat(test_globals.tmpdir, "segmented", NULL);
+
+    handle = lr_handle_init();
+    char *urls[] = {first_url, second_url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_MAXSEGMENTS, 4L);
+    lr_handle_setopt(handle, NULL, LRO_MAXDOWNLOADSPERMIRROR, 2L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    GSList *checksums = g_slist_append(NULL,
+                            lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256,
+                                                          checksum));
+    target = lr_downloadtarget_new(handle, "segmented", NULL, -1, fn,
+                                   checksums, (gint64) size, 0, NULL, NULL,
+                                   NULL, NULL, NULL, 0, 0);
+    list = g_slist_append(list, target);
+
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(target->err, "%s", target->err);
+
+    // The file is downloaded by ranges, from both mirrors, the ranges
+    // cover the whole file (its checksum was verified)
+    fail_if(g_atomic_int_get(&first->range_requests) == 0);
+    fail_if(g_atomic_int_get(&second->range_requests) == 0);
+    HttpServer *servers[] = {first, second};
+    fail_if(!ranges_cover(servers, 2, size));
+
+    fail_if(!g_file_get_contents(fn, &downloaded, &downloaded_len, NULL));
+    fail_if(downloaded_len != size);
+    fail_if(memcmp(downloaded, content, size) != 0);
+
+    g_free(downloaded);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(first);
+    http_server_stop(second);
+    unlink(fn);
+    lr_free(fn);
+    g_free(first_url);
+    g_free(second_url);
+    g_free(checksum);
+    g_free(content);
+}
+END_TEST
+
+/** Count the temporary files of hedges of the file.
+ */
+static guint
+count_hedge_files(const char *fn)
+{
+    gchar *dirname = g_path_get_dirname(fn);
+    gchar *basename = g_path_get_basename(fn);
+    gchar *prefix = g_strconcat(basename, ".hedge-", NULL);
+    GDir *dir = g_dir_open(dirname, 0, NULL);
+    const gchar *name;
+    guint count = 0;
+
+    fail_if(!dir);
+    while ((name = g_dir_read_name(dir)))
+        if (g_str_has_prefix(name, prefix))
+            count++;
+
+    g_dir_close(dir);
+    g_free(prefix);
+    g_free(basename);
+    g_free(dirname);
+    return count;
+}
+
+/** Download a file stuck at a stalling mirror and a file of the same
+ * size from a fast mirror, which measures the throughput of the fast
+ * mirror. The stalling mirror never sends the second half of the file
+ * and the file isn't tried from another mirror, so it is downloaded
+ * only if it is hedged from the fast mirror.
+ */
+static void
+hedge_download(long budget, long lowspeedtime, gboolean hedged)
+{
+    LrHandle *handle;
+    LrDownloadTarget *stalled, *measured;
+    GSList *list = NULL;
+    GError *err = NULL;
+    HttpServer *slow, *fast;
+    gsize size = 1024 * 1024;
+    char *content, *slow_url, *fast_url, *fn_stalled, *fn_measured;
+    gchar *downloaded;
+    gsize downloaded_len;
+    struct stat st;
+
+    content = g_malloc(size);
+    for (gsize x = 0; x < size; x++)
+        content[x] = (char) (x % 251);
+    slow = http_server_start(content, size);
+    slow->stall = TRUE;
+    fast = http_server_start(content, size);
+    slow_url = g_strdup_printf("http://127.0.0.1:%d", slow->port);
+    fast_url = g_strdup_printf("http://127.0.0.1:%d", fast->port);
+    fn_stalled = lr_pathconcat(test_globals.tmpdir, "hedge_stalled", NULL);
+    fn_measured = lr_pathconcat(test_globals.tmpdir, "hedge_measured", NULL);
+
+    handle = lr_handle_init();
+    char *urls[] = {slow_url, fast_url, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_MAXDOWNLOADSPERMIRROR, 1L);
+    lr_handle_setopt(handle, NULL, LRO_MAXMIRRORTRIES, 1L);
+    lr_handle_setopt(handle, NULL, LRO_HEDGEBUDGET, budget);
+    lr_handle_setopt(handle, NULL, LRO_LOWSPEEDTIME, lowspeedtime);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    stalled = lr_downloadtarget_new(handle, "stalled", NULL, -1, fn_stalled,
+                                    NULL, (gint64) size, 0, NULL, NULL,
+                                    NULL, NULL, NULL, 0, 0);
+    measured = lr_downloadtarget_new(handle, "measured", NULL, -1,
+                                     fn_measured, NULL, (gint64) size, 0,
+                                     NULL, NULL, NULL, NULL, NULL, 0, 0);
+    list = g_slist_append(list, stalled);
+    list = g_slist_append(list, measured);
+
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(measured->err, "%s", measured->err);
+    fail_if(stat(fn_measured, &st) != 0 || st.st_size != (off_t) size);
+    fail_if(g_atomic_int_get(&slow->requests) != 1);
+
+    if (hedged) {
+        fail_if(stalled->err, "%s", stalled->err);
+        fail_if(g_atomic_int_get(&fast->requests) != 2);
+        fail_if(strncmp(stalled->usedmirror, fast_url,
+                        strlen(fast_url)) != 0);
+        fail_if(!g_file_get_contents(fn_stalled, &downloaded,
+                                     &downloaded_len, NULL));
+        fail_if(downloaded_len != size);
+        fail_if(memcmp(downloaded, content, size) != 0);
+        g_free(downloaded);
+    } else {
+        // The hedge doesn't fit into the budget
+        fail_if(!stalled->err);
+        fail_if(g_atomic_int_get(&fast->requests) != 1);
+    }
+
+    // The temporary file of the hedge replaced the file of the target
+    // or it was removed
+    fail_if(count_hedge_files(fn_stalled) != 0);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(slow);
+    http_server_stop(fast);
+    unlink(fn_stalled);
+    unlink(fn_measured);
+    lr_free(fn_stalled);
+    lr_free(fn_measured);
+    g_free(slow_url);
+    g_free(fast_url);
+    g_free(content);
+}
+
+START_TEST(test_downloader_hedge)
+{
+    // The whole stalled file (a half of all the files) fits exactly
+    // into the budget. The stalled transfer is never timed out.
+    hedge_download(50L, 600L, TRUE);
+}
+END_TEST
+
+START_TEST(test_downloader_hedge_budget)
+{
+    // The stalled file exceeds the budget, so it isn't hedged
+    // and it fails when its transfer is timed out
+    hedge_download(49L, 2L, FALSE);
+}
+END_TEST
+
+static int
+offline_endcb(void *clientp,
+              G_GNUC_UNUSED LrTransferStatus status,
+              G_GNUC_UNUSED const char *msg)
+{
+    (*((int *) clientp))++;
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_offline)
+{
+    LrHandle *handle;
+    LrDownloadTarget *remote, *local;
+    GSList *list = NULL;
+    GError *err = NULL;
+    HttpServer *server;
+    gsize size = 1024;
+    int remote_ends = 0;
+    char *content, *repodata, *url, *fn_remote, *fn_local;
+    struct stat st;
+
+    content = g_malloc0(size);
+    server = http_server_start(content, size);
+    url = g_strdup_printf("http://127.0.0.1:%d/remote", server->port);
+    repodata = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata", NULL);
+    fn_remote = lr_pathconcat(test_globals.tmpdir, "offline_remote", NULL);
+    fn_local = lr_pathconcat(test_globals.tmpdir, "offline_repomd.xml", NULL);
+
+    handle = lr_handle_init();
+    char *urls[] = {repodata, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_OFFLINE, 1L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    // The target with a remote URL fails without being requested,
+    // the local file is downloaded
+    remote = lr_downloadtarget_new(handle, url, NULL, -1, fn_remote, NULL,
+                                   0, 0, NULL, &remote_ends, offline_endcb,
+                                   NULL, NULL, 0, 0);
+    local = lr_downloadtarget_new(handle, "repomd.xml", NULL, -1, fn_local,
+                                  NULL, 0, 0, NULL, NULL, NULL, NULL, NULL,
+                                  0, 0);
+    list = g_slist_append(list, remote);
+    list = g_slist_append(list, local);
+
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    fail_if(!remote->err);
+    fail_if(remote->rcode != LRE_NOURL);
+    fail_if(remote_ends != 1);
+    fail_if(g_atomic_int_get(&server->requests) != 0);
+    fail_if(local->err, "%s", local->err);
+    fail_if(stat(fn_local, &st) != 0);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(server);
+    unlink(fn_remote);
+    unlink(fn_local);
+    lr_free(fn_remote);
+    lr_free(fn_local);
+    lr_free(repodata);
+    g_free(url);
+    g_free(content);
+}
+END_TEST
+
+/** Download three files one by one from two mirrors, one of them
+ * is slow (with a delayed response and a delayed content) and the other
+ * one is fast. The first file is downloaded from the first mirror of
+ * the list. The second file is missing at the first mirror, so it is
+ * downloaded from the second one. Both mirrors are measured then and
+ * the third file should be downloaded from the fast mirror.
+ */
+static void
+mirror_ranking_download(gboolean slow_first)
+{
+    LrHandle *handle;
+    LrDownloadTarget *measured, *missing, *ranked;
+    GSList *list = NULL, *mirrorstats = NULL;
+    GError *err = NULL;
+    HttpServer *slow, *fast, *first;
+    gsize size = 256 * 1024;
+    char *content, *slow_url, *fast_url, *fn;
+
+    content = g_malloc0(size);
+    slow = http_server_start(content, size);
+    slow->delay = 50;
+    fast = http_server_start(content, size);
+    first = slow_first ? slow : fast;
+    first->missing = "/missing";
+    slow_url = g_strdup_printf("http://127.0.0.1:%d", slow->port);
+    fast_url = g_strdup_printf("http://127.0.0.1:%d", fast->port);
+    fn = lr_pathconcat(test_globals.tmpdir, "mirror_ranking", NULL);
+
+    handle = lr_handle_init();
+    char *urls[] = {slow_first ? slow_url : fast_url,
+                    slow_first ? fast_url : slow_url,
+                    NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 1L);
+    lr_handle_setopt(handle, NULL, LRO_ADAPTIVEMIRRORSORTING, 1L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    measured = lr_downloadtarget_new(handle, "measured", NULL, -1, fn, NULL,
+                                     (gint64) size, 0, NULL, NULL, NULL,
+                                     NULL, NULL, 0, 0);
+    missing = lr_downloadtarget_new(handle, "missing", NULL, -1, fn, NULL,
+                                    (gint64) size, 0, NULL, NULL, NULL,
+                                    NULL, NULL, 0, 0);
+    ranked = lr_downloadtarget_new(handle, "ranked", NULL, -1, fn, NULL,
+                                   (gint64) size, 0, NULL, NULL, NULL,
+                                   NULL, NULL, 0, 0);
+    list = g_slist_append(list, measured);
+    list = g_slist_append(list, missing);
+    list = g_slist_append(list, ranked);
+
+    fail_if(!lr_download(list, FALSE, &err));
+    fail_if(err);
+    for (GSList *elem = list; elem; elem = g_slist_next(elem))
+        fail_if(((LrDownloadTarget *) elem->data)->err);
+
+    fail_if(!g_str_has_prefix(measured->usedmirror, urls[0]),
+            "Used mirror: %s", measured->usedmirror);
+    fail_if(!g_str_has_prefix(missing->usedmirror, urls[1]),
+            "Used mirror: %s", missing->usedmirror);
+
+    // The slow mirror has a longer time to first byte and a lower
+    // throughput
+    fail_if(!lr_handle_getinfo(handle, NULL, LRI_MIRRORSTATS, &mirrorstats));
+    fail_if(g_slist_length(mirrorstats) != 2);
+    LrMirrorStats *slow_stats = slow_first ? mirrorstats->data
+                                           : mirrorstats->next->data;
+    LrMirrorStats *fast_stats = slow_first ? mirrorstats->next->data
+                                           : mirrorstats->data;
+    fail_if(slow_stats->ttfb <= fast_stats->ttfb);
+    fail_if(slow_stats->throughput <= 0.0);
+    fail_if(slow_stats->throughput >= fast_stats->throughput);
+
+    // The fast mirror is selected regardless of its position in the list
+    // and of the failure of the missing file at the first mirror
+    fail_if(!g_str_has_prefix(ranked->usedmirror, fast_url),
+            "Used mirror: %s", ranked->usedmirror);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    http_server_stop(slow);
+    http_server_stop(fast);
+    unlink(fn);
+    lr_free(fn);
+    g_free(slow_url);
+    g_free(fast_url);
+    g_free(content);
+}
+
+START_TEST(test_downloader_mirror_ranking)
+{
+    // The slow mirror is preferred by the list and it has no failure
+    mirror_ranking_download(TRUE);
+    // The fast mirror is preferred by the list, but it has a failure
+    mirror_ranking_download(FALSE);
+}
+END_TEST
+
 Suite *
 downloader_suite(void)
 {
@@ -300,6 +1632,19 @@ downloader_suite(void)
     tcase_add_test(tc, test_downloader_single_file_2);
     tcase_add_test(tc, test_downloader_two_files);
     tcase_add_test(tc, test_downloader_three_files_with_error);
+    tcase_add_test(tc, test_downloader_context);
+    tcase_add_test(tc, test_downloader_contentstore);
+    tcase_add_test(tc, test_downloader_local_copy);
+    tcase_add_test(tc, test_downloader_decompress);
+    tcase_add_test(tc, test_downloader_bandwidth_weights);
+    tcase_add_test(tc, test_downloader_max_downloads_per_mirror);
+    tcase_add_test(tc, test_downloader_shared_connections);
+    tcase_add_test(tc, test_downloader_multiplex);
+    tcase_add_test(tc, test_downloader_segments);
+    tcase_add_test(tc, test_downloader_hedge);
+    tcase_add_test(tc, test_downloader_hedge_budget);
+    tcase_add_test(tc, test_downloader_offline);
+    tcase_add_test(tc, test_downloader_mirror_ranking);
     suite_add_tcase(s, tc);
     return s;
 }
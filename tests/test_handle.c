@@ -6,11 +6,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <utime.h>
+#include <attr/xattr.h>
 
 #include "librepo/librepo.h"
 #include "librepo/rcodes.h"
 #include "librepo/handle.h"
 #include "librepo/url_substitution.h"
+#include "librepo/util.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -50,6 +53,14 @@ START_TEST(test_handle)
     fail_if(!lr_handle_setopt(h, NULL, LRO_VARSUB, vars));
     fail_if(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORCACHE,
                               "/var/cache/fastestmirror.librepo"));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CACHEDREPO, "/var/cache/repo"));
+    fail_if(!lr_handle_flush_connections(h, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(!lr_handle_flush_connections(h, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_SHAREDCACHE, 1L));
+    fail_if(!lr_handle_flush_connections(h, &tmp_err));
+    fail_if(tmp_err);
     lr_handle_free(h);
 }
 END_TEST
@@ -118,7 +129,468 @@ START_TEST(test_handle_getinfo)
     fail_if(!lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORMAXAGE, &num));
     fail_if(num != LRO_FASTESTMIRRORMAXAGE_DEFAULT);
 
+    GSList *mirrorstats = (GSList *) 1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_MIRRORSTATS, &mirrorstats));
+    fail_if(mirrorstats != NULL);
+
+    lr_handle_free(h);
+}
+END_TEST
+
+START_TEST(test_handles_perform_multi)
+{
+    LrHandle *handles[4] = {NULL};
+    LrResult *results[3];
+    GError *errors[3] = {NULL};
+    GError *err = NULL;
+    const char *repos[] = {"repo_yum_01", "repo_yum_02", "repo_nonexistent"};
+
+    for (int i = 0; i < 3; i++) {
+        char *url = lr_pathconcat(test_globals.testdata_dir, repos[i], NULL);
+        char *urls[] = {url, NULL};
+        char *destdir = lr_pathconcat(test_globals.tmpdir, "multi_XXXXXX",
+                                      NULL);
+        fail_if(!mkdtemp(destdir));
+        handles[i] = lr_handle_init();
+        fail_if(!lr_handle_setopt(handles[i], NULL, LRO_URLS, urls));
+        fail_if(!lr_handle_setopt(handles[i], NULL, LRO_REPOTYPE, LR_YUMREPO));
+        fail_if(!lr_handle_setopt(handles[i], NULL, LRO_DESTDIR, destdir));
+        results[i] = lr_result_init();
+        lr_free(destdir);
+        lr_free(url);
+    }
+
+    // The last repository doesn't exist, the others must not be affected
+    fail_if(lr_handles_perform_multi(handles, results, errors, &err));
+    fail_if(!err);
+    g_clear_error(&err);
+
+    for (int i = 0; i < 2; i++) {
+        LrYumRepo *repo = NULL;
+        fail_if(errors[i]);
+        fail_if(!lr_result_getinfo(results[i], NULL, LRR_YUM_REPO, &repo));
+        fail_if(!repo);
+        fail_if(!lr_yum_repo_path(repo, "primary"));
+        fail_if(!g_file_test(lr_yum_repo_path(repo, "primary"),
+                             G_FILE_TEST_IS_REGULAR));
+    }
+
+    fail_if(!errors[2]);
+    fail_if(errors[2]->code != LRE_NOURL);
+    g_clear_error(&errors[2]);
+
+    for (int i = 0; i < 3; i++) {
+        lr_result_free(results[i]);
+        lr_handle_free(handles[i]);
+    }
+}
+END_TEST
+
+START_TEST(test_handles_perform_multi_cancel)
+{
+    LrHandle *handles[3] = {NULL};
+    LrResult *results[2];
+    GError *errors[2] = {NULL};
+    GError *err = NULL;
+    LrCancelToken *token;
+    LrYumRepo *repo = NULL;
+    const char *repos[] = {"repo_yum_01", "repo_yum_02"};
+
+    for (int i = 0; i < 2; i++) {
+        char *url = lr_pathconcat(test_globals.testdata_dir, repos[i], NULL);
+        char *urls[] = {url, NULL};
+        char *destdir = lr_pathconcat(test_globals.tmpdir, "multi_XXXXXX",
+                                      NULL);
+        fail_if(!mkdtemp(destdir));
+        handles[i] = lr_handle_init();
+        fail_if(!lr_handle_setopt(handles[i], NULL, LRO_URLS, urls));
+        fail_if(!lr_handle_setopt(handles[i], NULL, LRO_REPOTYPE, LR_YUMREPO));
+        fail_if(!lr_handle_setopt(handles[i], NULL, LRO_DESTDIR, destdir));
+        results[i] = lr_result_init();
+        lr_free(destdir);
+        lr_free(url);
+    }
+
+    // The second repository is cancelled, the first one is downloaded
+    // in the same lr_download() calls and must not be affected
+    token = lr_cancel_token_new(&err);
+    fail_if(!token);
+    fail_if(!lr_handle_setopt(handles[1], NULL, LRO_CANCELTOKEN, token));
+    lr_cancel_token_cancel(token);
+
+    fail_if(lr_handles_perform_multi(handles, results, errors, &err));
+    fail_if(!err);
+    g_clear_error(&err);
+
+    fail_if(errors[0]);
+    fail_if(!lr_result_getinfo(results[0], NULL, LRR_YUM_REPO, &repo));
+    fail_if(!repo);
+    fail_if(!g_file_test(lr_yum_repo_path(repo, "primary"),
+                         G_FILE_TEST_IS_REGULAR));
+
+    fail_if(!errors[1]);
+    fail_if(errors[1]->code != LRE_CANCELLED);
+    g_clear_error(&errors[1]);
+
+    for (int i = 0; i < 2; i++) {
+        lr_result_free(results[i]);
+        lr_handle_free(handles[i]);
+    }
+    lr_cancel_token_free(token);
+}
+END_TEST
+
+START_TEST(test_handle_mirrorstats_window)
+{
+    LrHandle *h;
+    LrResult *r;
+    GError *err = NULL;
+    GSList *mirrorstats = NULL;
+    char *url = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    char *urls[] = {url, NULL};
+    char *destdir = lr_pathconcat(test_globals.tmpdir, "window_XXXXXX", NULL);
+
+    fail_if(!mkdtemp(destdir));
+
+    // A mirror which neither fails nor throttles keeps the full window
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, destdir));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_MAXDOWNLOADSPERMIRROR, 5L));
+    r = lr_result_init();
+    fail_if(!lr_handle_perform(h, r, &err));
+    fail_if(err);
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_MIRRORSTATS, &mirrorstats));
+    fail_if(g_slist_length(mirrorstats) != 1);
+    LrMirrorStats *stats = mirrorstats->data;
+    fail_if(stats->window != 5);
+    fail_if(stats->failed_transfers != 0);
+    lr_result_free(r);
+    lr_handle_free(h);
+
+    lr_free(destdir);
+    lr_free(url);
+}
+END_TEST
+
+START_TEST(test_handle_perform_reuse_records)
+{
+    LrHandle *h;
+    LrResult *r;
+    LrYumRepo *repo = NULL;
+    char **reused = NULL;
+    long unchanged = -1;
+    GError *err = NULL;
+    char *url = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    char *urls[] = {url, NULL};
+    char *cachedir = lr_pathconcat(test_globals.tmpdir, "cached_XXXXXX", NULL);
+    char *destdir = lr_pathconcat(test_globals.tmpdir, "reuse_XXXXXX", NULL);
+
+    fail_if(!mkdtemp(cachedir));
+    fail_if(!mkdtemp(destdir));
+
+    // First download - nothing to reuse
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, cachedir));
+    r = lr_result_init();
+    fail_if(!lr_handle_perform(h, r, &err));
+    fail_if(err);
+    fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REUSED, &reused));
+    fail_if(!reused);
+    fail_if(reused[0]);
+    g_strfreev(reused);
+    lr_result_free(r);
+    lr_handle_free(h);
+
+    // Pretend that the repomd.xml was changed since the first download
+    char *repomd = lr_pathconcat(cachedir, "repodata/repomd.xml", NULL);
+    FILE *f = fopen(repomd, "a");
+    fail_if(!f);
+    fputs("<!-- previous revision -->\n", f);
+    fclose(f);
+    lr_free(repomd);
+
+    // Download with the cached repository - repomd.xml is downloaded
+    // again, but the records are reused
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, destdir));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CACHEDREPO, cachedir));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CHECKSUM, 1L));
+    r = lr_result_init();
+    fail_if(!lr_handle_perform(h, r, &err));
+    fail_if(err);
+    fail_if(!lr_result_getinfo(r, NULL, LRR_UNCHANGED, &unchanged));
+    fail_if(unchanged != 0);
+    fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REUSED, &reused));
+    fail_if(!reused);
+    gboolean primary_reused = FALSE;
+    for (int i = 0; reused[i]; i++)
+        if (!strcmp(reused[i], "primary"))
+            primary_reused = TRUE;
+    fail_if(!primary_reused);
+    g_strfreev(reused);
+    fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REPO, &repo));
+    fail_if(!g_str_has_prefix(lr_yum_repo_path(repo, "primary"), destdir));
+    fail_if(!g_file_test(lr_yum_repo_path(repo, "primary"),
+                         G_FILE_TEST_IS_REGULAR));
+    lr_result_free(r);
     lr_handle_free(h);
+
+    // The cached repository cannot be the destination, its repomd.xml
+    // stays untouched
+    struct stat st_before, st_after;
+    repomd = lr_pathconcat(cachedir, "repodata/repomd.xml", NULL);
+    fail_if(stat(repomd, &st_before) != 0);
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, cachedir));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CACHEDREPO, cachedir));
+    r = lr_result_init();
+    fail_if(lr_handle_perform(h, r, &err));
+    fail_if(!err);
+    fail_if(err->code != LRE_BADOPTARG);
+    g_error_free(err);
+    err = NULL;
+    lr_result_free(r);
+    lr_handle_free(h);
+    fail_if(stat(repomd, &st_after) != 0);
+    fail_if(st_after.st_size != st_before.st_size);
+    fail_if(st_after.st_size == 0);
+    lr_free(repomd);
+
+    lr_free(cachedir);
+    lr_free(destdir);
+    lr_free(url);
+}
+END_TEST
+
+START_TEST(test_handle_perform_reuse_stale_checksum)
+{
+    LrHandle *h;
+    LrResult *r;
+    char **reused = NULL;
+    GError *err = NULL;
+    struct stat st;
+    char *url = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    char *urls[] = {url, NULL};
+    char *cachedir = lr_pathconcat(test_globals.tmpdir, "cached_XXXXXX", NULL);
+    char *destdir = lr_pathconcat(test_globals.tmpdir, "reuse_XXXXXX", NULL);
+    const char *checksum = "4543ad62e4d86337cd1949346f9aec976b847b58";
+    const char *href =
+        "repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz";
+
+    fail_if(!mkdtemp(cachedir));
+    fail_if(!mkdtemp(destdir));
+
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, cachedir));
+    r = lr_result_init();
+    fail_if(!lr_handle_perform(h, r, &err));
+    fail_if(err);
+    lr_result_free(r);
+    lr_handle_free(h);
+
+    char *repomd = lr_pathconcat(cachedir, "repodata/repomd.xml", NULL);
+    FILE *f = fopen(repomd, "a");
+    fail_if(!f);
+    fputs("<!-- previous revision -->\n", f);
+    fclose(f);
+    lr_free(repomd);
+
+    // The cached primary is modified, but the type agnostic cached
+    // checksum (keyed by the mtime only) still claims it is intact
+    char *primary = lr_pathconcat(cachedir, href, NULL);
+    int fd = open(primary, O_WRONLY|O_TRUNC);
+    fail_if(fd < 0);
+    fail_if(write(fd, "modified", 8) != 8);
+    fail_if(fstat(fd, &st));
+    char *key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
+                                (unsigned long long) st.st_mtime);
+    fail_if(fsetxattr(fd, key, checksum, strlen(checksum)+1, 0));
+    g_free(key);
+    close(fd);
+    lr_free(primary);
+
+    // The modified primary is not reused, it is downloaded again
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, destdir));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CACHEDREPO, cachedir));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CHECKSUM, 1L));
+    r = lr_result_init();
+    fail_if(!lr_handle_perform(h, r, &err));
+    fail_if(err);
+    fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REUSED, &reused));
+    fail_if(!reused);
+    for (int i = 0; reused[i]; i++)
+        fail_if(!strcmp(reused[i], "primary"));
+    g_strfreev(reused);
+    lr_result_free(r);
+    lr_handle_free(h);
+
+    primary = lr_pathconcat(destdir, href, NULL);
+    fail_if(stat(primary, &st));
+    fail_if(st.st_size != 936);
+    lr_free(primary);
+
+    lr_free(cachedir);
+    lr_free(destdir);
+    lr_free(url);
+}
+END_TEST
+
+START_TEST(test_handle_perform_decompress)
+{
+    LrHandle *h;
+    LrResult *r;
+    LrYumRepo *repo = NULL;
+    char **reused = NULL;
+    GError *err = NULL;
+    struct stat st;
+    char *url = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    char *urls[] = {url, NULL};
+    LrDecompressType modes[] = {LR_DECOMPRESS_OPEN, LR_DECOMPRESS_BOTH};
+    const char *href =
+        "repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz";
+
+    for (gsize i = 0; i < G_N_ELEMENTS(modes); i++) {
+        char *destdir = lr_pathconcat(test_globals.tmpdir,
+                                      "decompress_XXXXXX", NULL);
+        fail_if(!mkdtemp(destdir));
+        char *path = lr_pathconcat(destdir, href, NULL);
+        char *open_path = g_strndup(path, strlen(path) - 3);
+
+        h = lr_handle_init();
+        fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, destdir));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_DECOMPRESS, modes[i]));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_CHECKSUM, 1L));
+        r = lr_result_init();
+        fail_if(!lr_handle_perform(h, r, &err));
+        fail_if(err);
+
+        // The result points at the decompressed file, the compressed one
+        // is kept only with LR_DECOMPRESS_BOTH
+        fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REPO, &repo));
+        fail_if(g_strcmp0(lr_yum_repo_path(repo, "primary"), open_path));
+        fail_if(stat(open_path, &st) != 0);
+        fail_if(st.st_size != 3385);
+        if (modes[i] == LR_DECOMPRESS_BOTH)
+            fail_if(stat(path, &st) != 0 || st.st_size != 936);
+        else
+            fail_if(stat(path, &st) == 0);
+
+        // Nothing is downloaded again in update mode
+        fail_if(!lr_handle_setopt(h, NULL, LRO_UPDATE, 1L));
+        fail_if(!lr_handle_perform(h, r, &err));
+        fail_if(err);
+        fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REUSED, &reused));
+        gboolean primary_reused = FALSE;
+        for (int x = 0; reused && reused[x]; x++)
+            if (!strcmp(reused[x], "primary"))
+                primary_reused = TRUE;
+        fail_if(!primary_reused);
+        g_strfreev(reused);
+        fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REPO, &repo));
+        fail_if(g_strcmp0(lr_yum_repo_path(repo, "primary"), open_path));
+        lr_result_free(r);
+        lr_handle_free(h);
+
+        // The local repository is located with the decompressed files,
+        // which are checked by their open-checksums
+        h = lr_handle_init();
+        char *local_urls[] = {destdir, NULL};
+        fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, local_urls));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_LOCAL, 1L));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_DECOMPRESS, modes[i]));
+        fail_if(!lr_handle_setopt(h, NULL, LRO_CHECKSUM, 1L));
+        r = lr_result_init();
+        fail_if(!lr_handle_perform(h, r, &err));
+        fail_if(err);
+        fail_if(!lr_result_getinfo(r, NULL, LRR_YUM_REPO, &repo));
+        fail_if(g_strcmp0(lr_yum_repo_path(repo, "primary"), open_path));
+        lr_result_free(r);
+        lr_handle_free(h);
+
+        lr_remove_dir(destdir);
+        g_free(open_path);
+        lr_free(path);
+        lr_free(destdir);
+    }
+
+    lr_free(url);
+}
+END_TEST
+
+START_TEST(test_handle_perform_local_bad_checksums)
+{
+    LrHandle *h;
+    LrResult *r;
+    GError *err = NULL;
+    char *url = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    char *urls[] = {url, NULL};
+    char *destdir = lr_pathconcat(test_globals.tmpdir, "badsums_XXXXXX", NULL);
+    const char *hrefs[] = {
+        "repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+        "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz",
+    };
+
+    fail_if(!mkdtemp(destdir));
+
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, destdir));
+    r = lr_result_init();
+    fail_if(!lr_handle_perform(h, r, &err));
+    fail_if(err);
+    lr_result_free(r);
+    lr_handle_free(h);
+
+    // Files of two records are damaged, the first one in the order
+    // of the records is always reported
+    for (gsize i = 0; i < G_N_ELEMENTS(hrefs); i++) {
+        char *path = lr_pathconcat(destdir, hrefs[i], NULL);
+        FILE *f = fopen(path, "a");
+        fail_if(!f);
+        fputs("damaged", f);
+        fclose(f);
+        // Not within the second of the download, the type agnostic
+        // cached checksum (see lr_checksum_fd_compare()) doesn't apply
+        struct utimbuf times = {1000000000, 1000000000};
+        fail_if(utime(path, &times));
+        lr_free(path);
+    }
+
+    h = lr_handle_init();
+    char *local_urls[] = {destdir, NULL};
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, local_urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_LOCAL, 1L));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CHECKSUM, 1L));
+    r = lr_result_init();
+    fail_if(lr_handle_perform(h, r, &err));
+    fail_if(!err);
+    fail_if(err->code != LRE_BADCHECKSUM);
+    fail_if(!strstr(err->message, "primary"), "%s", err->message);
+    g_error_free(err);
+    lr_result_free(r);
+    lr_handle_free(h);
+
+    lr_remove_dir(destdir);
+    lr_free(destdir);
+    lr_free(url);
 }
 END_TEST
 
@@ -129,6 +601,13 @@ handle_suite(void)
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_handle);
     tcase_add_test(tc, test_handle_getinfo);
+    tcase_add_test(tc, test_handles_perform_multi);
+    tcase_add_test(tc, test_handles_perform_multi_cancel);
+    tcase_add_test(tc, test_handle_mirrorstats_window);
+    tcase_add_test(tc, test_handle_perform_reuse_records);
+    tcase_add_test(tc, test_handle_perform_reuse_stale_checksum);
+    tcase_add_test(tc, test_handle_perform_decompress);
+    tcase_add_test(tc, test_handle_perform_local_bad_checksums);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -10,6 +10,7 @@
 #include "librepo/util.h"
 
 #include "fixtures.h"
+#include "test_cancel.h"
 #include "test_checksum.h"
 #include "test_downloader.h"
 #include "test_gpg.h"
@@ -104,6 +105,7 @@ main(int argc, char **argv)
     printf("Tests using directory: %s\n", test_globals.tmpdir);
 
     SRunner *sr = srunner_create(checksum_suite());
+    srunner_add_suite(sr, cancel_suite());
     if (downloading) {
         srunner_add_suite(sr, downloader_suite());
     }